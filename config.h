@@ -1,6 +1,45 @@
 
 static const char* cache_dir = "~/.config/sbm/";
 static const char* cache_filename = "data.json";
+/* Blocks of the store which fail their checksum are appended here. */
+static const char* quarantine_filename = "quarantine.txt";
+/* What 'sbm undo' and 'sbm redo' step through. */
+static const char* journal_filename = "journal.json";
+/* Digests of the rows, kept up to date for 'sbm diff'. */
+static const char* merkle_filename = "merkle.bin";
+/* Canonical URLs of the rows, kept up to date for 'sbm has'. */
+static const char* urls_filename = "urls.bin";
+/* Rules which tag entries as they are added or imported; see 'sbm autotag'. */
+static const char* rules_filename = "rules.txt";
+/* Other names for tags; see 'sbm tag alias'. */
+static const char* aliases_filename = "aliases.txt";
+/* The results of 'sbm saved' searches, kept up to date by every save. */
+static const char* saved_filename = "saved.bin";
+/* What recent 'sbm list' queries printed, until the store is next saved. */
+static const char* results_filename = "results.bin";
+/* Every entry 'sbm open' has opened, and the scores 'sbm top' ranks them by. */
+static const char* visits_filename = "visits.bin";
+static const char* frecency_filename = "frecency.bin";
+/* Replicated mode: this device's view of the rows, and every operation it has
+ * made or imported ('sbm replica export' hands the latter on). */
+static const char* replica_filename = "replica.json";
+static const char* oplog_filename = "oplog.json";
+/* How far 'sbm sync' got with each server. */
+static const char* sync_filename = "sync.json";
+
+/* libcurl is loaded at runtime, only when a page title must be downloaded.
+ * These names are tried in order. */
+static const char* curl_libs[] = {
+	"libcurl.so.4", "libcurl-gnutls.so.4", "libcurl-nss.so.4", "libcurl.so",
+	NULL
+};
+
+/* zlib is also loaded at runtime, to compress 'sbm sync' traffic. Without it
+ * sync still works, uncompressed. */
+static const char* zlib_libs[] = { "libz.so.1", "libz.so", NULL };
+
+/* Command used by 'sbm open'. The URL is appended as the last argument. */
+static const char* opener[] = { "xdg-open", NULL };
 
 /* These values can be changed to increase things such as the comment size.
  * Doing so will hurt the portability of the savefile. Decreasing sizes
@@ -11,5 +50,60 @@ enum {
 	TITLE_S    = 64,
 	COMMENT_S  = 256,
 	S_ADDR_S   = 256,
-	TAG_NAME_S = 32,
+	TAG_NAME_S = 64,  /* Room for nested names such as lang/rust/async */
+};
+
+enum {
+	OPEN_ARGS_C = 8,   /* Most arguments taken from opener[] */
+	OPEN_JOBS_C = 4,   /* Most openers running at once */
+	OPEN_WAIT_MS = 1000,
+};
+
+enum {
+	/* Stores of at least this many bytes are loaded through a structural
+	 * index instead of json.h. Set to 0 to always use it. */
+	FAST_LOAD_S  = 1 << 20,
+	MAX_THREAD_C = 16,
+	
+	FSCK_REPORT_C = 20,  /* Most problems 'sbm fsck' lists one by one */
+	
+	/* Rows per checksummed block of the store. A damaged byte loses the
+	 * rows of its block. */
+	ROWS_PER_BLOCK_C = 256,
+	
+	JOURNAL_C = 64,  /* Most commands 'sbm undo' can go back through */
+	
+	/* Row IDs per leaf of the digest tree. Changing it rebuilds merkle.bin,
+	 * and 'sbm diff' needs both sides to agree on it. */
+	MERKLE_LEAF_IDS = 64,
+	
+	SYNC_PORT = 8765,  /* Default port of 'sbm serve-sync' */
+	/* Largest body 'sbm sync' and 'sbm serve' take, as sent or once
+	 * inflated; a message claiming more is dropped. */
+	HTTP_BODY_S = 1 << 30,
+	
+	/* The Bloom filter of 'sbm has': bits per URL and bits set for each,
+	 * which give about 1% false positives, and bits per block (one cache
+	 * line). */
+	URL_BLOOM_BITS = 10,
+	URL_BLOOM_K    = 7,
+	URL_BLOCK_BITS = 512,
+	
+	/* Most bytes of 'sbm list' output kept for one generation of the store;
+	 * larger results are printed but not kept. */
+	RESULTS_S = 4 << 20,
+	
+	/* A visit counts half as much after this many seconds (30 days) */
+	FRECENCY_HALF_LIFE = 30 * 24 * 60 * 60,
+	TOP_C = 10,  /* Entries 'sbm top' lists by default */
+	
+	SERVE_PORT      = 8764,     /* Default port of 'sbm serve' */
+	SERVE_FLUSH_MS  = 1000,     /* 'sbm serve' saves changes this long after */
+	SERVE_FLUSH_C   = 256,      /* ... or once this many have built up */
+	SERVE_CHUNK_S   = 32768,    /* Search results are streamed in chunks */
+	SERVE_REQUEST_S = 1 << 20,  /* Connections sending more are dropped */
+	
+	/* Long-running commands (serve, native-host, watch) reload the store
+	 * once this long has passed without another process writing to it. */
+	WATCH_SETTLE_MS = 50,
 };
@@ -40,21 +40,140 @@
  * 		-t <title>                 to update a custom title.
  * 		-tg <tag-ID> OR <tag-name> to add/remove tag(s).
  * 	sbm remove <ID>
- * 	sbm open   <ID>
- * 	sbm list <term> [OPTIONS]
- * 		<term> pertains the title. "all" can be used to list every entry.
+ * 	sbm open   <ID> [<ID> ...]
+ * 		-tg <tag-ID> OR <tag-name> to open every entry with a specified tag.
+ * 		--host <host>              to open every entry from a host.
+ * 	sbm remove --host <host>
+ * 		Removes every entry whose URL belongs to <host>.
+ * 	sbm remove --query <query> [--yes]
+ * 		Removes every entry matching <query> (see list), after asking
+ * 		once unless --yes is given.
+ * 	sbm saved add <name> <query>
+ * 	sbm saved show <name>
+ * 		Saves a query (see list) under a name. Its results are kept in
+ * 		saved.bin and brought up to date by each change, looking only at
+ * 		the entries changed, so showing them does not search the store.
+ * 	sbm saved list
+ * 	sbm saved remove <name>
+ * 	sbm retag <query> +<tag> -<tag> ... [--yes]
+ * 		Gives the +tags to, and takes the -tags from, every entry matching
+ * 		<query>, after asking once unless --yes is given.
+ * 	sbm list <query> [--any | --all] [--frecent]
+ * 		Lists the entries matching a query: words which the title, URL or
+ * 		comment must contain (every word, or with --any at least one,
+ * 		ignoring case), tag:<tag> for a tag they must have, -tag:<tag> for
+ * 		one they must not and host:<host> for the host they must be from.
+ * 		"all" on its own lists every entry. With --frecent, the entries
+ * 		opened most, and most recently, come first.
+ * 	sbm list [OPTIONS]
  * 		-tg <tag-ID> OR <tag-name> to list entries with a specified tag.
+ * 		--host <host>              to list entries from a host (e.g. docs.rs).
+ * 		Until the store is next saved, a list repeated is answered from
+ * 		results.bin without loading the store.
+ * 	sbm top [N]
+ * 		Lists the N (by default 10) entries opened most, and most
+ * 		recently. 'sbm open' logs each visit to visits.bin; older visits
+ * 		count for less, half as much every 30 days.
+ * 	sbm has <url>
+ * 		Prints the IDs of the entries with the same URL (as for merge), and
+ * 		exits with 1 if there are none. Answered from urls.bin, without
+ * 		loading the store.
+ * 	sbm stats hosts
+ * 		Lists every host along with how many entries belong to it.
+ * 	sbm merge <other-store>
+ * 		Adds the entries of another data.json. Entries with the same URL
+ * 		(ignoring the scheme, "www.", a trailing '/' and the fragment) are
+ * 		combined: their tags are joined and the newer title and comment kept.
+ * 		Tags are matched by name.
+ * 	sbm autotag --all
+ * 		Applies the rules in rules.txt to every entry. The rules are also
+ * 		applied to entries as they are added or merged. Each line is
+ * 		<url|title|any> <substring> -> <tag> [<tag> ...]
+ * 		e.g. "url github.com -> code"; case is ignored.
+ * 	sbm diff <other-store>
+ * 	sbm diff --socket <path>
+ * 	sbm diff --pipe <read-path> <write-path>
+ * 		Lists the entries which were added (+), removed (-) or changed (~)
+ * 		in another copy of the store. The copy can be a file, or be served
+ * 		by 'sbm diff-serve' over a unix socket or a pair of FIFOs. Only the
+ * 		ranges of IDs whose digests differ are compared. Exits with 1 when
+ * 		the stores differ.
+ * 	sbm diff-serve [--socket <path>]
+ * 		Answers 'sbm diff' on stdin and stdout, or on a unix socket.
+ * 	sbm replica init
+ * 		Turns on replicated mode, so that copies of the store on several
+ * 		devices can be changed independently and brought together without
+ * 		conflicts. From then on every change is also written to oplog.json
+ * 		as operations.
+ * 	sbm replica export <file>
+ * 	sbm replica import <file>
+ * 		Writes out every operation known here, or applies the operations of
+ * 		another device which are new here. Imports can be repeated and done
+ * 		in any order: devices which have seen the same operations have the
+ * 		same entries. Of two concurrent edits to a title or comment the later
+ * 		is kept, a tag added on one device stays when another removes it at
+ * 		the same time, and removed entries stay removed.
+ * 	sbm replica status
+ * 		Shows this device's ID and the operations it has seen.
+ * 	sbm sync <url>
+ * 		Exchanges operations with 'sbm serve-sync' at <url> (e.g.
+ * 		http://127.0.0.1:8765/), in replicated mode. Only what either side
+ * 		has not seen since the last sync is sent, compressed when zlib is
+ * 		available.
+ * 	sbm serve-sync [--port <port>]
+ * 		Serves this store to 'sbm sync' on 127.0.0.1, one connection at a
+ * 		time. Meant as a stand-in server for trying sync out locally.
+ * 	sbm serve [--port <port>]
+ * 		Serves a JSON API on 127.0.0.1 (port 8764 by default) for browser
+ * 		extensions and scripts, keeping the store in memory:
+ * 		GET  /lookup?url=<url>         entries with the same canonical URL
+ * 		GET  /search?q=<term>&tag=<tag>&host=<host>
+ * 		                               matching entries, streamed
+ * 		POST /add    {"url", "title", "comment", "tags": [...]}
+ * 		POST /tag    {"id", "tag"}     and /untag likewise
+ * 		POST /remove {"id"}
+ * 		Changes are saved within a second. Saves by other commands are
+ * 		picked up as they happen.
+ * 	sbm native-host
+ * 		The same API over native messaging on stdin and stdout, for an
+ * 		extension's runtime.connectNative() port. Each message names its
+ * 		endpoint in "op" (e.g. {"op": "lookup", "url": ...}) and is answered
+ * 		in order; searches are answered in parts, the last with
+ * 		"more": false.
+ * 	sbm watch
+ * 		Prints a line of JSON for each entry or tag other commands add,
+ * 		change or remove, as they save, e.g.
+ * 		{"generation": "7", "event": "update", "id": 3, "entry": {...}}.
+ * 	sbm undo
+ * 	sbm redo
+ * 		Reverts (or reapplies) the last command which changed the store.
+ * 		The last JOURNAL_C commands are kept.
+ * 	sbm fsck [--repair]
+ * 		Checks the store for duplicate IDs, unknown tags, invalid UTF-8,
+ * 		damaged blocks and stale indexes. Exits with 1 when problems are
+ * 		found. --repair fixes what it can and saves.
  * 
  * Tags behave similarly.
  * 	sbm tag add <term>
- * 		The first letter cannot be a number.
+ * 		The first letter cannot be a number. Tags nest by name: entries
+ * 		tagged lang/rust are also found when looking for lang.
  * 	sbm tag rename <tag-ID> OR <tag-name> <term>
  * 		Parameter 1 is the ID of the tag which is being changed. Parameter 2 is
  * 		the value the tag is changed to.
  * 		The new name must not begin with a number.
  * 	sbm tag remove <tag-ID> OR <tag-name>
+ * 	sbm tag merge <src> <dst>
+ * 		Gives every entry tagged <src> the tag <dst> instead, removes <src>
+ * 		and keeps its name as an alias of <dst>.
+ * 	sbm tag alias <alias> <tag-ID> OR <tag-name>
+ * 	sbm tag unalias <alias>
+ * 		Aliases are other names for a tag, accepted wherever a tag name is
+ * 		(unless a tag has the same name). They are kept in aliases.txt,
+ * 		which is written with the store, and can be undone like any change.
  * 	sbm tag list <term>
  * 		<term> pertains the title. "all" can be used to list every entry.
+ * 	sbm tag --host <host> <tag-ID> OR <tag-name>
+ * 		Adds the tag to every entry whose URL belongs to <host>.
  *
  * How do I compile and install this program?
  * 	Firstly, the dependencies must be installed: libcurl and json.h.
@@ -75,17 +194,44 @@
 
 
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <assert.h>
 #include <ctype.h>
 #include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <pthread.h>
 #include <pwd.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__SSE4_2__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_HW
+#endif
 #include <curl/curl.h>
 #ifdef __TINYC__
 #define __GNUC__
@@ -105,6 +251,8 @@
 #define true  1
 #define false 0
 
+extern char** environ;
+
 
 
 typedef struct URL {
@@ -130,6 +278,9 @@ typedef struct Table {
 			
 			char last_updated[20];
 		} datetime;
+		
+		/* Set by the loaders when a stored field did not fit */
+		int truncated;
 	} *rows;
 
 	unsigned int count;
@@ -139,6 +290,7 @@ typedef struct Table {
 typedef struct DateTime DateTime;
 typedef struct Row Row;
 typedef struct Tag Tag;
+typedef struct TagAlias TagAlias;
 
 typedef struct Tags {
 	struct Tag {
@@ -148,11 +300,352 @@ typedef struct Tags {
 	
 	unsigned int count;
 	unsigned int next_UID;
+	
+	/* Other names for tags, read from aliases_filename by ReadJSON(). They
+	 * are only looked up for names which no tag has. */
+	struct TagAlias {
+		char         name[TAG_NAME_S];
+		unsigned int id;             /* 0 once removed */
+	} *aliases;
+	unsigned int alias_c;
 } Tags;
 
+/* Secondary index from registrable host (e.g. "docs.rs", "bbc.co.uk") to the
+ * rows whose URL belongs to it. Each URL is parsed once, when it is loaded or
+ * added, and its host is interned. Row indices are stable (removing a row only
+ * zeroes its id), so the lists never need to be rebuilt. */
+typedef struct Hosts {
+	struct Host {
+		char*         name;
+		unsigned int* rows;
+		unsigned int  count;
+		unsigned int  capacity;
+	} *hosts;
+	
+	unsigned int  count;
+	unsigned int  capacity;
+	
+	/* Open addressing, stores host index + 1 so that 0 marks an empty slot */
+	unsigned int* buckets;
+	unsigned int  bucket_c;
+} Hosts;
+
+typedef struct Host Host;
+
+typedef struct HostCount {
+	unsigned int index;
+	unsigned int live;
+} HostCount;
+
+/* Secondary index from tag to the rows carrying it, with lists[] parallel to
+ * Tags.tags. It is built by FinishLoad() and appended to as tags are given to
+ * rows. Rows which later lose a tag (or are removed) are not taken out, so
+ * callers check the row itself. */
+typedef struct TagRows {
+	struct TagRowList {
+		unsigned int* rows;
+		unsigned int  count;
+		unsigned int  capacity;
+	} *lists;
+	unsigned int list_c;
+	
+	/* Tag ID -> index into Tags.tags + 1, or 0 when there is no such tag */
+	unsigned int* by_id;
+	unsigned int  by_id_c;
+	
+	/* Tag index -> the tag with its descendants, built by GetTagClosure()
+	 * the first time the tag is looked for. */
+	struct TagClosure {
+		uint64_t*    tags;       /* Bit per tag ID; NULL until built */
+		unsigned int tag_word_c;
+		uint64_t*    rows;       /* Bit per row given any of the tags. Like
+		                          * the lists, bits are only ever set. */
+		unsigned int row_word_c;
+	} *closures;
+	unsigned int closure_c;
+} TagRows;
+
+typedef struct TagRowList TagRowList;
+typedef struct TagClosure TagClosure;
+
+/* Bookkeeping saved alongside the rows. The next_UID values are stored so that
+ * the IDs of removed rows and tags are never handed out again. */
+typedef struct Meta {
+	unsigned int generation;  /* Bumped by every save */
+	unsigned int rows_next;   /* As saved; 0 for stores which predate it */
+	unsigned int tags_next;
+} Meta;
+
+typedef struct Buffer {
+	char*  data;
+	size_t length;
+	size_t capacity;
+} Buffer;
+
+/* What the current command changes, so that the next save can add it to the
+ * undo journal. Rows and tags are recorded by JournalRow() and JournalTag()
+ * before they are first changed; how they look afterwards is taken when
+ * saving. */
+typedef struct Journal {
+	Buffer        before_rows;
+	Buffer        before_tags;
+	unsigned int* rows;          /* (row index, row ID) pairs */
+	unsigned int  row_c;
+	unsigned int  row_capacity;
+	unsigned int* tags;          /* (tag index, tag ID) pairs */
+	unsigned int  tag_c;
+	unsigned int  tag_capacity;
+	uint64_t*     digests;       /* RowDigest() of each recorded row before */
+	Row*          before;        /* Copies of the recorded rows, kept only in
+	                              * replicated mode to work out its operations */
+	unsigned char* recorded;     /* By row index, once the row is recorded */
+	unsigned int   recorded_c;
+	Buffer        before_aliases;
+	char          (*aliases)[TAG_NAME_S]; /* Names of the recorded aliases */
+	unsigned int  alias_c;
+	
+	char          command[128];
+	int           step;          /* -1 for 'undo', 1 for 'redo' */
+} Journal;
+
+/* Digests of the rows over ranges of IDs, kept as a complete binary tree in
+ * an array: node 1 is the root, node n has the children 2n and 2n + 1, and
+ * nodes leaf_c .. 2 * leaf_c - 1 are the leaves. Leaf k covers the IDs
+ * k * MERKLE_LEAF_IDS up to (k + 1) * MERKLE_LEAF_IDS - 1 and is the sum of
+ * their RowDigest()s, so changing a row only adjusts one leaf and rehashes
+ * its path to the root. Two stores differ in a range exactly when their nodes
+ * for it differ. */
+typedef struct Merkle {
+	uint64_t*    nodes;
+	unsigned int leaf_c;      /* A power of two */
+	unsigned int generation;  /* Of the store it describes */
+} Merkle;
+
+/* A Lamport clock reading and the device which took it. Every operation of
+ * replicated mode is named by one, which makes them unique and puts them in
+ * an order all devices agree on. */
+typedef struct Stamp {
+	unsigned int clock;
+	unsigned int device;
+} Stamp;
+
+/* Replicated mode (see 'sbm replica'). Each row has a global ID, the stamp of
+ * the operation which added it, and local row IDs are only mapped to it.
+ * Titles, comments and dates are last-writer-wins registers (the larger stamp
+ * wins) and tags an observed-remove set: a tag is on a row while any of the
+ * operations which added it has not been removed. Removed rows are kept as
+ * tombstones so that late operations cannot bring them back. */
+typedef struct Replica {
+	int          enabled;     /* replica_filename exists */
+	int          loaded;
+	int          importing;   /* The changes come from other devices */
+	unsigned int device;
+	unsigned int clock;
+	unsigned int generation;  /* Of the store replica_filename describes */
+	
+	struct ReplicaRow {
+		Stamp        id;
+		unsigned int local_id;    /* 0 once removed */
+		Stamp        title_at;
+		Stamp        comment_at;
+		Stamp        date_at;
+		struct ReplicaTag {
+			char  name[TAG_NAME_S];
+			Stamp added;
+		} *tags;
+		unsigned int tag_c;
+	} *rows;
+	unsigned int row_c;
+	unsigned int row_capacity;
+	
+	/* Open addressing on the global ID, storing row index + 1 */
+	unsigned int* by_id;
+	unsigned int  bucket_c;
+	/* Local row ID -> row index + 1 */
+	unsigned int* by_local;
+	unsigned int  by_local_c;
+	
+	/* The newest clock seen from each device. A device's operations are
+	 * only ever passed on together with all of its earlier ones, so this is
+	 * enough to tell which operations are new. */
+	Stamp*        seen;
+	unsigned int  seen_c;
+	
+	Buffer        log;        /* Operations to append to oplog_filename */
+} Replica;
+
+typedef struct ReplicaRow ReplicaRow;
+typedef struct ReplicaTag ReplicaTag;
+
+typedef struct ReplicaOp {
+	enum ReplicaOpKind {
+		RO_ADD,
+		RO_TITLE,
+		RO_COMMENT,
+		RO_TAG,
+		RO_UNTAG,
+		RO_REMOVE
+	} kind;
+	Stamp        id;
+	Stamp        row;
+	Row          values;      /* Only the fields the operation carries */
+	int          has_date;
+	char         tag[TAG_NAME_S];
+	Stamp*       removes;     /* For RO_UNTAG, the additions it observed */
+	unsigned int remove_c;
+	size_t       start;       /* Where the operation's line is in its file */
+	size_t       end;
+} ReplicaOp;
+
+/* An Aho-Corasick automaton over classes of the bytes found in the patterns,
+ * which matches a string against every pattern in one pass, regardless of
+ * case. Every transition is completed, so failure links are never followed
+ * while matching. */
+typedef struct Matcher {
+	unsigned char classes[256];  /* Byte -> class, 0 for bytes in no pattern */
+	unsigned int  class_c;
+	unsigned int* next;          /* state * class_c + class -> state */
+	unsigned int  state_c;
+	unsigned int* own;           /* State -> index + 1 of a pattern ending
+	                              * there */
+	unsigned int* also;          /* Pattern -> index + 1 of the next pattern
+	                              * ending at the same state */
+	unsigned int* dict;          /* State -> the nearest state on its failure
+	                              * path which has patterns of its own */
+} Matcher;
+
+/* rules_filename, compiled so that a row is matched against every rule in
+ * one pass over its URL and one over its title. */
+typedef struct AutotagRule {
+	unsigned int fields;                /* AUTOTAG_URL | AUTOTAG_TITLE */
+	unsigned int tag_ids[ROW_TAG_C];
+} AutotagRule;
+
+enum {
+	AUTOTAG_URL   = 1,
+	AUTOTAG_TITLE = 2
+};
+
+typedef struct Autotag {
+	Matcher       matcher;       /* Pattern i is the substring of rules[i] */
+	AutotagRule*  rules;
+	unsigned int  rule_c;
+	int           loaded;
+} Autotag;
+
+/* One field of one row being matched */
+typedef struct AutotagScan {
+	Autotag*      autotag;
+	unsigned int  field;
+	unsigned int* tags;
+	unsigned int  tag_c;
+} AutotagScan;
+
+typedef struct AutotagJob {
+	Autotag*      autotag;
+	Row*          rows;
+	unsigned int* tags;    /* ROW_TAG_C per row */
+	unsigned int* counts;
+} AutotagJob;
+
+/* See ParseQuery() */
+typedef struct Query {
+	char*        text;       /* As given */
+	char*        words;      /* text, split up */
+	char**       terms;
+	unsigned int term_c;
+	int          any;        /* Otherwise every term must be found */
+	unsigned int tag_ids[ROW_TAG_C];
+	unsigned int tag_c;
+	unsigned int not_tag_ids[ROW_TAG_C];
+	unsigned int not_tag_c;
+	Host*        host;       /* NULL if no entry is from the host */
+	int          has_host;
+	char*        bad;        /* The tag which did not exist */
+} Query;
+
+/* Matching the terms of a query */
+typedef struct ListJob {
+	Matcher*       matcher;
+	Row*           rows;
+	unsigned int   term_c;
+	int            any;       /* Otherwise every term must be found */
+	unsigned char* matched;
+} ListJob;
+
+typedef struct ListScan {
+	ListJob*      job;
+	unsigned int* seen;       /* Term -> the row + 1 it was last found in */
+	unsigned int  row;
+	unsigned int  found;      /* Terms found in row */
+} ListScan;
+
+/* saved_filename; see LoadSavedSearches() */
+typedef struct SavedHeader {
+	char     magic[8];       /* "sbmsave1" */
+	uint32_t generation;
+	uint32_t count;
+} SavedHeader;
+
+typedef struct SavedSearch {
+	char         name[TAG_NAME_S];
+	char*        query;
+	uint64_t*    ids;        /* Bit per row ID which matches */
+	unsigned int word_c;
+} SavedSearch;
+
+typedef struct SavedSearches {
+	SavedSearch* searches;
+	unsigned int count;
+	unsigned int generation;
+} SavedSearches;
+
+/* visits_filename: one per entry opened, only ever appended */
+typedef struct Visit {
+	uint32_t id;
+	uint32_t time;           /* Seconds since the epoch */
+} Visit;
+
+/* frecency_filename: a header, then a Frecency for every entry opened, the
+ * most frecent first; see LoadFrecencies(). */
+typedef struct FrecencyHeader {
+	char     magic[8];       /* "sbmfrec1" */
+	uint64_t visits_s;       /* Bytes of visits_filename counted in */
+	uint32_t count;
+	uint32_t reserved;
+} FrecencyHeader;
+
+typedef struct Frecency {
+	uint32_t id;
+	uint32_t visits;
+	double   score;          /* See AddVisitScore() */
+} Frecency;
+
+typedef struct Frecencies {
+	Frecency*    rows;
+	unsigned int count;
+} Frecencies;
+
 typedef struct Core {
-	Table table;
-	Tags  tags;
+	Table   table;
+	Tags    tags;
+	Hosts   hosts;
+	TagRows tag_rows;
+	Meta    meta;
+	
+	/* Set by commands which change anything, so that read-only commands do
+	 * not rewrite the store. */
+	int     dirty;
+	
+	/* Blocks which failed their checksum when loading. Their text is written
+	 * to quarantine_filename by the next save. */
+	unsigned int bad_block_c;
+	Buffer       quarantine;
+	
+	Journal      journal;
+	Merkle       merkle;      /* Built or loaded by GetMerkle() */
+	Replica      replica;
+	Autotag*     autotag;     /* Compiled by GetAutotag() */
 } Core;
 
 typedef struct InputArgs {
@@ -166,11 +659,32 @@ typedef struct InputArgs {
 		
 		IM_LIST,
 		IM_TAG_LIST,
+		IM_STATS_HOSTS,
+		IM_FSCK,
+		
+		IM_UNDO,
+		IM_REDO,
+		IM_MERGE,
+		IM_DIFF,
+		IM_DIFF_SERVE,
+		IM_REPLICA,
+		IM_SYNC,
+		IM_SERVE_SYNC,
+		IM_SERVE,
+		IM_NATIVE_HOST,
+		IM_HAS,
+		IM_WATCH,
+		IM_AUTOTAG,
+		IM_RETAG,
+		IM_SAVED,
+		IM_TOP,
 		
 		IM_TAG_ADD,
 		IM_TAG_ADD_TO_ENTRY,
 		IM_TAG_RENAME,
-		IM_TAG_REMOVE
+		IM_TAG_REMOVE,
+		IM_TAG_MERGE,
+		IM_TAG_ALIAS
 	} input_mode;
 	
 	enum WordIndices {
@@ -179,48 +693,425 @@ typedef struct InputArgs {
 		WI_TITLE   = 1,
 		WI_COMMENT = 2,
 		WI_TAG     = 3,
+		WI_HOST    = 4,
+		WI_SORT    = 5,
 		
 		WI_COUNT
 	} WordIndices;
 	char* word_buffers[WI_COUNT];
+	
+	/* Every value given to commands that take more than one (e.g. open) */
+	char**       mod_list;
+	unsigned int mod_c;
 } InputArgs;
 
+/* One bit per byte of the store, set for every quote which opens or closes a
+ * string and for every { } [ ] : , outside of a string. See BuildStructIndex().
+ */
+typedef struct StructIndex {
+	const char* text;
+	size_t      size;
+	uint64_t*   bits;
+	size_t      word_c;
+} StructIndex;
+
+typedef struct StructRowsJob {
+	StructIndex*    index;
+	size_t*         row_starts;
+	Row*            rows;
+	
+	pthread_mutex_t lock;
+	size_t          error_at;
+	int             failed;
+} StructRowsJob;
+
+/* A block of rows as found in the store. Spans which could not be framed as a
+ * block at all are kept as well (with framed unset) so they can be
+ * quarantined. */
+typedef struct StoreBlock {
+	size_t   start;   /* The opening '{' */
+	size_t   body;    /* The first row */
+	size_t   footer;  /* The closing "}}" */
+	size_t   end;     /* Just past the closing "}}" */
+	uint32_t crc;     /* As written in the header */
+	int      framed;
+	int      ok;
+} StoreBlock;
+
+typedef struct VerifyBlocksJob {
+	const char* text;
+	StoreBlock* blocks;
+} VerifyBlocksJob;
+
+typedef struct URLHashJob {
+	Row*          rows;
+	unsigned int* hashes;  /* HashString() of each row's canonical URL */
+} URLHashJob;
+
+typedef struct URLKeyJob {
+	Row*      rows;
+	uint64_t* keys;
+} URLKeyJob;
+
+/* urls.bin, which answers 'sbm has' without loading the store: a blocked
+ * Bloom filter of the canonical URLs of the live rows, so that most URLs
+ * which are not bookmarked are turned away after reading one cache line,
+ * followed by an open addressing table of (key, row ID). Both are indexed by
+ * URLKey(). The file is mapped and updated in place. */
+typedef struct URLIndexHeader {
+	char         magic[8];     /* "sbmurls1" */
+	unsigned int generation;   /* Of the store it describes, 0 while updating */
+	unsigned int block_c;      /* Bloom blocks of URL_BLOCK_BITS */
+	unsigned int slot_c;       /* Both powers of two */
+	unsigned int used;         /* Slots holding an entry or a tombstone */
+	unsigned int added;        /* Keys ever added to the Bloom filter */
+	unsigned int reserved[9];  /* Keeps the blocks on cache lines */
+} URLIndexHeader;
+
+/* An empty slot has a check of 0, a tombstone an ID of 0 */
+typedef struct URLSlot {
+	uint32_t check;  /* The high half of the key, with the low bit set */
+	uint32_t id;
+} URLSlot;
+
+/* results_filename: a header, then for each query kept a ResultsEntry, its
+ * key from ListResultKey() and what it printed. Entries are only ever
+ * appended; a save of the store makes the whole file stale. */
+typedef struct ResultsHeader {
+	char     magic[8];     /* "sbmres1" */
+	uint32_t generation;   /* Of the store the entries were printed from */
+	uint32_t reserved;
+	uint64_t aliases;      /* AliasesStamp() */
+} ResultsHeader;
+
+typedef struct ResultsEntry {
+	uint32_t hash;         /* HashString() of the key */
+	uint32_t key_l;
+	uint32_t output_l;
+} ResultsEntry;
+
+typedef struct DigestJob {
+	Row*      rows;
+	uint64_t* digests;
+} DigestJob;
+
+/* The other side of 'sbm diff': another store loaded here, or a
+ * 'sbm diff-serve' at the end of a pair of streams. */
+typedef struct DiffPeer {
+	unsigned int leaf_c;
+	void*        ctx;
+	
+	/* Fills o_hashes with the peer's hash for each of the nodes */
+	void (*get_nodes)(void* ctx, unsigned int* nodes, unsigned int n,
+	                  uint64_t* o_hashes);
+	/* Returns the peer's rows whose IDs fall in any of the leaves */
+	Row* (*get_rows) (void* ctx, unsigned int* leaves, unsigned int n,
+	                  unsigned int* o_c);
+} DiffPeer;
+
+typedef struct DiffStream {
+	FILE* in;
+	FILE* out;
+} DiffStream;
+
+/* An HTTP request or response, as far as 'sbm sync' and 'sbm serve' need: the
+ * start line and the few headers they use. */
+typedef struct HTTPMessage {
+	char   start[2048];
+	size_t head_length;
+	size_t content_length;
+	char   encoding[16];     /* Content-Encoding */
+	int    accepts_deflate;  /* Accept-Encoding */
+	int    close;            /* Connection: close */
+	size_t raw_length;       /* X-Sbm-Length, the body before compression */
+	size_t log_size;         /* X-Sbm-Log-Size */
+	int    too_large;        /* Either length is over HTTP_BODY_S, or not one */
+} HTTPMessage;
+
+typedef struct HTTPConn {
+	int    fd;
+	Buffer in;
+	size_t used;  /* Bytes of in already read as messages */
+} HTTPConn;
+
+/* What a long-running command knows of the store on disk, to tell saves by
+ * other processes from its own */
+typedef struct Watch {
+	int             fd;        /* inotify, or -1 */
+	int             settling;  /* Something changed; look again at due */
+	struct timespec due;
+	struct timespec mtime;     /* Of the store as last loaded or saved */
+	off_t           size;
+} Watch;
+
+/* A 'sbm serve' search being streamed: the rows are walked from next on as
+ * the connection drains. */
+typedef struct ServeSearch {
+	int          active;
+	unsigned int epoch;  /* Serve.epoch when it started */
+	char         term[TITLE_S];
+	unsigned int tag_id;
+	int          host;   /* Index into Hosts.hosts, or -1 */
+	unsigned int next;   /* Into the host's rows, or else the table */
+	unsigned int found;
+} ServeSearch;
+
+typedef struct ServeConn {
+	int         fd;
+	Buffer      in;
+	size_t      used;   /* Bytes of in already handled as requests */
+	Buffer      out;
+	size_t      sent;   /* Bytes of out already written */
+	int         close;  /* Once out is written */
+	int         native; /* Native messaging framing rather than HTTP */
+	ServeSearch search;
+} ServeConn;
+
+/* The fields of a 'sbm serve' request body, or of a 'sbm native-host'
+ * message */
+typedef struct ServeFields {
+	char         op[16];
+	char         q[TITLE_S];
+	char         host[S_ADDR_S];
+	char*        url;
+	char         title[TITLE_S];
+	int          has_title;
+	char         comment[COMMENT_S];
+	char         tag[TAG_NAME_S];
+	char         tags[ROW_TAG_C][TAG_NAME_S];
+	unsigned int tag_c;
+	unsigned int id;
+} ServeFields;
+
+/* What 'sbm serve' keeps alongside the Core */
+typedef struct Serve {
+	Core*           core;
+	unsigned int    row_capacity;
+	
+	/* Canonical URL hash of each row, and a table of row index + 1 by it */
+	unsigned int*   url_hashes;
+	unsigned int*   buckets;
+	unsigned int    bucket_c;
+	
+	/* Row ID -> row index + 1 */
+	unsigned int*   by_id;
+	unsigned int    by_id_c;
+	
+	unsigned int    pending;        /* Changes not saved yet */
+	struct timespec first_pending;
+	
+	Watch           watch;
+	unsigned int    epoch;          /* Bumped when the store is loaded afresh */
+} Serve;
+
+typedef struct ParallelJob {
+	void       (*fn)(void* ctx, unsigned int begin, unsigned int end);
+	void*        ctx;
+	unsigned int begin;
+	unsigned int end;
+} ParallelJob;
+
+typedef struct FsckJob {
+	Core*          core;
+	unsigned char* problems;  /* FsckProblem bits, one per row */
+} FsckJob;
+
+enum FsckProblem {
+	FP_BAD_UTF8     = 1 << 0,
+	FP_DANGLING_TAG = 1 << 1,
+	FP_REPEATED_TAG = 1 << 2,
+	FP_DUPLICATE_ID = 1 << 3,
+	FP_TRUNCATED    = 1 << 4,
+};
+
+typedef struct DOMRowsJob {
+	struct json_object_element_s** items;
+	Row*                           rows;
+} DOMRowsJob;
+
 typedef struct CURLData {
 	char* contents;
 	int   index;
 	int   contents_length;
 } CURLData;
 
+/* libcurl is only needed when a page title has to be downloaded, so rather
+ * than linking against it (and paying for its start-up on every run) it is
+ * loaded on first use by LoadCURL(). */
+typedef struct CURLLib {
+	void* handle;
+	
+	CURLcode    (*global_init)  (long flags);
+	CURL*       (*easy_init)    (void);
+	CURLcode    (*easy_setopt)  (CURL* curl, CURLoption option, ...);
+	CURLcode    (*easy_perform) (CURL* curl);
+	CURLcode    (*easy_getinfo) (CURL* curl, CURLINFO info, ...);
+	void        (*easy_cleanup) (CURL* curl);
+	const char* (*easy_strerror)(CURLcode code);
+} CURLLib;
+
+/* Loaded by LoadZLib() to compress sync traffic, when it is there. */
+typedef struct ZLib {
+	void* handle;
+	
+	int           (*compress2)    (unsigned char* dest, unsigned long* destLen,
+	                               const unsigned char* source,
+	                               unsigned long sourceLen, int level);
+	unsigned long (*compressBound)(unsigned long sourceLen);
+	int           (*uncompress)   (unsigned char* dest, unsigned long* destLen,
+	                               const unsigned char* source,
+	                               unsigned long sourceLen);
+} ZLib;
+
 
 
 static int WriteJSON(Core* c);
 
+static void BufferReserve        (Buffer* io_b, size_t n);
+static void BufferAppend         (Buffer* io_b, const char* s, size_t n);
+static void BufferAppendS        (Buffer* io_b, const char* s);
+static void BufferAppendUInt     (Buffer* io_b, unsigned int v);
+static void BufferAppendJSONString(Buffer* io_b, const char* s);
+static void BufferAppendRow      (Buffer* io_b, Row* r);
+
+static size_t JSONUnescape(const char* s, size_t l, char* o_buffer, size_t m);
+static uint32_t CRC32C   (uint32_t crc, const void* data, size_t n);
+static void     InitCRC32C(void);
+static void   RunParallel(unsigned int count, unsigned int minPerThread,
+                          void (*fn)(void* ctx, unsigned int begin,
+                                     unsigned int end),
+                          void* ctx);
+
 static char* stristr(const char* a, const char* b);
 static int   stricmp(const char* a, const char* b);
 static char* strcpyt(char* d, char* s, unsigned int m, int l);
 
-static void PrintWithTagIDs(unsigned int* tagIDs, unsigned int tc,
-                           Row* r, unsigned int rc,
-                           Tags tg);
+static void PrintWithTagIDs(Core* c, unsigned int* tagIDs, unsigned int tc,
+                            Buffer* io_b);
 static void PrintRow(Row r, Tags tg);
+static void BufferAppendListedRow(Buffer* io_b, Row* r, Tags tg);
+static int  RowHasTagID(Row r, unsigned int id);
 
 static char*        GetTagName(Tags t, unsigned int id);
 static unsigned int GetTagID  (Tags t, char* s);
+static void         LoadTagAliases(Tags* io_t);
+static void         SaveTagAliases(Tags* t);
+static int          SetTagAlias   (Tags* io_t, const char* name, unsigned int id);
+static unsigned int GetTagAlias   (Tags t, const char* name);
 
 static void GetCurrentDateTime(DateTime* o_dt);
 
 static void UpdateRowTags(Core* io_c, unsigned int rowIndex, InputArgs* ia);
 
 static void      GetPageTitle(char* contents, char* o_buffer);
+static CURLLib*  LoadCURL(void);
 static CURLData* GetWebpage(char* url);
 
 static void         ValidateTagName(char* io_buffer[],
                                     const unsigned int index);
 static unsigned int GetInputTagIndex(Core* c, char* buffers[],
                                      const unsigned int inputIndex);
+static unsigned int GetInputTagIDs  (Core* c, char* input,
+                                     unsigned int** o_ids);
+
+static unsigned int OpenURLs(char** urls, unsigned int c);
 
 static void GetConfigPath(char* o_buffer);
 
+static char*        GetRowURL    (Row* r);
+static void         GetURLHost   (const char* url, char* o_buffer);
+static void         CanonicalURL (const char* url, char* o_buffer);
+static int          SameCanonicalURL(const char* a, const char* b);
+static Host*        FindHost     (Hosts* h, const char* url);
+static void         IndexRowHost (Core* io_c, unsigned int rowIndex);
+static void         BuildHostIndex(Core* io_c);
+static void         FreeHostIndex(Hosts* io_h);
+
+static int          FindTagIndex(Core* c, unsigned int tagID);
+static int          FindNamedTag(Core* c, const char* s);
+static TagRowList*  GetTagRows  (Core* c, unsigned int tagID);
+static void         TagRowsAdd  (Core* io_c, unsigned int tagID,
+                                 unsigned int rowIndex);
+static void         BuildTagRows(Core* io_c);
+static void         FreeTagRows (TagRows* io_t);
+static TagClosure*  GetTagClosure(Core* c, unsigned int tagID);
+static int          RowUnderTag  (TagClosure* cl, Row* r);
+static unsigned int NextClosureRow(TagClosure* cl, unsigned int from,
+                                   unsigned int end);
+static void         FreeTagClosures(TagRows* io_t);
+static void         FinishLoad  (Core* io_c);
+static void         MergeTag    (Core* io_c, unsigned int srcIndex,
+                                 unsigned int dstIndex);
+
+static unsigned int Fsck(Core* io_c, int repair);
+
+static void MergeStore(Core* io_c, const char* filename);
+static int            ParseQuery (Core* c, char** args, unsigned int argc, int any,
+                                  Query* o_q);
+static void           FreeQuery  (Query* q);
+static unsigned char* MatchQuery (Core* c, Query* q);
+static unsigned char* MatchListQuery(Core* c, Query* q, char** args,
+                                     unsigned int argc);
+static void           Retag      (Core* io_c, char** args, unsigned int argc);
+static void           RemoveQuery(Core* io_c, char** args, unsigned int argc);
+static void           SaveSavedSearches(Core* c);
+static void           SavedCommand(Core* io_c, char** args, unsigned int argc);
+static void LogVisits          (unsigned int* ids, unsigned int c);
+static void LoadFrecencies     (Frecencies* o_f);
+static void BufferAppendFrecent(Core* c, unsigned char* matched, Buffer* io_b);
+static void PrintTop           (Core* c, unsigned int n);
+static void AutotagRow(Core* io_c, unsigned int rowIndex);
+static void AutotagAll(Core* io_c);
+static void FreeAutotag(Autotag* a);
+
+static uint64_t RowDigest (Row* r);
+static Merkle*  GetMerkle (Core* io_c);
+static void     MerkleBuild(Core* c, Merkle* o_m);
+static int      LoadMerkle(Merkle* o_m, unsigned int generation);
+static void     SaveMerkle(Core* c);
+static void     SaveURLIndex(Core* c);
+static void     BuildURLIndex(Core* c);
+static int      HasURL    (const char* url);
+static void     ListResultKey  (InputArgs* ia, Buffer* o_key);
+static int      ListFromResults(InputArgs* ia);
+static void     SaveListResult (Core* c, Buffer* key, Buffer* output);
+static void     Diff      (Core* io_c, char** args, unsigned int argc);
+static void     DiffServe (Core* io_c, char** args, unsigned int argc);
+
+static int  ReplicaEnabled(void);
+static void SaveReplica   (Core* c);
+static void ReplicaCommand(Core* io_c, char** args);
+static void Sync          (Core* io_c, const char* url);
+static void ServeSync     (Core* io_c, char** args, unsigned int argc);
+static void ServeAPI      (Core* io_c, char** args, unsigned int argc);
+static void NativeHost    (Core* io_c);
+static void WatchStore    (Core* io_c);
+static void FreeCore      (Core* io_c);
+static unsigned int FsckReplica(Core* io_c, int repair);
+
+static void JournalRow   (Core* io_c, unsigned int rowIndex, int isNew);
+static void JournalTag   (Core* io_c, unsigned int tagIndex, int isNew);
+static void JournalAlias (Core* io_c, const char* name);
+static void CommitJournal(Core* c);
+static void ResetJournal (Journal* io_j);
+static void StepJournal  (Core* io_c, int step);
+static size_t FindJournalSide(StructIndex* idx, const char* side,
+                              const char** o_command, size_t* o_commandL);
+static int  ApplyJournalImages(Core* io_c, StructIndex* idx, size_t pos);
+static char* ReadJournal(char*** o_lines, unsigned int* o_c,
+                         unsigned int* o_undo, unsigned int* o_generation);
+
+static int   ReadStoreMeta(Meta* o_meta);
+static char* ReadWholeFile(const char* filename, size_t* o_size);
+static void StartWatching(Watch* o_w);
+static void WatchSaved   (Watch* io_w);
+static void WatchEvents  (Watch* io_w);
+static int  WatchTimeout (Watch* w);
+static int  WatchDue     (Watch* io_w);
+static int  MinTimeout   (int a, int b);
+static int  ReloadStore  (Core* io_c, Buffer* o_events);
+static int          CompareHostCounts(const void* a, const void* b);
+
 
 static InputArgs
 ParseEntryInput(char* args[], int argc)
@@ -281,25 +1172,202 @@ ParseEntryInput(char* args[], int argc)
 			exit(-1);
 		}
 		result.input_mode = IM_REMOVE;
-		result.word_buffers[WI_MOD] = args[1];
-	} else if (strcmp(args[0], "list") == 0) {
-		result.input_mode = IM_LIST;
-		if (argc == 2) {
-			result.word_buffers[WI_MOD] = args[1];
-		} else if (argc == 3) {
-			if (stricmp(args[1], "-tg") == 0) {
-				result.word_buffers[WI_TAG] = args[2];
-			} else {
-				printf("Invalid input\n");
+		if (strcmp(args[1], "--host") == 0) {
+			if (argc != 3) {
+				printf("Attempting to remove by host but no host provided\n");
+				exit(-1);
+			}
+			result.word_buffers[WI_HOST] = args[2];
+		} else if (strcmp(args[1], "--query") == 0) {
+			if (argc < 3) {
+				printf("Invalid input. Usage: sbm remove --query <query> " \
+				       "[--yes]\n");
 				exit(-1);
 			}
+			result.mod_list = &args[2];
+			result.mod_c    = argc - 2;
 		} else {
+			result.word_buffers[WI_MOD] = args[1];
+		}
+	} else if (strcmp(args[0], "saved") == 0) {
+		if (!(argc >= 4 && strcmp(args[1], "add") == 0) &&
+		    !(argc == 2 && strcmp(args[1], "list") == 0) &&
+		    !(argc == 3 && (strcmp(args[1], "show") == 0 ||
+		                    strcmp(args[1], "remove") == 0))) {
+			printf("Invalid input. Usage: sbm saved add <name> <query> | list | " \
+			       "show <name> | remove <name>\n");
+			exit(-1);
+		}
+		result.input_mode = IM_SAVED;
+		result.mod_list = &args[1];
+		result.mod_c    = argc - 1;
+	} else if (strcmp(args[0], "retag") == 0) {
+		if (argc < 3) {
+			printf("Invalid input. Usage: sbm retag <query> +<tag> -<tag> ... " \
+			       "[--yes]\n");
+			exit(-1);
+		}
+		result.input_mode = IM_RETAG;
+		result.mod_list = &args[1];
+		result.mod_c    = argc - 1;
+	} else if (strcmp(args[0], "list") == 0) {
+		result.input_mode = IM_LIST;
+		if (argc == 3 && stricmp(args[1], "-tg") == 0) {
+			result.word_buffers[WI_TAG] = args[2];
+		} else if (argc == 3 && strcmp(args[1], "--host") == 0) {
+			result.word_buffers[WI_HOST] = args[2];
+		} else if (stricmp(args[1], "-tg") == 0 ||
+		           strcmp(args[1], "--host") == 0) {
 			printf("Invalid input\n");
 			exit(-1);
+		} else {
+			unsigned int i;
+			
+			/* Terms, and which of --any or --all was given last */
+			result.mod_list = &args[1];
+			for (i = 1; i < argc; ++i) {
+				if (strcmp(args[i], "--any") == 0 ||
+				    strcmp(args[i], "--all") == 0) {
+					result.word_buffers[WI_MOD] = args[i];
+				} else if (strcmp(args[i], "--frecent") == 0) {
+					result.word_buffers[WI_SORT] = args[i];
+				} else {
+					args[1 + result.mod_c++] = args[i];
+				}
+			}
+			if (result.mod_c == 0) {
+				printf("Invalid input\n");
+				exit(-1);
+			}
 		}
 	} else if (strcmp(args[0], "open") == 0) {
+		if (argc < 2) {
+			printf("Attempting to open entries but no row ID provided\n");
+			exit(-1);
+		}
 		result.input_mode = IM_OPEN;
+		if (strcmp(args[1], "-tg") == 0 || strcmp(args[1], "--host") == 0) {
+			if (argc != 3) {
+				printf("Has option flag but no option given\n");
+				exit(-1);
+			}
+			result.word_buffers[(args[1][1] == 't') ? WI_TAG : WI_HOST] = args[2];
+		} else {
+			result.word_buffers[WI_MOD] = args[1];
+			result.mod_list = &args[1];
+			result.mod_c    = argc - 1;
+		}
+	} else if (strcmp(args[0], "fsck") == 0) {
+		result.input_mode = IM_FSCK;
+		if (argc == 2 && strcmp(args[1], "--repair") == 0) {
+			result.word_buffers[WI_MOD] = args[1];
+		} else if (argc != 1) {
+			printf("Invalid input. Usage: sbm fsck [--repair]\n");
+			exit(-1);
+		}
+	} else if (strcmp(args[0], "merge") == 0) {
+		if (argc != 2) {
+			printf("Invalid input. Usage: sbm merge <other-store>\n");
+			exit(-1);
+		}
+		result.input_mode = IM_MERGE;
+		result.word_buffers[WI_MOD] = args[1];
+	} else if (strcmp(args[0], "diff") == 0) {
+		if (!(argc == 2 && args[1][0] != '-') &&
+		    !(argc == 3 && strcmp(args[1], "--socket") == 0) &&
+		    !(argc == 4 && strcmp(args[1], "--pipe") == 0)) {
+			printf("Invalid input. Usage: sbm diff <other-store> | " \
+			       "--socket <path> | --pipe <read-path> <write-path>\n");
+			exit(-1);
+		}
+		result.input_mode = IM_DIFF;
+		result.mod_list = &args[1];
+		result.mod_c    = argc - 1;
+	} else if (strcmp(args[0], "diff-serve") == 0) {
+		if (argc != 1 && !(argc == 3 && strcmp(args[1], "--socket") == 0)) {
+			printf("Invalid input. Usage: sbm diff-serve [--socket <path>]\n");
+			exit(-1);
+		}
+		result.input_mode = IM_DIFF_SERVE;
+		result.mod_list = &args[1];
+		result.mod_c    = argc - 1;
+	} else if (strcmp(args[0], "replica") == 0) {
+		if (!(argc == 2 && (strcmp(args[1], "init") == 0 ||
+		                    strcmp(args[1], "status") == 0)) &&
+		    !(argc == 3 && (strcmp(args[1], "export") == 0 ||
+		                    strcmp(args[1], "import") == 0))) {
+			printf("Invalid input. Usage: sbm replica init | status | " \
+			       "export <file> | import <file>\n");
+			exit(-1);
+		}
+		result.input_mode = IM_REPLICA;
+		result.mod_list = &args[1];
+		result.mod_c    = argc - 1;
+	} else if (strcmp(args[0], "sync") == 0) {
+		if (argc != 2) {
+			printf("Invalid input. Usage: sbm sync <url>\n");
+			exit(-1);
+		}
+		result.input_mode = IM_SYNC;
+		result.word_buffers[WI_MOD] = args[1];
+	} else if (strcmp(args[0], "serve-sync") == 0) {
+		if (argc != 1 && !(argc == 3 && strcmp(args[1], "--port") == 0)) {
+			printf("Invalid input. Usage: sbm serve-sync [--port <port>]\n");
+			exit(-1);
+		}
+		result.input_mode = IM_SERVE_SYNC;
+		result.mod_list = &args[1];
+		result.mod_c    = argc - 1;
+	} else if (strcmp(args[0], "serve") == 0) {
+		if (argc != 1 && !(argc == 3 && strcmp(args[1], "--port") == 0)) {
+			printf("Invalid input. Usage: sbm serve [--port <port>]\n");
+			exit(-1);
+		}
+		result.input_mode = IM_SERVE;
+		result.mod_list = &args[1];
+		result.mod_c    = argc - 1;
+	} else if (strcmp(args[0], "watch") == 0) {
+		if (argc != 1) {
+			printf("Invalid input. Usage: sbm watch\n");
+			exit(-1);
+		}
+		result.input_mode = IM_WATCH;
+	} else if (strcmp(args[0], "autotag") == 0) {
+		if (argc != 2 || strcmp(args[1], "--all") != 0) {
+			printf("Invalid input. Usage: sbm autotag --all\n");
+			exit(-1);
+		}
+		result.input_mode = IM_AUTOTAG;
+	} else if (strcmp(args[0], "top") == 0) {
+		if (argc > 2 || (argc == 2 && (!isdigit(args[1][0]) || atoi(args[1]) < 1))) {
+			printf("Invalid input. Usage: sbm top [N]\n");
+			exit(-1);
+		}
+		result.input_mode = IM_TOP;
+		result.word_buffers[WI_MOD] = (argc == 2) ? args[1] : NULL;
+	} else if (strcmp(args[0], "has") == 0) {
+		if (argc != 2) {
+			printf("Invalid input. Usage: sbm has <url>\n");
+			exit(-1);
+		}
+		result.input_mode = IM_HAS;
 		result.word_buffers[WI_MOD] = args[1];
+	} else if (strcmp(args[0], "native-host") == 0) {
+		/* The browser passes the extension's origin (Chrome) or the manifest
+		 * and the extension's ID (Firefox), none of which are needed. */
+		result.input_mode = IM_NATIVE_HOST;
+	} else if (strcmp(args[0], "undo") == 0 || strcmp(args[0], "redo") == 0) {
+		if (argc != 1) {
+			printf("Invalid input. Usage: sbm %s\n", args[0]);
+			exit(-1);
+		}
+		result.input_mode = (args[0][0] == 'u') ? IM_UNDO : IM_REDO;
+	} else if (strcmp(args[0], "stats") == 0) {
+		if (argc != 2 || strcmp(args[1], "hosts") != 0) {
+			printf("Invalid input. Available stats: hosts\n");
+			exit(-1);
+		}
+		result.input_mode = IM_STATS_HOSTS;
 	}
 	
 	return result;
@@ -333,9 +1401,36 @@ ParseTagInput(char* args[], int argc)
 	} else if (strcmp(args[0], "remove") == 0) {
 		result.input_mode = IM_TAG_REMOVE;
 		result.word_buffers[WI_MOD] = args[1];
+	} else if (strcmp(args[0], "merge") == 0) {
+		if (argc != 3) {
+			printf("Invalid input. Usage: sbm tag merge <src> <dst>\n");
+			exit(-1);
+		}
+		result.input_mode = IM_TAG_MERGE;
+		result.word_buffers[WI_MOD] = args[1];
+		result.word_buffers[WI_TAG] = args[2];
+	} else if (strcmp(args[0], "alias") == 0) {
+		if (argc != 3) {
+			printf("Invalid input. Usage: sbm tag alias <alias> <tag>\n");
+			exit(-1);
+		}
+		result.input_mode = IM_TAG_ALIAS;
+		result.word_buffers[WI_MOD] = args[1];
+		result.word_buffers[WI_TAG] = args[2];
+	} else if (strcmp(args[0], "unalias") == 0) {
+		result.input_mode = IM_TAG_ALIAS;
+		result.word_buffers[WI_MOD] = args[1];
 	} else if (strcmp(args[0], "list") == 0) {
 		result.input_mode = IM_TAG_LIST;
 		result.word_buffers[WI_MOD] = args[1];
+	} else if (strcmp(args[0], "--host") == 0) {
+		if (argc != 3) {
+			printf("Tagging by host requires a host and a tag.\n");
+			exit(-1);
+		}
+		result.input_mode = IM_TAG_ADD_TO_ENTRY;
+		result.word_buffers[WI_HOST] = args[1];
+		result.word_buffers[WI_TAG]  = args[2];
 	} else {
 		result.input_mode = IM_TAG_ADD_TO_ENTRY;
 		result.word_buffers[WI_MOD] = args[0];
@@ -345,98 +1440,207 @@ ParseTagInput(char* args[], int argc)
 	return result;
 }
 
-static Core
-ReadJSON(void)
+static void
+DecodeDOMRow(struct json_object_element_s* item, Row* o_row)
 {
-	Core result;
+	Row row;
+	int len;
+	int j;
+	struct json_string_s* value;
+	struct json_array_element_s* arrayItem;
 	
-	char* contents = NULL;
-	size_t contentsSize = 0;
-	struct json_value_s* root;
-	struct json_object_element_s* tagsHandle, *rowsHandle;
-	Tags tags   = { 0 };
-	Table table = { 0 };
-	int rowUID = 0;
+	memset(&row, 0, sizeof(Row));
+	row.id = atoi(item->name->string);
 	
 	{
-		FILE* jsonFile = NULL;
-		char filename[512] = { 0 };
-		DIR* dir;
+		struct json_value_s* itemValue;
+		struct json_array_s* arrayEntry;
 		
-		GetConfigPath(filename);
-		if ((dir = opendir(filename))) {
-			closedir(dir);
+		itemValue = item->value;
+		assert(itemValue);
+		arrayEntry = itemValue->payload;
+		assert(arrayEntry);
+		
+		arrayItem = arrayEntry->start;
+		assert(arrayItem);
+	}
+	{
+		assert(arrayItem->value->type == json_type_string);
+		assert((value = json_value_as_string(arrayItem->value)));
+		
+		len = strlen(value->string);
+		if (len > S_ADDR_S - 1) {
+			row.url.long_url = true;
+			row.url.address.l = malloc(sizeof(char) * (len + 1));
+			strncpy(row.url.address.l, value->string, len);
+			row.url.address.l[len] = '\0';
 		} else {
-			if (mkdir(filename, 0777) < 0) {
-				fprintf(stderr, "Could not create directory '%s'.\n", filename);
-				exit(-1);
-			}
+			strncpy(row.url.address.s, value->string,
+			        Min(len, S_ADDR_S - 1));
+			row.url.address.s[len] = '\0';
 		}
-		strcat(filename, cache_filename);
 		
-		jsonFile = fopen(filename, "rb");
+		arrayItem = arrayItem->next;
+		assert(arrayItem);
+	}
+	{
+		assert(arrayItem->value->type == json_type_string);
+		assert((value = json_value_as_string(arrayItem->value)));
 		
-		if (!jsonFile) {
-			char confirmation;
-			printf("Could not find '%s'.\nWould you like to create a new config " \
-			       "file? [Y/n] ", filename);
-			scanf("%c", &confirmation);
-			if (!(confirmation == 'y' || confirmation == 'Y')) {
-				exit(0);
-			}
-			
-			memset(&result, 0, sizeof(Core));
-			result.table.next_UID = 1;
-			result.table.rows = malloc(sizeof(Row));
-			memset(result.table.rows, 0, sizeof(Row));
-			result.tags.next_UID = 1;
-			result.tags.tags = malloc(sizeof(Tag));
-			memset(result.tags.tags, 0, sizeof(Tag));
-			
-			WriteJSON(&result);
-			printf("Config created. You may need to reperform your last command.\n");
-			exit(0);
-		}
+		row.truncated |= strlen(value->string) > TITLE_S - 1;
+		len = Min(TITLE_S - 1, strlen(value->string));
+		strncpy(row.title, value->string, Min(len, TITLE_S - 1));
 		
-		{
-			fseek(jsonFile, 0, SEEK_END);
-			contentsSize = ftell(jsonFile);
-			fseek(jsonFile, 0, SEEK_SET);
-			
-			contents = malloc(sizeof(char) * contentsSize + 1);
-			memset(contents, 0, sizeof(char) * contentsSize + 1);
-			
-			fread(contents, contentsSize, 1, jsonFile);
-		}
-		fclose(jsonFile);
+		arrayItem = arrayItem->next;
 	}
-	
 	{
-		struct json_object_s* obj;
+		assert(arrayItem->value->type == json_type_string);
+		assert((value = json_value_as_string(arrayItem->value)));
 		
-		root = json_parse(contents, contentsSize);
-		free(contents);
-		assert(root);
-		assert(root->type == json_type_object);
+		row.truncated |= strlen(value->string) > COMMENT_S - 1;
+		len = Min(COMMENT_S - 1, strlen(value->string));
+		strncpy(row.comment, value->string, Min(len, COMMENT_S - 1));
 		
-		obj = (struct json_object_s*) root->payload;
-		assert(obj->length == 2);
+		arrayItem = arrayItem->next;
+	}
+	{
+		assert(arrayItem->value->type == json_type_string);
+		assert((value = json_value_as_string(arrayItem->value)));
+		
+		assert(strlen(value->string) < 20);
+		len = Min(19, strlen(value->string));
+		strncpy(row.datetime.last_updated, value->string, Min(len, 19));
+		if (sscanf(row.datetime.last_updated,
+		           "%d-%d-%d %d:%d:%d",
+		           &row.datetime.d_y, &row.datetime.d_m, &row.datetime.d_d,
+		           &row.datetime.t_h, &row.datetime.t_m, &row.datetime.t_s)
+		     < 1) {
+			printf("Could not parse date and time\n");
+		}
 		
-		tagsHandle = obj->start;
+		arrayItem = arrayItem->next;
 	}
-	
-	assert(strcmp(tagsHandle->name->string, "tags") == 0);
-	
 	{
-		int i = 0;
-		struct json_object_element_s* item;
-		struct json_object_s* entry;
+		struct json_array_s* tagArray;
+		struct json_array_element_s* tagItem;
 		
-		entry = (struct json_object_s*) tagsHandle->value->payload;
-		assert(entry);
+		assert(arrayItem->value->type == json_type_array);
+		assert((tagArray = json_value_as_array(arrayItem->value)));
+		assert((tagItem = tagArray->start));
+		j = 0;
 		
-		item = entry->start;
-		/* Allocate one extra. If the user uses the 'tag add' command, it will
+		while (tagItem != NULL && j < ROW_TAG_C) {
+			assert((value = json_value_as_string(tagItem->value)));
+			row.tag_ids[j] = atoi(value->string);
+			tagItem = tagItem->next;
+			j++;
+		}
+	}
+	
+	*o_row = row;
+}
+
+static void
+DecodeDOMRows(void* ctx, unsigned int begin, unsigned int end)
+{
+	DOMRowsJob* job = ctx;
+	unsigned int i;
+	
+	for (i = begin; i < end; ++i) {
+		DecodeDOMRow(job->items[i], &job->rows[i]);
+	}
+}
+
+static void
+SetMetaValue(Meta* io_m, const char* name, const char* value)
+{
+	if (strcmp(name, "generation") == 0) {
+		io_m->generation = strtoul(value, NULL, 10);
+	} else if (strcmp(name, "rows_next") == 0) {
+		io_m->rows_next = strtoul(value, NULL, 10);
+	} else if (strcmp(name, "tags_next") == 0) {
+		io_m->tags_next = strtoul(value, NULL, 10);
+	}
+}
+
+/* Loads the store through json.h's DOM. */
+static void
+LoadDOM(char* contents, size_t contentsSize,
+        Tags* o_tags, Table* o_table, Meta* o_meta)
+{
+	struct json_value_s* root;
+	struct json_object_element_s* tagsHandle;
+	/* The "rows" object of every block, or the single top-level one of
+	 * stores written before blocks */
+	struct json_object_s** rowObjects = NULL;
+	unsigned int rowObjectC = 0;
+	Tags tags   = { 0 };
+	Table table = { 0 };
+	
+	{
+		struct json_object_s* obj;
+		struct json_object_element_s* handle;
+		
+		root = json_parse(contents, contentsSize);
+		assert(root);
+		assert(root->type == json_type_object);
+		
+		obj = (struct json_object_s*) root->payload;
+		tagsHandle = NULL;
+		for (handle = obj->start; handle != NULL; handle = handle->next) {
+			if (strcmp(handle->name->string, "tags") == 0) {
+				tagsHandle = handle;
+			} else if (strcmp(handle->name->string, "rows") == 0) {
+				rowObjects = realloc(rowObjects, sizeof(*rowObjects) *
+				                                 (rowObjectC + 1));
+				assert((rowObjects[rowObjectC++] =
+				        json_value_as_object(handle->value)));
+			} else if (strcmp(handle->name->string, "blocks") == 0) {
+				struct json_array_s* blocks;
+				struct json_array_element_s* block;
+				
+				assert((blocks = json_value_as_array(handle->value)));
+				rowObjects = realloc(rowObjects, sizeof(*rowObjects) *
+				                                 (rowObjectC + blocks->length));
+				for (block = blocks->start; block != NULL; block = block->next) {
+					struct json_object_s* blockObj;
+					struct json_object_element_s* item;
+					
+					assert((blockObj = json_value_as_object(block->value)));
+					for (item = blockObj->start; item != NULL; item = item->next) {
+						if (strcmp(item->name->string, "rows") == 0) {
+							assert((rowObjects[rowObjectC++] =
+							        json_value_as_object(item->value)));
+							break;
+						}
+					}
+				}
+			} else if (strcmp(handle->name->string, "meta") == 0) {
+				struct json_object_s* meta;
+				struct json_object_element_s* item;
+				
+				assert((meta = json_value_as_object(handle->value)));
+				for (item = meta->start; item != NULL; item = item->next) {
+					struct json_string_s* value;
+					
+					assert((value = json_value_as_string(item->value)));
+					SetMetaValue(o_meta, item->name->string, value->string);
+				}
+			}
+		}
+		assert(tagsHandle && rowObjects);
+	}
+	
+	{
+		int i = 0;
+		struct json_object_element_s* item;
+		struct json_object_s* entry;
+		
+		entry = (struct json_object_s*) tagsHandle->value->payload;
+		assert(entry);
+		
+		item = entry->start;
+		/* Allocate one extra. If the user uses the 'tag add' command, it will
 		   save time by not having to realloc. */
 		tags.tags = malloc(sizeof(Tag) * ((tags.count = entry->length) + 1));
 		memset(tags.tags, 0, sizeof(Tag) * tags.count + 1);
@@ -447,7 +1651,6 @@ ReadJSON(void)
 			
 			value = item->value->payload;
 			tags.tags[i].id = atoi(item->name->string);
-			tags.next_UID = Max(tags.tags[i].id, tags.next_UID);
 			len = Min(strlen(value->string), TAG_NAME_S - 1);
 			strncpy(tags.tags[i].name, value->string, len);
 			
@@ -456,216 +1659,853 @@ ReadJSON(void)
 		}
 	}
 	
-	rowsHandle = tagsHandle->next;
-	assert(strcmp(rowsHandle->name->string, "rows") == 0);
-	
 	{
-		int i = 0;
-		struct json_object_s* entry;
+		unsigned int i, j;
 		struct json_object_element_s* item;
+		DOMRowsJob job;
 		
-		entry = rowsHandle->value->payload;
-		assert(entry);
-		
-		item = entry->start;
+		for (j = 0; j < rowObjectC; ++j) {
+			table.count += rowObjects[j]->length;
+		}
 		/* Allocate one extra. If the user uses the 'add' command, it will
 		   save time by not having to realloc. */
-		table.rows = malloc(sizeof(Row) * ((table.count = entry->length) + 1));
+		table.rows = malloc(sizeof(Row) * (table.count + 1));
 		memset(table.rows, 0, sizeof(Row) * table.count + 1);
 		
-		while (item != NULL) {
-			Row row;
-			int len; 
-			int j;
-			struct json_string_s* value;
-			struct json_array_element_s* arrayItem;
-			
-			memset(&row, 0, sizeof(Row));
-			row.id = atoi(item->name->string);
-			rowUID = Max(row.id, rowUID);
-			
-			{
-				struct json_value_s* itemValue;
-				struct json_array_s* arrayEntry;
-				
-				itemValue = item->value;
-				assert(itemValue);
-				arrayEntry = itemValue->payload;
-				assert(arrayEntry);
-				
-				arrayItem = arrayEntry->start;
-				assert(arrayItem);
-			}
-			{
-				assert(arrayItem->value->type == json_type_string);
-				assert((value = json_value_as_string(arrayItem->value)));
-				
-				len = strlen(value->string);
-				if (len > S_ADDR_S - 1) {
-					row.url.long_url = true;
-					row.url.address.l = malloc(sizeof(char) * (len + 1));
-					strncpy(row.url.address.l, value->string, len);
-					row.url.address.l[len] = '\0';
-				} else {
-					strncpy(row.url.address.s, value->string,
-					        Min(len, S_ADDR_S - 1));
-					row.url.address.s[len] = '\0';
-				}
-				
-				arrayItem = arrayItem->next;
-				assert(arrayItem);
-			}
-			{
-				assert(arrayItem->value->type == json_type_string);
-				assert((value = json_value_as_string(arrayItem->value)));
-				
-				len = Min(TITLE_S - 1, strlen(value->string));
-				strncpy(row.title, value->string, Min(len, TITLE_S - 1));
-				
-				arrayItem = arrayItem->next;
-			}
-			{
-				assert(arrayItem->value->type == json_type_string);
-				assert((value = json_value_as_string(arrayItem->value)));
-				
-				len = Min(COMMENT_S - 1, strlen(value->string));
-				strncpy(row.comment, value->string, Min(len, COMMENT_S - 1));
-				
-				arrayItem = arrayItem->next;
+		/* Walking json.h's linked list is cheap; decoding is not. Gather the
+		 * elements so that the rows can be decoded in parallel. */
+		job.items = malloc(sizeof(struct json_object_element_s*) *
+		                   (table.count + 1));
+		for (i = 0, j = 0; j < rowObjectC; ++j) {
+			for (item = rowObjects[j]->start; item != NULL; item = item->next) {
+				job.items[i++] = item;
 			}
-			{
-				assert(arrayItem->value->type == json_type_string);
-				assert((value = json_value_as_string(arrayItem->value)));
-				
-				assert(strlen(value->string) < 20);
-				len = Min(19, strlen(value->string));
-				strncpy(row.datetime.last_updated, value->string, Min(len, 19));
-				if (sscanf(row.datetime.last_updated,
-				           "%d-%d-%d %d:%d:%d",
-				           &row.datetime.d_y, &row.datetime.d_m, &row.datetime.d_d,
-				           &row.datetime.t_h, &row.datetime.t_m, &row.datetime.t_s)
-				     < 1) {
-					printf("Could not parse date and time\n");
-				}
-				
-				arrayItem = arrayItem->next;
+		}
+		job.rows = table.rows;
+		RunParallel(table.count, 4096, DecodeDOMRows, &job);
+		free(job.items);
+		free(rowObjects);
+	}
+	
+	free(root);
+	
+	*o_tags  = tags;
+	*o_table = table;
+}
+
+/* Builds the structural index of a store, 64 bytes at a time. Quotes,
+ * backslashes and separators are found with SSE2 compares; escaped quotes are
+ * removed by walking the (rare) backslashes, and whether each byte is inside a
+ * string is the prefix-XOR of the remaining quotes. */
+static void
+BuildStructIndex(const char* text, size_t size, StructIndex* o_index)
+{
+	uint64_t inString = 0, escapeCarry = 0;
+	size_t w;
+	
+	o_index->text   = text;
+	o_index->size   = size;
+	o_index->word_c = (size + 63) / 64;
+	o_index->bits   = malloc(sizeof(uint64_t) * (o_index->word_c + 1));
+	
+	for (w = 0; w < o_index->word_c; ++w) {
+		const char* chunk = &text[w * 64];
+		char padded[64];
+		uint64_t quotes = 0, slashes = 0, separators = 0;
+		uint64_t escaped, inside, b;
+		unsigned int k;
+		
+		if (size - w * 64 < 64) {
+			memset(padded, ' ', sizeof(padded));
+			memcpy(padded, chunk, size - w * 64);
+			chunk = padded;
+		}
+		
+#ifdef __SSE2__
+		for (k = 0; k < 4; ++k) {
+			__m128i v, lower;
+			
+			v = _mm_loadu_si128((const __m128i*) &chunk[k * 16]);
+			/* '{' and '[' (and '}' and ']') differ only by 0x20 */
+			lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+			quotes  |= (uint64_t) (unsigned int) _mm_movemask_epi8(
+				_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << (k * 16);
+			slashes |= (uint64_t) (unsigned int) _mm_movemask_epi8(
+				_mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))) << (k * 16);
+			separators |= (uint64_t) (unsigned int) _mm_movemask_epi8(
+				_mm_or_si128(
+					_mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('{')),
+					             _mm_cmpeq_epi8(lower, _mm_set1_epi8('}'))),
+					_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')),
+					             _mm_cmpeq_epi8(v, _mm_set1_epi8(','))))) <<
+				(k * 16);
+		}
+#else
+		for (k = 0; k < 64; ++k) {
+			switch (chunk[k]) {
+				case '"':  quotes  |= (uint64_t) 1 << k; break;
+				case '\\': slashes |= (uint64_t) 1 << k; break;
+				case '{': case '}': case '[': case ']': case ':': case ',':
+					separators |= (uint64_t) 1 << k;
+					break;
 			}
-			{
-				struct json_array_s* tagArray;
-				struct json_array_element_s* tagItem;
-				
-				assert(arrayItem->value->type == json_type_array);
-				assert((tagArray = json_value_as_array(arrayItem->value)));
-				assert((tagItem = tagArray->start));
-				j = 0;
-				
-				while (tagItem != NULL) {
-					assert((value = json_value_as_string(tagItem->value)));
-					row.tag_ids[j] = atoi(value->string);
-					tagItem = tagItem->next;
-					j++;
-				}
+		}
+#endif
+		
+		escaped = escapeCarry;
+		escapeCarry = 0;
+		for (b = slashes; b != 0; b &= b - 1) {
+			uint64_t bit = b & -b;
+			if (escaped & bit) continue;
+			if (bit == (uint64_t) 1 << 63) {
+				escapeCarry = 1;
+			} else {
+				escaped |= bit << 1;
 			}
-			
-			table.rows[i] = row;
-			i++;
-			item = item->next;
 		}
+		quotes &= ~escaped;
 		
+		inside = quotes;
+		inside ^= inside << 1;
+		inside ^= inside << 2;
+		inside ^= inside << 4;
+		inside ^= inside << 8;
+		inside ^= inside << 16;
+		inside ^= inside << 32;
+		inside ^= inString;
+		inString = (inside >> 63) ? ~(uint64_t) 0 : 0;
+		
+		o_index->bits[w] = quotes | (separators & ~inside);
 	}
+}
+
+static size_t
+NextStructural(StructIndex* idx, size_t from)
+{
+	size_t w = from >> 6;
+	uint64_t m;
 	
-	free(root);
+	if (w >= idx->word_c) {
+		return idx->size;
+	}
+	m = idx->bits[w] & (~(uint64_t) 0 << (from & 63));
+	while (m == 0) {
+		if (++w >= idx->word_c) {
+			return idx->size;
+		}
+		m = idx->bits[w];
+	}
+	
+	return (w << 6) + __builtin_ctzll(m);
+}
+
+static int
+StructExpect(StructIndex* idx, size_t* io_pos, char c)
+{
+	if (*io_pos >= idx->size || idx->text[*io_pos] != c) {
+		return false;
+	}
+	*io_pos = NextStructural(idx, *io_pos + 1);
+	return true;
+}
+
+/* Yields the raw (still escaped) contents of the string at io_pos. */
+static int
+StructString(StructIndex* idx, size_t* io_pos, const char** o_s, size_t* o_l)
+{
+	size_t end;
 	
-	result.table = table;
-	result.tags = tags;
-	result.tags.next_UID += 1;
-	result.table.next_UID = rowUID + 1;
+	if (*io_pos >= idx->size || idx->text[*io_pos] != '"') {
+		return false;
+	}
+	end = NextStructural(idx, *io_pos + 1);
+	if (end >= idx->size || idx->text[end] != '"') {
+		return false;
+	}
+	*o_s = &idx->text[*io_pos + 1];
+	*o_l = end - *io_pos - 1;
+	*io_pos = NextStructural(idx, end + 1);
 	
-	return result;
+	return true;
 }
 
 static int
-WriteJSON(Core* c)
+StructSkipValue(StructIndex* idx, size_t* io_pos)
 {
-	char LARGE_BUFFER[10000];
-	int i, j;
+	const char* s;
+	size_t l;
+	int depth;
 	
-	memset(LARGE_BUFFER, 0, sizeof(LARGE_BUFFER));
+	if (*io_pos >= idx->size) {
+		return false;
+	}
+	if (idx->text[*io_pos] == '"') {
+		return StructString(idx, io_pos, &s, &l);
+	}
+	if (idx->text[*io_pos] != '{' && idx->text[*io_pos] != '[') {
+		return false;
+	}
 	
-	strcpy(LARGE_BUFFER, "{\n\t\"tags\":{\n");
-	for (i = 0; i < c->tags.count; ++i) {
-		if (c->tags.tags[i].id == 0) continue;
-		sprintf(&LARGE_BUFFER[strlen(LARGE_BUFFER)],
-				"\t\t\"%d\": \"%s\"",
-				c->tags.tags[i].id, c->tags.tags[i].name);
-		if (i != c->tags.count - 1) {
-			strcat(&LARGE_BUFFER[strlen(LARGE_BUFFER)], ",\n");
-		} else {
-			strcat(&LARGE_BUFFER[strlen(LARGE_BUFFER)], "\n");
+	*io_pos = NextStructural(idx, *io_pos + 1);
+	for (depth = 1; depth > 0; ) {
+		if (*io_pos >= idx->size) {
+			return false;
+		}
+		switch (idx->text[*io_pos]) {
+			case '"':
+				if (!StructString(idx, io_pos, &s, &l)) return false;
+				continue;
+			case '{': case '[': depth++; break;
+			case '}': case ']': depth--; break;
 		}
+		*io_pos = NextStructural(idx, *io_pos + 1);
 	}
-	strcpy(&LARGE_BUFFER[strlen(LARGE_BUFFER)], "\t},\n\t\"rows\":{\n");
-	for (i = 0; i < c->table.count; ++i) {
-		Row* curr;
-		char* url;
-		
-		curr = &c->table.rows[i];
-		if (curr->id == 0) continue;
+	
+	return true;
+}
+
+static unsigned int
+StructUInt(const char* s, size_t l)
+{
+	unsigned int result = 0;
+	
+	while (l-- > 0 && isdigit((unsigned char) *s)) {
+		result = result * 10 + (*s++ - '0');
+	}
+	return result;
+}
+
+/* Records where each row of the "rows" object at io_pos starts, leaving io_pos
+ * after the object. */
+static int
+StructRowStarts(StructIndex* idx, size_t* io_pos, size_t** io_starts,
+                unsigned int* io_c, unsigned int* io_capacity)
+{
+	const char* s;
+	size_t l;
+	
+	if (!StructExpect(idx, io_pos, '{')) return false;
+	while (*io_pos < idx->size && idx->text[*io_pos] == '"') {
+		if (*io_c == *io_capacity) {
+			*io_capacity = Max(1024, *io_capacity * 2);
+			*io_starts = realloc(*io_starts, sizeof(size_t) * *io_capacity);
+		}
+		(*io_starts)[(*io_c)++] = *io_pos;
+		if (!StructString(idx, io_pos, &s, &l) ||
+		    !StructExpect(idx, io_pos, ':') ||
+		    !StructSkipValue(idx, io_pos)) return false;
+		if (!StructExpect(idx, io_pos, ',')) break;
+	}
+	return StructExpect(idx, io_pos, '}');
+}
+
+static int
+DecodeStructRow(StructIndex* idx, size_t pos, Row* o_row)
+{
+	const char* s;
+	size_t l;
+	unsigned int j;
+	
+	memset(o_row, 0, sizeof(Row));
+	if (!StructString(idx, &pos, &s, &l)) return false;
+	o_row->id = StructUInt(s, l);
+	if (!StructExpect(idx, &pos, ':') || !StructExpect(idx, &pos, '[')) {
+		return false;
+	}
+	
+	if (!StructString(idx, &pos, &s, &l)) return false;
+	if (l > S_ADDR_S - 1) {
+		char* url = malloc(l + 1);
 		
-		if (curr->url.long_url == true) {
-			url = curr->url.address.l;
+		if (JSONUnescape(s, l, url, l + 1) > S_ADDR_S - 1) {
+			o_row->url.long_url = true;
+			o_row->url.address.l = url;
 		} else {
-			url = curr->url.address.s;
+			strcpy(o_row->url.address.s, url);
+			free(url);
 		}
-		
-		sprintf(&LARGE_BUFFER[strlen(LARGE_BUFFER)],
-		        "\t\t\"%d\": [\"%s\", \"%s\", \"%s\", \"%s\", [",
-		        curr->id, url, curr->title, curr->comment,
-		        curr->datetime.last_updated);
-		for (j = 0; j < ROW_TAG_C; ++j) {
-			sprintf(&LARGE_BUFFER[strlen(LARGE_BUFFER)], "\"%d\"", curr->tag_ids[j]);
-			if (j != ROW_TAG_C - 1) {
-				strcat(&LARGE_BUFFER[strlen(LARGE_BUFFER)], ", ");
+	} else {
+		JSONUnescape(s, l, o_row->url.address.s, S_ADDR_S);
+	}
+	
+	if (!StructExpect(idx, &pos, ',') || !StructString(idx, &pos, &s, &l)) {
+		return false;
+	}
+	o_row->truncated |= JSONUnescape(s, l, o_row->title, TITLE_S) > TITLE_S - 1;
+	if (!StructExpect(idx, &pos, ',') || !StructString(idx, &pos, &s, &l)) {
+		return false;
+	}
+	o_row->truncated |=
+		JSONUnescape(s, l, o_row->comment, COMMENT_S) > COMMENT_S - 1;
+	if (!StructExpect(idx, &pos, ',') || !StructString(idx, &pos, &s, &l)) {
+		return false;
+	}
+	JSONUnescape(s, l, o_row->datetime.last_updated, 20);
+	if (sscanf(o_row->datetime.last_updated,
+	           "%d-%d-%d %d:%d:%d",
+	           &o_row->datetime.d_y, &o_row->datetime.d_m,
+	           &o_row->datetime.d_d, &o_row->datetime.t_h,
+	           &o_row->datetime.t_m, &o_row->datetime.t_s) < 1) {
+		printf("Could not parse date and time\n");
+	}
+	
+	if (!StructExpect(idx, &pos, ',') || !StructExpect(idx, &pos, '[')) {
+		return false;
+	}
+	for (j = 0; pos < idx->size && idx->text[pos] == '"'; ) {
+		if (!StructString(idx, &pos, &s, &l)) return false;
+		if (j < ROW_TAG_C) {
+			o_row->tag_ids[j++] = StructUInt(s, l);
+		}
+		if (!StructExpect(idx, &pos, ',')) break;
+	}
+	
+	return StructExpect(idx, &pos, ']') && StructExpect(idx, &pos, ']');
+}
+
+static void
+DecodeStructRows(void* ctx, unsigned int begin, unsigned int end)
+{
+	StructRowsJob* job = ctx;
+	unsigned int i;
+	
+	for (i = begin; i < end; ++i) {
+		if (!DecodeStructRow(job->index, job->row_starts[i], &job->rows[i])) {
+			pthread_mutex_lock(&job->lock);
+			if (job->failed == false || job->row_starts[i] < job->error_at) {
+				job->error_at = job->row_starts[i];
 			}
+			job->failed = true;
+			pthread_mutex_unlock(&job->lock);
+			return;
 		}
+	}
+}
+
+/* Loads the store from its structural index instead of a DOM. The rows object
+ * is split into rows with one cheap sequential walk over the index, after
+ * which the rows are decoded in parallel straight into the table. */
+static void
+LoadStructural(char* contents, size_t contentsSize,
+               Tags* o_tags, Table* o_table, Meta* o_meta)
+{
+	StructIndex idx;
+	Tags tags   = { 0 };
+	Table table = { 0 };
+	size_t pos, errorAt;
+	size_t* rowStarts = NULL;
+	unsigned int rowStartC = 0, rowStartCapacity = 0, tagCapacity = 0;
+	const char* s;
+	size_t l;
+	
+	BuildStructIndex(contents, contentsSize, &idx);
+	
+	pos = NextStructural(&idx, 0);
+	errorAt = pos;
+	if (!StructExpect(&idx, &pos, '{')) goto fail;
+	while (pos < idx.size && idx.text[pos] == '"') {
+		errorAt = pos;
+		if (!StructString(&idx, &pos, &s, &l) ||
+		    !StructExpect(&idx, &pos, ':')) goto fail;
 		
-		if ((i != c->table.count - 1) &&
-		   !(i == c->table.count - 2 && c->table.rows[i + 1].id == 0)) {
-			strcat(&LARGE_BUFFER[strlen(LARGE_BUFFER)], "]],\n");
-		} else {
-			strcat(&LARGE_BUFFER[strlen(LARGE_BUFFER)], "]]\n");
+		if (l == 4 && memcmp(s, "tags", 4) == 0) {
+			if (!StructExpect(&idx, &pos, '{')) goto fail;
+			while (pos < idx.size && idx.text[pos] == '"') {
+				Tag* tag;
+				
+				if (tags.count + 1 >= tagCapacity) {
+					tagCapacity = Max(16, tagCapacity * 2);
+					tags.tags = realloc(tags.tags, sizeof(Tag) * tagCapacity);
+				}
+				tag = &tags.tags[tags.count++];
+				memset(tag, 0, sizeof(Tag));
+				errorAt = pos;
+				if (!StructString(&idx, &pos, &s, &l)) goto fail;
+				tag->id = StructUInt(s, l);
+				if (!StructExpect(&idx, &pos, ':') ||
+				    !StructString(&idx, &pos, &s, &l)) goto fail;
+				JSONUnescape(s, l, tag->name, TAG_NAME_S);
+				if (!StructExpect(&idx, &pos, ',')) break;
+			}
+			if (!StructExpect(&idx, &pos, '}')) goto fail;
+		} else if (l == 4 && memcmp(s, "rows", 4) == 0) {
+			errorAt = pos;
+			if (!StructRowStarts(&idx, &pos, &rowStarts, &rowStartC,
+			                     &rowStartCapacity)) goto fail;
+		} else if (l == 6 && memcmp(s, "blocks", 6) == 0) {
+			if (!StructExpect(&idx, &pos, '[')) goto fail;
+			while (pos < idx.size && idx.text[pos] == '{') {
+				errorAt = pos;
+				if (!StructExpect(&idx, &pos, '{')) goto fail;
+				while (pos < idx.size && idx.text[pos] == '"') {
+					if (!StructString(&idx, &pos, &s, &l) ||
+					    !StructExpect(&idx, &pos, ':')) goto fail;
+					errorAt = pos;
+					if (l == 4 && memcmp(s, "rows", 4) == 0) {
+						if (!StructRowStarts(&idx, &pos, &rowStarts, &rowStartC,
+						                     &rowStartCapacity)) goto fail;
+					} else if (!StructSkipValue(&idx, &pos)) {
+						goto fail;
+					}
+					if (!StructExpect(&idx, &pos, ',')) break;
+				}
+				if (!StructExpect(&idx, &pos, '}')) goto fail;
+				if (!StructExpect(&idx, &pos, ',')) break;
+			}
+			if (!StructExpect(&idx, &pos, ']')) goto fail;
+		} else if (l == 4 && memcmp(s, "meta", 4) == 0) {
+			if (!StructExpect(&idx, &pos, '{')) goto fail;
+			while (pos < idx.size && idx.text[pos] == '"') {
+				char name[32], value[32];
+				
+				errorAt = pos;
+				if (!StructString(&idx, &pos, &s, &l)) goto fail;
+				JSONUnescape(s, l, name, sizeof(name));
+				if (!StructExpect(&idx, &pos, ':') ||
+				    !StructString(&idx, &pos, &s, &l)) goto fail;
+				JSONUnescape(s, l, value, sizeof(value));
+				SetMetaValue(o_meta, name, value);
+				if (!StructExpect(&idx, &pos, ',')) break;
+			}
+			if (!StructExpect(&idx, &pos, '}')) goto fail;
+		} else if (!StructSkipValue(&idx, &pos)) {
+			goto fail;
 		}
+		
+		if (!StructExpect(&idx, &pos, ',')) break;
+	}
+	errorAt = pos;
+	if (!StructExpect(&idx, &pos, '}')) goto fail;
+	
+	/* Allocate one extra, as the other loader does. */
+	if (tags.tags == NULL) {
+		tags.tags = malloc(sizeof(Tag));
 	}
-	strcat(&LARGE_BUFFER[strlen(LARGE_BUFFER)], "\t}\n}\n");
+	memset(&tags.tags[tags.count], 0, sizeof(Tag));
+	table.count = rowStartC;
+	table.rows = malloc(sizeof(Row) * (table.count + 1));
+	memset(&table.rows[table.count], 0, sizeof(Row));
 	
 	{
-		FILE* fp;
-		char filename[512] = { 0 };
+		StructRowsJob job;
 		
-		GetConfigPath(filename);
-		strcat(filename, cache_filename);
-		fp = fopen(filename, "w");
-		if (fp == NULL) {
-			return -1;
-		}
-		if ((fwrite(LARGE_BUFFER, strlen(LARGE_BUFFER), 1, fp) < 1)) {
-			fclose(fp);
-			return -1;
+		job.index      = &idx;
+		job.row_starts = rowStarts;
+		job.rows       = table.rows;
+		job.failed     = false;
+		job.error_at   = 0;
+		pthread_mutex_init(&job.lock, NULL);
+		RunParallel(table.count, 4096, DecodeStructRows, &job);
+		pthread_mutex_destroy(&job.lock);
+		
+		if (job.failed == true) {
+			errorAt = job.error_at;
+			goto fail;
 		}
-		fclose(fp);
 	}
 	
-	return 1;
+	free(rowStarts);
+	free(idx.bits);
+	*o_tags  = tags;
+	*o_table = table;
+	return;
+	
+fail:
+	fprintf(stderr, "Could not parse the store near byte %lu.\n",
+	        (unsigned long) errorAt);
+	exit(-1);
 }
 
 static void
-ProcessCommand(Core* io_c, InputArgs* ia)
+VerifyBlocksRange(void* ctx, unsigned int begin, unsigned int end)
 {
-	switch (ia->input_mode) {
-		case IM_INVALID:
-			{
-				printf("Invalid input\n");
-				exit(-1);
+	VerifyBlocksJob* job = ctx;
+	unsigned int i;
+	
+	for (i = begin; i < end; ++i) {
+		StoreBlock* b = &job->blocks[i];
+		
+		b->ok = b->framed == true &&
+		        CRC32C(0, &job->text[b->body], b->footer - b->body) == b->crc;
+	}
+}
+
+/* Parses a block header line, "\t\t{"crc": "xxxxxxxx", "rows":{", at s. */
+static int
+ParseBlockHeader(const char* s, const char* lineEnd, uint32_t* o_crc)
+{
+	static const char head[] = "\t\t{\"crc\": \"", tail[] = "\", \"rows\":{";
+	const size_t headL = sizeof(head) - 1, tailL = sizeof(tail) - 1;
+	uint32_t crc = 0;
+	int i;
+	
+	if (lineEnd - s != headL + 8 + tailL || memcmp(s, head, headL) != 0 ||
+	    memcmp(s + headL + 8, tail, tailL) != 0) {
+		return false;
+	}
+	for (i = 0; i < 8; ++i) {
+		char c = s[headL + i];
+		
+		if (!isxdigit((unsigned char) c)) return false;
+		crc = (crc << 4) | (isdigit((unsigned char) c) ? c - '0'
+		                                                : (c | 0x20) - 'a' + 10);
+	}
+	*o_crc = crc;
+	return true;
+}
+
+/* Checks the checksum of every block of rows in parallel. Blocks which fail,
+ * and any text between blocks which is not a block at all, are cut out and
+ * kept in io_c->quarantine, so one damaged block costs its own rows rather
+ * than the whole store. Stores written before blocks are returned as they
+ * are. Returns contents, or a new buffer without the damaged blocks. */
+static char*
+VerifyBlocks(char* contents, size_t* io_size, Core* io_c)
+{
+	static const char marker[] = "\n\t\"blocks\":[\n";
+	StoreBlock* blocks = NULL;
+	unsigned int blockC = 0, blockCapacity = 0, i;
+	char* p, *end, *lineEnd, *suffix = NULL;
+	StoreBlock* open = NULL;
+	
+	if ((p = strstr(contents, marker)) == NULL) {
+		return contents;
+	}
+	p += sizeof(marker) - 1;
+	end = contents + *io_size;
+	
+	/* One walk over the lines frames the blocks. Newlines only appear
+	 * between values, as strings are always written escaped. */
+	for (; p < end; p = lineEnd + 1) {
+		uint32_t crc;
+		
+		if ((lineEnd = memchr(p, '\n', end - p)) == NULL) {
+			lineEnd = end;
+		}
+		if (ParseBlockHeader(p, lineEnd, &crc)) {
+			if (open != NULL) {
+				/* The previous block lost its footer */
+				open->footer = open->end = p - contents - 1;
+				open->framed = false;
+			}
+			if (blockC == blockCapacity) {
+				blockCapacity = Max(64, blockCapacity * 2);
+				blocks = realloc(blocks, sizeof(StoreBlock) * blockCapacity);
+			}
+			open = &blocks[blockC++];
+			open->start  = p - contents + 2;
+			open->body   = lineEnd + 1 - contents;
+			open->crc    = crc;
+			open->framed = true;
+		} else if (lineEnd - p >= 4 && memcmp(p, "\t\t}}", 4) == 0 &&
+		           open != NULL && open->framed == true) {
+			open->footer = p - contents + 2;
+			open->end    = open->footer + 2;
+			open = NULL;
+		} else if (open == NULL && lineEnd - p == 2 && memcmp(p, "\t]", 2) == 0) {
+			suffix = p;
+			break;
+		} else if (open == NULL) {
+			/* Stray text outside of any block */
+			if (blockC == blockCapacity) {
+				blockCapacity = Max(64, blockCapacity * 2);
+				blocks = realloc(blocks, sizeof(StoreBlock) * blockCapacity);
+			}
+			open = &blocks[blockC++];
+			open->start = open->body = p - contents;
+			open->framed = false;
+		}
+	}
+	if (open != NULL) {
+		open->footer = open->end = (suffix ? suffix - 1 : end) - contents;
+		open->framed = false;
+	}
+	
+	{
+		VerifyBlocksJob job;
+		
+		InitCRC32C();
+		job.text   = contents;
+		job.blocks = blocks;
+		RunParallel(blockC, 64, VerifyBlocksRange, &job);
+	}
+	
+	for (i = 0; i < blockC && blocks[i].ok == true; ++i);
+	if (i < blockC || suffix == NULL) {
+		char* result;
+		size_t length;
+		int first = true;
+		
+		/* Nothing is ever longer than what it came from, bar the separators
+		 * and the closing lines which are written again. */
+		result = malloc(*io_size + 2 * blockC + 16);
+		length = strstr(contents, marker) + sizeof(marker) - 1 - contents;
+		memcpy(result, contents, length);
+		for (i = 0; i < blockC; ++i) {
+			StoreBlock* b = &blocks[i];
+			
+			if (b->ok == false) {
+				io_c->bad_block_c++;
+				BufferAppendS(&io_c->quarantine, "# Damaged block at byte ");
+				BufferAppendUInt(&io_c->quarantine, b->start);
+				BufferAppendS(&io_c->quarantine, "\n");
+				BufferAppend(&io_c->quarantine, &contents[b->start],
+				             b->end - b->start);
+				BufferAppendS(&io_c->quarantine, "\n");
+				continue;
+			}
+			if (first == false) {
+				memcpy(&result[length], ",\n", 2);
+				length += 2;
+			}
+			memcpy(&result[length], "\t\t", 2);
+			memcpy(&result[length + 2], &contents[b->start], b->end - b->start);
+			length += 2 + b->end - b->start;
+			first = false;
+		}
+		strcpy(&result[length], (first == true) ? "\t]\n}\n" : "\n\t]\n}\n");
+		*io_size = length + strlen(&result[length]);
+		
+		free(contents);
+		contents = result;
+	}
+	
+	free(blocks);
+	return contents;
+}
+
+/* Loads a store from contents (which are freed) into io_result, which must be
+ * zeroed. */
+static void
+LoadStore(char* contents, size_t contentsSize, Core* io_result)
+{
+	Tags tags   = { 0 };
+	Table table = { 0 };
+	
+	contents = VerifyBlocks(contents, &contentsSize, io_result);
+	if (contentsSize >= FAST_LOAD_S) {
+		LoadStructural(contents, contentsSize, &tags, &table, &io_result->meta);
+	} else {
+		LoadDOM(contents, contentsSize, &tags, &table, &io_result->meta);
+	}
+	free(contents);
+	
+	io_result->table = table;
+	io_result->tags = tags;
+	FinishLoad(io_result);
+}
+
+static Core
+ReadJSON(void)
+{
+	Core result;
+	
+	char* contents = NULL;
+	size_t contentsSize = 0;
+	
+	{
+		FILE* jsonFile = NULL;
+		char filename[512] = { 0 };
+		DIR* dir;
+		
+		GetConfigPath(filename);
+		if ((dir = opendir(filename))) {
+			closedir(dir);
+		} else {
+			if (mkdir(filename, 0777) < 0) {
+				fprintf(stderr, "Could not create directory '%s'.\n", filename);
+				exit(-1);
+			}
+		}
+		strcat(filename, cache_filename);
+		
+		jsonFile = fopen(filename, "rb");
+		
+		if (!jsonFile) {
+			char confirmation;
+			printf("Could not find '%s'.\nWould you like to create a new config " \
+			       "file? [Y/n] ", filename);
+			scanf("%c", &confirmation);
+			if (!(confirmation == 'y' || confirmation == 'Y')) {
+				exit(0);
+			}
+			
+			memset(&result, 0, sizeof(Core));
+			result.table.next_UID = 1;
+			result.table.rows = malloc(sizeof(Row));
+			memset(result.table.rows, 0, sizeof(Row));
+			result.tags.next_UID = 1;
+			result.tags.tags = malloc(sizeof(Tag));
+			memset(result.tags.tags, 0, sizeof(Tag));
+			
+			WriteJSON(&result);
+			printf("Config created. You may need to reperform your last command.\n");
+			exit(0);
+		}
+		
+		{
+			fseek(jsonFile, 0, SEEK_END);
+			contentsSize = ftell(jsonFile);
+			fseek(jsonFile, 0, SEEK_SET);
+			
+			contents = malloc(sizeof(char) * contentsSize + 1);
+			memset(contents, 0, sizeof(char) * contentsSize + 1);
+			
+			fread(contents, contentsSize, 1, jsonFile);
+		}
+		fclose(jsonFile);
+	}
+	
+	memset(&result, 0, sizeof(Core));
+	LoadStore(contents, contentsSize, &result);
+	LoadTagAliases(&result.tags);
+	/* Left as it is until a command changes the store (or 'sbm fsck
+	 * --repair' runs), so that read-only commands never rewrite it and fsck
+	 * can still see the damage. */
+	if (result.bad_block_c > 0) {
+		fprintf(stderr, "%d damaged block(s) in the store were skipped. " \
+		        "Their rows will be moved to '%s' by the next command which " \
+		        "changes the store, or by 'sbm fsck --repair'.\n",
+		        result.bad_block_c, quarantine_filename);
+	}
+	
+	return result;
+}
+
+/* Ends the block whose header has its checksum placeholder at crcAt, and
+ * fills it in. */
+static void
+CloseBlock(Buffer* io_b, size_t crcAt)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t body = crcAt + 8 + strlen("\", \"rows\":{\n");
+	uint32_t crc;
+	int i;
+	
+	BufferAppendS(io_b, "\n\t\t");
+	crc = CRC32C(0, &io_b->data[body], io_b->length - body);
+	for (i = 7; i >= 0; --i, crc >>= 4) {
+		io_b->data[crcAt + i] = hex[crc & 0xF];
+	}
+	BufferAppendS(io_b, "}}");
+}
+
+static int
+WriteJSON(Core* c)
+{
+	Buffer out;
+	int i, first, rowC;
+	size_t crcAt = 0;
+	
+	memset(&out, 0, sizeof(Buffer));
+	/* Most rows are far smaller than their fixed-size fields, so this is
+	 * usually enough to never grow. */
+	BufferReserve(&out, 256 + c->tags.count * 48 + c->table.count * 192);
+	
+	c->meta.generation++;
+	c->meta.rows_next = c->table.next_UID;
+	c->meta.tags_next = c->tags.next_UID;
+	BufferAppendS(&out, "{\n\t\"meta\":{\"generation\": \"");
+	BufferAppendUInt(&out, c->meta.generation);
+	BufferAppendS(&out, "\", \"rows_next\": \"");
+	BufferAppendUInt(&out, c->meta.rows_next);
+	BufferAppendS(&out, "\", \"tags_next\": \"");
+	BufferAppendUInt(&out, c->meta.tags_next);
+	BufferAppendS(&out, "\"},\n\t\"tags\":{\n");
+	for (i = 0, first = true; i < c->tags.count; ++i) {
+		if (c->tags.tags[i].id == 0) continue;
+		BufferAppendS(&out, (first == true) ? "\t\t\"" : ",\n\t\t\"");
+		BufferAppendUInt(&out, c->tags.tags[i].id);
+		BufferAppendS(&out, "\": ");
+		BufferAppendJSONString(&out, c->tags.tags[i].name);
+		first = false;
+	}
+	BufferAppendS(&out, (first == true) ? "\t},\n\t\"blocks\":[\n" :
+	                                      "\n\t},\n\t\"blocks\":[\n");
+	/* Rows are written in blocks of ROWS_PER_BLOCK_C, each with the CRC32C of
+	 * its rows (from the first row's line to the footer) in its header. */
+	InitCRC32C();
+	for (i = 0, rowC = 0; i < c->table.count; ++i) {
+		Row* curr;
+		
+		curr = &c->table.rows[i];
+		if (curr->id == 0) continue;
+		
+		if (rowC % ROWS_PER_BLOCK_C == 0) {
+			if (rowC > 0) {
+				CloseBlock(&out, crcAt);
+				BufferAppendS(&out, ",\n");
+			}
+			BufferAppendS(&out, "\t\t{\"crc\": \"");
+			crcAt = out.length;
+			BufferAppendS(&out, "00000000\", \"rows\":{\n\t\t\t");
+		} else {
+			BufferAppendS(&out, ",\n\t\t\t");
+		}
+		BufferAppendRow(&out, curr);
+		rowC++;
+	}
+	if (rowC > 0) {
+		CloseBlock(&out, crcAt);
+		BufferAppendS(&out, "\n");
+	}
+	BufferAppendS(&out, "\t]\n}\n");
+	
+	{
+		FILE* fp;
+		char filename[512] = { 0 };
+		
+		GetConfigPath(filename);
+		strcat(filename, cache_filename);
+		fp = fopen(filename, "w");
+		if (fp == NULL) {
+			free(out.data);
+			return -1;
+		}
+		if ((fwrite(out.data, out.length, 1, fp) < 1)) {
+			fclose(fp);
+			free(out.data);
+			return -1;
+		}
+		fclose(fp);
+	}
+	
+	if (c->quarantine.length > 0) {
+		FILE* fp;
+		char filename[512] = { 0 };
+		
+		GetConfigPath(filename);
+		strcat(filename, quarantine_filename);
+		if ((fp = fopen(filename, "ab")) != NULL) {
+			fprintf(fp, "# Removed from generation %u of the store\n",
+			        c->meta.generation - 1);
+			fwrite(c->quarantine.data, c->quarantine.length, 1, fp);
+			fclose(fp);
+		}
+		free(c->quarantine.data);
+		memset(&c->quarantine, 0, sizeof(Buffer));
+	}
+	SaveMerkle(c);
+	SaveURLIndex(c);
+	SaveSavedSearches(c);
+	SaveReplica(c);
+	if (c->journal.alias_c > 0) {
+		SaveTagAliases(&c->tags);
+	}
+	CommitJournal(c);
+	
+	free(out.data);
+	return 1;
+}
+
+static void
+ProcessCommand(Core* io_c, InputArgs* ia)
+{
+	switch (ia->input_mode) {
+		case IM_INVALID:
+			{
+				printf("Invalid input\n");
+				exit(-1);
 			}
 			break;
 		case IM_ADD:
@@ -675,10 +2515,11 @@ ProcessCommand(Core* io_c, InputArgs* ia)
 				row = &io_c->table.rows[io_c->table.count];
 				memset(row, 0, sizeof(Row));
 				row->id = io_c->table.next_UID++;
+				JournalRow(io_c, io_c->table.count, true);
 				if (strlen(ia->word_buffers[WI_MOD]) >= S_ADDR_S) {
-					row->url.address.l = malloc(strlen(ia->word_buffers[WI_MOD]));
-					memset(row->url.address.l, 0, strlen(ia->word_buffers[WI_MOD]));
-					strcpy(row->url.address.s, ia->word_buffers[WI_MOD]);
+					row->url.address.l =
+						malloc(strlen(ia->word_buffers[WI_MOD]) + 1);
+					strcpy(row->url.address.l, ia->word_buffers[WI_MOD]);
 					row->url.long_url = true;
 				} else {
 					strcpy(row->url.address.s, ia->word_buffers[WI_MOD]);
@@ -746,7 +2587,17 @@ ProcessCommand(Core* io_c, InputArgs* ia)
 				}
 				GetCurrentDateTime(&row->datetime);
 				
+				{
+					unsigned int i;
+					for (i = 0; i < ROW_TAG_C; ++i) {
+						if (row->tag_ids[i] == 0) continue;
+						TagRowsAdd(io_c, row->tag_ids[i], io_c->table.count);
+					}
+				}
+				IndexRowHost(io_c, io_c->table.count);
 				io_c->table.count += 1;
+				AutotagRow(io_c, io_c->table.count - 1);
+				io_c->dirty = true;
 			}
 			break;
 		case IM_UPDATE:
@@ -771,6 +2622,7 @@ ProcessCommand(Core* io_c, InputArgs* ia)
 					fprintf(stderr, "URL ID %d could not be found.\n", id);
 					exit(-1);
 				}
+				JournalRow(io_c, index, false);
 
 				if (ia->word_buffers[WI_TITLE] != NULL) {
 					strcpyt(io_c->table.rows[index].title,
@@ -795,6 +2647,7 @@ ProcessCommand(Core* io_c, InputArgs* ia)
 					}
 				}
 				GetCurrentDateTime(&io_c->table.rows[index].datetime);
+				io_c->dirty = true;
 			}
 			break;
 		case IM_REMOVE:
@@ -803,6 +2656,39 @@ ProcessCommand(Core* io_c, InputArgs* ia)
 				         int  id, index;
 				         char confirmation;
 				
+				if (ia->word_buffers[WI_HOST] != NULL) {
+					Host* host;
+					unsigned int live;
+					
+					host = FindHost(&io_c->hosts, ia->word_buffers[WI_HOST]);
+					for (i = 0, live = 0; host != NULL && i < host->count; ++i) {
+						if (io_c->table.rows[host->rows[i]].id != 0) live++;
+					}
+					if (live == 0) {
+						printf("No entries found for host '%s'.\n",
+						       ia->word_buffers[WI_HOST]);
+						exit(-1);
+					}
+					
+					printf("Are you sure you want to delete %d row(s) from " \
+					       "'%s'? [Y/n] \n", live, host->name);
+					scanf("%c", &confirmation);
+					if (!((confirmation == 'y') || (confirmation == 'Y'))) {
+						exit(0);
+					}
+					for (i = 0; i < host->count; ++i) {
+						if (io_c->table.rows[host->rows[i]].id == 0) continue;
+						JournalRow(io_c, host->rows[i], false);
+						io_c->table.rows[host->rows[i]].id = 0;
+					}
+					io_c->dirty = true;
+					break;
+				}
+				if (ia->mod_c > 0) {
+					RemoveQuery(io_c, ia->mod_list, ia->mod_c);
+					break;
+				}
+				
 				if (!isdigit(ia->word_buffers[WI_MOD][0])) {
 					printf("Arg 1 must be the URL ID which you want to " \
 					       "delete\n");
@@ -827,7 +2713,9 @@ ProcessCommand(Core* io_c, InputArgs* ia)
 				
 				scanf("%c", &confirmation);
 				if ((confirmation == 'y') || (confirmation == 'Y')) {
+					JournalRow(io_c, index, false);
 					io_c->table.rows[index].id = 0;
+					io_c->dirty = true;
 				} else {
 					exit(0);
 				}
@@ -835,28 +2723,44 @@ ProcessCommand(Core* io_c, InputArgs* ia)
 			break;
 		case IM_LIST:
 			{
+				Buffer out, key;
 				unsigned int i;
-				if (ia->word_buffers[WI_MOD] != NULL) {
-					if (stricmp(ia->word_buffers[WI_MOD], "all") == 0) {
-						for (i = 0; i < io_c->table.count; ++i) {
-							if (io_c->table.rows[i].id == 0) continue;
-							PrintRow(io_c->table.rows[i], io_c->tags);
-						}
+				
+				memset(&out, 0, sizeof(Buffer));
+				ListResultKey(ia, &key);
+				if (ia->word_buffers[WI_HOST] != NULL) {
+					Host* host;
+					
+					host = FindHost(&io_c->hosts, ia->word_buffers[WI_HOST]);
+					for (i = 0; host != NULL && i < host->count; ++i) {
+						Row* r = &io_c->table.rows[host->rows[i]];
+						if (r->id == 0) continue;
+						BufferAppendListedRow(&out, r, io_c->tags);
+					}
+				} else if (ia->mod_c > 0) {
+					unsigned char* matched;
+					Query q;
+					
+					if (!ParseQuery(io_c, ia->mod_list, ia->mod_c,
+					                ia->word_buffers[WI_MOD] != NULL &&
+					                strcmp(ia->word_buffers[WI_MOD],
+					                       "--any") == 0, &q)) {
+						printf("Could not find tag '%s'\n", q.bad);
+						exit(-1);
+					}
+					matched = MatchListQuery(io_c, &q, ia->mod_list, ia->mod_c);
+					FreeQuery(&q);
+					if (ia->word_buffers[WI_SORT] != NULL) {
+						BufferAppendFrecent(io_c, matched, &out);
 					} else {
-						char* ssPtr;
 						for (i = 0; i < io_c->table.count; ++i) {
-							if (io_c->table.rows[i].id == 0) continue;
-							ssPtr = stristr(io_c->table.rows[i].title,
-							                ia->word_buffers[WI_MOD]);
-							if (ssPtr != NULL) {
-								PrintRow(io_c->table.rows[i], io_c->tags);
-							}
+							if (matched[i] == false) continue;
+							BufferAppendListedRow(&out, &io_c->table.rows[i],
+							                      io_c->tags);
 						}
 					}
-					return;
-				}
-				
-				if (ia->word_buffers[WI_TAG] != NULL) {
+					free(matched);
+				} else if (ia->word_buffers[WI_TAG] != NULL) {
 					/* (Contains multiple values) */
 					if (strstr(ia->word_buffers[WI_TAG], " ") != NULL) {
 						char* curr;
@@ -882,11 +2786,10 @@ ProcessCommand(Core* io_c, InputArgs* ia)
 									exit(-1);
 								}
 							}
+							i++;
 							curr = strtok(0, " ");
 						}
-						PrintWithTagIDs(tmp, freq,
-						                io_c->table.rows, io_c->table.count,
-						                io_c->tags);
+						PrintWithTagIDs(io_c, tmp, i, &out);
 						free(tmp);
 					/* (Single Value) */
 					} else {
@@ -903,47 +2806,119 @@ ProcessCommand(Core* io_c, InputArgs* ia)
 							}
 						}
 						{
-							unsigned int tmp[1] = { id };
-							PrintWithTagIDs(tmp, 1,
-							                io_c->table.rows, io_c->table.count,
-							                io_c->tags);
+							TagClosure* cl = GetTagClosure(io_c, id);
+							unsigned int end = io_c->table.count;
+							
+							for (i = 0; cl != NULL &&
+							            (i = NextClosureRow(cl, i, end)) < end; ++i) {
+								Row* r = &io_c->table.rows[i];
+								if (r->id == 0 || !RowUnderTag(cl, r)) continue;
+								BufferAppendListedRow(&out, r, io_c->tags);
+							}
 						}
 					}
 				}
-				
+				if (out.length > 0) {
+					fwrite(out.data, 1, out.length, stdout);
+				}
+				SaveListResult(io_c, &key, &out);
+				free(key.data);
+				free(out.data);
 			}
 			break;
 		case IM_OPEN:
 			{
-				char buffer[9 + S_ADDR_S];
-				char* url;
-				int i, result, id, len;
+				char** urls;
+				unsigned int* opened;
+				unsigned int i, j, urlC;
+				/* One per row, or per ID given, which may repeat */
+				unsigned int capacity = Max(io_c->table.count, ia->mod_c) + 1;
 				
-				id = atoi(ia->word_buffers[WI_MOD]);
-				for (i = 0, url = NULL; i < io_c->table.count; ++i) {
-					if (io_c->table.rows[i].id == id) {
-						if (io_c->table.rows[i].url.long_url == true) {
-							url = io_c->table.rows[i].url.address.l;
-						} else {
-							url = io_c->table.rows[i].url.address.s;
+				urls = malloc(sizeof(char*) * capacity);
+				opened = malloc(sizeof(unsigned int) * capacity);
+				urlC = 0;
+				if (ia->word_buffers[WI_HOST] != NULL) {
+					Host* host;
+					
+					host = FindHost(&io_c->hosts, ia->word_buffers[WI_HOST]);
+					for (i = 0; host != NULL && i < host->count; ++i) {
+						Row* r = &io_c->table.rows[host->rows[i]];
+						if (r->id == 0) continue;
+						opened[urlC] = r->id;
+						urls[urlC++] = GetRowURL(r);
+					}
+				} else if (ia->word_buffers[WI_TAG] != NULL) {
+					unsigned int* tagIDs;
+					unsigned int  tagC;
+					unsigned char* seen;
+					
+					/* A row can carry several of the tags; open it once. */
+					seen = malloc(io_c->table.count / 8 + 1);
+					memset(seen, 0, io_c->table.count / 8 + 1);
+					tagC = GetInputTagIDs(io_c, ia->word_buffers[WI_TAG], &tagIDs);
+					for (j = 0; j < tagC; ++j) {
+						TagClosure* cl = GetTagClosure(io_c, tagIDs[j]);
+						unsigned int index, end = io_c->table.count;
+						
+						for (index = 0; cl != NULL &&
+						     (index = NextClosureRow(cl, index, end)) < end;
+						     ++index) {
+							Row* r = &io_c->table.rows[index];
+							
+							if (r->id == 0 || !RowUnderTag(cl, r) ||
+							    (seen[index / 8] & (1 << (index % 8)))) continue;
+							seen[index / 8] |= 1 << (index % 8);
+							opened[urlC] = r->id;
+							urls[urlC++] = GetRowURL(r);
+						}
+					}
+					free(tagIDs);
+					free(seen);
+				} else {
+					/* Resolve every requested ID in one pass over the table,
+					 * keeping the order they were given in. */
+					unsigned int* ids;
+					
+					ids = malloc(sizeof(unsigned int) * ia->mod_c);
+					for (j = 0; j < ia->mod_c; ++j) {
+						if (!isdigit(ia->mod_list[j][0])) {
+							printf("'%s' is not a row ID\n", ia->mod_list[j]);
+							exit(-1);
+						}
+						ids[j] = opened[j] = atoi(ia->mod_list[j]);
+						urls[j] = NULL;
+					}
+					for (i = 0; i < io_c->table.count; ++i) {
+						Row* r = &io_c->table.rows[i];
+						if (r->id == 0) continue;
+						for (j = 0; j < ia->mod_c; ++j) {
+							if (ids[j] == r->id) urls[j] = GetRowURL(r);
+						}
+					}
+					for (j = 0; j < ia->mod_c; ++j) {
+						if (urls[j] == NULL) {
+							printf("Could not find row entry with ID %d\n", ids[j]);
+							exit(-1);
 						}
-						break;
 					}
+					urlC = ia->mod_c;
+					free(ids);
 				}
 				
-				if (url == NULL) {
-					printf("Could not find row entry with this ID\n");
+				if (urlC == 0) {
+					printf("No entries to open\n");
 					exit(-1);
 				}
-				
-				len = Min(11 + strlen(url), 11 + S_ADDR_S - 1);
-				sprintf(buffer, "xdg-open %s &", url);
-				buffer[len] = 0;
-				result = system(buffer);
-				if (result != 0) {
-					printf("Could not open URL\n");
+				i = OpenURLs(urls, urlC);
+				if (i > 0) {
+					LogVisits(opened, urlC);
+				}
+				if (i < urlC) {
+					printf("Could not open every URL\n");
 					exit(-1);
 				}
+				free(urls);
+				free(opened);
 			}
 			
 			break;
@@ -958,7 +2933,9 @@ ProcessCommand(Core* io_c, InputArgs* ia)
 				
 				strcpy(io_c->tags.tags[io_c->tags.count].name,
 				       ia->word_buffers[WI_MOD]);
-				io_c->tags.tags[io_c->tags.count++].id = io_c->tags.next_UID++;
+				io_c->tags.tags[io_c->tags.count].id = io_c->tags.next_UID++;
+				JournalTag(io_c, io_c->tags.count++, true);
+				io_c->dirty = true;
 			}
 			break;
 		case IM_TAG_ADD_TO_ENTRY:
@@ -967,6 +2944,48 @@ ProcessCommand(Core* io_c, InputArgs* ia)
 				unsigned int urlID,    tagIndex;
 				         int urlIndex, freeTagIndex;
 				
+				if (ia->word_buffers[WI_HOST] != NULL) {
+					Host* host;
+					unsigned int tagID, tagged, full, j;
+					
+					if (!isdigit(ia->word_buffers[WI_TAG][0])) {
+						ValidateTagName(ia->word_buffers, WI_TAG);
+					}
+					tagIndex = GetInputTagIndex(io_c, ia->word_buffers, WI_TAG);
+					tagID = io_c->tags.tags[tagIndex].id;
+					
+					host = FindHost(&io_c->hosts, ia->word_buffers[WI_HOST]);
+					if (host == NULL) {
+						printf("No entries found for host '%s'.\n",
+						       ia->word_buffers[WI_HOST]);
+						exit(-1);
+					}
+					for (i = 0, tagged = 0, full = 0; i < host->count; ++i) {
+						Row* r = &io_c->table.rows[host->rows[i]];
+						
+						if (r->id == 0 || RowHasTagID(*r, tagID)) continue;
+						for (j = 0; j < ROW_TAG_C; ++j) {
+							if (r->tag_ids[j] == 0) break;
+						}
+						if (j == ROW_TAG_C) {
+							full++;
+							continue;
+						}
+						JournalRow(io_c, host->rows[i], false);
+						r->tag_ids[j] = tagID;
+						TagRowsAdd(io_c, tagID, host->rows[i]);
+						GetCurrentDateTime(&r->datetime);
+						tagged++;
+					}
+					printf("Tagged %d entries from '%s' with %s.\n",
+					       tagged, host->name, io_c->tags.tags[tagIndex].name);
+					if (full > 0) {
+						printf("%d entries could not take any more tags.\n", full);
+					}
+					io_c->dirty = tagged > 0;
+					break;
+				}
+				
 				if (isdigit(ia->word_buffers[WI_MOD][0])) {
 					urlID = atoi(ia->word_buffers[WI_MOD]);
 				} else {
@@ -1014,9 +3033,12 @@ ProcessCommand(Core* io_c, InputArgs* ia)
 					}
 				}
 				
+				JournalRow(io_c, urlIndex, false);
 				io_c->table.rows[urlIndex].tag_ids[freeTagIndex] = 
 					io_c->tags.tags[tagIndex].id;
+				TagRowsAdd(io_c, io_c->tags.tags[tagIndex].id, urlIndex);
 				GetCurrentDateTime(&io_c->table.rows[urlIndex].datetime);
+				io_c->dirty = true;
 			}
 			break;
 		case IM_TAG_RENAME:
@@ -1028,7 +3050,9 @@ ProcessCommand(Core* io_c, InputArgs* ia)
 				}
 				
 				index = GetInputTagIndex(io_c, ia->word_buffers, WI_MOD);
+				JournalTag(io_c, index, false);
 				strcpy(io_c->tags.tags[index].name, ia->word_buffers[WI_TAG]);
+				io_c->dirty = true;
 			}
 			break;
 		case IM_TAG_REMOVE:
@@ -1045,495 +3069,8522 @@ ProcessCommand(Core* io_c, InputArgs* ia)
 				confirmation = 0;
 				scanf("%c", &confirmation);
 				if ((confirmation == 'y') || (confirmation == 'Y')) {
-					for (i = 0; i < io_c->table.count; ++i) {
+					unsigned int id = io_c->tags.tags[index].id;
+					TagRowList* list;
+					
+					JournalTag(io_c, index, false);
+					for (i = 0; (list = GetTagRows(io_c, id)) != NULL &&
+					            i < list->count; ++i) {
+						Row* r = &io_c->table.rows[list->rows[i]];
+						
+						if (r->id == 0 || !RowHasTagID(*r, id)) continue;
+						JournalRow(io_c, list->rows[i], false);
 						for (j = 0; j < ROW_TAG_C; ++j) {
-							if (io_c->table.rows[i].tag_ids[j] ==
-							    io_c->tags.tags[index].id) {
-								io_c->table.rows[i].tag_ids[j] = 0;
-								GetCurrentDateTime(&io_c->table.rows[i].datetime);
-							}
+							if (r->tag_ids[j] == id) r->tag_ids[j] = 0;
 						}
+						GetCurrentDateTime(&r->datetime);
 					}
 					io_c->tags.tags[index].id = 0;
+					io_c->dirty = true;
 				} else {
 					exit(-1);
 				}
 			}
 			break;
-		case IM_TAG_LIST:
+		case IM_TAG_MERGE:
 			{
-				unsigned int i;
+				int src, dst;
+				
+				src = FindNamedTag(io_c, ia->word_buffers[WI_MOD]);
+				dst = FindNamedTag(io_c, ia->word_buffers[WI_TAG]);
+				if (src < 0 || dst < 0) {
+					printf("Could not find tag '%s'\n",
+					       ia->word_buffers[(src < 0) ? WI_MOD : WI_TAG]);
+					exit(-1);
+				}
+				if (src == dst) {
+					printf("Tags to merge must be two different tags.\n");
+					exit(-1);
+				}
+				MergeTag(io_c, src, dst);
+			}
+			break;
+		case IM_TAG_ALIAS:
+			{
+				char* name = ia->word_buffers[WI_MOD];
+				
+				if (ia->word_buffers[WI_TAG] == NULL) {
+					JournalAlias(io_c, name);
+					if (!SetTagAlias(&io_c->tags, name, 0)) {
+						printf("There is no alias '%s'.\n", name);
+						exit(-1);
+					}
+				} else {
+					unsigned int i;
+					int index;
+					
+					ValidateTagName(ia->word_buffers, WI_MOD);
+					if (strlen(name) >= TAG_NAME_S) {
+						printf("Tag names must be shorter than %d characters.\n",
+						       TAG_NAME_S);
+						exit(-1);
+					}
+					for (i = 0; i < io_c->tags.count; ++i) {
+						if (io_c->tags.tags[i].id != 0 &&
+						    stricmp(io_c->tags.tags[i].name, name) == 0) {
+							printf("There already is a tag '%s'.\n", name);
+							exit(-1);
+						}
+					}
+					index = FindNamedTag(io_c, ia->word_buffers[WI_TAG]);
+					if (index < 0) {
+						printf("Could not find tag '%s'\n", ia->word_buffers[WI_TAG]);
+						exit(-1);
+					}
+					JournalAlias(io_c, name);
+					SetTagAlias(&io_c->tags, name, io_c->tags.tags[index].id);
+				}
+				io_c->dirty = true;
+			}
+			break;
+		case IM_FSCK:
+			{
+				int repair = ia->word_buffers[WI_MOD] != NULL;
+				
+				if (Fsck(io_c, repair) > 0) {
+					if (repair == false) {
+						exit(1);
+					}
+					io_c->dirty = true;
+				}
+			}
+			break;
+		case IM_MERGE:
+			MergeStore(io_c, ia->word_buffers[WI_MOD]);
+			break;
+		case IM_DIFF:
+			Diff(io_c, ia->mod_list, ia->mod_c);
+			break;
+		case IM_DIFF_SERVE:
+			DiffServe(io_c, ia->mod_list, ia->mod_c);
+			break;
+		case IM_REPLICA:
+			ReplicaCommand(io_c, ia->mod_list);
+			break;
+		case IM_SYNC:
+			Sync(io_c, ia->word_buffers[WI_MOD]);
+			break;
+		case IM_SERVE_SYNC:
+			ServeSync(io_c, ia->mod_list, ia->mod_c);
+			break;
+		case IM_SERVE:
+			ServeAPI(io_c, ia->mod_list, ia->mod_c);
+			break;
+		case IM_NATIVE_HOST:
+			NativeHost(io_c);
+			break;
+		case IM_WATCH:
+			WatchStore(io_c);
+			break;
+		case IM_AUTOTAG:
+			AutotagAll(io_c);
+			break;
+		case IM_RETAG:
+			Retag(io_c, ia->mod_list, ia->mod_c);
+			break;
+		case IM_SAVED:
+			SavedCommand(io_c, ia->mod_list, ia->mod_c);
+			break;
+		case IM_TOP:
+			PrintTop(io_c, (ia->word_buffers[WI_MOD] != NULL)
+			               ? atoi(ia->word_buffers[WI_MOD]) : TOP_C);
+			break;
+		case IM_HAS:
+			/* urls.bin could not answer; it is built for next time. */
+			{
+				unsigned int i, found = false;
+				
+				for (i = 0; i < io_c->table.count; ++i) {
+					Row* r = &io_c->table.rows[i];
+					
+					if (r->id != 0 &&
+					    SameCanonicalURL(GetRowURL(r), ia->word_buffers[WI_MOD])) {
+						printf("%u\n", r->id);
+						found = true;
+					}
+				}
+				BuildURLIndex(io_c);
+				exit((found == true) ? 0 : 1);
+			}
+		case IM_UNDO:
+		case IM_REDO:
+			StepJournal(io_c, (ia->input_mode == IM_UNDO) ? -1 : 1);
+			break;
+		case IM_STATS_HOSTS:
+			{
+				unsigned int i, j;
+				HostCount* counts;
+				
+				counts = malloc(sizeof(HostCount) * (io_c->hosts.count + 1));
+				for (i = 0; i < io_c->hosts.count; ++i) {
+					Host* host = &io_c->hosts.hosts[i];
+					
+					counts[i].index = i;
+					for (j = 0, counts[i].live = 0; j < host->count; ++j) {
+						if (io_c->table.rows[host->rows[j]].id != 0) {
+							counts[i].live++;
+						}
+					}
+				}
+				qsort(counts, io_c->hosts.count, sizeof(HostCount),
+				      CompareHostCounts);
+				for (i = 0; i < io_c->hosts.count; ++i) {
+					if (counts[i].live == 0) continue;
+					printf("%6d %s\n", counts[i].live,
+					       io_c->hosts.hosts[counts[i].index].name);
+				}
+				free(counts);
+			}
+			break;
+		case IM_TAG_LIST:
+			{
+				unsigned int i;
+				
+				if (stricmp(ia->word_buffers[WI_MOD], "all") == 0) {
+					for (i = 0; i < io_c->tags.count; ++i) {
+						if (io_c->tags.tags[i].id == 0) continue;
+						printf("%d] %s\n",
+						       io_c->tags.tags[i].id, io_c->tags.tags[i].name);
+					}
+					for (i = 0; i < io_c->tags.alias_c; ++i) {
+						TagAlias* a = &io_c->tags.aliases[i];
+						
+						/* Not when it is out of use, or a tag took the name */
+						if (a->id == 0 || GetTagID(io_c->tags, a->name) != a->id) {
+							continue;
+						}
+						printf("%s -> %s\n", a->name, GetTagName(io_c->tags, a->id));
+					}
+				} else {
+					int found = false;
+					for (i = 0; i < io_c->tags.count; ++i) {
+						if (io_c->tags.tags[i].id == 0) continue;
+						if (stristr(io_c->tags.tags[i].name, ia->word_buffers[WI_MOD]) !=
+						    NULL) {
+							printf("%d] %s\n",
+							       io_c->tags.tags[i].id, io_c->tags.tags[i].name);
+							found = true;
+						}
+					}
+					if (found == false) {
+						printf("No tags found.\n");
+					}
+				}
+			}
+			break;
+	}
+}
+
+
+
+static void
+BufferReserve(Buffer* io_b, size_t n)
+{
+	if (io_b->length + n + 1 <= io_b->capacity) {
+		return;
+	}
+	
+	io_b->capacity = Max(io_b->capacity * 2, io_b->length + n + 1);
+	io_b->data = realloc(io_b->data, io_b->capacity);
+	if (io_b->data == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(-1);
+	}
+}
+
+static void
+BufferAppend(Buffer* io_b, const char* s, size_t n)
+{
+	BufferReserve(io_b, n);
+	memcpy(&io_b->data[io_b->length], s, n);
+	io_b->length += n;
+	io_b->data[io_b->length] = '\0';
+}
+
+static void
+BufferAppendS(Buffer* io_b, const char* s)
+{
+	BufferAppend(io_b, s, strlen(s));
+}
+
+static void
+BufferAppendUInt(Buffer* io_b, unsigned int v)
+{
+	char digits[16];
+	int i = sizeof(digits);
+	
+	do {
+		digits[--i] = '0' + (v % 10);
+		v /= 10;
+	} while (v != 0);
+	BufferAppend(io_b, &digits[i], sizeof(digits) - i);
+}
+
+/* Returns how many of the n bytes at s can be copied as they are, i.e. the
+ * offset of the first '"', '\\' or control character, or n if there is none.
+ * With SSE2 this checks 16 bytes at a time while that many remain; titles and
+ * URLs rarely need escaping at all, so most strings are a single bulk copy. */
+static size_t
+JSONCleanRun(const char* s, size_t n)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i quote     = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i control   = _mm_set1_epi8(0x1F);
+#endif
+	
+#ifdef __SSE2__
+	for (; n - i >= 16; i += 16) {
+		__m128i block;
+		int mask;
+		
+		block = _mm_loadu_si128((const __m128i*) &s[i]);
+		mask = _mm_movemask_epi8(_mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(block, quote),
+			             _mm_cmpeq_epi8(block, backslash)),
+			/* Unsigned "<= 0x1F" */
+			_mm_cmpeq_epi8(_mm_max_epu8(block, control), control)));
+		if (mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+#endif
+	for (; i < n; ++i) {
+		if (s[i] == '"' || s[i] == '\\' || (unsigned char) s[i] <= 0x1F) {
+			return i;
+		}
+	}
+	return n;
+}
+
+static void
+BufferAppendJSONString(Buffer* io_b, const char* s)
+{
+	static const char hex[] = "0123456789abcdef";
+	const char* end = s + strlen(s);
+	size_t run;
+	
+	BufferAppend(io_b, "\"", 1);
+	for (;;) {
+		run = JSONCleanRun(s, end - s);
+		BufferAppend(io_b, s, run);
+		s += run;
+		if (s == end) break;
+		
+		switch (*s) {
+			case '"':  BufferAppend(io_b, "\\\"", 2); break;
+			case '\\': BufferAppend(io_b, "\\\\", 2); break;
+			case '\n': BufferAppend(io_b, "\\n", 2);  break;
+			case '\r': BufferAppend(io_b, "\\r", 2);  break;
+			case '\t': BufferAppend(io_b, "\\t", 2);  break;
+			case '\b': BufferAppend(io_b, "\\b", 2);  break;
+			case '\f': BufferAppend(io_b, "\\f", 2);  break;
+			default:
+				{
+					char u[6] = { '\\', 'u', '0', '0', 0, 0 };
+					u[4] = hex[(unsigned char) *s >> 4];
+					u[5] = hex[(unsigned char) *s & 0xF];
+					BufferAppend(io_b, u, 6);
+				}
+				break;
+		}
+		s++;
+	}
+	BufferAppend(io_b, "\"", 1);
+}
+
+/* Appends r as it is saved: "id": ["url", "title", "comment", "date", [tags]] */
+static void
+BufferAppendRow(Buffer* io_b, Row* r)
+{
+	unsigned int j;
+	
+	BufferAppendS(io_b, "\"");
+	BufferAppendUInt(io_b, r->id);
+	BufferAppendS(io_b, "\": [");
+	BufferAppendJSONString(io_b, GetRowURL(r));
+	BufferAppendS(io_b, ", ");
+	BufferAppendJSONString(io_b, r->title);
+	BufferAppendS(io_b, ", ");
+	BufferAppendJSONString(io_b, r->comment);
+	BufferAppendS(io_b, ", ");
+	BufferAppendJSONString(io_b, r->datetime.last_updated);
+	BufferAppendS(io_b, ", [");
+	for (j = 0; j < ROW_TAG_C; ++j) {
+		BufferAppendS(io_b, (j == 0) ? "\"" : ", \"");
+		BufferAppendUInt(io_b, r->tag_ids[j]);
+		BufferAppendS(io_b, "\"");
+	}
+	BufferAppendS(io_b, "]]");
+}
+
+/* Copies the escaped JSON string contents s (l bytes) into o_buffer, which
+ * holds m bytes, and returns the unescaped length. Runs without a backslash
+ * are found with memchr and copied in bulk. Output is truncated to m - 1
+ * bytes; the returned length is not. */
+static size_t
+JSONUnescape(const char* s, size_t l, char* o_buffer, size_t m)
+{
+	const char* end = s + l;
+	size_t length = 0;
+	
+	while (s < end) {
+		const char* slash;
+		size_t run;
+		unsigned int cp;
+		char utf8[4];
+		unsigned int utf8L;
+		
+		slash = memchr(s, '\\', end - s);
+		run = ((slash != NULL) ? slash : end) - s;
+		if (length < m) {
+			memcpy(&o_buffer[length], s, Min(run, m - length));
+		}
+		length += run;
+		s += run;
+		if (s >= end) break;
+		
+		s++;
+		if (s >= end) break;
+		utf8L = 1;
+		switch (*s++) {
+			case 'n': utf8[0] = '\n'; break;
+			case 'r': utf8[0] = '\r'; break;
+			case 't': utf8[0] = '\t'; break;
+			case 'b': utf8[0] = '\b'; break;
+			case 'f': utf8[0] = '\f'; break;
+			case 'u':
+				{
+					unsigned int k;
+					
+					for (k = 0, cp = 0; k < 4 && s < end; ++k, ++s) {
+						cp = cp * 16 + (isdigit((unsigned char) *s) ?
+						                *s - '0' : (tolower(*s) - 'a' + 10));
+					}
+					/* Surrogate pair */
+					if (cp >= 0xD800 && cp < 0xDC00 && end - s >= 6 &&
+					    s[0] == '\\' && s[1] == 'u') {
+						unsigned int low = 0;
+						
+						for (k = 2; k < 6; ++k) {
+							low = low * 16 + (isdigit((unsigned char) s[k]) ?
+							                  s[k] - '0' : (tolower(s[k]) - 'a' + 10));
+						}
+						if (low >= 0xDC00 && low < 0xE000) {
+							cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+							s += 6;
+						}
+					}
+					
+					if (cp < 0x80) {
+						utf8[0] = cp;
+					} else if (cp < 0x800) {
+						utf8[0] = 0xC0 | (cp >> 6);
+						utf8[1] = 0x80 | (cp & 0x3F);
+						utf8L = 2;
+					} else if (cp < 0x10000) {
+						utf8[0] = 0xE0 | (cp >> 12);
+						utf8[1] = 0x80 | ((cp >> 6) & 0x3F);
+						utf8[2] = 0x80 | (cp & 0x3F);
+						utf8L = 3;
+					} else {
+						utf8[0] = 0xF0 | (cp >> 18);
+						utf8[1] = 0x80 | ((cp >> 12) & 0x3F);
+						utf8[2] = 0x80 | ((cp >> 6) & 0x3F);
+						utf8[3] = 0x80 | (cp & 0x3F);
+						utf8L = 4;
+					}
+				}
+				break;
+			default: utf8[0] = s[-1]; break;
+		}
+		if (length + utf8L <= m) {
+			memcpy(&o_buffer[length], utf8, utf8L);
+		}
+		length += utf8L;
+	}
+	
+	if (m > 0) {
+		o_buffer[Min(length, m - 1)] = '\0';
+	}
+	return length;
+}
+
+#ifndef CRC32C_HW
+static uint32_t crc32c_table[8][256];
+#endif
+
+/* Builds the tables used when there is no CRC32 instruction (slicing-by-8).
+ * Must be called before CRC32C(), and not from more than one thread. */
+static void
+InitCRC32C(void)
+{
+#ifndef CRC32C_HW
+	uint32_t i, j, crc;
+	
+	if (crc32c_table[0][1] != 0) {
+		return;
+	}
+	for (i = 0; i < 256; ++i) {
+		for (crc = i, j = 0; j < 8; ++j) {
+			crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1));
+		}
+		crc32c_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; ++i) {
+		for (j = 1; j < 8; ++j) {
+			crc = crc32c_table[j - 1][i];
+			crc32c_table[j][i] = (crc >> 8) ^ crc32c_table[0][crc & 0xFF];
+		}
+	}
+#endif
+}
+
+/* CRC32C (Castagnoli) of n bytes, continuing from crc (0 to start). Uses the
+ * SSE4.2 CRC32 instruction when built for it, eight bytes at a time. */
+static uint32_t
+CRC32C(uint32_t crc, const void* data, size_t n)
+{
+	const unsigned char* p = data;
+	
+	crc = ~crc;
+#ifdef CRC32C_HW
+	for (; n >= 8; n -= 8, p += 8) {
+		uint64_t word;
+		
+		memcpy(&word, p, sizeof(word));
+		crc = (uint32_t) _mm_crc32_u64(crc, word);
+	}
+	for (; n > 0; --n) {
+		crc = _mm_crc32_u8(crc, *p++);
+	}
+#else
+	for (; n >= 8; n -= 8, p += 8) {
+		uint32_t lo = crc ^ ((uint32_t) p[0] | (uint32_t) p[1] << 8 |
+		                     (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24);
+		
+		crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^
+		      crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+		      crc32c_table[3][p[4]] ^ crc32c_table[2][p[5]] ^
+		      crc32c_table[1][p[6]] ^ crc32c_table[0][p[7]];
+	}
+	for (; n > 0; --n) {
+		crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xFF];
+	}
+#endif
+	
+	return ~crc;
+}
+
+static void*
+RunParallelThread(void* arg)
+{
+	ParallelJob* job = arg;
+	
+	job->fn(job->ctx, job->begin, job->end);
+	return NULL;
+}
+
+/* Splits [0, count) into contiguous ranges and runs fn on each range from its
+ * own thread, one per CPU (at most MAX_THREAD_C), giving each thread at least
+ * minPerThread items. The calling thread takes the first range. */
+static void
+RunParallel(unsigned int count, unsigned int minPerThread,
+            void (*fn)(void* ctx, unsigned int begin, unsigned int end),
+            void* ctx)
+{
+	ParallelJob jobs[MAX_THREAD_C];
+	pthread_t   threads[MAX_THREAD_C];
+	int         started[MAX_THREAD_C];
+	long threadC;
+	int t;
+	
+	threadC = sysconf(_SC_NPROCESSORS_ONLN);
+	threadC = Min(threadC, MAX_THREAD_C);
+	threadC = Min(threadC, count / Max(minPerThread, 1));
+	threadC = Max(threadC, 1);
+	
+	for (t = 0; t < threadC; ++t) {
+		jobs[t].fn    = fn;
+		jobs[t].ctx   = ctx;
+		jobs[t].begin = (unsigned int) ((unsigned long long) count * t / threadC);
+		jobs[t].end   = (unsigned int) ((unsigned long long) count * (t + 1) /
+		                                threadC);
+		started[t] = false;
+	}
+	for (t = 1; t < threadC; ++t) {
+		started[t] = pthread_create(&threads[t], NULL, RunParallelThread,
+		                            &jobs[t]) == 0;
+	}
+	
+	fn(ctx, jobs[0].begin, jobs[0].end);
+	for (t = 1; t < threadC; ++t) {
+		if (started[t] == true) {
+			pthread_join(threads[t], NULL);
+		} else {
+			fn(ctx, jobs[t].begin, jobs[t].end);
+		}
+	}
+}
+
+static char*
+stristr(const char* a, const char* b)
+{
+	const char* p1 = a;
+	const char* p2 = b;
+	const char* r = *p2 == 0 ? a : 0;
+	
+	while (*p1 != 0 && * p2 != 0) {
+		if (toupper((unsigned char) *p1) == toupper((unsigned char) *p2)) {
+			if (r == 0) {
+				r = p1;
+			}
+			p2++;
+		} else {
+			p2 = b;
+			if (r != 0) {
+				p1 = r + 1;
+			}
+			
+			if (toupper((unsigned char)*p1) == toupper((unsigned char)*p2)) {
+				r = p1;
+				p2++;
+			} else {
+				r = 0;
+			}
+		}
+		
+		p1++;
+	}
+	
+	return *p2 == 0 ? (char*)r : 0;
+}
+
+static int
+stricmp(const char* a, const char* b)
+{
+	if (a == NULL || b == NULL) {
+		return(false);
+	}
+	while(toupper(*a) && (toupper(*a) == toupper(*b))) {
+		a++;
+		b++;
+	}
+	
+	return *(const char*) a - *(const char*) b;
+}
+
+static char*
+strcpyt(char* d, char* s, unsigned int m, int l)
+{
+	int i;
+	
+	/* Sometimes I only want to copy a substring, other times the whole
+	 * string. In the latter case, it is sometimes annoying to have to 
+	 * call strlen and input a large variable name. Instead I can pass in
+	 * -1 and this will save me the time. */
+	if (l == -1) {
+		l = strlen(s);
+	}
+	if (l >= m) {
+		l = m - 1;
+	}
+	
+	strncpy(d, s, l);
+	if ((l + 1 >= m) && (l > 4)) {
+		l = m - 4;
+		for (i = l; i < l + 3; ++i) {
+			d[i] = '.';
+		}
+		d[m - 1] = '\0';
+	} else {
+		d[l] = '\0';
+	}
+	
+	return NULL;
+}
+
+static int
+RowHasTagID(Row r, unsigned int id)
+{
+	unsigned int i;
+	for (i = 0; i < ROW_TAG_C; ++i) {
+		if (r.tag_ids[i] == id) {
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+static void
+PrintWithTagIDs(Core* c, unsigned int* tagIDs, unsigned int tc, Buffer* io_b)
+{
+	TagClosure** closures;
+	unsigned int i, j;
+	
+	closures = malloc(sizeof(TagClosure*) * (tc + 1));
+	for (j = 0; j < tc; ++j) {
+		closures[j] = GetTagClosure(c, tagIDs[j]);
+	}
+	for (i = 0; i < c->table.count; ++i) {
+		if (c->table.rows[i].id == 0) continue;
+		for (j = 0; j < tc; ++j) {
+			if (closures[j] != NULL && RowUnderTag(closures[j],
+			                                       &c->table.rows[i])) {
+				BufferAppendListedRow(io_b, &c->table.rows[i], c->tags);
+				break;
+			}
+		}
+	}
+	free(closures);
+}
+
+static char*
+GetTagName(Tags t, unsigned int id)
+{
+	unsigned int i;
+	for (i = 0; i < t.count; ++i) {
+		if (t.tags[i].id == id) {
+			return t.tags[i].name;
+		}
+	}
+	
+	return NULL;
+}
+
+static unsigned int
+GetTagID(Tags t, char* s)
+{
+	unsigned int i;
+	for (i = 0; i < t.count; ++i) {
+		if (t.tags[i].id != 0 && strcmp(t.tags[i].name, s) == 0) {
+			return t.tags[i].id;
+		}
+	}
+	for (i = 0; i < t.alias_c; ++i) {
+		if (t.aliases[i].id != 0 && strcmp(t.aliases[i].name, s) == 0) {
+			return (GetTagName(t, t.aliases[i].id) != NULL) ? t.aliases[i].id : 0;
+		}
+	}
+	
+	return 0;
+}
+
+/* aliases_filename has a line "<alias> <tag ID>" for each alias. */
+static void
+LoadTagAliases(Tags* io_t)
+{
+	char filename[512] = { 0 }, line[256];
+	unsigned int capacity = 0;
+	FILE* fp;
+	
+	GetConfigPath(filename);
+	strcat(filename, aliases_filename);
+	if ((fp = fopen(filename, "r")) == NULL) {
+		return;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		char* name, *id;
+		
+		name = strtok(line, " \t\r\n");
+		id = strtok(NULL, " \t\r\n");
+		if (name == NULL || id == NULL || strlen(name) >= TAG_NAME_S ||
+		    atoi(id) <= 0) continue;
+		if (io_t->alias_c == capacity) {
+			capacity = Max(16, capacity * 2);
+			io_t->aliases = realloc(io_t->aliases, sizeof(TagAlias) * capacity);
+		}
+		strcpy(io_t->aliases[io_t->alias_c].name, name);
+		io_t->aliases[io_t->alias_c++].id = atoi(id);
+	}
+	fclose(fp);
+}
+
+static void
+SaveTagAliases(Tags* t)
+{
+	char filename[512] = { 0 };
+	unsigned int i;
+	FILE* fp;
+	
+	GetConfigPath(filename);
+	strcat(filename, aliases_filename);
+	if ((fp = fopen(filename, "w")) == NULL) {
+		fprintf(stderr, "Could not write '%s'.\n", filename);
+		return;
+	}
+	for (i = 0; i < t->alias_c; ++i) {
+		if (t->aliases[i].id == 0) continue;
+		fprintf(fp, "%s %u\n", t->aliases[i].name, t->aliases[i].id);
+	}
+	fclose(fp);
+}
+
+/* Points alias name at tag id, or removes it if id is 0. Returns false if
+ * there was no such alias to remove. */
+static int
+SetTagAlias(Tags* io_t, const char* name, unsigned int id)
+{
+	unsigned int i;
+	
+	for (i = 0; i < io_t->alias_c; ++i) {
+		if (io_t->aliases[i].id != 0 && strcmp(io_t->aliases[i].name, name) == 0) {
+			io_t->aliases[i].id = id;
+			return true;
+		}
+	}
+	if (id == 0) {
+		return false;
+	}
+	io_t->aliases = realloc(io_t->aliases, sizeof(TagAlias) * (io_t->alias_c + 1));
+	strcpy(io_t->aliases[io_t->alias_c].name, name);
+	io_t->aliases[io_t->alias_c++].id = id;
+	
+	return true;
+}
+
+/* The tag ID alias name points at, or 0 if there is no such alias. */
+static unsigned int
+GetTagAlias(Tags t, const char* name)
+{
+	unsigned int i;
+	
+	for (i = 0; i < t.alias_c; ++i) {
+		if (t.aliases[i].id != 0 && strcmp(t.aliases[i].name, name) == 0) {
+			return t.aliases[i].id;
+		}
+	}
+	
+	return 0;
+}
+
+static void
+PrintRow(Row r, Tags tg)
+{
+	Buffer out;
+	
+	memset(&out, 0, sizeof(Buffer));
+	BufferAppendListedRow(&out, &r, tg);
+	fwrite(out.data, 1, out.length, stdout);
+	free(out.data);
+}
+
+/* A row as 'sbm list' shows it. */
+static void
+BufferAppendListedRow(Buffer* io_b, Row* r, Tags tg)
+{
+	unsigned int i, hasTags;
+	
+	BufferAppendUInt(io_b, r->id);
+	BufferAppendS(io_b, ". ");
+	BufferAppendS(io_b, r->title);
+	BufferAppendS(io_b, "\n\t > ");
+	BufferAppendS(io_b, GetRowURL(r));
+	BufferAppendS(io_b, "\n");
+	
+	if (strlen(r->comment) > 0) {
+		BufferAppendS(io_b, "\t + '");
+		BufferAppendS(io_b, r->comment);
+		BufferAppendS(io_b, "'\n");
+	}
+	
+	for (i = 0, hasTags = false; i < ROW_TAG_C; ++i) {
+		char* name;
+		
+		if (r->tag_ids[i] == 0 ||
+		    (name = GetTagName(tg, r->tag_ids[i])) == NULL) continue;
+		BufferAppendS(io_b, (hasTags == true) ? " " : "\t | ");
+		BufferAppendS(io_b, name);
+		BufferAppendS(io_b, " |");
+		hasTags = true;
+	}
+	if (hasTags) {
+		BufferAppendS(io_b, "\n");
+	}
+}
+
+static size_t
+CURLBuildPage(char* b, size_t s, size_t c, void* d)
+{
+	CURLData* cd;
+	int i;
+	
+	if (d == NULL){
+		return s * c;
+	}
+	
+	cd = (CURLData*) d;
+	if (cd->contents != NULL) {
+		if ((strstr(cd->contents, "</title>")  != NULL) ||
+		    (strstr(cd->contents, "</header>") != NULL)) {
+			return s * c;
+		}
+	}
+	
+	for (i = 0; i < c; ++i) {
+		cd->contents[cd->index] = b[i];
+		cd->index++;
+	}
+	
+	return s * c;
+}
+
+static void
+GetPageTitle(char* contents, char* o_buffer)
+{
+	char* startPos, *endPos;
+	int len;
+	
+	if (contents == NULL || strlen(contents) < 1) {
+		printf("No webpage contents read\n");
+	}
+	
+	startPos = strstr(contents, "<title>");
+	endPos   = strstr(contents, "</title>");
+	if (startPos == NULL) { 
+		printf("No <title> tag\n");
+	} 
+	if (endPos == NULL) {
+		printf("No </title> tag\n");
+	}
+	startPos += strlen("<title>");
+	assert(startPos < endPos);
+	
+	len = endPos - startPos;
+	strcpyt(o_buffer, startPos, TITLE_S, len);
+}
+
+static unsigned int
+OpenURLs(char** urls, unsigned int c)
+{
+	/* The opener is started directly with an argv array, so URLs are never
+	 * seen by a shell and are not limited in length. At most OPEN_JOBS_C
+	 * openers run at once. */
+	char* argv[OPEN_ARGS_C + 2];
+	unsigned int i, argC, running, opened;
+	pid_t pid;
+	int status;
+	
+	for (argC = 0; argC < OPEN_ARGS_C && opener[argC] != NULL; ++argC) {
+		argv[argC] = (char*) opener[argC];
+	}
+	argv[argC + 1] = NULL;
+	
+	for (i = 0, running = 0, opened = 0; i < c; ++i) {
+		if (running == OPEN_JOBS_C) {
+			if (wait(&status) > 0) {
+				running--;
+				if (WIFEXITED(status) && WEXITSTATUS(status) == 0) opened++;
+			}
+		}
+		
+		argv[argC] = urls[i];
+		if ((status = posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ))
+		    != 0) {
+			fprintf(stderr, "Could not run '%s': %s\n",
+			        argv[0], strerror(status));
+			continue;
+		}
+		running++;
+	}
+	
+	/* Openers normally hand the URL to the browser and exit straight away.
+	 * Give them a moment, but leave any that linger (e.g. the browser itself)
+	 * running rather than blocking until they are closed. */
+	for (i = 0; running > 0 && i < OPEN_WAIT_MS; ) {
+		if ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+			running--;
+			if (WIFEXITED(status) && WEXITSTATUS(status) == 0) opened++;
+		} else if (pid == 0) {
+			struct timespec ts = { 0, 10 * 1000000L };
+			nanosleep(&ts, NULL);
+			i += 10;
+		} else {
+			break;
+		}
+	}
+	
+	return opened + running;
+}
+
+static CURLLib*
+LoadCURL(void)
+{
+	static CURLLib lib;
+	unsigned int i;
+	
+	if (lib.handle != NULL) {
+		return &lib;
+	}
+	
+	for (i = 0; curl_libs[i] != NULL && lib.handle == NULL; ++i) {
+		lib.handle = dlopen(curl_libs[i], RTLD_NOW | RTLD_LOCAL);
+	}
+	if (lib.handle == NULL) {
+		fprintf(stderr, "Could not load libcurl (%s). Set the title with -t " \
+		        "instead.\n", dlerror());
+		exit(-1);
+	}
+	
+	/* Function pointers cannot be assigned from dlsym()'s void* in ISO C, so
+	 * write through the address of the pointer instead. */
+	*(void**) &lib.global_init   = dlsym(lib.handle, "curl_global_init");
+	*(void**) &lib.easy_init     = dlsym(lib.handle, "curl_easy_init");
+	*(void**) &lib.easy_setopt   = dlsym(lib.handle, "curl_easy_setopt");
+	*(void**) &lib.easy_perform  = dlsym(lib.handle, "curl_easy_perform");
+	*(void**) &lib.easy_getinfo  = dlsym(lib.handle, "curl_easy_getinfo");
+	*(void**) &lib.easy_cleanup  = dlsym(lib.handle, "curl_easy_cleanup");
+	*(void**) &lib.easy_strerror = dlsym(lib.handle, "curl_easy_strerror");
+	if (!lib.global_init  || !lib.easy_init    || !lib.easy_setopt  ||
+	    !lib.easy_perform || !lib.easy_getinfo || !lib.easy_cleanup ||
+	    !lib.easy_strerror) {
+		fprintf(stderr, "Could not find the libcurl functions sbm needs.\n");
+		exit(-1);
+	}
+	
+	if (lib.global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+		fprintf(stderr, "Could not init CURL.\n");
+		exit(-1);
+	}
+	
+	return &lib;
+}
+
+static CURLData*
+GetWebpage(char* url)
+{
+	CURLData* result;
+	CURLLib*  lib;
+	CURL*     curl;
+	CURLcode  code;
+	
+	lib = LoadCURL();
+	result = malloc(sizeof(CURLData));
+	memset(result, 0, sizeof(CURLData));
+	
+	{
+		/* NOTE: This is the biggest design problem. It first reads the page to
+		 * determine how much needs to be alloced, but this just doubles the
+		 * amount of time spent downloading. This is always going to be *much*
+		 * longer than just reallocating every CURLBuildPage() call... */
+		long size;
+		curl = lib->easy_init();
+		if (curl) {
+			CURLcode res;
+			lib->easy_setopt(curl, CURLOPT_URL, url);
+			lib->easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+			lib->easy_setopt(curl, CURLOPT_WRITEDATA, NULL);
+			lib->easy_setopt(curl, CURLOPT_WRITEFUNCTION, CURLBuildPage);
+			lib->easy_setopt(curl, CURLOPT_USERAGENT, "libcurl-agent/1.0");
+			res = lib->easy_perform(curl);
+			if (res == CURLE_OK) {
+				res = lib->easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T , &size);
+			}
+			lib->easy_cleanup(curl);
+		}
+		result->contents_length = size + 1;
+		result->contents = malloc(result->contents_length);
+		memset(result->contents, 0, result->contents_length);
+	}
+	
+	curl = lib->easy_init();
+	if (!curl) {
+		printf("Could not init CURL.");
+	}
+	lib->easy_setopt(curl, CURLOPT_URL, url);
+	lib->easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+	lib->easy_setopt(curl, CURLOPT_WRITEDATA, result);
+	lib->easy_setopt(curl, CURLOPT_WRITEFUNCTION, CURLBuildPage);
+	lib->easy_setopt(curl, CURLOPT_USERAGENT, "libcurl-agent/1.0");
+	
+	code = lib->easy_perform(curl);
+	if (code != CURLE_OK) {
+		fprintf(stderr,
+		        "Could not download page: %s\n",
+		        lib->easy_strerror(code));
+		free(result->contents);
+		exit(0);
+	}
+	
+	lib->easy_cleanup(curl);
+	return result;
+}
+
+static void
+ValidateTagName(char* io_buffer[], const unsigned int index)
+{
+	char buffer[TAG_NAME_S];
+	int i;
+	
+	assert(io_buffer[index]);
+	memset(buffer, 0, sizeof(char) * TAG_NAME_S);
+	if (isdigit(io_buffer[index][0])/* == true*/) {
+		printf("Invalid tag name. Tag names cannot start with a number.\n");
+		exit(0);
+	}
+	else if ((stricmp(io_buffer[index], "add") == 0) ||
+	         (stricmp(io_buffer[index], "update") == 0) ||
+	         (stricmp(io_buffer[index], "rename") == 0) ||
+	         (stricmp(io_buffer[index], "remove") == 0)) {
+		printf("Invalid tag name. Tag names cannot be set to reserved terms\n");
+		exit(0);
+	}
+	
+	if (strstr(io_buffer[index], " ") != NULL) {
+		for (i = 0; i < strlen(io_buffer[index]); ++i) {
+			char c = io_buffer[index][i];
+			if (c == ' ') {
+				buffer[i] = '-';
+			} else {
+				buffer[i] = c;
+			}
+		}
+	}
+	
+	if (strlen(buffer) > 0) {
+		strcpy(io_buffer[index], buffer);
+	}
+}
+
+static unsigned int
+GetInputTagIndex(Core* c, char* buffers[], const unsigned int inputIndex)
+{
+	int result;
+	int i;
+	
+	result = 0;
+	if (buffers[inputIndex] != NULL) {
+		if (isdigit(buffers[inputIndex][0])) {
+			const int value = atoi(buffers[inputIndex]);
+			for (i = 0, result = 0; i < c->tags.count; ++i) {
+				if (c->tags.tags[i].id == value) {
+					result = i;
+					break;
+				}
+			}
+		} else {
+			for (i = 0, result = 0; i < c->tags.count; ++i) {
+				if (stricmp(c->tags.tags[i].name, buffers[inputIndex]) == 0) {
+					result = i;
+					break;
+				}
+			}
+			if (i == c->tags.count) {
+				int index = FindTagIndex(c, GetTagID(c->tags,
+				                                     buffers[inputIndex]));
+				
+				result = Max(index, 0);
+			}
+		}
+	} else {
+		printf("Invalid args\n");
+		exit(0);
+	}
+	
+	return result;
+}
+
+static unsigned int
+GetInputTagIDs(Core* c, char* input, unsigned int** o_ids)
+{
+	unsigned int result, i;
+	char* curr;
+	
+	for (i = 0, result = 1; input[i]; ++i) {
+		if (input[i] == ' ') result++;
+	}
+	*o_ids = malloc(sizeof(unsigned int) * result);
+	
+	result = 0;
+	curr = strtok(input, " ");
+	while (curr != NULL) {
+		if (isdigit(curr[0])) {
+			(*o_ids)[result++] = atoi(curr);
+		} else if (((*o_ids)[result++] = GetTagID(c->tags, curr)) == 0) {
+			printf("Could not find tag '%s'\n", curr);
+			exit(-1);
+		}
+		curr = strtok(0, " ");
+	}
+	
+	return result;
+}
+
+static void
+GetCurrentDateTime(DateTime* o_dt)
+{
+	struct tm* t;
+	time_t now;
+	
+	now = time(0);
+	t = localtime(&now);
+	strftime(o_dt->last_updated, sizeof(o_dt->last_updated), "%F %T", t);
+	
+	if (sscanf
+	(
+		o_dt->last_updated,
+		"%d-%d-%d %d:%d:%d",
+		&o_dt->d_y, &o_dt->d_m, &o_dt->d_d,
+		&o_dt->t_h, &o_dt->t_m, &o_dt->t_s
+	) < 1) {
+		printf("Could not parse date and time\n");
+	}
+}
+
+static void
+UpdateRowTags(Core* io_c, unsigned int rowIndex, InputArgs* ia)
+{
+	char* tagInput;
+	int tagID, tagIndexInRow;
+	
+	tagInput = ia->word_buffers[WI_TAG];
+	{
+		if (isdigit(tagInput[0])) {
+			tagID = atoi(tagInput);
+			if (tagID < 1) {
+				printf("Invalid tag ID (%s)\n", tagInput);
+			}
+		} else {
+			int index;
+			ValidateTagName(ia->word_buffers, WI_TAG);
+			index = GetInputTagIndex(io_c, ia->word_buffers, WI_TAG);
+			tagID = io_c->tags.tags[index].id;
+		}
+	}
+	{
+		unsigned int i, full;
+		
+		for (i = 0, full = true, tagIndexInRow = -1; i < ROW_TAG_C; ++i) {
+			if (io_c->table.rows[rowIndex].tag_ids[i] == 0 &&
+			    tagIndexInRow == -1) {
+				full = false;
+				tagIndexInRow = i;
+			} else if (io_c->table.rows[rowIndex].tag_ids[i] == tagID) {
+				char confirmation;
+				
+				full = false;
+				tagIndexInRow = i;
+				printf("Are you sure you want to remove tag %s from row " \
+				       "%d? [Y/n] \n", GetTagName(io_c->tags, tagID),  tagID);
+				
+				scanf("%c", &confirmation);
+				if ((confirmation == 'y') || (confirmation == 'Y')) {
+					tagID = 0;
+				} else {
+					exit(0);
+				}
+				break;
+			}
+		}
+		
+		if (full == true) {
+			printf("Cannot add anymore tags to this url entry.\n");
+			exit(0);
+		}
+	}
+	
+	io_c->table.rows[rowIndex].tag_ids[tagIndexInRow] = tagID;
+	if (tagID != 0) {
+		TagRowsAdd(io_c, tagID, rowIndex);
+	}
+}
+
+static void
+GetConfigPath(char* o_buffer)
+{
+	if (strstr(cache_dir, "~/") != NULL) {
+		const char* homedir;
+		unsigned int index = 0, i;
+		
+		if ((homedir = getenv("HOME")) == NULL) {
+			homedir = getpwuid(getuid())->pw_dir;
+		}
+		
+		for (i = 0; i < strlen(cache_dir); ++i, ++index) {
+			if (cache_dir[i] == '~') {
+				unsigned int j;
+				for (j = 0; j < strlen(homedir); ++j, ++index) {
+					o_buffer[index] = homedir[j];
+				}
+				index--;
+			} else {
+				o_buffer[index] = cache_dir[i];
+			}
+		}
+	} else {
+		strcpy(o_buffer, cache_dir);
+	}
+}
+
+static char*
+GetRowURL(Row* r)
+{
+	if (r->url.long_url == true) {
+		return r->url.address.l;
+	}
+	return r->url.address.s;
+}
+
+static void
+GetURLHost(const char* url, char* o_buffer)
+{
+	/* Second-level labels which are registered under a country code, so that
+	 * "news.bbc.co.uk" is filed under "bbc.co.uk" rather than "co.uk". */
+	static const char* secondLevel[] = {
+		"ac", "co", "com", "edu", "gov", "net", "or", "org", NULL
+	};
+	const char* start, *end, *p;
+	const char* labels[4] = { NULL };
+	char host[S_ADDR_S];
+	unsigned int len, i, keep, labelC;
+	
+	start = strstr(url, "://");
+	start = (start != NULL) ? start + 3 : url;
+	for (end = start; *end && *end != '/' && *end != '?' && *end != '#'; ++end);
+	/* Drop any "user:password@" */
+	for (p = start; p < end; ++p) {
+		if (*p == '@') start = p + 1;
+	}
+	/* Drop the port */
+	for (p = start; p < end; ++p) {
+		if (*p == ':') {
+			end = p;
+			break;
+		}
+	}
+	
+	len = Min(end - start, S_ADDR_S - 1);
+	for (i = 0; i < len; ++i) {
+		host[i] = tolower((unsigned char) start[i]);
+	}
+	while (len > 0 && host[len - 1] == '.') len--;
+	host[len] = '\0';
+	
+	/* Remember where the last few labels start, right to left. */
+	labelC = 0;
+	for (i = len; i > 0 && labelC < 4; --i) {
+		if (host[i - 1] == '.') {
+			labels[labelC++] = &host[i];
+		}
+	}
+	if (labelC < 4 && len > 0) {
+		labels[labelC++] = host;
+	}
+	
+	keep = 2;
+	if (labelC >= 3 && strlen(labels[0]) == 2) {
+		for (i = 0; secondLevel[i] != NULL; ++i) {
+			unsigned int l = strlen(secondLevel[i]);
+			if (strncmp(labels[1], secondLevel[i], l) == 0 &&
+			    labels[1][l] == '.') {
+				keep = 3;
+				break;
+			}
+		}
+	}
+	/* An IPv4 address is its own host. */
+	if (labelC > 0 && isdigit((unsigned char) labels[0][0])) {
+		keep = labelC;
+	}
+	
+	if (labelC > keep) {
+		strcpy(o_buffer, labels[keep - 1]);
+	} else {
+		strcpy(o_buffer, host);
+	}
+}
+
+/* Writes the form of url under which two bookmarks count as the same page:
+ * without the scheme, user info, "www.", a default port, a trailing '/' or the
+ * fragment, and with the host in lower case. o_buffer must hold as many bytes
+ * as url. */
+static void
+CanonicalURL(const char* url, char* o_buffer)
+{
+	const char* start, *end, *p;
+	char* o = o_buffer;
+	
+	start = strstr(url, "://");
+	start = (start != NULL && strcspn(url, "/?#") > start - url) ? start + 3
+	                                                             : url;
+	for (end = start; *end && *end != '/' && *end != '?' && *end != '#'; ++end);
+	for (p = start; p < end; ++p) {
+		if (*p == '@') start = p + 1;
+	}
+	if (end - start > 4 && tolower((unsigned char) start[0]) == 'w' &&
+	    tolower((unsigned char) start[1]) == 'w' &&
+	    tolower((unsigned char) start[2]) == 'w' && start[3] == '.') {
+		start += 4;
+	}
+	for (p = start; p < end; ++p) {
+		if ((end - p == 3 && memcmp(p, ":80", 3) == 0) ||
+		    (end - p == 4 && memcmp(p, ":443", 4) == 0)) break;
+		*o++ = tolower((unsigned char) *p);
+	}
+	while (o > o_buffer && o[-1] == '.') o--;
+	
+	for (p = end; *p && *p != '#' && *p != '?'; ++p) {
+		*o++ = *p;
+	}
+	while (o > o_buffer && o[-1] == '/') o--;
+	for (; *p && *p != '#'; ++p) {
+		*o++ = *p;
+	}
+	*o = '\0';
+}
+
+static unsigned int
+HashString(const char* s)
+{
+	unsigned int h = 2166136261u;
+	while (*s) {
+		h ^= (unsigned char) *s++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static int
+FindHostIndex(Hosts* h, const char* name)
+{
+	unsigned int i;
+	
+	if (h->bucket_c == 0) return -1;
+	for (i = HashString(name) & (h->bucket_c - 1);
+	     h->buckets[i] != 0;
+	     i = (i + 1) & (h->bucket_c - 1)) {
+		if (strcmp(h->hosts[h->buckets[i] - 1].name, name) == 0) {
+			return h->buckets[i] - 1;
+		}
+	}
+	
+	return -1;
+}
+
+static Host*
+FindHost(Hosts* h, const char* url)
+{
+	char name[S_ADDR_S];
+	int index;
+	
+	GetURLHost(url, name);
+	if ((index = FindHostIndex(h, name)) < 0) {
+		return NULL;
+	}
+	
+	return &h->hosts[index];
+}
+
+static unsigned int
+InternHost(Hosts* io_h, const char* name)
+{
+	unsigned int i;
+	int index;
+	
+	if ((index = FindHostIndex(io_h, name)) >= 0) {
+		return index;
+	}
+	
+	if (io_h->count == io_h->capacity) {
+		io_h->capacity = Max(16, io_h->capacity * 2);
+		io_h->hosts = realloc(io_h->hosts, sizeof(Host) * io_h->capacity);
+	}
+	if ((io_h->count + 1) * 2 > io_h->bucket_c) {
+		io_h->bucket_c = Max(32, io_h->bucket_c * 2);
+		free(io_h->buckets);
+		io_h->buckets = malloc(sizeof(unsigned int) * io_h->bucket_c);
+		memset(io_h->buckets, 0, sizeof(unsigned int) * io_h->bucket_c);
+		for (index = 0; index < io_h->count; ++index) {
+			for (i = HashString(io_h->hosts[index].name) & (io_h->bucket_c - 1);
+			     io_h->buckets[i] != 0;
+			     i = (i + 1) & (io_h->bucket_c - 1));
+			io_h->buckets[i] = index + 1;
+		}
+	}
+	
+	index = io_h->count++;
+	memset(&io_h->hosts[index], 0, sizeof(Host));
+	io_h->hosts[index].name = malloc(strlen(name) + 1);
+	strcpy(io_h->hosts[index].name, name);
+	for (i = HashString(name) & (io_h->bucket_c - 1);
+	     io_h->buckets[i] != 0;
+	     i = (i + 1) & (io_h->bucket_c - 1));
+	io_h->buckets[i] = index + 1;
+	
+	return index;
+}
+
+static void
+IndexRowHost(Core* io_c, unsigned int rowIndex)
+{
+	char name[S_ADDR_S];
+	unsigned int index;
+	Host* host;
+	
+	GetURLHost(GetRowURL(&io_c->table.rows[rowIndex]), name);
+	index = InternHost(&io_c->hosts, name);
+	host = &io_c->hosts.hosts[index];
+	if (host->count == host->capacity) {
+		host->capacity = Max(4, host->capacity * 2);
+		host->rows = realloc(host->rows, sizeof(unsigned int) * host->capacity);
+	}
+	host->rows[host->count++] = rowIndex;
+}
+
+static void
+BuildHostIndex(Core* io_c)
+{
+	unsigned int i;
+	
+	for (i = 0; i < io_c->table.count; ++i) {
+		if (io_c->table.rows[i].id == 0) continue;
+		IndexRowHost(io_c, i);
+	}
+}
+
+static void
+FreeHostIndex(Hosts* io_h)
+{
+	unsigned int i;
+	
+	for (i = 0; i < io_h->count; ++i) {
+		free(io_h->hosts[i].name);
+		free(io_h->hosts[i].rows);
+	}
+	free(io_h->hosts);
+	free(io_h->buckets);
+	memset(io_h, 0, sizeof(Hosts));
+}
+
+static int
+CompareHostCounts(const void* a, const void* b)
+{
+	const HostCount* x = a, *y = b;
+	
+	if (x->live != y->live) {
+		return (x->live < y->live) ? 1 : -1;
+	}
+	return (x->index > y->index) - (x->index < y->index);
+}
+
+/* Everything which is derived from the rows rather than stored: the next
+ * free IDs and the secondary indexes. Runs once, after either loader. */
+static void
+FinishLoad(Core* io_c)
+{
+	unsigned int i, rowUID, tagUID;
+	
+	for (i = 0, rowUID = 0; i < io_c->table.count; ++i) {
+		rowUID = Max(io_c->table.rows[i].id, rowUID);
+	}
+	for (i = 0, tagUID = 0; i < io_c->tags.count; ++i) {
+		tagUID = Max(io_c->tags.tags[i].id, tagUID);
+	}
+	io_c->table.next_UID = Max(rowUID + 1, io_c->meta.rows_next);
+	io_c->tags.next_UID  = Max(tagUID + 1, io_c->meta.tags_next);
+	
+	BuildTagRows(io_c);
+	BuildHostIndex(io_c);
+}
+
+static int
+FindTagIndex(Core* c, unsigned int tagID)
+{
+	unsigned int i;
+	
+	if (tagID < c->tag_rows.by_id_c && c->tag_rows.by_id[tagID] != 0) {
+		return c->tag_rows.by_id[tagID] - 1;
+	}
+	for (i = 0; i < c->tags.count; ++i) {
+		if (c->tags.tags[i].id == tagID && tagID != 0) {
+			return i;
+		}
+	}
+	
+	return -1;
+}
+
+/* The index of the live tag s names, by ID, name or alias, or -1. */
+static int
+FindNamedTag(Core* c, const char* s)
+{
+	unsigned int id;
+	int index;
+	
+	id = isdigit(s[0]) ? (unsigned int) atoi(s) : GetTagID(c->tags, (char*) s);
+	index = FindTagIndex(c, id);
+	if (id == 0 || index < 0 || c->tags.tags[index].id == 0) {
+		return -1;
+	}
+	return index;
+}
+
+static TagRowList*
+GetTagRows(Core* c, unsigned int tagID)
+{
+	int index;
+	
+	if ((index = FindTagIndex(c, tagID)) < 0 || index >= c->tag_rows.list_c) {
+		return NULL;
+	}
+	return &c->tag_rows.lists[index];
+}
+
+static void
+TagRowsAdd(Core* io_c, unsigned int tagID, unsigned int rowIndex)
+{
+	TagRows* t = &io_c->tag_rows;
+	TagRowList* list;
+	unsigned int k;
+	int index;
+	
+	if ((index = FindTagIndex(io_c, tagID)) < 0) {
+		return;
+	}
+	if (tagID >= t->by_id_c) {
+		unsigned int c = Max(tagID + 1, t->by_id_c * 2);
+		t->by_id = realloc(t->by_id, sizeof(unsigned int) * c);
+		memset(&t->by_id[t->by_id_c], 0, sizeof(unsigned int) * (c - t->by_id_c));
+		t->by_id_c = c;
+	}
+	t->by_id[tagID] = index + 1;
+	if (index >= t->list_c) {
+		t->lists = realloc(t->lists, sizeof(TagRowList) * (index + 1));
+		memset(&t->lists[t->list_c], 0,
+		       sizeof(TagRowList) * (index + 1 - t->list_c));
+		t->list_c = index + 1;
+	}
+	
+	list = &t->lists[index];
+	if (list->count == list->capacity) {
+		list->capacity = Max(4, list->capacity * 2);
+		list->rows = realloc(list->rows, sizeof(unsigned int) * list->capacity);
+	}
+	list->rows[list->count++] = rowIndex;
+	
+	for (k = 0; k < t->closure_c; ++k) {
+		TagClosure* cl = &t->closures[k];
+		
+		if (cl->tags == NULL || tagID / 64 >= cl->tag_word_c ||
+		    !(cl->tags[tagID / 64] >> (tagID % 64) & 1)) continue;
+		if (rowIndex / 64 >= cl->row_word_c) {
+			unsigned int c = Max(rowIndex / 64 + 1, cl->row_word_c * 2);
+			
+			cl->rows = realloc(cl->rows, sizeof(uint64_t) * c);
+			memset(&cl->rows[cl->row_word_c], 0,
+			       sizeof(uint64_t) * (c - cl->row_word_c));
+			cl->row_word_c = c;
+		}
+		cl->rows[rowIndex / 64] |= 1ULL << (rowIndex % 64);
+	}
+}
+
+/* Gives the entries tagged src dst instead, then removes src and keeps its
+ * name as an alias of dst (written with the store, so that undoing the merge
+ * removes it again). Only the entries in src's list are visited. */
+static void
+MergeTag(Core* io_c, unsigned int srcIndex, unsigned int dstIndex)
+{
+	unsigned int src = io_c->tags.tags[srcIndex].id;
+	unsigned int dst = io_c->tags.tags[dstIndex].id;
+	unsigned int merged = 0, i, j;
+	TagRowList* list;
+	
+	/* TagRowsAdd() may move the lists, so src's is looked up each time */
+	for (i = 0; (list = GetTagRows(io_c, src)) != NULL && i < list->count; ++i) {
+		unsigned int index = list->rows[i];
+		Row* r = &io_c->table.rows[index];
+		
+		if (r->id == 0 || !RowHasTagID(*r, src)) continue;
+		JournalRow(io_c, index, false);
+		for (j = 0; r->tag_ids[j] != src; ++j);
+		if (RowHasTagID(*r, dst)) {
+			r->tag_ids[j] = 0;
+		} else {
+			r->tag_ids[j] = dst;
+			TagRowsAdd(io_c, dst, index);
+		}
+		GetCurrentDateTime(&r->datetime);
+		merged++;
+	}
+	
+	JournalTag(io_c, srcIndex, false);
+	io_c->tags.tags[srcIndex].id = 0;
+	for (i = 0; i < io_c->tags.alias_c; ++i) {
+		if (io_c->tags.aliases[i].id != src) continue;
+		JournalAlias(io_c, io_c->tags.aliases[i].name);
+		io_c->tags.aliases[i].id = dst;
+	}
+	JournalAlias(io_c, io_c->tags.tags[srcIndex].name);
+	SetTagAlias(&io_c->tags, io_c->tags.tags[srcIndex].name, dst);
+	
+	printf("Merged '%s' into '%s' (%u entries).\n",
+	       io_c->tags.tags[srcIndex].name, io_c->tags.tags[dstIndex].name, merged);
+	io_c->dirty = true;
+}
+
+static void
+BuildTagRows(Core* io_c)
+{
+	TagRows* t = &io_c->tag_rows;
+	unsigned int i, j;
+	
+	memset(t, 0, sizeof(TagRows));
+	t->list_c  = io_c->tags.count;
+	t->lists   = malloc(sizeof(TagRowList) * (t->list_c + 1));
+	memset(t->lists, 0, sizeof(TagRowList) * (t->list_c + 1));
+	t->by_id_c = io_c->tags.next_UID + 1;
+	t->by_id   = malloc(sizeof(unsigned int) * t->by_id_c);
+	memset(t->by_id, 0, sizeof(unsigned int) * t->by_id_c);
+	for (i = 0; i < io_c->tags.count; ++i) {
+		if (io_c->tags.tags[i].id == 0) continue;
+		t->by_id[io_c->tags.tags[i].id] = i + 1;
+	}
+	
+	/* Count first so that every list is allocated once. */
+	for (i = 0; i < io_c->table.count; ++i) {
+		Row* r = &io_c->table.rows[i];
+		if (r->id == 0) continue;
+		for (j = 0; j < ROW_TAG_C; ++j) {
+			if (r->tag_ids[j] < t->by_id_c && t->by_id[r->tag_ids[j]] != 0) {
+				t->lists[t->by_id[r->tag_ids[j]] - 1].capacity++;
+			}
+		}
+	}
+	for (i = 0; i < t->list_c; ++i) {
+		t->lists[i].rows = malloc(sizeof(unsigned int) *
+		                          (t->lists[i].capacity + 1));
+	}
+	for (i = 0; i < io_c->table.count; ++i) {
+		Row* r = &io_c->table.rows[i];
+		if (r->id == 0) continue;
+		for (j = 0; j < ROW_TAG_C; ++j) {
+			if (r->tag_ids[j] < t->by_id_c && t->by_id[r->tag_ids[j]] != 0) {
+				TagRowList* list = &t->lists[t->by_id[r->tag_ids[j]] - 1];
+				list->rows[list->count++] = i;
+			}
+		}
+	}
+}
+
+static void
+FreeTagRows(TagRows* io_t)
+{
+	unsigned int i;
+	
+	for (i = 0; i < io_t->list_c; ++i) {
+		free(io_t->lists[i].rows);
+	}
+	free(io_t->lists);
+	free(io_t->by_id);
+	FreeTagClosures(io_t);
+	memset(io_t, 0, sizeof(TagRows));
+}
+
+/* Tags are nested by name: "lang/rust" and "lang/rust/async" descend from
+ * "lang". Returns the closure of tagID, or NULL if there is no such tag. The
+ * rows of every tag in it are unioned into one bitset here, after which
+ * TagRowsAdd() keeps it up to date, so that looking for a tag with
+ * descendants costs the same as looking for one without. */
+static TagClosure*
+GetTagClosure(Core* c, unsigned int tagID)
+{
+	TagRows* t = &c->tag_rows;
+	TagClosure* cl;
+	const char* name;
+	unsigned int i, j;
+	size_t l;
+	int index;
+	
+	if ((index = FindTagIndex(c, tagID)) < 0) {
+		return NULL;
+	}
+	if (index >= t->closure_c) {
+		unsigned int n = Max(index + 1, c->tags.count);
+		
+		t->closures = realloc(t->closures, sizeof(TagClosure) * n);
+		memset(&t->closures[t->closure_c], 0,
+		       sizeof(TagClosure) * (n - t->closure_c));
+		t->closure_c = n;
+	}
+	cl = &t->closures[index];
+	if (cl->tags != NULL) {
+		return cl;
+	}
+	
+	cl->tag_word_c = c->tags.next_UID / 64 + 1;
+	cl->tags = malloc(sizeof(uint64_t) * cl->tag_word_c);
+	memset(cl->tags, 0, sizeof(uint64_t) * cl->tag_word_c);
+	cl->row_word_c = c->table.count / 64 + 1;
+	cl->rows = malloc(sizeof(uint64_t) * cl->row_word_c);
+	memset(cl->rows, 0, sizeof(uint64_t) * cl->row_word_c);
+	name = c->tags.tags[index].name;
+	l = strlen(name);
+	for (i = 0; i < c->tags.count; ++i) {
+		Tag* g = &c->tags.tags[i];
+		
+		if (g->id == 0 || g->id / 64 >= cl->tag_word_c ||
+		    (g->id != tagID && !(strncmp(g->name, name, l) == 0 &&
+		                         g->name[l] == '/'))) continue;
+		cl->tags[g->id / 64] |= 1ULL << (g->id % 64);
+		for (j = 0; i < t->list_c && j < t->lists[i].count; ++j) {
+			unsigned int row = t->lists[i].rows[j];
+			
+			cl->rows[row / 64] |= 1ULL << (row % 64);
+		}
+	}
+	
+	return cl;
+}
+
+/* Whether r has any tag of the closure */
+static int
+RowUnderTag(TagClosure* cl, Row* r)
+{
+	unsigned int i;
+	
+	for (i = 0; i < ROW_TAG_C; ++i) {
+		unsigned int id = r->tag_ids[i];
+		
+		if (id != 0 && id / 64 < cl->tag_word_c &&
+		    (cl->tags[id / 64] >> (id % 64) & 1)) return true;
+	}
+	
+	return false;
+}
+
+/* The first row at or after from whose bit is set, or end if there is none */
+static unsigned int
+NextClosureRow(TagClosure* cl, unsigned int from, unsigned int end)
+{
+	unsigned int w = from / 64;
+	uint64_t bits;
+	
+	if (w >= cl->row_word_c) {
+		return end;
+	}
+	bits = cl->rows[w] & (~0ULL << (from % 64));
+	while (bits == 0) {
+		if (++w >= cl->row_word_c) return end;
+		bits = cl->rows[w];
+	}
+	
+	return Min(w * 64 + __builtin_ctzll(bits), end);
+}
+
+/* Dropped whenever the tags themselves may have changed */
+static void
+FreeTagClosures(TagRows* io_t)
+{
+	unsigned int i;
+	
+	for (i = 0; i < io_t->closure_c; ++i) {
+		free(io_t->closures[i].tags);
+		free(io_t->closures[i].rows);
+	}
+	free(io_t->closures);
+	io_t->closures = NULL;
+	io_t->closure_c = 0;
+}
+
+/* Returns the length of the UTF-8 sequence at s, or 0 if it is not valid. */
+static unsigned int
+UTF8SequenceLength(const unsigned char* s)
+{
+	unsigned int l, i;
+	
+	if (s[0] < 0x80) return 1;
+	else if (s[0] >= 0xC2 && s[0] <= 0xDF) l = 2;
+	else if (s[0] >= 0xE0 && s[0] <= 0xEF) l = 3;
+	else if (s[0] >= 0xF0 && s[0] <= 0xF4) l = 4;
+	else return 0;
+	
+	for (i = 1; i < l; ++i) {
+		if ((s[i] & 0xC0) != 0x80) return 0;
+	}
+	/* Overlong forms, surrogates and code points past U+10FFFF */
+	if ((s[0] == 0xE0 && s[1] < 0xA0) || (s[0] == 0xED && s[1] > 0x9F) ||
+	    (s[0] == 0xF0 && s[1] < 0x90) || (s[0] == 0xF4 && s[1] > 0x8F)) {
+		return 0;
+	}
+	
+	return l;
+}
+
+/* Checks s, replacing invalid bytes with '?' when repair is set. Plain ASCII
+ * is skipped eight bytes at a time. */
+static int
+CheckUTF8(char* s, int repair)
+{
+	const unsigned char* p = (const unsigned char*) s;
+	const unsigned char* end = p + strlen(s);
+	int valid = true;
+	
+	while (p < end) {
+		uint64_t word;
+		unsigned int l;
+		
+		if (end - p >= sizeof(word)) {
+			memcpy(&word, p, sizeof(word));
+			if ((word & 0x8080808080808080ULL) == 0) {
+				p += sizeof(word);
+				continue;
+			}
+		}
+		if ((l = UTF8SequenceLength(p)) == 0) {
+			valid = false;
+			if (repair == false) return false;
+			*(unsigned char*) p = '?';
+			l = 1;
+		}
+		p += l;
+	}
+	
+	return valid;
+}
+
+static void
+FsckRows(void* ctx, unsigned int begin, unsigned int end)
+{
+	FsckJob* job = ctx;
+	Core* c = job->core;
+	unsigned int i, j, k;
+	
+	for (i = begin; i < end; ++i) {
+		Row* r = &c->table.rows[i];
+		unsigned char problems = 0;
+		
+		if (r->id == 0) continue;
+		if (!CheckUTF8(GetRowURL(r), false) || !CheckUTF8(r->title, false) ||
+		    !CheckUTF8(r->comment, false)) {
+			problems |= FP_BAD_UTF8;
+		}
+		for (j = 0; j < ROW_TAG_C; ++j) {
+			if (r->tag_ids[j] == 0) continue;
+			if (r->tag_ids[j] >= c->tag_rows.by_id_c ||
+			    c->tag_rows.by_id[r->tag_ids[j]] == 0) {
+				problems |= FP_DANGLING_TAG;
+			}
+			for (k = 0; k < j; ++k) {
+				if (r->tag_ids[k] == r->tag_ids[j]) problems |= FP_REPEATED_TAG;
+			}
+		}
+		if (r->truncated == true) {
+			problems |= FP_TRUNCATED;
+		}
+		job->problems[i] = problems;
+	}
+}
+
+static int
+CompareRowIDs(const void* a, const void* b)
+{
+	const unsigned int* x = a, *y = b;
+	
+	if (x[0] != y[0]) return (x[0] > y[0]) - (x[0] < y[0]);
+	return (x[1] > y[1]) - (x[1] < y[1]);
+}
+
+static void
+FsckReport(unsigned int* io_shown, const char* subject, unsigned int id,
+           const char* what)
+{
+	if ((*io_shown)++ >= FSCK_REPORT_C) {
+		return;
+	}
+	if (id != 0) {
+		printf("%s %d: %s\n", subject, id, what);
+	} else {
+		printf("%s: %s\n", subject, what);
+	}
+}
+
+/* Validates the whole store: the per-row checks run in parallel, then the
+ * table-wide ones (duplicate IDs, tags, saved IDs, derived indexes). Returns
+ * how many problems were found, which are fixed when repair is set. */
+static unsigned int
+Fsck(Core* io_c, int repair)
+{
+	FsckJob job;
+	unsigned int i, j, k, shown, problemC, truncatedC, maxID;
+	unsigned int* ids;
+	
+	job.core = io_c;
+	job.problems = malloc(io_c->table.count + 1);
+	memset(job.problems, 0, io_c->table.count + 1);
+	RunParallel(io_c->table.count, 16384, FsckRows, &job);
+	
+	problemC = 0;
+	truncatedC = 0;
+	shown = 0;
+	
+	/* Duplicate row IDs: sort (id, index) pairs and compare neighbours. */
+	ids = malloc(sizeof(unsigned int) * 2 * (io_c->table.count + 1));
+	for (i = 0, k = 0, maxID = 0; i < io_c->table.count; ++i) {
+		if (io_c->table.rows[i].id == 0) continue;
+		ids[k * 2]     = io_c->table.rows[i].id;
+		ids[k * 2 + 1] = i;
+		maxID = Max(maxID, io_c->table.rows[i].id);
+		k++;
+	}
+	qsort(ids, k, sizeof(unsigned int) * 2, CompareRowIDs);
+	for (i = 1; i < k; ++i) {
+		if (ids[i * 2] == ids[(i - 1) * 2]) {
+			job.problems[ids[i * 2 + 1]] |= FP_DUPLICATE_ID;
+		}
+	}
+	free(ids);
+	
+	for (i = 0; i < io_c->table.count; ++i) {
+		Row* r = &io_c->table.rows[i];
+		unsigned char p = job.problems[i];
+		
+		if (p == 0) continue;
+		if (p & FP_BAD_UTF8) {
+			FsckReport(&shown, "row", r->id, "invalid UTF-8");
+			if (repair == true) {
+				CheckUTF8(GetRowURL(r), true);
+				CheckUTF8(r->title, true);
+				CheckUTF8(r->comment, true);
+			}
+			problemC++;
+		}
+		if (p & (FP_DANGLING_TAG | FP_REPEATED_TAG)) {
+			FsckReport(&shown, "row", r->id,
+			           (p & FP_DANGLING_TAG) ? "refers to a tag which does not exist"
+			                                 : "has the same tag more than once");
+			if (repair == true) {
+				for (j = 0; j < ROW_TAG_C; ++j) {
+					if (r->tag_ids[j] == 0) continue;
+					if (FindTagIndex(io_c, r->tag_ids[j]) < 0) {
+						r->tag_ids[j] = 0;
+						continue;
+					}
+					for (k = 0; k < j; ++k) {
+						if (r->tag_ids[k] == r->tag_ids[j]) {
+							r->tag_ids[j] = 0;
+							break;
+						}
+					}
+				}
+			}
+			problemC++;
+		}
+		if (p & FP_DUPLICATE_ID) {
+			FsckReport(&shown, "row", r->id,
+			           "shares its ID with an earlier row");
+			if (repair == true) {
+				r->id = io_c->table.next_UID++;
+				printf("\trow given the new ID %d\n", r->id);
+			}
+			problemC++;
+		}
+		if (p & FP_TRUNCATED) {
+			truncatedC++;
+		}
+	}
+	free(job.problems);
+	
+	for (i = 0; i < io_c->tags.count; ++i) {
+		Tag* t = &io_c->tags.tags[i];
+		
+		if (t->id == 0) continue;
+		if (!CheckUTF8(t->name, repair)) {
+			FsckReport(&shown, "tag", t->id, "invalid UTF-8");
+			problemC++;
+		}
+		for (j = 0; j < i; ++j) {
+			Tag* u = &io_c->tags.tags[j];
+			
+			if (u->id == 0) continue;
+			if (u->id == t->id) {
+				FsckReport(&shown, "tag", t->id,
+				           "shares its ID with an earlier tag");
+				if (repair == true) {
+					t->id = io_c->tags.next_UID++;
+				}
+				problemC++;
+				break;
+			} else if (stricmp(u->name, t->name) == 0) {
+				FsckReport(&shown, "tag", t->id,
+				           "has the same name as an earlier tag");
+				if (repair == true) {
+					char suffix[16];
+					
+					sprintf(suffix, "-%d", t->id);
+					t->name[Min(strlen(t->name),
+					            TAG_NAME_S - 1 - strlen(suffix))] = '\0';
+					strcat(t->name, suffix);
+				}
+				problemC++;
+				break;
+			}
+		}
+	}
+	
+	if (io_c->bad_block_c > 0) {
+		FsckReport(&shown, "store", 0,
+		           "damaged blocks of rows were skipped when loading");
+		problemC++;
+	}
+	{
+		FILE* fp;
+		char filename[512] = { 0 };
+		Merkle saved;
+		
+		GetConfigPath(filename);
+		strcat(filename, merkle_filename);
+		if ((fp = fopen(filename, "rb")) != NULL) {
+			fclose(fp);
+			if (!LoadMerkle(&saved, io_c->meta.generation)) {
+				FsckReport(&shown, "store", 0,
+				           "merkle.bin does not match the store");
+				problemC++;
+			} else {
+				Merkle fresh;
+				
+				/* Built from the rows, as GetMerkle() would load the file */
+				MerkleBuild(io_c, &fresh);
+				if (saved.leaf_c != fresh.leaf_c ||
+				    memcmp(saved.nodes, fresh.nodes,
+				           sizeof(uint64_t) * 2 * saved.leaf_c) != 0) {
+					FsckReport(&shown, "store", 0,
+					           "merkle.bin does not match the rows");
+					problemC++;
+				}
+				free(saved.nodes);
+				free(fresh.nodes);
+			}
+		}
+	}
+	if (FsckReplica(io_c, repair) > 0) {
+		FsckReport(&shown, "store", 0,
+		           "replica.json does not match the store");
+		problemC++;
+	}
+	if (io_c->meta.rows_next != 0 && io_c->meta.rows_next <= maxID) {
+		FsckReport(&shown, "store", 0,
+		           "saved next row ID is already in use");
+		problemC++;
+	}
+	
+	if (shown > FSCK_REPORT_C) {
+		printf("... and %d more\n", shown - FSCK_REPORT_C);
+	}
+	if (truncatedC > 0) {
+		printf("%d row(s) had fields which were too long and have been " \
+		       "shortened to fit.\n", truncatedC);
+	}
+	if (io_c->meta.rows_next == 0) {
+		printf("The store does not record its next IDs yet; the next save " \
+		       "will add them.\n");
+	}
+	
+	if (repair == true) {
+		FreeTagRows(&io_c->tag_rows);
+		FreeHostIndex(&io_c->hosts);
+		BuildTagRows(io_c);
+		BuildHostIndex(io_c);
+		printf("%d problem(s) repaired, indexes rebuilt.\n", problemC);
+	} else if (problemC > 0) {
+		printf("%d problem(s) found. Run 'sbm fsck --repair' to fix them.\n",
+		       problemC);
+	} else {
+		printf("No problems found.\n");
+	}
+	
+	return problemC;
+}
+
+static unsigned int
+HashCanonicalURL(const char* url)
+{
+	char stack[1024], *buffer;
+	unsigned int h;
+	size_t l = strlen(url);
+	
+	buffer = (l < sizeof(stack)) ? stack : malloc(l + 1);
+	CanonicalURL(url, buffer);
+	h = HashString(buffer);
+	if (buffer != stack) free(buffer);
+	
+	return h;
+}
+
+static int
+SameCanonicalURL(const char* a, const char* b)
+{
+	char stackA[1024], stackB[1024], *bufferA, *bufferB;
+	size_t la = strlen(a), lb = strlen(b);
+	int same;
+	
+	bufferA = (la < sizeof(stackA)) ? stackA : malloc(la + 1);
+	bufferB = (lb < sizeof(stackB)) ? stackB : malloc(lb + 1);
+	CanonicalURL(a, bufferA);
+	CanonicalURL(b, bufferB);
+	same = strcmp(bufferA, bufferB) == 0;
+	if (bufferA != stackA) free(bufferA);
+	if (bufferB != stackB) free(bufferB);
+	
+	return same;
+}
+
+static void
+HashURLs(void* ctx, unsigned int begin, unsigned int end)
+{
+	URLHashJob* job = ctx;
+	unsigned int i;
+	
+	for (i = begin; i < end; ++i) {
+		if (job->rows[i].id == 0) continue;
+		job->hashes[i] = HashCanonicalURL(GetRowURL(&job->rows[i]));
+	}
+}
+
+/* Folds o (from the other store, with its tags already mapped) into row
+ * index: the newer title and comment win and the tags are joined. Returns
+ * whether anything changed. */
+static int
+MergeRow(Core* io_c, unsigned int index, Row* o)
+{
+	Row* r = &io_c->table.rows[index];
+	unsigned int add[ROW_TAG_C], addC, i, j;
+	int newer;
+	
+	newer = strcmp(o->datetime.last_updated, r->datetime.last_updated) > 0 &&
+	        (strcmp(o->title, r->title) != 0 ||
+	         strcmp(o->comment, r->comment) != 0);
+	for (i = 0, addC = 0; i < ROW_TAG_C; ++i) {
+		if (o->tag_ids[i] != 0 && !RowHasTagID(*r, o->tag_ids[i])) {
+			add[addC++] = o->tag_ids[i];
+		}
+	}
+	for (i = 0, j = 0; i < ROW_TAG_C && j < addC; ++i) {
+		if (r->tag_ids[i] == 0) j++;
+	}
+	addC = j;
+	if (newer == false && addC == 0) {
+		return false;
+	}
+	
+	JournalRow(io_c, index, false);
+	if (newer == true) {
+		strcpy(r->title, o->title);
+		strcpy(r->comment, o->comment);
+		r->datetime = o->datetime;
+	}
+	for (i = 0, j = 0; i < ROW_TAG_C && j < addC; ++i) {
+		if (r->tag_ids[i] != 0) continue;
+		r->tag_ids[i] = add[j++];
+		TagRowsAdd(io_c, r->tag_ids[i], index);
+	}
+	
+	return true;
+}
+
+/* Merges the store at filename into this one. Rows are matched on their
+ * canonical URL with a hash join: every URL of both stores is hashed (in
+ * parallel) once, this store's rows go into an open-addressed table, and
+ * each row of the other store probes it. */
+static void
+MergeStore(Core* io_c, const char* filename)
+{
+	Core other;
+	char* contents;
+	size_t contentsSize;
+	unsigned int* tagMap, *hashes, *otherHashes, *buckets;
+	unsigned int bucketC, mask, localC, i, j;
+	unsigned int added = 0, updated = 0, tagsAdded = 0;
+	
+	{
+		FILE* fp;
+		
+		if ((fp = fopen(filename, "rb")) == NULL) {
+			fprintf(stderr, "Could not open '%s'.\n", filename);
+			exit(-1);
+		}
+		fseek(fp, 0, SEEK_END);
+		contentsSize = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		contents = malloc(contentsSize + 1);
+		contents[fread(contents, 1, contentsSize, fp)] = '\0';
+		fclose(fp);
+	}
+	memset(&other, 0, sizeof(Core));
+	LoadStore(contents, contentsSize, &other);
+	if (other.bad_block_c > 0) {
+		fprintf(stderr, "%d damaged block(s) of '%s' were skipped.\n",
+		        other.bad_block_c, filename);
+	}
+	
+	/* Tags are matched by name; the other store's IDs mean nothing here. */
+	tagMap = malloc(sizeof(unsigned int) * (other.tags.next_UID + 1));
+	memset(tagMap, 0, sizeof(unsigned int) * (other.tags.next_UID + 1));
+	for (i = 0; i < other.tags.count; ++i) {
+		Tag* t = &other.tags.tags[i];
+		unsigned int id;
+		
+		if (t->id == 0) continue;
+		if ((id = GetTagID(io_c->tags, t->name)) == 0) {
+			io_c->tags.tags = realloc(io_c->tags.tags,
+			                          sizeof(Tag) * (io_c->tags.count + 2));
+			memset(&io_c->tags.tags[io_c->tags.count], 0, sizeof(Tag) * 2);
+			strcpy(io_c->tags.tags[io_c->tags.count].name, t->name);
+			id = io_c->tags.tags[io_c->tags.count].id = io_c->tags.next_UID++;
+			JournalTag(io_c, io_c->tags.count++, true);
+			tagsAdded++;
+		}
+		tagMap[t->id] = id;
+	}
+	for (i = 0; i < other.table.count; ++i) {
+		Row* o = &other.table.rows[i];
+		
+		for (j = 0; j < ROW_TAG_C; ++j) {
+			o->tag_ids[j] = (o->tag_ids[j] <= other.tags.next_UID)
+			                ? tagMap[o->tag_ids[j]] : 0;
+		}
+	}
+	free(tagMap);
+	
+	localC = io_c->table.count;
+	io_c->table.rows = realloc(io_c->table.rows, sizeof(Row) *
+	                           (localC + other.table.count + 1));
+	memset(&io_c->table.rows[localC], 0, sizeof(Row) * (other.table.count + 1));
+	hashes = malloc(sizeof(unsigned int) * (localC + other.table.count + 1));
+	otherHashes = malloc(sizeof(unsigned int) * (other.table.count + 1));
+	{
+		URLHashJob job;
+		
+		job.rows = io_c->table.rows;
+		job.hashes = hashes;
+		RunParallel(localC, 4096, HashURLs, &job);
+		job.rows = other.table.rows;
+		job.hashes = otherHashes;
+		RunParallel(other.table.count, 4096, HashURLs, &job);
+	}
+	
+	/* Room for both stores at no more than half full; slots hold index + 1. */
+	for (bucketC = 16; bucketC < (localC + other.table.count) * 2; bucketC *= 2);
+	mask = bucketC - 1;
+	buckets = malloc(sizeof(unsigned int) * bucketC);
+	memset(buckets, 0, sizeof(unsigned int) * bucketC);
+	for (i = 0; i < localC; ++i) {
+		if (io_c->table.rows[i].id == 0) continue;
+		for (j = hashes[i] & mask; buckets[j] != 0; j = (j + 1) & mask);
+		buckets[j] = i + 1;
+	}
+	
+	for (i = 0; i < other.table.count; ++i) {
+		Row* o = &other.table.rows[i];
+		Row* r;
+		unsigned int k, index;
+		
+		if (o->id == 0) continue;
+		for (j = otherHashes[i] & mask; buckets[j] != 0; j = (j + 1) & mask) {
+			index = buckets[j] - 1;
+			if (hashes[index] == otherHashes[i] &&
+			    SameCanonicalURL(GetRowURL(&io_c->table.rows[index]),
+			                     GetRowURL(o))) break;
+		}
+		if (buckets[j] != 0) {
+			updated += MergeRow(io_c, buckets[j] - 1, o);
+			continue;
+		}
+		
+		/* A new row. The long URL (if any) is taken over from other. */
+		index = io_c->table.count++;
+		r = &io_c->table.rows[index];
+		*r = *o;
+		o->url.long_url = false;
+		r->truncated = false;
+		r->id = io_c->table.next_UID++;
+		for (j = 0, k = 0; j < ROW_TAG_C; ++j) {
+			unsigned int id = r->tag_ids[j];
+			
+			r->tag_ids[j] = 0;
+			if (id != 0) r->tag_ids[k++] = id;
+		}
+		JournalRow(io_c, index, true);
+		for (j = 0; j < k; ++j) {
+			TagRowsAdd(io_c, r->tag_ids[j], index);
+		}
+		IndexRowHost(io_c, index);
+		AutotagRow(io_c, index);
+		
+		hashes[index] = otherHashes[i];
+		for (j = hashes[index] & mask; buckets[j] != 0; j = (j + 1) & mask);
+		buckets[j] = index + 1;
+		added++;
+	}
+	
+	printf("Merged '%s': %d entries added, %d updated, %d tags added.\n",
+	       filename, added, updated, tagsAdded);
+	io_c->dirty = added > 0 || updated > 0 || tagsAdded > 0;
+	
+	free(buckets);
+	free(hashes);
+	free(otherHashes);
+	for (i = 0; i < other.table.count; ++i) {
+		if (other.table.rows[i].url.long_url == true) {
+			free(other.table.rows[i].url.address.l);
+		}
+	}
+	free(other.table.rows);
+	free(other.tags.tags);
+	FreeHostIndex(&other.hosts);
+	FreeTagRows(&other.tag_rows);
+	free(other.quarantine.data);
+}
+
+
+/* Compiles the c patterns (which must not be empty) into o_m. */
+static void
+BuildMatcher(Matcher* o_m, char** patterns, unsigned int c)
+{
+	unsigned int total = 1, i, s;
+	unsigned int* queue, *fail;
+	
+	memset(o_m, 0, sizeof(Matcher));
+	for (i = 0; i < c; ++i) {
+		total += strlen(patterns[i]);
+	}
+	
+	/* Classes of the bytes found in patterns, either case alike */
+	o_m->class_c = 1;
+	for (i = 0; i < c; ++i) {
+		unsigned char* p;
+		
+		for (p = (unsigned char*) patterns[i]; *p != '\0'; ++p) {
+			unsigned char b = tolower(*p);
+			
+			if (o_m->classes[b] == 0) {
+				o_m->classes[b] = o_m->classes[toupper(b)] = o_m->class_c++;
+			}
+		}
+	}
+	
+	/* The trie, with 0 standing for a missing edge as nothing leads to the
+	 * root */
+	o_m->next = malloc(sizeof(unsigned int) * total * o_m->class_c);
+	memset(o_m->next, 0, sizeof(unsigned int) * total * o_m->class_c);
+	o_m->own = malloc(sizeof(unsigned int) * total);
+	o_m->dict = malloc(sizeof(unsigned int) * total);
+	o_m->also = malloc(sizeof(unsigned int) * c);
+	memset(o_m->own, 0, sizeof(unsigned int) * total);
+	memset(o_m->dict, 0, sizeof(unsigned int) * total);
+	o_m->state_c = 1;
+	for (i = 0; i < c; ++i) {
+		unsigned char* p;
+		
+		for (s = 0, p = (unsigned char*) patterns[i]; *p != '\0'; ++p) {
+			unsigned int* edge = &o_m->next[s * o_m->class_c + o_m->classes[*p]];
+			
+			if (*edge == 0) *edge = o_m->state_c++;
+			s = *edge;
+		}
+		o_m->also[i] = o_m->own[s];
+		o_m->own[s] = i + 1;
+	}
+	
+	/* Breadth first, completing every transition through the failure links.
+	 * dict[] leads to the nearest proper suffix at which patterns end. */
+	queue = malloc(sizeof(unsigned int) * o_m->state_c);
+	fail = malloc(sizeof(unsigned int) * o_m->state_c);
+	fail[0] = 0;
+	{
+		unsigned int head = 0, tail = 0, k;
+		
+		queue[tail++] = 0;
+		while (head < tail) {
+			unsigned int u = queue[head++];
+			
+			for (k = 0; k < o_m->class_c; ++k) {
+				unsigned int* edge = &o_m->next[u * o_m->class_c + k];
+				
+				if (*edge != 0) {
+					unsigned int v = *edge;
+					
+					fail[v] = (u == 0) ? 0 : o_m->next[fail[u] * o_m->class_c + k];
+					o_m->dict[v] = (o_m->own[fail[v]] != 0) ? fail[v]
+					                                         : o_m->dict[fail[v]];
+					queue[tail++] = v;
+				} else if (u != 0) {
+					*edge = o_m->next[fail[u] * o_m->class_c + k];
+				}
+			}
+		}
+	}
+	free(queue);
+	free(fail);
+}
+
+static void
+FreeMatcher(Matcher* m)
+{
+	free(m->next);
+	free(m->own);
+	free(m->dict);
+	free(m->also);
+}
+
+/* Calls fn with the index of every pattern found in s, at each place it ends,
+ * until fn returns false. Returns false if it was stopped. */
+static int
+MatcherScan(Matcher* m, const char* s, int (*fn)(void* ctx, unsigned int pattern),
+            void* ctx)
+{
+	const unsigned char* p;
+	unsigned int state = 0;
+	
+	for (p = (const unsigned char*) s; *p != '\0'; ++p) {
+		unsigned int t, i;
+		
+		state = m->next[state * m->class_c + m->classes[*p]];
+		for (t = (m->own[state] != 0) ? state : m->dict[state]; t != 0;
+		     t = m->dict[t]) {
+			for (i = m->own[t]; i != 0; i = m->also[i - 1]) {
+				if (!fn(ctx, i - 1)) return false;
+			}
+		}
+	}
+	
+	return true;
+}
+
+/* Reads rules_filename and compiles it. Each line is
+ * 	<field> <substring> -> <tag> [<tag> ...]
+ * where field is url, title or any; substrings match regardless of case, and
+ * the tags must exist. Blank lines and lines starting with '#' are skipped.
+ * Returns false if there are no rules. */
+static int
+LoadAutotag(Core* c, Autotag* o_a)
+{
+	FILE* fp;
+	char filename[512] = { 0 }, line[1024];
+	char** patterns = NULL;
+	unsigned int lineN = 0, capacity = 0, i;
+	
+	memset(o_a, 0, sizeof(Autotag));
+	GetConfigPath(filename);
+	strcat(filename, rules_filename);
+	if ((fp = fopen(filename, "r")) == NULL) {
+		return false;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		char* field, *pattern, *arrow, *tag, *end;
+		AutotagRule rule;
+		unsigned int tagC = 0;
+		
+		lineN++;
+		line[strcspn(line, "\r\n")] = '\0';
+		field = line + strspn(line, " \t");
+		if (*field == '\0' || *field == '#') continue;
+		
+		memset(&rule, 0, sizeof(AutotagRule));
+		pattern = field + strcspn(field, " \t");
+		if (*pattern != '\0') *pattern++ = '\0';
+		pattern += strspn(pattern, " \t");
+		if (strcmp(field, "url") == 0) {
+			rule.fields = AUTOTAG_URL;
+		} else if (strcmp(field, "title") == 0) {
+			rule.fields = AUTOTAG_TITLE;
+		} else if (strcmp(field, "any") == 0) {
+			rule.fields = AUTOTAG_URL | AUTOTAG_TITLE;
+		}
+		if (rule.fields == 0 || (arrow = strstr(pattern, "->")) == NULL) {
+			fprintf(stderr, "%s:%u: expected '<url|title|any> <substring> -> " \
+			        "<tag> ...'\n", rules_filename, lineN);
+			continue;
+		}
+		for (end = arrow; end > pattern && isspace((unsigned char) end[-1]); --end);
+		*end = '\0';
+		if (*pattern == '\0') {
+			fprintf(stderr, "%s:%u: the substring is empty\n", rules_filename,
+			        lineN);
+			continue;
+		}
+		for (tag = strtok(arrow + 2, " \t"); tag != NULL; tag = strtok(NULL, " \t")) {
+			unsigned int id = GetTagID(c->tags, tag);
+			
+			if (id == 0) {
+				fprintf(stderr, "%s:%u: no such tag '%s'\n", rules_filename,
+				        lineN, tag);
+			} else if (tagC < ROW_TAG_C) {
+				rule.tag_ids[tagC++] = id;
+			}
+		}
+		if (tagC == 0) continue;
+		
+		if (o_a->rule_c == capacity) {
+			capacity = Max(16, capacity * 2);
+			o_a->rules = realloc(o_a->rules, sizeof(AutotagRule) * capacity);
+			patterns = realloc(patterns, sizeof(char*) * capacity);
+		}
+		patterns[o_a->rule_c] = malloc(strlen(pattern) + 1);
+		strcpy(patterns[o_a->rule_c], pattern);
+		o_a->rules[o_a->rule_c++] = rule;
+	}
+	fclose(fp);
+	if (o_a->rule_c == 0) {
+		free(o_a->rules);
+		return false;
+	}
+	
+	BuildMatcher(&o_a->matcher, patterns, o_a->rule_c);
+	for (i = 0; i < o_a->rule_c; ++i) {
+		free(patterns[i]);
+	}
+	free(patterns);
+	
+	return true;
+}
+
+/* Compiles the rules the first time they are needed. Returns NULL if there
+ * are none. */
+static Autotag*
+GetAutotag(Core* io_c)
+{
+	if (io_c->autotag == NULL) {
+		io_c->autotag = malloc(sizeof(Autotag));
+		io_c->autotag->loaded = LoadAutotag(io_c, io_c->autotag);
+	}
+	
+	return (io_c->autotag->loaded == true) ? io_c->autotag : NULL;
+}
+
+static void
+FreeAutotag(Autotag* a)
+{
+	if (a == NULL) return;
+	if (a->loaded == true) {
+		FreeMatcher(&a->matcher);
+		free(a->rules);
+	}
+	free(a);
+}
+
+/* Adds the tags of a rule which matched, if it is for the field scanned. */
+static int
+AutotagFound(void* ctx, unsigned int pattern)
+{
+	AutotagScan* scan = ctx;
+	AutotagRule* rule = &scan->autotag->rules[pattern];
+	unsigned int i, j;
+	
+	if ((rule->fields & scan->field) == 0) return true;
+	for (i = 0; i < ROW_TAG_C && rule->tag_ids[i] != 0; ++i) {
+		for (j = 0; j < scan->tag_c && scan->tags[j] != rule->tag_ids[i]; ++j);
+		if (j == scan->tag_c && scan->tag_c < ROW_TAG_C) {
+			scan->tags[scan->tag_c++] = rule->tag_ids[i];
+		}
+	}
+	
+	return true;
+}
+
+static unsigned int
+AutotagMatch(Autotag* a, Row* r, unsigned int* o_tags)
+{
+	AutotagScan scan;
+	
+	scan.autotag = a;
+	scan.tags = o_tags;
+	scan.tag_c = 0;
+	scan.field = AUTOTAG_URL;
+	MatcherScan(&a->matcher, GetRowURL(r), AutotagFound, &scan);
+	scan.field = AUTOTAG_TITLE;
+	MatcherScan(&a->matcher, r->title, AutotagFound, &scan);
+	
+	return scan.tag_c;
+}
+
+/* Gives row rowIndex the tags in tags (c of them) which it lacks, while it
+ * has room. Returns how many it was given, or -1 if it had no room left. */
+static int
+GiveRowTags(Core* io_c, unsigned int rowIndex, unsigned int* tags,
+            unsigned int c)
+{
+	Row* r = &io_c->table.rows[rowIndex];
+	unsigned int i, j;
+	int given = 0;
+	
+	for (i = 0; i < c; ++i) {
+		int index = FindTagIndex(io_c, tags[i]);
+		
+		if (index < 0 || io_c->tags.tags[index].id == 0 ||
+		    RowHasTagID(*r, tags[i])) continue;
+		for (j = 0; j < ROW_TAG_C && r->tag_ids[j] != 0; ++j);
+		if (j == ROW_TAG_C) {
+			return (given > 0) ? given : -1;
+		}
+		JournalRow(io_c, rowIndex, false);
+		r->tag_ids[j] = tags[i];
+		TagRowsAdd(io_c, tags[i], rowIndex);
+		given++;
+	}
+	
+	return given;
+}
+
+/* Applies the rules to one row, as it is added. */
+static void
+AutotagRow(Core* io_c, unsigned int rowIndex)
+{
+	Autotag* a = GetAutotag(io_c);
+	unsigned int tags[ROW_TAG_C];
+	
+	if (a != NULL) {
+		GiveRowTags(io_c, rowIndex, tags,
+		            AutotagMatch(a, &io_c->table.rows[rowIndex], tags));
+	}
+}
+
+static void
+AutotagRows(void* ctx, unsigned int begin, unsigned int end)
+{
+	AutotagJob* job = ctx;
+	unsigned int i;
+	
+	for (i = begin; i < end; ++i) {
+		if (job->rows[i].id == 0) continue;
+		job->counts[i] = AutotagMatch(job->autotag, &job->rows[i],
+		                              &job->tags[i * ROW_TAG_C]);
+	}
+}
+
+/* 'sbm autotag --all': matches every row in parallel, then tags them. */
+static void
+AutotagAll(Core* io_c)
+{
+	Autotag* a = GetAutotag(io_c);
+	AutotagJob job;
+	unsigned int tagged = 0, given = 0, full = 0, i;
+	
+	if (a == NULL) {
+		printf("There are no rules; see '%s'.\n", rules_filename);
+		exit(0);
+	}
+	job.autotag = a;
+	job.rows = io_c->table.rows;
+	job.tags = malloc(sizeof(unsigned int) * ROW_TAG_C * (io_c->table.count + 1));
+	job.counts = malloc(sizeof(unsigned int) * (io_c->table.count + 1));
+	memset(job.counts, 0, sizeof(unsigned int) * (io_c->table.count + 1));
+	RunParallel(io_c->table.count, 4096, AutotagRows, &job);
+	
+	for (i = 0; i < io_c->table.count; ++i) {
+		int n;
+		
+		if (job.counts[i] == 0) continue;
+		n = GiveRowTags(io_c, i, &job.tags[i * ROW_TAG_C], job.counts[i]);
+		if (n < 0) {
+			full++;
+		} else if (n > 0) {
+			GetCurrentDateTime(&io_c->table.rows[i].datetime);
+			given += n;
+			tagged++;
+		}
+	}
+	free(job.tags);
+	free(job.counts);
+	
+	printf("Gave %u tag(s) to %u entries.\n", given, tagged);
+	if (full > 0) {
+		printf("%u entries could not take any more tags.\n", full);
+	}
+	io_c->dirty = tagged > 0;
+}
+
+/* Parses a query out of args (argc of them, each holding one or more words):
+ * words which the title, URL or comment of an entry must contain (all of
+ * them, or with any set or "--any" among them, one), "tag:<tag>" for a tag it
+ * must have, "-tag:<tag>" for one it must not and "host:<host>" for the host
+ * it must be from. Returns false, leaving the name in bad, if a tag does not
+ * exist. */
+static int
+ParseQuery(Core* c, char** args, unsigned int argc, int any, Query* o_q)
+{
+	size_t length = 1;
+	unsigned int i;
+	char* word;
+	
+	memset(o_q, 0, sizeof(Query));
+	o_q->any = any;
+	for (i = 0; i < argc; ++i) {
+		length += strlen(args[i]) + 1;
+	}
+	o_q->text = malloc(length);
+	o_q->words = malloc(length);
+	o_q->terms = malloc(sizeof(char*) * (length / 2 + 1));
+	o_q->text[0] = '\0';
+	for (i = 0; i < argc; ++i) {
+		if (i > 0) strcat(o_q->text, " ");
+		strcat(o_q->text, args[i]);
+	}
+	strcpy(o_q->words, o_q->text);
+	
+	for (word = strtok(o_q->words, " \t"); word != NULL;
+	     word = strtok(NULL, " \t")) {
+		int not = word[0] == '-' && strncmp(&word[1], "tag:", 4) == 0;
+		
+		if ((strncmp(word, "tag:", 4) == 0 || not) && word[not + 4] != '\0') {
+			char* name = &word[not + 4];
+			unsigned int id;
+			int index;
+			
+			id = isdigit(name[0]) ? (unsigned int) atoi(name)
+			                      : GetTagID(c->tags, name);
+			index = FindTagIndex(c, id);
+			if (id == 0 || index < 0 || c->tags.tags[index].id == 0) {
+				o_q->bad = name;
+				return false;
+			}
+			if (not == true && o_q->not_tag_c < ROW_TAG_C) {
+				o_q->not_tag_ids[o_q->not_tag_c++] = id;
+			} else if (not == false && o_q->tag_c < ROW_TAG_C) {
+				o_q->tag_ids[o_q->tag_c++] = id;
+			}
+		} else if (strncmp(word, "host:", 5) == 0 && word[5] != '\0') {
+			o_q->host = FindHost(&c->hosts, &word[5]);
+			o_q->has_host = true;
+		} else if (strcmp(word, "--any") == 0 || strcmp(word, "--all") == 0) {
+			o_q->any = strcmp(word, "--any") == 0;
+		} else {
+			o_q->terms[o_q->term_c++] = word;
+		}
+	}
+	
+	return true;
+}
+
+static void
+FreeQuery(Query* q)
+{
+	free(q->text);
+	free(q->words);
+	free(q->terms);
+}
+
+static int
+EmptyQuery(Query* q)
+{
+	return q->term_c == 0 && q->tag_c == 0 && q->not_tag_c == 0 &&
+	       q->has_host == false;
+}
+
+/* Notes a term found in the row being scanned, stopping the scan once the row
+ * is known to match. */
+static int
+ListTermFound(void* ctx, unsigned int term)
+{
+	ListScan* scan = ctx;
+	
+	if (scan->seen[term] != scan->row + 1) {
+		scan->seen[term] = scan->row + 1;
+		scan->found++;
+	}
+	
+	return !(scan->job->any == true || scan->found == scan->job->term_c);
+}
+
+/* Whether row index has the terms, scanning each field at most once */
+static int
+RowHasTerms(ListScan* io_scan, Matcher* m, unsigned int index)
+{
+	Row* r = &io_scan->job->rows[index];
+	
+	io_scan->row = index;
+	io_scan->found = 0;
+	return !(MatcherScan(m, r->title, ListTermFound, io_scan) &&
+	         MatcherScan(m, GetRowURL(r), ListTermFound, io_scan) &&
+	         MatcherScan(m, r->comment, ListTermFound, io_scan));
+}
+
+static void
+ListRows(void* ctx, unsigned int begin, unsigned int end)
+{
+	ListScan scan;
+	Matcher* m;
+	unsigned int i;
+	
+	scan.job = ctx;
+	scan.seen = malloc(sizeof(unsigned int) * scan.job->term_c);
+	memset(scan.seen, 0, sizeof(unsigned int) * scan.job->term_c);
+	m = scan.job->matcher;
+	for (i = begin; i < end; ++i) {
+		if (scan.job->rows[i].id == 0) continue;
+		scan.job->matched[i] = RowHasTerms(&scan, m, i);
+	}
+	free(scan.seen);
+}
+
+/* Returns which rows match q, one byte per row. The terms are all looked for
+ * in a single pass over each field, with rows matched in parallel. */
+static unsigned char*
+MatchQuery(Core* c, Query* q)
+{
+	unsigned char* matched;
+	unsigned int i, j;
+	
+	matched = malloc(c->table.count + 1);
+	memset(matched, 0, c->table.count + 1);
+	if (q->term_c > 0) {
+		Matcher matcher;
+		ListJob job;
+		
+		BuildMatcher(&matcher, q->terms, q->term_c);
+		job.matcher = &matcher;
+		job.rows = c->table.rows;
+		job.term_c = q->term_c;
+		job.any = q->any;
+		job.matched = matched;
+		RunParallel(c->table.count, 4096, ListRows, &job);
+		FreeMatcher(&matcher);
+	} else if (q->has_host == false) {
+		memset(matched, true, c->table.count);
+	}
+	
+	if (q->has_host == true) {
+		unsigned char* inHost = malloc(c->table.count + 1);
+		
+		memset(inHost, 0, c->table.count + 1);
+		for (i = 0; q->host != NULL && i < q->host->count; ++i) {
+			inHost[q->host->rows[i]] = true;
+		}
+		for (i = 0; i < c->table.count; ++i) {
+			matched[i] = (q->term_c > 0) ? matched[i] && inHost[i] : inHost[i];
+		}
+		free(inHost);
+	}
+	
+	for (j = 0; j < q->tag_c; ++j) {
+		TagClosure* cl = GetTagClosure(c, q->tag_ids[j]);
+		unsigned int next;
+		
+		/* Only rows in the closure's bitset can match */
+		for (i = 0; i < c->table.count; i = next + 1) {
+			next = (cl != NULL) ? NextClosureRow(cl, i, c->table.count)
+			                    : c->table.count;
+			memset(&matched[i], false, next - i);
+			if (next < c->table.count && matched[next] == true) {
+				matched[next] = RowUnderTag(cl, &c->table.rows[next]);
+			}
+		}
+	}
+	for (j = 0; j < q->not_tag_c; ++j) {
+		TagClosure* cl = GetTagClosure(c, q->not_tag_ids[j]);
+		
+		for (i = 0; cl != NULL &&
+		            (i = NextClosureRow(cl, i, c->table.count)) < c->table.count;
+		     ++i) {
+			if (matched[i] == true) matched[i] = !RowUnderTag(cl, &c->table.rows[i]);
+		}
+	}
+	for (i = 0; i < c->table.count; ++i) {
+		if (c->table.rows[i].id == 0) matched[i] = false;
+	}
+	
+	return matched;
+}
+
+/* MatchQuery(), except that "all" on its own (the only argument q was parsed
+ * from) stands for every entry, as in 'sbm list'. */
+static unsigned char*
+MatchListQuery(Core* c, Query* q, char** args, unsigned int argc)
+{
+	unsigned char* matched;
+	unsigned int i;
+	
+	if (argc != 1 || stricmp(args[0], "all") != 0) {
+		return MatchQuery(c, q);
+	}
+	matched = malloc(c->table.count + 1);
+	for (i = 0; i < c->table.count; ++i) {
+		matched[i] = c->table.rows[i].id != 0;
+	}
+	return matched;
+}
+
+/* Asks before a bulk change, unless --yes was given. */
+static void
+ConfirmBulk(const char* what, unsigned int c, Query* q, int yes)
+{
+	char confirmation;
+	
+	if (yes == true) return;
+	printf("Are you sure you want to %s %u row(s) matching '%s'? [Y/n] \n",
+	       what, c, q->text);
+	scanf("%c", &confirmation);
+	if (!((confirmation == 'y') || (confirmation == 'Y'))) {
+		exit(0);
+	}
+}
+
+/* 'sbm retag <query> +<tag> -<tag> ... [--yes]' */
+static void
+Retag(Core* io_c, char** args, unsigned int argc)
+{
+	Query q;
+	unsigned int add[ROW_TAG_C], take[ROW_TAG_C];
+	unsigned int addC = 0, takeC = 0, queryC = 0, yes = false;
+	unsigned int matchC = 0, retagged = 0, full = 0, i, j, k;
+	unsigned char* matched;
+	
+	for (i = 0; i < argc; ++i) {
+		unsigned int id;
+		int index;
+		
+		if (strcmp(args[i], "--yes") == 0) {
+			yes = true;
+			continue;
+		}
+		if ((args[i][0] != '+' && args[i][0] != '-') || args[i][1] == '\0' ||
+		    strncmp(args[i], "-tag:", 5) == 0) {
+			args[queryC++] = args[i];
+			continue;
+		}
+		id = isdigit(args[i][1]) ? (unsigned int) atoi(&args[i][1])
+		                         : GetTagID(io_c->tags, &args[i][1]);
+		index = FindTagIndex(io_c, id);
+		if (id == 0 || index < 0 || io_c->tags.tags[index].id == 0) {
+			printf("Could not find tag '%s'\n", &args[i][1]);
+			exit(-1);
+		}
+		if (args[i][0] == '+' && addC < ROW_TAG_C) {
+			add[addC++] = id;
+		} else if (args[i][0] == '-' && takeC < ROW_TAG_C) {
+			take[takeC++] = id;
+		}
+	}
+	if (addC + takeC == 0) {
+		printf("Invalid input. Usage: sbm retag <query> +<tag> -<tag> ... " \
+		       "[--yes]\n");
+		exit(-1);
+	}
+	if (!ParseQuery(io_c, args, queryC, false, &q)) {
+		printf("Could not find tag '%s'\n", q.bad);
+		exit(-1);
+	}
+	if (EmptyQuery(&q)) {
+		printf("The query is empty.\n");
+		exit(-1);
+	}
+	
+	matched = MatchListQuery(io_c, &q, args, queryC);
+	for (i = 0; i < io_c->table.count; ++i) {
+		matchC += matched[i];
+	}
+	if (matchC == 0) {
+		printf("No entries match '%s'.\n", q.text);
+		exit(0);
+	}
+	ConfirmBulk("retag", matchC, &q, yes);
+	
+	for (i = 0; i < io_c->table.count; ++i) {
+		Row* r = &io_c->table.rows[i];
+		int changed = false, given;
+		
+		if (matched[i] == false) continue;
+		for (j = 0; j < takeC; ++j) {
+			for (k = 0; k < ROW_TAG_C; ++k) {
+				if (r->tag_ids[k] != take[j]) continue;
+				JournalRow(io_c, i, false);
+				r->tag_ids[k] = 0;
+				changed = true;
+			}
+		}
+		if ((given = GiveRowTags(io_c, i, add, addC)) < 0) {
+			full++;
+		}
+		if (changed == true || given > 0) {
+			GetCurrentDateTime(&r->datetime);
+			retagged++;
+		}
+	}
+	printf("Retagged %u of %u matching entries.\n", retagged, matchC);
+	if (full > 0) {
+		printf("%u entries could not take any more tags.\n", full);
+	}
+	io_c->dirty = retagged > 0;
+	free(matched);
+	FreeQuery(&q);
+}
+
+/* 'sbm remove --query <query> [--yes]' */
+static void
+RemoveQuery(Core* io_c, char** args, unsigned int argc)
+{
+	Query q;
+	unsigned int queryC = 0, yes = false, matchC = 0, i;
+	unsigned char* matched;
+	
+	for (i = 0; i < argc; ++i) {
+		if (strcmp(args[i], "--yes") == 0) {
+			yes = true;
+		} else {
+			args[queryC++] = args[i];
+		}
+	}
+	if (!ParseQuery(io_c, args, queryC, false, &q)) {
+		printf("Could not find tag '%s'\n", q.bad);
+		exit(-1);
+	}
+	if (EmptyQuery(&q)) {
+		printf("The query is empty.\n");
+		exit(-1);
+	}
+	
+	matched = MatchListQuery(io_c, &q, args, queryC);
+	for (i = 0; i < io_c->table.count; ++i) {
+		matchC += matched[i];
+	}
+	if (matchC == 0) {
+		printf("No entries match '%s'.\n", q.text);
+		exit(0);
+	}
+	ConfirmBulk("delete", matchC, &q, yes);
+	
+	for (i = 0; i < io_c->table.count; ++i) {
+		if (matched[i] == false) continue;
+		JournalRow(io_c, i, false);
+		io_c->table.rows[i].id = 0;
+	}
+	printf("Removed %u entries.\n", matchC);
+	io_c->dirty = true;
+	free(matched);
+	FreeQuery(&q);
+}
+
+/* Whether row index matches q. scan must have been set up with q's terms
+ * compiled, unless it has none. */
+static int
+QueryMatchesRow(Core* c, Query* q, ListScan* io_scan, unsigned int index)
+{
+	Row* r = &c->table.rows[index];
+	unsigned int i;
+	
+	if (r->id == 0 ||
+	    (q->term_c > 0 && !RowHasTerms(io_scan, io_scan->job->matcher, index)) ||
+	    (q->has_host == true && (q->host == NULL ||
+	                             FindHost(&c->hosts, GetRowURL(r)) != q->host))) {
+		return false;
+	}
+	for (i = 0; i < q->tag_c; ++i) {
+		TagClosure* cl = GetTagClosure(c, q->tag_ids[i]);
+		
+		if (cl == NULL || !RowUnderTag(cl, r)) return false;
+	}
+	for (i = 0; i < q->not_tag_c; ++i) {
+		TagClosure* cl = GetTagClosure(c, q->not_tag_ids[i]);
+		
+		if (cl != NULL && RowUnderTag(cl, r)) return false;
+	}
+	
+	return true;
+}
+
+/* saved_filename is a SavedHeader followed by, for each search, its name and
+ * query (each a uint32_t length and the text) and its results, as a uint32_t
+ * word count and a bitset over row IDs. The results are of store generation
+ * generation; every save brings them up to date. */
+static int
+LoadSavedSearches(SavedSearches* o_s)
+{
+	char filename[512] = { 0 };
+	SavedHeader h;
+	char* contents;
+	size_t size, pos;
+	unsigned int i;
+	
+	memset(o_s, 0, sizeof(SavedSearches));
+	GetConfigPath(filename);
+	strcat(filename, saved_filename);
+	if ((contents = ReadWholeFile(filename, &size)) == NULL) {
+		return false;
+	}
+	if (size < sizeof(SavedHeader)) {
+		free(contents);
+		return false;
+	}
+	memcpy(&h, contents, sizeof(SavedHeader));
+	/* Each search takes at least its three lengths */
+	if (memcmp(h.magic, "sbmsave1", 8) != 0 ||
+	    h.count > (size - sizeof(SavedHeader)) / (sizeof(uint32_t) * 3)) {
+		free(contents);
+		return false;
+	}
+	o_s->generation = h.generation;
+	o_s->searches = malloc(sizeof(SavedSearch) * ((size_t) h.count + 1));
+	memset(o_s->searches, 0, sizeof(SavedSearch) * ((size_t) h.count + 1));
+	for (i = 0, pos = sizeof(SavedHeader); i < h.count; ++i) {
+		SavedSearch* ss = &o_s->searches[i];
+		uint32_t l[3];
+		
+		if (size - pos < sizeof(l)) break;
+		memcpy(l, &contents[pos], sizeof(l));
+		pos += sizeof(l);
+		if (l[0] >= TAG_NAME_S || size - pos < (size_t) l[0] + l[1] ||
+		    (size - pos - l[0] - l[1]) / sizeof(uint64_t) < l[2]) break;
+		memcpy(ss->name, &contents[pos], l[0]);
+		ss->query = malloc((size_t) l[1] + 1);
+		memcpy(ss->query, &contents[pos + l[0]], l[1]);
+		ss->query[l[1]] = '\0';
+		pos += l[0] + l[1];
+		ss->word_c = l[2];
+		ss->ids = malloc(sizeof(uint64_t) * ((size_t) ss->word_c + 1));
+		memcpy(ss->ids, &contents[pos], sizeof(uint64_t) * ss->word_c);
+		pos += sizeof(uint64_t) * ss->word_c;
+		o_s->count++;
+	}
+	free(contents);
+	
+	return true;
+}
+
+static void
+WriteSavedSearches(SavedSearches* s)
+{
+	char filename[512] = { 0 };
+	SavedHeader h;
+	unsigned int i;
+	FILE* fp;
+	
+	GetConfigPath(filename);
+	strcat(filename, saved_filename);
+	if ((fp = fopen(filename, "wb")) == NULL) {
+		fprintf(stderr, "Could not write '%s'.\n", filename);
+		return;
+	}
+	memset(&h, 0, sizeof(SavedHeader));
+	memcpy(h.magic, "sbmsave1", 8);
+	h.generation = s->generation;
+	h.count = s->count;
+	fwrite(&h, sizeof(SavedHeader), 1, fp);
+	for (i = 0; i < s->count; ++i) {
+		SavedSearch* ss = &s->searches[i];
+		uint32_t l[3];
+		
+		l[0] = strlen(ss->name);
+		l[1] = strlen(ss->query);
+		l[2] = ss->word_c;
+		fwrite(l, sizeof(l), 1, fp);
+		fwrite(ss->name, l[0], 1, fp);
+		fwrite(ss->query, l[1], 1, fp);
+		fwrite(ss->ids, sizeof(uint64_t), ss->word_c, fp);
+	}
+	fclose(fp);
+}
+
+static void
+FreeSavedSearches(SavedSearches* s)
+{
+	unsigned int i;
+	
+	for (i = 0; i < s->count; ++i) {
+		free(s->searches[i].query);
+		free(s->searches[i].ids);
+	}
+	free(s->searches);
+}
+
+static void
+SetSavedID(SavedSearch* io_ss, unsigned int id, int set)
+{
+	if (id / 64 >= io_ss->word_c) {
+		unsigned int c = Max(id / 64 + 1, io_ss->word_c * 2);
+		
+		if (set == false) return;
+		io_ss->ids = realloc(io_ss->ids, sizeof(uint64_t) * c);
+		memset(&io_ss->ids[io_ss->word_c], 0,
+		       sizeof(uint64_t) * (c - io_ss->word_c));
+		io_ss->word_c = c;
+	}
+	if (set == true) {
+		io_ss->ids[id / 64] |= 1ULL << (id % 64);
+	} else {
+		io_ss->ids[id / 64] &= ~(1ULL << (id % 64));
+	}
+}
+
+/* Runs a saved search over the whole store. A query naming a tag which no
+ * longer exists matches nothing. */
+static void
+EvaluateSaved(Core* c, SavedSearch* io_ss)
+{
+	Query q;
+	unsigned char* matched;
+	unsigned int i;
+	
+	io_ss->word_c = c->table.next_UID / 64 + 1;
+	io_ss->ids = realloc(io_ss->ids, sizeof(uint64_t) * io_ss->word_c);
+	memset(io_ss->ids, 0, sizeof(uint64_t) * io_ss->word_c);
+	if (ParseQuery(c, &io_ss->query, 1, false, &q)) {
+		matched = MatchQuery(c, &q);
+		for (i = 0; i < c->table.count; ++i) {
+			if (matched[i] == true) SetSavedID(io_ss, c->table.rows[i].id, true);
+		}
+		free(matched);
+	}
+	FreeQuery(&q);
+}
+
+/* Brings the saved searches up to date with a save. Only the rows in the
+ * journal are looked at, unless tags changed (which can change what any row
+ * matches) or the results are not of the previous generation. */
+static void
+SaveSavedSearches(Core* c)
+{
+	Journal* j = &c->journal;
+	SavedSearches s;
+	unsigned int i, k;
+	
+	if (!LoadSavedSearches(&s)) {
+		return;
+	}
+	for (i = 0; i < s.count; ++i) {
+		SavedSearch* ss = &s.searches[i];
+		Matcher matcher;
+		ListJob job;
+		ListScan scan;
+		Query q;
+		
+		if (s.generation != c->meta.generation - 1 || j->tag_c > 0) {
+			EvaluateSaved(c, ss);
+			continue;
+		}
+		if (!ParseQuery(c, &ss->query, 1, false, &q)) {
+			memset(ss->ids, 0, sizeof(uint64_t) * ss->word_c);
+			FreeQuery(&q);
+			continue;
+		}
+		memset(&job, 0, sizeof(ListJob));
+		memset(&scan, 0, sizeof(ListScan));
+		if (q.term_c > 0) {
+			BuildMatcher(&matcher, q.terms, q.term_c);
+			job.matcher = &matcher;
+			job.rows = c->table.rows;
+			job.term_c = q.term_c;
+			job.any = q.any;
+			scan.job = &job;
+			scan.seen = malloc(sizeof(unsigned int) * q.term_c);
+			memset(scan.seen, 0, sizeof(unsigned int) * q.term_c);
+		}
+		for (k = 0; k < j->row_c; ++k) {
+			unsigned int index = j->rows[k * 2];
+			
+			SetSavedID(ss, j->rows[k * 2 + 1], false);
+			if (QueryMatchesRow(c, &q, &scan, index)) {
+				SetSavedID(ss, c->table.rows[index].id, true);
+			}
+		}
+		if (q.term_c > 0) {
+			FreeMatcher(&matcher);
+			free(scan.seen);
+		}
+		FreeQuery(&q);
+	}
+	s.generation = c->meta.generation;
+	WriteSavedSearches(&s);
+	FreeSavedSearches(&s);
+}
+
+/* Rows are mostly in the order of their IDs, which only ever grow, so this is
+ * a binary search. Undoing a removal puts the row back at the end though, so
+ * on a miss an index by ID is built in io_byID and used from then on. */
+static int
+FindRowByID(Core* c, unsigned int id, unsigned int** io_byID)
+{
+	unsigned int low = 0, high = c->table.count, i;
+	
+	if (*io_byID == NULL) {
+		while (low < high) {
+			unsigned int mid = low + (high - low) / 2;
+			
+			if (c->table.rows[mid].id == id) return mid;
+			if (c->table.rows[mid].id != 0 && c->table.rows[mid].id < id) {
+				low = mid + 1;
+			} else {
+				high = mid;
+			}
+		}
+		*io_byID = malloc(sizeof(unsigned int) * (c->table.next_UID + 1));
+		memset(*io_byID, 0, sizeof(unsigned int) * (c->table.next_UID + 1));
+		for (i = 0; i < c->table.count; ++i) {
+			if (c->table.rows[i].id <= c->table.next_UID) {
+				(*io_byID)[c->table.rows[i].id] = i + 1;
+			}
+		}
+	}
+	
+	return (id <= c->table.next_UID) ? (int) (*io_byID)[id] - 1 : -1;
+}
+
+/* 'sbm saved add <name> <query>', 'sbm saved list', 'sbm saved show <name>'
+ * and 'sbm saved remove <name>' */
+static void
+SavedCommand(Core* io_c, char** args, unsigned int argc)
+{
+	SavedSearches s;
+	SavedSearch* ss = NULL;
+	unsigned int i, w;
+	
+	if (!LoadSavedSearches(&s)) {
+		s.generation = io_c->meta.generation;
+	}
+	if (s.generation != io_c->meta.generation) {
+		for (i = 0; i < s.count; ++i) {
+			EvaluateSaved(io_c, &s.searches[i]);
+		}
+		s.generation = io_c->meta.generation;
+		WriteSavedSearches(&s);
+	}
+	for (i = 0; argc > 1 && i < s.count; ++i) {
+		if (strcmp(s.searches[i].name, args[1]) == 0) ss = &s.searches[i];
+	}
+	
+	if (strcmp(args[0], "add") == 0) {
+		Query q;
+		
+		if (!ParseQuery(io_c, &args[2], argc - 2, false, &q)) {
+			printf("Could not find tag '%s'\n", q.bad);
+			exit(-1);
+		}
+		if (EmptyQuery(&q)) {
+			printf("The query is empty.\n");
+			exit(-1);
+		}
+		if (strlen(args[1]) >= TAG_NAME_S) {
+			printf("Names must be shorter than %d characters.\n", TAG_NAME_S);
+			exit(-1);
+		}
+		if (ss == NULL) {
+			s.searches = realloc(s.searches, sizeof(SavedSearch) * (s.count + 1));
+			ss = &s.searches[s.count++];
+			memset(ss, 0, sizeof(SavedSearch));
+			strcpy(ss->name, args[1]);
+		}
+		free(ss->query);
+		ss->query = malloc(strlen(q.text) + 1);
+		strcpy(ss->query, q.text);
+		FreeQuery(&q);
+		EvaluateSaved(io_c, ss);
+		WriteSavedSearches(&s);
+		for (i = 0, w = 0; w < ss->word_c; ++w) {
+			i += __builtin_popcountll(ss->ids[w]);
+		}
+		printf("Saved '%s': %u entries.\n", ss->name, i);
+		FreeSavedSearches(&s);
+		return;
+	} else if (strcmp(args[0], "remove") == 0) {
+		if (ss == NULL) {
+			printf("There is no saved search '%s'.\n", args[1]);
+			exit(-1);
+		}
+		free(ss->query);
+		free(ss->ids);
+		*ss = s.searches[--s.count];
+		WriteSavedSearches(&s);
+		FreeSavedSearches(&s);
+		return;
+	} else if (strcmp(args[0], "list") == 0) {
+		for (i = 0; i < s.count; ++i) {
+			unsigned int n = 0;
+			
+			for (w = 0; w < s.searches[i].word_c; ++w) {
+				n += __builtin_popcountll(s.searches[i].ids[w]);
+			}
+			printf("%s (%u): %s\n", s.searches[i].name, n, s.searches[i].query);
+		}
+		FreeSavedSearches(&s);
+		return;
+	} else if (ss == NULL) {
+		printf("There is no saved search '%s'.\n", args[1]);
+		exit(-1);
+	}
+	
+	/* Shown from the bitset alone, at a cost of the results and not the store */
+	{
+		unsigned int* byID = NULL;
+		
+		for (w = 0; w < ss->word_c; ++w) {
+			uint64_t bits = ss->ids[w];
+			
+			while (bits != 0) {
+				int index = FindRowByID(io_c, w * 64 + __builtin_ctzll(bits),
+				                        &byID);
+				
+				if (index >= 0) PrintRow(io_c->table.rows[index], io_c->tags);
+				bits &= bits - 1;
+			}
+		}
+		free(byID);
+	}
+	FreeSavedSearches(&s);
+}
+
+/* Adds a visit for each of the c entries opened to visits_filename, with a
+ * single write so that other processes' visits are not interleaved. */
+static void
+LogVisits(unsigned int* ids, unsigned int c)
+{
+	char filename[512] = { 0 };
+	Visit* visits;
+	uint32_t now = time(NULL);
+	unsigned int i;
+	int fd;
+	
+	GetConfigPath(filename);
+	strcat(filename, visits_filename);
+	if ((fd = open(filename, O_WRONLY | O_APPEND | O_CREAT, 0644)) < 0) {
+		return;
+	}
+	visits = malloc(sizeof(Visit) * (c + 1));
+	for (i = 0; i < c; ++i) {
+		visits[i].id = ids[i];
+		visits[i].time = now;
+	}
+	if (write(fd, visits, sizeof(Visit) * c) != (ssize_t) (sizeof(Visit) * c)) {
+		fprintf(stderr, "Could not write '%s'.\n", filename);
+	}
+	close(fd);
+	free(visits);
+}
+
+static int
+CompareVisits(const void* a, const void* b)
+{
+	const Visit* x = a, *y = b;
+	
+	if (x->id != y->id) return (x->id < y->id) ? -1 : 1;
+	return (x->time < y->time) ? -1 : (x->time > y->time);
+}
+
+static int
+CompareFrecencyIDs(const void* a, const void* b)
+{
+	const Frecency* x = a, *y = b;
+	
+	return (x->id < y->id) ? -1 : (x->id > y->id);
+}
+
+/* The most frecent first; the more recently added of equals. */
+static int
+CompareFrecencies(const void* a, const void* b)
+{
+	const Frecency* x = a, *y = b;
+	
+	if (x->score != y->score) return (x->score > y->score) ? -1 : 1;
+	return (x->id > y->id) ? -1 : (x->id < y->id);
+}
+
+/* A visit at time t weighs 2^(t / FRECENCY_HALF_LIFE), so that visits count
+ * half as much per half-life which has passed, for every entry alike; the
+ * order of the scores never has to be decayed. They are kept as logarithms,
+ * which this adds in without overflowing. */
+static double
+AddVisitScore(double score, unsigned int visits, uint32_t t)
+{
+	double v = (double) t / FRECENCY_HALF_LIFE, high, low;
+	
+	if (visits == 0) {
+		return v;
+	}
+	high = (v > score) ? v : score;
+	low = (v > score) ? score : v;
+	
+	return high + log2(1 + exp2(low - high));
+}
+
+/* Reads frecency_filename, folding in the visits logged since it was last
+ * written, and writes it back if there were any. It is built afresh when it
+ * is missing or does not match visits_filename. */
+static void
+LoadFrecencies(Frecencies* o_f)
+{
+	FrecencyHeader h;
+	Frecency* merged;
+	Visit* visits;
+	char visitsFile[512] = { 0 }, filename[512] = { 0 }, temp[520];
+	char* contents;
+	size_t size, from = 0, visitC, i, j, k;
+	struct stat st;
+	FILE* fp;
+	int fd;
+	
+	memset(o_f, 0, sizeof(Frecencies));
+	GetConfigPath(visitsFile);
+	strcat(visitsFile, visits_filename);
+	if ((fd = open(visitsFile, O_RDONLY)) < 0) {
+		return;
+	}
+	GetConfigPath(filename);
+	strcat(filename, frecency_filename);
+	if ((contents = ReadWholeFile(filename, &size)) != NULL) {
+		memcpy(&h, contents, Min(size, sizeof(FrecencyHeader)));
+		if (size >= sizeof(FrecencyHeader) &&
+		    memcmp(h.magic, "sbmfrec1", 8) == 0 &&
+		    size == sizeof(FrecencyHeader) + sizeof(Frecency) * h.count &&
+		    fstat(fd, &st) == 0 && h.visits_s <= st.st_size) {
+			o_f->count = h.count;
+			o_f->rows = malloc(sizeof(Frecency) * (h.count + 1));
+			memcpy(o_f->rows, contents + sizeof(FrecencyHeader),
+			       sizeof(Frecency) * h.count);
+			from = h.visits_s;
+		}
+		free(contents);
+	}
+	
+	/* The visits since, less any still being written */
+	visitC = 0;
+	visits = NULL;
+	if (fstat(fd, &st) == 0 && st.st_size > from) {
+		visitC = (st.st_size - from) / sizeof(Visit);
+		visits = malloc(sizeof(Visit) * (visitC + 1));
+		if (pread(fd, visits, sizeof(Visit) * visitC, from) !=
+		    (ssize_t) (sizeof(Visit) * visitC)) {
+			visitC = 0;
+		}
+	}
+	close(fd);
+	if (visitC == 0) {
+		free(visits);
+		return;
+	}
+	
+	/* Both by ID, merged */
+	qsort(visits, visitC, sizeof(Visit), CompareVisits);
+	if (o_f->count > 0) {
+		qsort(o_f->rows, o_f->count, sizeof(Frecency), CompareFrecencyIDs);
+	}
+	merged = malloc(sizeof(Frecency) * (o_f->count + visitC));
+	for (i = 0, j = 0, k = 0; i < o_f->count || j < visitC;) {
+		if (j == visitC || (i < o_f->count && o_f->rows[i].id < visits[j].id)) {
+			merged[k++] = o_f->rows[i++];
+			continue;
+		}
+		if (i < o_f->count && o_f->rows[i].id == visits[j].id) {
+			merged[k] = o_f->rows[i++];
+		} else {
+			memset(&merged[k], 0, sizeof(Frecency));
+			merged[k].id = visits[j].id;
+		}
+		for (; j < visitC && visits[j].id == merged[k].id; ++j) {
+			merged[k].score = AddVisitScore(merged[k].score, merged[k].visits,
+			                                visits[j].time);
+			merged[k].visits++;
+		}
+		k++;
+	}
+	free(o_f->rows);
+	free(visits);
+	o_f->rows = merged;
+	o_f->count = k;
+	qsort(o_f->rows, o_f->count, sizeof(Frecency), CompareFrecencies);
+	
+	memset(&h, 0, sizeof(FrecencyHeader));
+	memcpy(h.magic, "sbmfrec1", 8);
+	h.visits_s = from + sizeof(Visit) * visitC;
+	h.count = o_f->count;
+	snprintf(temp, sizeof(temp), "%s.tmp", filename);
+	if ((fp = fopen(temp, "wb")) != NULL) {
+		int ok = fwrite(&h, sizeof(FrecencyHeader), 1, fp) == 1 &&
+		         fwrite(o_f->rows, sizeof(Frecency), o_f->count, fp) == o_f->count;
+		
+		if (fclose(fp) == 0 && ok == true) {
+			rename(temp, filename);
+		} else {
+			remove(temp);
+		}
+	}
+}
+
+/* Appends the rows matched[] marks to io_b: the most frecent first, then the
+ * ones never opened in the order they are stored. */
+static void
+BufferAppendFrecent(Core* c, unsigned char* matched, Buffer* io_b)
+{
+	Frecencies f;
+	unsigned int* byID = NULL;
+	unsigned int i;
+	
+	LoadFrecencies(&f);
+	for (i = 0; i < f.count; ++i) {
+		int index = FindRowByID(c, f.rows[i].id, &byID);
+		
+		if (index < 0 || matched[index] == false) continue;
+		BufferAppendListedRow(io_b, &c->table.rows[index], c->tags);
+		matched[index] = false;
+	}
+	for (i = 0; i < c->table.count; ++i) {
+		if (matched[i] == false) continue;
+		BufferAppendListedRow(io_b, &c->table.rows[i], c->tags);
+	}
+	free(byID);
+	free(f.rows);
+}
+
+/* 'sbm top [N]' */
+static void
+PrintTop(Core* c, unsigned int n)
+{
+	Frecencies f;
+	unsigned int* byID = NULL;
+	unsigned int i, shown;
+	
+	LoadFrecencies(&f);
+	for (i = 0, shown = 0; i < f.count && shown < n; ++i) {
+		int index = FindRowByID(c, f.rows[i].id, &byID);
+		
+		if (index < 0) continue;
+		PrintRow(c->table.rows[index], c->tags);
+		shown++;
+	}
+	if (f.count == 0) {
+		printf("No entries have been opened yet.\n");
+	}
+	free(byID);
+	free(f.rows);
+}
+
+static uint64_t
+Mix64(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBULL;
+	x ^= x >> 31;
+	return x;
+}
+
+/* A digest of everything saved for r. 0 stands for "no row". */
+static uint64_t
+RowDigest(Row* r)
+{
+	const char* fields[4];
+	uint64_t h = 14695981039346656037ULL;
+	unsigned int i;
+	const unsigned char* p;
+	
+	fields[0] = GetRowURL(r);
+	fields[1] = r->title;
+	fields[2] = r->comment;
+	fields[3] = r->datetime.last_updated;
+	for (i = 0; i < 4; ++i) {
+		for (p = (const unsigned char*) fields[i]; ; ++p) {
+			h ^= *p;
+			h *= 1099511628211ULL;
+			if (*p == '\0') break;
+		}
+	}
+	for (i = 0; i < ROW_TAG_C; ++i) {
+		h ^= r->tag_ids[i];
+		h *= 1099511628211ULL;
+	}
+	
+	return Mix64(h ^ r->id) | 1;
+}
+
+static uint64_t
+MerkleCombine(uint64_t a, uint64_t b)
+{
+	/* Empty ranges stay 0, so that padding a tree out does not change it. */
+	if (a == 0 && b == 0) return 0;
+	return Mix64(a ^ Mix64(b + 0x9E3779B97F4A7C15ULL));
+}
+
+static void
+MerkleRehash(Merkle* io_m)
+{
+	unsigned int i;
+	
+	for (i = io_m->leaf_c - 1; i > 0; --i) {
+		io_m->nodes[i] = MerkleCombine(io_m->nodes[i * 2], io_m->nodes[i * 2 + 1]);
+	}
+}
+
+/* Pads the tree out to leafC leaves. */
+static void
+MerkleGrow(Merkle* io_m, unsigned int leafC)
+{
+	uint64_t* nodes;
+	
+	if (leafC <= io_m->leaf_c) return;
+	nodes = malloc(sizeof(uint64_t) * 2 * leafC);
+	memset(nodes, 0, sizeof(uint64_t) * 2 * leafC);
+	memcpy(&nodes[leafC], &io_m->nodes[io_m->leaf_c],
+	       sizeof(uint64_t) * io_m->leaf_c);
+	free(io_m->nodes);
+	io_m->nodes = nodes;
+	io_m->leaf_c = leafC;
+	MerkleRehash(io_m);
+}
+
+/* Replaces the digest of row id, before, with after. */
+static void
+MerkleUpdate(Merkle* io_m, unsigned int id, uint64_t before, uint64_t after)
+{
+	unsigned int node, leafC = io_m->leaf_c;
+	
+	while (id / MERKLE_LEAF_IDS >= leafC) leafC *= 2;
+	MerkleGrow(io_m, leafC);
+	
+	node = io_m->leaf_c + id / MERKLE_LEAF_IDS;
+	io_m->nodes[node] += after - before;
+	for (node /= 2; node > 0; node /= 2) {
+		io_m->nodes[node] = MerkleCombine(io_m->nodes[node * 2],
+		                                  io_m->nodes[node * 2 + 1]);
+	}
+}
+
+static void
+DigestRows(void* ctx, unsigned int begin, unsigned int end)
+{
+	DigestJob* job = ctx;
+	unsigned int i;
+	
+	for (i = begin; i < end; ++i) {
+		job->digests[i] = (job->rows[i].id != 0) ? RowDigest(&job->rows[i]) : 0;
+	}
+}
+
+static void
+MerkleBuild(Core* c, Merkle* o_m)
+{
+	DigestJob job;
+	unsigned int i;
+	
+	for (o_m->leaf_c = 1;
+	     o_m->leaf_c <= c->table.next_UID / MERKLE_LEAF_IDS; o_m->leaf_c *= 2);
+	o_m->nodes = malloc(sizeof(uint64_t) * 2 * o_m->leaf_c);
+	memset(o_m->nodes, 0, sizeof(uint64_t) * 2 * o_m->leaf_c);
+	o_m->generation = c->meta.generation;
+	
+	job.rows = c->table.rows;
+	job.digests = malloc(sizeof(uint64_t) * (c->table.count + 1));
+	RunParallel(c->table.count, 16384, DigestRows, &job);
+	for (i = 0; i < c->table.count; ++i) {
+		if (c->table.rows[i].id == 0) continue;
+		o_m->nodes[o_m->leaf_c + c->table.rows[i].id / MERKLE_LEAF_IDS] +=
+			job.digests[i];
+	}
+	free(job.digests);
+	MerkleRehash(o_m);
+}
+
+/* merkle.bin holds "sbmmerk1", the generation, MERKLE_LEAF_IDS and leaf_c
+ * (as unsigned ints) followed by the leaves. It is only used while its
+ * generation matches the store's. */
+static int
+LoadMerkle(Merkle* o_m, unsigned int generation)
+{
+	FILE* fp;
+	char filename[512] = { 0 }, magic[8];
+	unsigned int header[3];
+	int ok;
+	
+	memset(o_m, 0, sizeof(Merkle));
+	GetConfigPath(filename);
+	strcat(filename, merkle_filename);
+	if ((fp = fopen(filename, "rb")) == NULL) {
+		return false;
+	}
+	ok = fread(magic, sizeof(magic), 1, fp) == 1 &&
+	     memcmp(magic, "sbmmerk1", 8) == 0 &&
+	     fread(header, sizeof(header), 1, fp) == 1 &&
+	     header[0] == generation && header[1] == MERKLE_LEAF_IDS &&
+	     header[2] > 0 && (header[2] & (header[2] - 1)) == 0;
+	if (ok == true) {
+		o_m->leaf_c = header[2];
+		o_m->generation = generation;
+		o_m->nodes = malloc(sizeof(uint64_t) * 2 * o_m->leaf_c);
+		memset(o_m->nodes, 0, sizeof(uint64_t) * o_m->leaf_c);
+		ok = fread(&o_m->nodes[o_m->leaf_c], sizeof(uint64_t) * o_m->leaf_c,
+		           1, fp) == 1;
+		if (ok == true) {
+			MerkleRehash(o_m);
+		} else {
+			free(o_m->nodes);
+			memset(o_m, 0, sizeof(Merkle));
+		}
+	}
+	fclose(fp);
+	
+	return ok;
+}
+
+static void
+WriteMerkle(Merkle* m)
+{
+	FILE* fp;
+	char filename[512] = { 0 };
+	unsigned int header[3];
+	
+	GetConfigPath(filename);
+	strcat(filename, merkle_filename);
+	if ((fp = fopen(filename, "wb")) == NULL) {
+		return;
+	}
+	header[0] = m->generation;
+	header[1] = MERKLE_LEAF_IDS;
+	header[2] = m->leaf_c;
+	fwrite("sbmmerk1", 8, 1, fp);
+	fwrite(header, sizeof(header), 1, fp);
+	fwrite(&m->nodes[m->leaf_c], sizeof(uint64_t) * m->leaf_c, 1, fp);
+	fclose(fp);
+}
+
+/* The tree of the store as loaded, from merkle.bin when it is current and
+ * otherwise built from the rows (and saved for next time). */
+static Merkle*
+GetMerkle(Core* io_c)
+{
+	if (io_c->merkle.nodes == NULL &&
+	    !LoadMerkle(&io_c->merkle, io_c->meta.generation)) {
+		MerkleBuild(io_c, &io_c->merkle);
+		WriteMerkle(&io_c->merkle);
+	}
+	return &io_c->merkle;
+}
+
+/* Called once the store is saved. When the command (or the undo or redo)
+ * journaled its changes, merkle.bin is brought up to date from the digests of
+ * the rows it touched; otherwise the file is dropped and rebuilt the next time
+ * it is needed. */
+static void
+SaveMerkle(Core* c)
+{
+	Journal* j = &c->journal;
+	Merkle m;
+	char filename[512] = { 0 };
+	unsigned int i;
+	
+	GetConfigPath(filename);
+	strcat(filename, merkle_filename);
+	if ((j->row_c == 0 && j->tag_c == 0) ||
+	    !LoadMerkle(&m, c->meta.generation - 1)) {
+		remove(filename);
+		return;
+	}
+	for (i = 0; i < j->row_c; ++i) {
+		Row* r = &c->table.rows[j->rows[i * 2]];
+		
+		MerkleUpdate(&m, j->rows[i * 2 + 1], j->digests[i],
+		             (r->id != 0) ? RowDigest(r) : 0);
+	}
+	m.generation = c->meta.generation;
+	WriteMerkle(&m);
+	free(m.nodes);
+}
+
+/* A 64-bit hash of the canonical form of url (FNV-1a, then mixed so that
+ * every bit depends on all of it), as kept by urls.bin. */
+static uint64_t
+URLKey(const char* url)
+{
+	char stack[1024], *buffer, *p;
+	uint64_t h = 14695981039346656037ull;
+	size_t l = strlen(url);
+	
+	buffer = (l < sizeof(stack)) ? stack : malloc(l + 1);
+	CanonicalURL(url, buffer);
+	for (p = buffer; *p != '\0'; ++p) {
+		h ^= (unsigned char) *p;
+		h *= 1099511628211ull;
+	}
+	if (buffer != stack) free(buffer);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	
+	return h;
+}
+
+static void
+URLKeys(void* ctx, unsigned int begin, unsigned int end)
+{
+	URLKeyJob* job = ctx;
+	unsigned int i;
+	
+	for (i = begin; i < end; ++i) {
+		if (job->rows[i].id == 0) continue;
+		job->keys[i] = URLKey(GetRowURL(&job->rows[i]));
+	}
+}
+
+static size_t
+URLIndexSize(unsigned int blockC, unsigned int slotC)
+{
+	return sizeof(URLIndexHeader) + (size_t) blockC * URL_BLOCK_BITS / 8 +
+	       (size_t) slotC * sizeof(URLSlot);
+}
+
+static uint64_t*
+URLIndexBlock(URLIndexHeader* h, uint64_t key)
+{
+	uint64_t* blocks = (uint64_t*) (h + 1);
+	
+	return &blocks[((key >> 32) & (h->block_c - 1)) * (URL_BLOCK_BITS / 64)];
+}
+
+static URLSlot*
+URLIndexSlots(URLIndexHeader* h)
+{
+	return (URLSlot*) ((char*) (h + 1) + (size_t) h->block_c * URL_BLOCK_BITS / 8);
+}
+
+/* The Bloom filter's bits for key all lie in one block, stepped through from
+ * the low bits of the key. */
+static int
+URLIndexMayHave(URLIndexHeader* h, uint64_t key, int add)
+{
+	uint64_t* block = URLIndexBlock(h, key);
+	unsigned int bit = (uint32_t) key, step = ((uint32_t) key >> 23) | 1, i;
+	int have = true;
+	
+	for (i = 0; i < URL_BLOOM_K; ++i, bit += step) {
+		unsigned int b = bit & (URL_BLOCK_BITS - 1);
+		
+		if (add == true) {
+			block[b >> 6] |= (uint64_t) 1 << (b & 63);
+		} else if ((block[b >> 6] & ((uint64_t) 1 << (b & 63))) == 0) {
+			have = false;
+			break;
+		}
+	}
+	
+	return have;
+}
+
+static void
+URLIndexAdd(URLIndexHeader* io_h, uint64_t key, unsigned int id)
+{
+	URLSlot* slots = URLIndexSlots(io_h);
+	uint32_t check = (uint32_t) (key >> 32) | 1;
+	unsigned int mask = io_h->slot_c - 1, i;
+	int empty = -1;
+	
+	for (i = (uint32_t) key & mask; slots[i].check != 0; i = (i + 1) & mask) {
+		if (slots[i].check == check && slots[i].id == id) {
+			return;
+		}
+		if (slots[i].id == 0 && empty < 0) {
+			empty = i;
+		}
+	}
+	if (empty < 0) {
+		empty = i;
+		io_h->used++;
+	}
+	slots[empty].check = check;
+	slots[empty].id = id;
+	URLIndexMayHave(io_h, key, true);
+	io_h->added++;
+}
+
+/* Leaves a tombstone, as the entries after it may have probed past. */
+static void
+URLIndexRemove(URLIndexHeader* io_h, uint64_t key, unsigned int id)
+{
+	URLSlot* slots = URLIndexSlots(io_h);
+	uint32_t check = (uint32_t) (key >> 32) | 1;
+	unsigned int mask = io_h->slot_c - 1, i;
+	
+	for (i = (uint32_t) key & mask; slots[i].check != 0; i = (i + 1) & mask) {
+		if (slots[i].check == check && slots[i].id == id) {
+			slots[i].id = 0;
+			return;
+		}
+	}
+}
+
+/* Writes urls.bin afresh from every live row, with room for as many again. */
+static void
+BuildURLIndex(Core* c)
+{
+	URLIndexHeader* h;
+	URLKeyJob job;
+	char filename[512] = { 0 }, temp[520];
+	unsigned int live = 0, capacity, blockC = 1, slotC = 1024, i;
+	size_t size;
+	FILE* fp;
+	
+	for (i = 0; i < c->table.count; ++i) {
+		live += c->table.rows[i].id != 0;
+	}
+	capacity = Max(live * 2, 1024);
+	while ((size_t) blockC * URL_BLOCK_BITS < (size_t) capacity * URL_BLOOM_BITS) {
+		blockC *= 2;
+	}
+	while (slotC < capacity * 2) slotC *= 2;
+	
+	size = URLIndexSize(blockC, slotC);
+	h = malloc(size);
+	memset(h, 0, size);
+	memcpy(h->magic, "sbmurls1", 8);
+	h->block_c = blockC;
+	h->slot_c = slotC;
+	
+	job.rows = c->table.rows;
+	job.keys = malloc(sizeof(uint64_t) * (c->table.count + 1));
+	RunParallel(c->table.count, 4096, URLKeys, &job);
+	for (i = 0; i < c->table.count; ++i) {
+		if (c->table.rows[i].id == 0) continue;
+		URLIndexAdd(h, job.keys[i], c->table.rows[i].id);
+	}
+	free(job.keys);
+	h->generation = c->meta.generation;
+	
+	GetConfigPath(filename);
+	strcat(filename, urls_filename);
+	snprintf(temp, sizeof(temp), "%s.tmp", filename);
+	if ((fp = fopen(temp, "wb")) != NULL) {
+		int ok = fwrite(h, size, 1, fp) == 1;
+		
+		if (fclose(fp) == 0 && ok == true) {
+			rename(temp, filename);
+		} else {
+			remove(temp);
+		}
+	}
+	free(h);
+}
+
+/* Maps urls.bin if it describes the given generation of the store. */
+static URLIndexHeader*
+MapURLIndex(int fd, unsigned int generation, int writable, size_t* o_size)
+{
+	URLIndexHeader* h;
+	struct stat st;
+	
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(URLIndexHeader)) {
+		return NULL;
+	}
+	h = mmap(NULL, st.st_size, PROT_READ | ((writable == true) ? PROT_WRITE : 0),
+	         MAP_SHARED, fd, 0);
+	if (h == MAP_FAILED) {
+		return NULL;
+	}
+	if (memcmp(h->magic, "sbmurls1", 8) != 0 || h->generation != generation ||
+	    h->block_c == 0 || (h->block_c & (h->block_c - 1)) != 0 ||
+	    h->slot_c == 0 || (h->slot_c & (h->slot_c - 1)) != 0 ||
+	    URLIndexSize(h->block_c, h->slot_c) != st.st_size) {
+		munmap(h, st.st_size);
+		return NULL;
+	}
+	*o_size = st.st_size;
+	
+	return h;
+}
+
+/* Brings urls.bin up to date with the save. Only the journaled rows are
+ * looked at, in place; it is built afresh when it is missing or stale, when
+ * it would fill up, or when the save was not journaled. The rows' URLs never
+ * change, so a journaled row's key is the same before and after. */
+static void
+SaveURLIndex(Core* c)
+{
+	Journal* j = &c->journal;
+	URLIndexHeader* h = NULL;
+	char filename[512] = { 0 };
+	unsigned int adds = 0, i;
+	size_t size;
+	int fd;
+	
+	GetConfigPath(filename);
+	strcat(filename, urls_filename);
+	if ((j->row_c > 0 || j->tag_c > 0) &&
+	    (fd = open(filename, O_RDWR)) >= 0) {
+		h = MapURLIndex(fd, c->meta.generation - 1, true, &size);
+		close(fd);
+	}
+	for (i = 0; h != NULL && i < j->row_c; ++i) {
+		adds += c->table.rows[j->rows[i * 2]].id != 0;
+	}
+	if (h == NULL || h->used + adds > h->slot_c / 2 ||
+	    (size_t) (h->added + adds) * URL_BLOOM_BITS >
+	    (size_t) h->block_c * URL_BLOCK_BITS) {
+		if (h != NULL) munmap(h, size);
+		BuildURLIndex(c);
+		return;
+	}
+	
+	h->generation = 0;
+	for (i = 0; i < j->row_c; ++i) {
+		Row* r = &c->table.rows[j->rows[i * 2]];
+		uint64_t key = URLKey(GetRowURL(r));
+		
+		if (j->rows[i * 2 + 1] != 0 && j->rows[i * 2 + 1] != r->id) {
+			URLIndexRemove(h, key, j->rows[i * 2 + 1]);
+		}
+		if (r->id != 0) {
+			URLIndexAdd(h, key, r->id);
+		}
+	}
+	h->generation = c->meta.generation;
+	munmap(h, size);
+}
+
+/* 'sbm has <url>' from urls.bin alone: prints the IDs of the entries with the
+ * same canonical URL as url. Returns whether there are any, or -1 when
+ * urls.bin is missing or is not of the store as it is now. */
+static int
+HasURL(const char* url)
+{
+	URLIndexHeader* h;
+	URLSlot* slots;
+	char filename[512] = { 0 };
+	unsigned int mask, i;
+	uint64_t key;
+	uint32_t check;
+	int fd, found = false;
+	size_t size;
+	Meta meta;
+	
+	GetConfigPath(filename);
+	strcat(filename, urls_filename);
+	if (!ReadStoreMeta(&meta) || (fd = open(filename, O_RDONLY)) < 0) {
+		return -1;
+	}
+	h = MapURLIndex(fd, meta.generation, false, &size);
+	close(fd);
+	if (h == NULL) {
+		return -1;
+	}
+	
+	key = URLKey(url);
+	if (URLIndexMayHave(h, key, false)) {
+		slots = URLIndexSlots(h);
+		check = (uint32_t) (key >> 32) | 1;
+		mask = h->slot_c - 1;
+		for (i = (uint32_t) key & mask; slots[i].check != 0; i = (i + 1) & mask) {
+			if (slots[i].check == check && slots[i].id != 0) {
+				printf("%u\n", slots[i].id);
+				found = true;
+			}
+		}
+	}
+	munmap(h, size);
+	
+	return found;
+}
+
+static int
+CompareStrings(const void* a, const void* b)
+{
+	return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+/* What an 'sbm list' is looked up by in results_filename: its mode and
+ * terms, with the terms sorted and without repeats, as their order changes
+ * nothing. Taken before the command runs, which may cut up its arguments. */
+static void
+ListResultKey(InputArgs* ia, Buffer* o_key)
+{
+	memset(o_key, 0, sizeof(Buffer));
+	if (ia->word_buffers[WI_HOST] != NULL) {
+		BufferAppendS(o_key, "--host\n");
+		BufferAppendS(o_key, ia->word_buffers[WI_HOST]);
+	} else if (ia->word_buffers[WI_TAG] != NULL) {
+		BufferAppendS(o_key, "-tg\n");
+		BufferAppendS(o_key, ia->word_buffers[WI_TAG]);
+	} else {
+		char** terms;
+		unsigned int i;
+		
+		terms = malloc(sizeof(char*) * (ia->mod_c + 1));
+		memcpy(terms, ia->mod_list, sizeof(char*) * ia->mod_c);
+		qsort(terms, ia->mod_c, sizeof(char*), CompareStrings);
+		BufferAppendS(o_key, (ia->word_buffers[WI_MOD] != NULL &&
+		                      strcmp(ia->word_buffers[WI_MOD], "--any") == 0)
+		                     ? "--any" : "--all");
+		if (ia->word_buffers[WI_SORT] != NULL) {
+			char filename[512] = { 0 };
+			struct stat st;
+			
+			/* The order changes with every visit logged */
+			GetConfigPath(filename);
+			strcat(filename, visits_filename);
+			BufferAppendS(o_key, "\n--frecent ");
+			BufferAppendUInt(o_key, (stat(filename, &st) == 0) ? st.st_size : 0);
+		}
+		for (i = 0; i < ia->mod_c; ++i) {
+			if (i > 0 && strcmp(terms[i], terms[i - 1]) == 0) continue;
+			BufferAppendS(o_key, "\n");
+			BufferAppendS(o_key, terms[i]);
+		}
+		free(terms);
+	}
+}
+
+/* When aliases_filename last changed, or 0 if there is none. Aliases change
+ * what a query means without a save of the store. */
+static uint64_t
+AliasesStamp(void)
+{
+	char filename[512] = { 0 };
+	struct stat st;
+	
+	GetConfigPath(filename);
+	strcat(filename, aliases_filename);
+	if (stat(filename, &st) < 0) {
+		return 0;
+	}
+	
+	return (uint64_t) st.st_mtim.tv_sec * 1000000000u + st.st_mtim.tv_nsec;
+}
+
+/* 'sbm list' from results_filename alone: prints what the same query printed
+ * before, if the store has not been saved since. Returns false when it has
+ * to be run. */
+static int
+ListFromResults(InputArgs* ia)
+{
+	ResultsHeader* h;
+	char filename[512] = { 0 };
+	struct stat st;
+	Buffer key;
+	Meta meta;
+	size_t at;
+	int fd, found = false;
+	
+	GetConfigPath(filename);
+	strcat(filename, results_filename);
+	if (!ReadStoreMeta(&meta) || (fd = open(filename, O_RDONLY)) < 0) {
+		return false;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(ResultsHeader) ||
+	    (h = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+	close(fd);
+	if (memcmp(h->magic, "sbmres1", 8) != 0 ||
+	    h->generation != meta.generation || h->aliases != AliasesStamp()) {
+		munmap(h, st.st_size);
+		return false;
+	}
+	
+	ListResultKey(ia, &key);
+	/* Another process may be appending; an entry cut short is left out. */
+	for (at = sizeof(ResultsHeader);
+	     found == false && at + sizeof(ResultsEntry) <= st.st_size;) {
+		ResultsEntry e;
+		char* p = (char*) h + at;
+		
+		memcpy(&e, p, sizeof(ResultsEntry));
+		p += sizeof(ResultsEntry);
+		at += sizeof(ResultsEntry) + (size_t) e.key_l + e.output_l;
+		if (at > st.st_size) break;
+		if (e.hash == HashString(key.data) && e.key_l == key.length &&
+		    memcmp(p, key.data, key.length) == 0) {
+			fwrite(p + e.key_l, 1, e.output_l, stdout);
+			found = true;
+		}
+	}
+	munmap(h, st.st_size);
+	free(key.data);
+	
+	return found;
+}
+
+/* Adds what an 'sbm list' printed to results_filename, starting it afresh
+ * when it is of an older store. Once it holds RESULTS_S bytes, further
+ * queries are not kept until the next save. */
+static void
+SaveListResult(Core* c, Buffer* key, Buffer* output)
+{
+	ResultsHeader h;
+	ResultsEntry e;
+	Buffer entry;
+	char filename[512] = { 0 }, temp[520];
+	struct stat st;
+	uint64_t stamp = AliasesStamp();
+	int fd, fresh = true;
+	
+	if (sizeof(ResultsHeader) + sizeof(ResultsEntry) + key->length +
+	    output->length > RESULTS_S) {
+		return;
+	}
+	GetConfigPath(filename);
+	strcat(filename, results_filename);
+	if ((fd = open(filename, O_RDONLY)) >= 0) {
+		if (fstat(fd, &st) == 0 && read(fd, &h, sizeof(h)) == sizeof(h) &&
+		    memcmp(h.magic, "sbmres1", 8) == 0 &&
+		    h.generation == c->meta.generation && h.aliases == stamp) {
+			if (st.st_size + sizeof(ResultsEntry) + key->length +
+			    output->length > RESULTS_S) {
+				close(fd);
+				return;
+			}
+			fresh = false;
+		}
+		close(fd);
+	}
+	
+	memset(&entry, 0, sizeof(Buffer));
+	if (fresh == true) {
+		memset(&h, 0, sizeof(ResultsHeader));
+		memcpy(h.magic, "sbmres1", 8);
+		h.generation = c->meta.generation;
+		h.aliases = stamp;
+		BufferAppend(&entry, (char*) &h, sizeof(ResultsHeader));
+	}
+	e.hash = HashString(key->data);
+	e.key_l = key->length;
+	e.output_l = output->length;
+	BufferAppend(&entry, (char*) &e, sizeof(ResultsEntry));
+	BufferAppend(&entry, key->data, key->length);
+	if (output->length > 0) {
+		BufferAppend(&entry, output->data, output->length);
+	}
+	
+	/* A new file replaces the old one whole; entries are added to a current
+	 * one with a single write, so readers never see half of one. */
+	if (fresh == true) {
+		snprintf(temp, sizeof(temp), "%s.tmp", filename);
+		fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	} else {
+		fd = open(filename, O_WRONLY | O_APPEND);
+	}
+	if (fd >= 0) {
+		int ok = write(fd, entry.data, entry.length) == (ssize_t) entry.length;
+		
+		if (close(fd) == 0 && ok == true && fresh == true) {
+			rename(temp, filename);
+		} else if (fresh == true) {
+			remove(temp);
+		}
+	}
+	free(entry.data);
+}
+
+/* Collects the rows of c whose IDs fall in the marked leaves. */
+static Row*
+RowsInLeaves(Core* c, unsigned char* marked, unsigned int leafC,
+             unsigned int* o_c)
+{
+	Row* rows = NULL;
+	unsigned int i, capacity = 0;
+	
+	*o_c = 0;
+	for (i = 0; i < c->table.count; ++i) {
+		unsigned int leaf = c->table.rows[i].id / MERKLE_LEAF_IDS;
+		
+		if (c->table.rows[i].id == 0 || leaf >= leafC || marked[leaf] == 0) {
+			continue;
+		}
+		if (*o_c == capacity) {
+			capacity = Max(64, capacity * 2);
+			rows = realloc(rows, sizeof(Row) * capacity);
+		}
+		rows[(*o_c)++] = c->table.rows[i];
+	}
+	
+	return rows;
+}
+
+static unsigned char*
+MarkLeaves(unsigned int* leaves, unsigned int n, unsigned int leafC)
+{
+	unsigned char* marked;
+	unsigned int i;
+	
+	marked = malloc(leafC + 1);
+	memset(marked, 0, leafC + 1);
+	for (i = 0; i < n; ++i) {
+		if (leaves[i] < leafC) marked[leaves[i]] = 1;
+	}
+	return marked;
+}
+
+static void
+LocalPeerNodes(void* ctx, unsigned int* nodes, unsigned int n,
+               uint64_t* o_hashes)
+{
+	Merkle* m = &((Core*) ctx)->merkle;
+	unsigned int i;
+	
+	for (i = 0; i < n; ++i) {
+		o_hashes[i] = (nodes[i] < 2 * m->leaf_c) ? m->nodes[nodes[i]] : 0;
+	}
+}
+
+static Row*
+LocalPeerRows(void* ctx, unsigned int* leaves, unsigned int n, unsigned int* o_c)
+{
+	Core* c = ctx;
+	unsigned char* marked;
+	Row* rows;
+	
+	marked = MarkLeaves(leaves, n, c->merkle.leaf_c);
+	rows = RowsInLeaves(c, marked, c->merkle.leaf_c, o_c);
+	free(marked);
+	
+	return rows;
+}
+
+/* Sends one request line: a word followed by n numbers. */
+static void
+DiffSend(FILE* out, const char* word, unsigned int* values, unsigned int n)
+{
+	Buffer line;
+	unsigned int i;
+	
+	memset(&line, 0, sizeof(Buffer));
+	BufferAppendS(&line, word);
+	BufferAppendS(&line, " ");
+	BufferAppendUInt(&line, n);
+	for (i = 0; i < n; ++i) {
+		BufferAppendS(&line, " ");
+		BufferAppendUInt(&line, values[i]);
+	}
+	BufferAppendS(&line, "\n");
+	fwrite(line.data, line.length, 1, out);
+	fflush(out);
+	free(line.data);
+}
+
+static char*
+DiffReceive(FILE* in, char** io_line, size_t* io_size)
+{
+	if (getline(io_line, io_size, in) < 0) {
+		fprintf(stderr, "The other side of the diff went away.\n");
+		exit(-1);
+	}
+	return *io_line;
+}
+
+static void
+StreamPeerNodes(void* ctx, unsigned int* nodes, unsigned int n,
+                uint64_t* o_hashes)
+{
+	DiffStream* stream = ctx;
+	char* line = NULL, *p;
+	size_t size = 0;
+	unsigned int i;
+	
+	DiffSend(stream->out, "NODES", nodes, n);
+	p = DiffReceive(stream->in, &line, &size);
+	if (strncmp(p, "NODES ", 6) != 0 || strtoul(p + 6, &p, 10) != n) {
+		fprintf(stderr, "Unexpected reply: %s", line);
+		exit(-1);
+	}
+	for (i = 0; i < n; ++i) {
+		o_hashes[i] = strtoull(p, &p, 16);
+	}
+	free(line);
+}
+
+static Row*
+StreamPeerRows(void* ctx, unsigned int* leaves, unsigned int n,
+               unsigned int* o_c)
+{
+	DiffStream* stream = ctx;
+	char* line = NULL;
+	size_t size = 0;
+	Row* rows = NULL;
+	unsigned int capacity = 0;
+	
+	*o_c = 0;
+	DiffSend(stream->out, "ROWS", leaves, n);
+	while (strcmp(DiffReceive(stream->in, &line, &size), "END\n") != 0) {
+		StructIndex idx;
+		size_t pos;
+		
+		if (*o_c == capacity) {
+			capacity = Max(64, capacity * 2);
+			rows = realloc(rows, sizeof(Row) * capacity);
+		}
+		BuildStructIndex(line, strlen(line), &idx);
+		pos = NextStructural(&idx, 0);
+		if (!DecodeStructRow(&idx, pos, &rows[*o_c])) {
+			fprintf(stderr, "Unexpected reply: %s", line);
+			exit(-1);
+		}
+		free(idx.bits);
+		(*o_c)++;
+	}
+	free(line);
+	
+	return rows;
+}
+
+static int
+CompareRowsByID(const void* a, const void* b)
+{
+	const Row* x = a, *y = b;
+	return (x->id > y->id) - (x->id < y->id);
+}
+
+/* Walks both trees down from the root, level by level, only into the nodes
+ * whose hashes differ, then compares the rows of the differing leaves. The
+ * work (and, for a stream, the traffic) is O(changes * log n). Returns how
+ * many rows differ. */
+static unsigned int
+DiffWithPeer(Core* io_c, DiffPeer* peer)
+{
+	Merkle* m;
+	unsigned int* frontier, *next, *leaves;
+	unsigned int frontierC, nextC, leafC, i, j;
+	unsigned int added = 0, removed = 0, changed = 0;
+	uint64_t* hashes;
+	
+	m = GetMerkle(io_c);
+	MerkleGrow(m, peer->leaf_c);
+	
+	frontier = malloc(sizeof(unsigned int) * m->leaf_c);
+	next     = malloc(sizeof(unsigned int) * m->leaf_c);
+	leaves   = malloc(sizeof(unsigned int) * m->leaf_c);
+	hashes   = malloc(sizeof(uint64_t) * m->leaf_c);
+	frontier[0] = 1;
+	frontierC = 1;
+	leafC = 0;
+	while (frontierC > 0) {
+		peer->get_nodes(peer->ctx, frontier, frontierC, hashes);
+		for (i = 0, nextC = 0; i < frontierC; ++i) {
+			unsigned int node = frontier[i];
+			
+			if (hashes[i] == m->nodes[node]) continue;
+			if (node >= m->leaf_c) {
+				leaves[leafC++] = node - m->leaf_c;
+			} else {
+				next[nextC++] = node * 2;
+				next[nextC++] = node * 2 + 1;
+			}
+		}
+		memcpy(frontier, next, sizeof(unsigned int) * nextC);
+		frontierC = nextC;
+	}
+	
+	if (leafC > 0) {
+		Row* mine, *theirs;
+		unsigned int mineC, theirC;
+		unsigned char* marked;
+		
+		marked = MarkLeaves(leaves, leafC, m->leaf_c);
+		mine = RowsInLeaves(io_c, marked, m->leaf_c, &mineC);
+		theirs = peer->get_rows(peer->ctx, leaves, leafC, &theirC);
+		qsort(mine, mineC, sizeof(Row), CompareRowsByID);
+		qsort(theirs, theirC, sizeof(Row), CompareRowsByID);
+		for (i = 0, j = 0; i < mineC || j < theirC; ) {
+			if (j == theirC || (i < mineC && mine[i].id < theirs[j].id)) {
+				printf("- %d %s\n", mine[i].id, GetRowURL(&mine[i]));
+				removed++;
+				i++;
+			} else if (i == mineC || theirs[j].id < mine[i].id) {
+				printf("+ %d %s\n", theirs[j].id, GetRowURL(&theirs[j]));
+				added++;
+				j++;
+			} else {
+				if (RowDigest(&mine[i]) != RowDigest(&theirs[j])) {
+					printf("~ %d %s\n", theirs[j].id, GetRowURL(&theirs[j]));
+					changed++;
+				}
+				i++;
+				j++;
+			}
+		}
+		free(marked);
+		free(mine);
+		free(theirs);
+	}
+	printf("%d added, %d removed, %d changed.\n", added, removed, changed);
+	
+	free(frontier);
+	free(next);
+	free(leaves);
+	free(hashes);
+	
+	return added + removed + changed;
+}
+
+static int
+ConnectUnixSocket(const char* path, int listening)
+{
+	struct sockaddr_un addr;
+	int fd, conn;
+	
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		return -1;
+	}
+	if (listening == false) {
+		if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+	
+	unlink(path);
+	if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+	    listen(fd, 1) < 0 || (conn = accept(fd, NULL, NULL)) < 0) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	unlink(path);
+	
+	return conn;
+}
+
+static void
+Diff(Core* io_c, char** args, unsigned int argc)
+{
+	DiffPeer peer;
+	unsigned int differences;
+	
+	memset(&peer, 0, sizeof(DiffPeer));
+	if (argc == 1) {
+		Core* other;
+		char* contents;
+		size_t contentsSize;
+		FILE* fp;
+		
+		if ((fp = fopen(args[0], "rb")) == NULL) {
+			fprintf(stderr, "Could not open '%s'.\n", args[0]);
+			exit(-1);
+		}
+		fseek(fp, 0, SEEK_END);
+		contentsSize = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		contents = malloc(contentsSize + 1);
+		contents[fread(contents, 1, contentsSize, fp)] = '\0';
+		fclose(fp);
+		
+		other = malloc(sizeof(Core));
+		memset(other, 0, sizeof(Core));
+		LoadStore(contents, contentsSize, other);
+		MerkleBuild(other, &other->merkle);
+		MerkleGrow(&other->merkle, GetMerkle(io_c)->leaf_c);
+		peer.leaf_c    = other->merkle.leaf_c;
+		peer.ctx       = other;
+		peer.get_nodes = LocalPeerNodes;
+		peer.get_rows  = LocalPeerRows;
+		differences = DiffWithPeer(io_c, &peer);
+	} else {
+		DiffStream stream;
+		char* line = NULL;
+		size_t size = 0;
+		unsigned int hello[2], leafIDs;
+		
+		if (argc == 2) {
+			int fd;
+			
+			if ((fd = ConnectUnixSocket(args[1], false)) < 0) {
+				fprintf(stderr, "Could not connect to '%s'.\n", args[1]);
+				exit(-1);
+			}
+			stream.in  = fdopen(fd, "r");
+			stream.out = fdopen(dup(fd), "w");
+		} else {
+			/* Open the writing end first: the server's reads come first. */
+			stream.out = fopen(args[2], "w");
+			stream.in  = (stream.out != NULL) ? fopen(args[1], "r") : NULL;
+		}
+		if (stream.in == NULL || stream.out == NULL) {
+			fprintf(stderr, "Could not open the streams to diff against.\n");
+			exit(-1);
+		}
+		
+		hello[0] = MERKLE_LEAF_IDS;
+		hello[1] = GetMerkle(io_c)->leaf_c;
+		DiffSend(stream.out, "HELLO", hello, 2);
+		if (sscanf(DiffReceive(stream.in, &line, &size), "HELLO 2 %u %u",
+		           &leafIDs, &peer.leaf_c) != 2 || leafIDs != MERKLE_LEAF_IDS) {
+			fprintf(stderr, "Unexpected reply: %s", line);
+			exit(-1);
+		}
+		free(line);
+		peer.ctx       = &stream;
+		peer.get_nodes = StreamPeerNodes;
+		peer.get_rows  = StreamPeerRows;
+		differences = DiffWithPeer(io_c, &peer);
+		
+		DiffSend(stream.out, "BYE", NULL, 0);
+		fclose(stream.in);
+		fclose(stream.out);
+	}
+	
+	if (differences > 0) {
+		exit(1);
+	}
+}
+
+/* Answers the requests of 'sbm diff', one line each:
+ * 	HELLO 2 <leaf IDs> <leaf count>  -> HELLO 2 <leaf IDs> <leaf count>
+ * 	NODES <n> <node>...              -> NODES <n> <hash in hex>...
+ * 	ROWS <n> <leaf>...               -> one saved row per line, then END
+ * 	BYE */
+static void
+DiffServe(Core* io_c, char** args, unsigned int argc)
+{
+	FILE* in = stdin, *out = stdout;
+	Merkle* m;
+	char* line = NULL, *p;
+	size_t size = 0;
+	unsigned int* values = NULL, valueC, i;
+	
+	if (argc == 2) {
+		int fd;
+		
+		if ((fd = ConnectUnixSocket(args[1], true)) < 0) {
+			fprintf(stderr, "Could not listen on '%s'.\n", args[1]);
+			exit(-1);
+		}
+		in  = fdopen(fd, "r");
+		out = fdopen(dup(fd), "w");
+	}
+	
+	m = GetMerkle(io_c);
+	while (getline(&line, &size, in) >= 0) {
+		char word[8] = { 0 };
+		
+		sscanf(line, "%7s", word);
+		p = line + strlen(word);
+		valueC = strtoul(p, &p, 10);
+		values = realloc(values, sizeof(unsigned int) * (valueC + 1));
+		for (i = 0; i < valueC; ++i) {
+			values[i] = strtoul(p, &p, 10);
+		}
+		
+		if (strcmp(word, "HELLO") == 0 && valueC == 2) {
+			MerkleGrow(m, values[1]);
+			fprintf(out, "HELLO 2 %d %d\n", MERKLE_LEAF_IDS, m->leaf_c);
+		} else if (strcmp(word, "NODES") == 0) {
+			fprintf(out, "NODES %d", valueC);
+			for (i = 0; i < valueC; ++i) {
+				fprintf(out, " %llx", (unsigned long long)
+				        ((values[i] < 2 * m->leaf_c) ? m->nodes[values[i]] : 0));
+			}
+			fprintf(out, "\n");
+		} else if (strcmp(word, "ROWS") == 0) {
+			unsigned char* marked;
+			Row* rows;
+			unsigned int rowC;
+			Buffer b;
+			
+			marked = MarkLeaves(values, valueC, m->leaf_c);
+			rows = RowsInLeaves(io_c, marked, m->leaf_c, &rowC);
+			memset(&b, 0, sizeof(Buffer));
+			for (i = 0; i < rowC; ++i) {
+				BufferAppendRow(&b, &rows[i]);
+				BufferAppendS(&b, "\n");
+			}
+			BufferAppendS(&b, "END\n");
+			fwrite(b.data, b.length, 1, out);
+			free(b.data);
+			free(rows);
+			free(marked);
+		} else if (strcmp(word, "BYE") == 0) {
+			break;
+		} else {
+			fprintf(out, "ERROR unknown request\n");
+		}
+		fflush(out);
+	}
+	
+	free(values);
+	free(line);
+	if (in != stdin) {
+		fclose(in);
+		fclose(out);
+	}
+}
+
+static int
+StampCompare(Stamp a, Stamp b)
+{
+	if (a.clock != b.clock) return (a.clock < b.clock) ? -1 : 1;
+	if (a.device != b.device) return (a.device < b.device) ? -1 : 1;
+	return 0;
+}
+
+/* Stamps are written as "<clock>.<device>", e.g. "42.5f3a09c1". */
+static void
+BufferAppendStamp(Buffer* io_b, Stamp s)
+{
+	char text[32];
+	
+	snprintf(text, sizeof(text), "\"%u.%08x\"", s.clock, s.device);
+	BufferAppendS(io_b, text);
+}
+
+static int
+ParseStamp(const char* s, size_t l, Stamp* o_s)
+{
+	char text[32], *end;
+	
+	if (l == 0 || l >= sizeof(text) || !isdigit((unsigned char) s[0])) {
+		return false;
+	}
+	memcpy(text, s, l);
+	text[l] = '\0';
+	o_s->clock = strtoul(text, &end, 10);
+	if (*end != '.' || !isxdigit((unsigned char) end[1])) return false;
+	o_s->device = strtoul(end + 1, &end, 16);
+	return *end == '\0';
+}
+
+static int
+CompareReplicaOps(const void* a, const void* b)
+{
+	return StampCompare(((const ReplicaOp*) a)->id, ((const ReplicaOp*) b)->id);
+}
+
+static Stamp
+ReplicaTick(Replica* io_r)
+{
+	Stamp s;
+	
+	s.clock = ++io_r->clock;
+	s.device = io_r->device;
+	return s;
+}
+
+/* The newest clock of device in the vector seen. */
+static unsigned int
+SeenClock(Stamp* seen, unsigned int seenC, unsigned int device)
+{
+	unsigned int i;
+	
+	for (i = 0; i < seenC; ++i) {
+		if (seen[i].device == device) return seen[i].clock;
+	}
+	return 0;
+}
+
+static void
+ReplicaSee(Replica* io_r, Stamp s)
+{
+	unsigned int i;
+	
+	for (i = 0; i < io_r->seen_c && io_r->seen[i].device != s.device; ++i);
+	if (i == io_r->seen_c) {
+		io_r->seen = realloc(io_r->seen, sizeof(Stamp) * (io_r->seen_c + 1));
+		io_r->seen[io_r->seen_c++] = s;
+	} else {
+		io_r->seen[i].clock = Max(io_r->seen[i].clock, s.clock);
+	}
+	io_r->clock = Max(io_r->clock, s.clock);
+}
+
+static unsigned int
+HashStamp(Stamp s)
+{
+	return (unsigned int) Mix64(((uint64_t) s.device << 32) | s.clock);
+}
+
+static ReplicaRow*
+FindReplicaRow(Replica* r, Stamp id)
+{
+	unsigned int mask, i;
+	
+	if (r->bucket_c == 0) return NULL;
+	mask = r->bucket_c - 1;
+	for (i = HashStamp(id) & mask; r->by_id[i] != 0; i = (i + 1) & mask) {
+		if (StampCompare(r->rows[r->by_id[i] - 1].id, id) == 0) {
+			return &r->rows[r->by_id[i] - 1];
+		}
+	}
+	return NULL;
+}
+
+static ReplicaRow*
+FindLocalReplicaRow(Replica* r, unsigned int localID)
+{
+	if (localID == 0 || localID >= r->by_local_c || r->by_local[localID] == 0) {
+		return NULL;
+	}
+	return &r->rows[r->by_local[localID] - 1];
+}
+
+static void
+MapLocalReplicaRow(Replica* io_r, ReplicaRow* rr, unsigned int localID)
+{
+	if (rr->local_id != 0 && rr->local_id < io_r->by_local_c) {
+		io_r->by_local[rr->local_id] = 0;
+	}
+	rr->local_id = localID;
+	if (localID == 0) return;
+	if (localID >= io_r->by_local_c) {
+		unsigned int c = Max(localID + 1, io_r->by_local_c * 2);
+		
+		io_r->by_local = realloc(io_r->by_local, sizeof(unsigned int) * c);
+		memset(&io_r->by_local[io_r->by_local_c], 0,
+		       sizeof(unsigned int) * (c - io_r->by_local_c));
+		io_r->by_local_c = c;
+	}
+	io_r->by_local[localID] = rr - io_r->rows + 1;
+}
+
+static ReplicaRow*
+AddReplicaRow(Replica* io_r, Stamp id, unsigned int localID)
+{
+	ReplicaRow* rr;
+	unsigned int mask, i;
+	
+	if (io_r->row_c == io_r->row_capacity) {
+		io_r->row_capacity = Max(64, io_r->row_capacity * 2);
+		io_r->rows = realloc(io_r->rows, sizeof(ReplicaRow) * io_r->row_capacity);
+	}
+	/* Kept at most half full */
+	if ((io_r->row_c + 1) * 2 > io_r->bucket_c) {
+		io_r->bucket_c = Max(128, io_r->bucket_c * 2);
+		free(io_r->by_id);
+		io_r->by_id = malloc(sizeof(unsigned int) * io_r->bucket_c);
+		memset(io_r->by_id, 0, sizeof(unsigned int) * io_r->bucket_c);
+		mask = io_r->bucket_c - 1;
+		for (i = 0; i < io_r->row_c; ++i) {
+			unsigned int b;
+			
+			for (b = HashStamp(io_r->rows[i].id) & mask; io_r->by_id[b] != 0;
+			     b = (b + 1) & mask);
+			io_r->by_id[b] = i + 1;
+		}
+	}
+	
+	rr = &io_r->rows[io_r->row_c++];
+	memset(rr, 0, sizeof(ReplicaRow));
+	rr->id = rr->title_at = rr->comment_at = rr->date_at = id;
+	mask = io_r->bucket_c - 1;
+	for (i = HashStamp(id) & mask; io_r->by_id[i] != 0; i = (i + 1) & mask);
+	io_r->by_id[i] = io_r->row_c;
+	MapLocalReplicaRow(io_r, rr, localID);
+	
+	return rr;
+}
+
+static void
+AddReplicaTag(ReplicaRow* io_rr, const char* name, Stamp added)
+{
+	io_rr->tags = realloc(io_rr->tags, sizeof(ReplicaTag) * (io_rr->tag_c + 1));
+	memset(&io_rr->tags[io_rr->tag_c], 0, sizeof(ReplicaTag));
+	strncpy(io_rr->tags[io_rr->tag_c].name, name, TAG_NAME_S - 1);
+	io_rr->tags[io_rr->tag_c++].added = added;
+}
+
+static int
+ReplicaEnabled(void)
+{
+	char filename[512] = { 0 };
+	
+	GetConfigPath(filename);
+	strcat(filename, replica_filename);
+	return access(filename, F_OK) == 0;
+}
+
+static char*
+ReadWholeFile(const char* filename, size_t* o_size)
+{
+	FILE* fp;
+	char* contents;
+	
+	if ((fp = fopen(filename, "rb")) == NULL) {
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	*o_size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	contents = malloc(*o_size + 1);
+	contents[*o_size = fread(contents, 1, *o_size, fp)] = '\0';
+	fclose(fp);
+	
+	return contents;
+}
+
+/* replica.json holds a header line,
+ * 	{"device": "D", "clock": "C", "generation": "G", "seen": {"D": "C", ...}}
+ * followed by a line for each row,
+ * 	"<global ID>": ["<local ID>", "<title stamp>", "<comment stamp>",
+ * 	                "<date stamp>", [["<tag>", "<added stamp>"], ...]]
+ * where a local ID of 0 marks a removed row. */
+static int
+LoadReplica(Replica* io_r)
+{
+	char filename[512] = { 0 };
+	char* contents;
+	size_t size, pos;
+	StructIndex idx;
+	const char* s;
+	size_t l;
+	int ok = false;
+	
+	GetConfigPath(filename);
+	strcat(filename, replica_filename);
+	if ((contents = ReadWholeFile(filename, &size)) == NULL) {
+		return false;
+	}
+	BuildStructIndex(contents, size, &idx);
+	pos = NextStructural(&idx, 0);
+	if (!StructExpect(&idx, &pos, '{')) goto done;
+	while (pos < idx.size && idx.text[pos] == '"') {
+		char key[16] = { 0 };
+		
+		if (!StructString(&idx, &pos, &s, &l) ||
+		    !StructExpect(&idx, &pos, ':')) goto done;
+		memcpy(key, s, Min(l, sizeof(key) - 1));
+		if (strcmp(key, "seen") == 0) {
+			if (!StructExpect(&idx, &pos, '{')) goto done;
+			while (pos < idx.size && idx.text[pos] == '"') {
+				char device[16] = { 0 };
+				Stamp seen;
+				
+				if (!StructString(&idx, &pos, &s, &l)) goto done;
+				memcpy(device, s, Min(l, sizeof(device) - 1));
+				seen.device = strtoul(device, NULL, 16);
+				if (!StructExpect(&idx, &pos, ':') ||
+				    !StructString(&idx, &pos, &s, &l)) goto done;
+				seen.clock = StructUInt(s, l);
+				ReplicaSee(io_r, seen);
+				if (!StructExpect(&idx, &pos, ',')) break;
+			}
+			if (!StructExpect(&idx, &pos, '}')) goto done;
+		} else {
+			char value[16] = { 0 };
+			
+			if (!StructString(&idx, &pos, &s, &l)) goto done;
+			memcpy(value, s, Min(l, sizeof(value) - 1));
+			if (strcmp(key, "device") == 0) {
+				io_r->device = strtoul(value, NULL, 16);
+			} else if (strcmp(key, "clock") == 0) {
+				io_r->clock = Max(io_r->clock, StructUInt(s, l));
+			} else if (strcmp(key, "generation") == 0) {
+				io_r->generation = StructUInt(s, l);
+			}
+		}
+		if (!StructExpect(&idx, &pos, ',')) break;
+	}
+	if (!StructExpect(&idx, &pos, '}') || io_r->device == 0) goto done;
+	
+	while (pos < idx.size && idx.text[pos] == '"') {
+		ReplicaRow* rr;
+		Stamp id;
+		
+		if (!StructString(&idx, &pos, &s, &l) || !ParseStamp(s, l, &id) ||
+		    !StructExpect(&idx, &pos, ':') || !StructExpect(&idx, &pos, '[') ||
+		    !StructString(&idx, &pos, &s, &l)) goto done;
+		rr = AddReplicaRow(io_r, id, StructUInt(s, l));
+		if (!StructExpect(&idx, &pos, ',') ||
+		    !StructString(&idx, &pos, &s, &l) ||
+		    !ParseStamp(s, l, &rr->title_at) ||
+		    !StructExpect(&idx, &pos, ',') ||
+		    !StructString(&idx, &pos, &s, &l) ||
+		    !ParseStamp(s, l, &rr->comment_at) ||
+		    !StructExpect(&idx, &pos, ',') ||
+		    !StructString(&idx, &pos, &s, &l) ||
+		    !ParseStamp(s, l, &rr->date_at) ||
+		    !StructExpect(&idx, &pos, ',') ||
+		    !StructExpect(&idx, &pos, '[')) goto done;
+		while (pos < idx.size && idx.text[pos] == '[') {
+			char name[TAG_NAME_S];
+			Stamp added;
+			
+			if (!StructExpect(&idx, &pos, '[') ||
+			    !StructString(&idx, &pos, &s, &l)) goto done;
+			JSONUnescape(s, l, name, TAG_NAME_S);
+			if (!StructExpect(&idx, &pos, ',') ||
+			    !StructString(&idx, &pos, &s, &l) ||
+			    !ParseStamp(s, l, &added) ||
+			    !StructExpect(&idx, &pos, ']')) goto done;
+			AddReplicaTag(rr, name, added);
+			if (!StructExpect(&idx, &pos, ',')) break;
+		}
+		if (!StructExpect(&idx, &pos, ']') ||
+		    !StructExpect(&idx, &pos, ']')) goto done;
+	}
+	ok = pos >= idx.size;
+	
+done:
+	free(idx.bits);
+	free(contents);
+	if (ok == false) {
+		fprintf(stderr, "'%s' is damaged.\n", filename);
+		exit(-1);
+	}
+	io_r->loaded = true;
+	return true;
+}
+
+/* Appends the operations made since loading to oplog.json and rewrites
+ * replica.json. */
+static void
+WriteReplica(Replica* r)
+{
+	FILE* fp;
+	char filename[512] = { 0 };
+	Buffer out;
+	unsigned int i, j;
+	
+	if (r->log.length > 0) {
+		GetConfigPath(filename);
+		strcat(filename, oplog_filename);
+		if ((fp = fopen(filename, "ab")) == NULL) {
+			fprintf(stderr, "Could not write to '%s'.\n", filename);
+			exit(-1);
+		}
+		fwrite(r->log.data, r->log.length, 1, fp);
+		fclose(fp);
+		r->log.length = 0;
+	}
+	
+	memset(&out, 0, sizeof(Buffer));
+	BufferReserve(&out, 256 + r->row_c * 96);
+	{
+		char text[128];
+		
+		snprintf(text, sizeof(text), "{\"device\": \"%08x\", \"clock\": \"%u\", " \
+		         "\"generation\": \"%u\", \"seen\": {", r->device, r->clock,
+		         r->generation);
+		BufferAppendS(&out, text);
+		for (i = 0; i < r->seen_c; ++i) {
+			snprintf(text, sizeof(text), "%s\"%08x\": \"%u\"", (i == 0) ? "" : ", ",
+			         r->seen[i].device, r->seen[i].clock);
+			BufferAppendS(&out, text);
+		}
+		BufferAppendS(&out, "}}\n");
+	}
+	for (i = 0; i < r->row_c; ++i) {
+		ReplicaRow* rr = &r->rows[i];
+		
+		BufferAppendStamp(&out, rr->id);
+		BufferAppendS(&out, ": [\"");
+		BufferAppendUInt(&out, rr->local_id);
+		BufferAppendS(&out, "\", ");
+		BufferAppendStamp(&out, rr->title_at);
+		BufferAppendS(&out, ", ");
+		BufferAppendStamp(&out, rr->comment_at);
+		BufferAppendS(&out, ", ");
+		BufferAppendStamp(&out, rr->date_at);
+		BufferAppendS(&out, ", [");
+		for (j = 0; j < rr->tag_c; ++j) {
+			BufferAppendS(&out, (j == 0) ? "[" : ", [");
+			BufferAppendJSONString(&out, rr->tags[j].name);
+			BufferAppendS(&out, ", ");
+			BufferAppendStamp(&out, rr->tags[j].added);
+			BufferAppendS(&out, "]");
+		}
+		BufferAppendS(&out, "]]\n");
+	}
+	
+	memset(filename, 0, sizeof(filename));
+	GetConfigPath(filename);
+	strcat(filename, replica_filename);
+	if ((fp = fopen(filename, "wb")) == NULL ||
+	    fwrite(out.data, out.length, 1, fp) < 1) {
+		fprintf(stderr, "Could not write to '%s'.\n", filename);
+		exit(-1);
+	}
+	fclose(fp);
+	free(out.data);
+}
+
+/* Starts a line of oplog.json: {"op": kind, "id": ..., "row": ... */
+static Stamp
+ReplicaOpStart(Replica* io_r, const char* kind, ReplicaRow* rr)
+{
+	Stamp id = ReplicaTick(io_r);
+	
+	ReplicaSee(io_r, id);
+	BufferAppendS(&io_r->log, "{\"op\": \"");
+	BufferAppendS(&io_r->log, kind);
+	BufferAppendS(&io_r->log, "\", \"id\": ");
+	BufferAppendStamp(&io_r->log, id);
+	BufferAppendS(&io_r->log, ", \"row\": ");
+	BufferAppendStamp(&io_r->log, (rr != NULL) ? rr->id : id);
+	return id;
+}
+
+static void
+ReplicaOpField(Replica* io_r, const char* name, const char* value)
+{
+	BufferAppendS(&io_r->log, ", \"");
+	BufferAppendS(&io_r->log, name);
+	BufferAppendS(&io_r->log, "\": ");
+	BufferAppendJSONString(&io_r->log, value);
+}
+
+/* Brings the tag set of rr in line with the tags row now has, adding an
+ * operation for each tag given to or taken from it. */
+static void
+ReplicaSyncTags(Core* c, ReplicaRow* rr, Row* row)
+{
+	Replica* r = &c->replica;
+	const char* names[ROW_TAG_C];
+	unsigned int nameC = 0, i, j, k;
+	Stamp id;
+	
+	for (i = 0; i < ROW_TAG_C; ++i) {
+		int index = (row->tag_ids[i] != 0) ? FindTagIndex(c, row->tag_ids[i]) : -1;
+		
+		if (index >= 0 && c->tags.tags[index].id != 0) {
+			names[nameC++] = c->tags.tags[index].name;
+		}
+	}
+	for (i = 0; i < rr->tag_c; ) {
+		char name[TAG_NAME_S];
+		
+		for (j = 0; j < nameC && strcmp(names[j], rr->tags[i].name) != 0; ++j);
+		if (j < nameC) {
+			i++;
+			continue;
+		}
+		strcpy(name, rr->tags[i].name);
+		
+		/* Removes every addition of the tag seen here */
+		id = ReplicaOpStart(r, "untag", rr);
+		ReplicaOpField(r, "tag", name);
+		ReplicaOpField(r, "date", row->datetime.last_updated);
+		BufferAppendS(&r->log, ", \"removes\": [");
+		for (j = i, k = 0; j < rr->tag_c; ++j) {
+			if (strcmp(rr->tags[j].name, name) != 0) continue;
+			BufferAppendS(&r->log, (k++ == 0) ? "" : ", ");
+			BufferAppendStamp(&r->log, rr->tags[j].added);
+		}
+		BufferAppendS(&r->log, "]}\n");
+		for (j = i, k = i; j < rr->tag_c; ++j) {
+			if (strcmp(rr->tags[j].name, name) != 0) rr->tags[k++] = rr->tags[j];
+		}
+		rr->tag_c = k;
+		rr->date_at = id;
+	}
+	for (i = 0; i < nameC; ++i) {
+		for (j = 0; j < rr->tag_c && strcmp(rr->tags[j].name, names[i]) != 0; ++j);
+		if (j < rr->tag_c) continue;
+		id = ReplicaOpStart(r, "tag", rr);
+		ReplicaOpField(r, "tag", names[i]);
+		ReplicaOpField(r, "date", row->datetime.last_updated);
+		BufferAppendS(&r->log, "}\n");
+		AddReplicaTag(rr, names[i], id);
+		rr->date_at = id;
+	}
+}
+
+static void
+ReplicaAddRow(Core* c, Row* row)
+{
+	Replica* r = &c->replica;
+	ReplicaRow* rr;
+	Stamp id;
+	
+	id = ReplicaOpStart(r, "add", NULL);
+	ReplicaOpField(r, "url", GetRowURL(row));
+	ReplicaOpField(r, "title", row->title);
+	ReplicaOpField(r, "comment", row->comment);
+	ReplicaOpField(r, "date", row->datetime.last_updated);
+	BufferAppendS(&r->log, "}\n");
+	rr = AddReplicaRow(r, id, row->id);
+	ReplicaSyncTags(c, rr, row);
+}
+
+static void
+ReplicaRemoveRow(Core* c, ReplicaRow* rr)
+{
+	ReplicaOpStart(&c->replica, "remove", rr);
+	BufferAppendS(&c->replica.log, "}\n");
+	MapLocalReplicaRow(&c->replica, rr, 0);
+}
+
+/* Catches replica.json up with changes it has not seen (e.g. made before
+ * replicated mode was turned on, or by a build without it): rows which are
+ * not in it are added and rows which are gone are removed. Returns how many
+ * operations this took. */
+static unsigned int
+ReplicaAdopt(Core* c)
+{
+	Replica* r = &c->replica;
+	unsigned char* live;
+	unsigned int i, changed = 0;
+	
+	live = malloc(c->table.next_UID + 1);
+	memset(live, 0, c->table.next_UID + 1);
+	for (i = 0; i < c->table.count; ++i) {
+		Row* row = &c->table.rows[i];
+		
+		if (row->id == 0 || row->id > c->table.next_UID) continue;
+		live[row->id] = 1;
+		if (FindLocalReplicaRow(r, row->id) == NULL) {
+			ReplicaAddRow(c, row);
+			changed++;
+		}
+	}
+	for (i = 0; i < r->row_c; ++i) {
+		ReplicaRow* rr = &r->rows[i];
+		
+		if (rr->local_id != 0 &&
+		    (rr->local_id > c->table.next_UID || live[rr->local_id] == 0)) {
+			ReplicaRemoveRow(c, rr);
+			changed++;
+		}
+	}
+	free(live);
+	
+	return changed;
+}
+
+/* Works out the operations of the command being saved from the rows it
+ * journaled: how each looked before against how it looks now. A renamed tag
+ * is taken off and given again to every row carrying it. */
+static void
+RecordReplicaOps(Core* c)
+{
+	Replica* r = &c->replica;
+	Journal* j = &c->journal;
+	unsigned int i, k;
+	
+	for (i = 0; i < j->row_c; ++i) {
+		Row* row = &c->table.rows[j->rows[i * 2]];
+		Row* before = &j->before[i];
+		ReplicaRow* rr = FindLocalReplicaRow(r, j->rows[i * 2 + 1]);
+		Stamp id;
+		
+		if (row->id == 0) {
+			if (rr != NULL) ReplicaRemoveRow(c, rr);
+			continue;
+		}
+		if (rr == NULL) {
+			ReplicaAddRow(c, row);
+			continue;
+		}
+		if (strcmp(before->title, row->title) != 0) {
+			id = ReplicaOpStart(r, "title", rr);
+			ReplicaOpField(r, "value", row->title);
+			ReplicaOpField(r, "date", row->datetime.last_updated);
+			BufferAppendS(&r->log, "}\n");
+			rr->title_at = rr->date_at = id;
+		}
+		if (strcmp(before->comment, row->comment) != 0) {
+			id = ReplicaOpStart(r, "comment", rr);
+			ReplicaOpField(r, "value", row->comment);
+			ReplicaOpField(r, "date", row->datetime.last_updated);
+			BufferAppendS(&r->log, "}\n");
+			rr->comment_at = rr->date_at = id;
+		}
+		ReplicaSyncTags(c, rr, row);
+	}
+	for (i = 0; i < j->tag_c; ++i) {
+		TagRowList* list;
+		
+		if (c->tags.tags[j->tags[i * 2]].id == 0 ||
+		    (list = GetTagRows(c, j->tags[i * 2 + 1])) == NULL) continue;
+		for (k = 0; k < list->count; ++k) {
+			Row* row = &c->table.rows[list->rows[k]];
+			ReplicaRow* rr;
+			
+			if (row->id == 0 || !RowHasTagID(*row, j->tags[i * 2 + 1]) ||
+			    (rr = FindLocalReplicaRow(r, row->id)) == NULL) continue;
+			ReplicaSyncTags(c, rr, row);
+		}
+	}
+}
+
+/* Called once the store is saved, in replicated mode. */
+static void
+SaveReplica(Core* c)
+{
+	Replica* r = &c->replica;
+	Journal* j = &c->journal;
+	
+	if (r->enabled == false || (r->loaded == false && !LoadReplica(r))) {
+		return;
+	}
+	if (r->generation != c->meta.generation - 1 ||
+	    (j->row_c == 0 && j->tag_c == 0)) {
+		ReplicaAdopt(c);
+	} else if (r->importing == false) {
+		RecordReplicaOps(c);
+	}
+	r->generation = c->meta.generation;
+	WriteReplica(r);
+}
+
+/* Gives row index the tags named by rr's set, creating any it lacks here. */
+static void
+ReplicaApplyTags(Core* io_c, unsigned int index, ReplicaRow* rr)
+{
+	Row* row = &io_c->table.rows[index];
+	unsigned int ids[ROW_TAG_C], idC = 0, i, j;
+	
+	for (i = 0; i < rr->tag_c && idC < ROW_TAG_C; ++i) {
+		unsigned int id = 0;
+		
+		for (j = 0; j < io_c->tags.count; ++j) {
+			if (io_c->tags.tags[j].id != 0 &&
+			    strcmp(io_c->tags.tags[j].name, rr->tags[i].name) == 0) {
+				id = io_c->tags.tags[j].id;
+				break;
+			}
+		}
+		if (id == 0) {
+			io_c->tags.tags = realloc(io_c->tags.tags,
+			                          sizeof(Tag) * (io_c->tags.count + 2));
+			memset(&io_c->tags.tags[io_c->tags.count], 0, sizeof(Tag) * 2);
+			strcpy(io_c->tags.tags[io_c->tags.count].name, rr->tags[i].name);
+			id = io_c->tags.tags[io_c->tags.count].id = io_c->tags.next_UID++;
+			JournalTag(io_c, io_c->tags.count++, true);
+		}
+		for (j = 0; j < idC && ids[j] != id; ++j);
+		if (j == idC) ids[idC++] = id;
+	}
+	for (i = 0; i < idC; ++i) {
+		if (!RowHasTagID(*row, ids[i])) TagRowsAdd(io_c, ids[i], index);
+	}
+	memset(row->tag_ids, 0, sizeof(row->tag_ids));
+	memcpy(row->tag_ids, ids, sizeof(unsigned int) * idC);
+}
+
+/* Applies an operation from another device. rowByID maps local row IDs to
+ * row index + 1. Returns whether the store changed. */
+static int
+ApplyReplicaOp(Core* io_c, ReplicaOp* op, unsigned int* rowByID)
+{
+	Replica* r = &io_c->replica;
+	ReplicaRow* rr = FindReplicaRow(r, op->row);
+	unsigned int index, i, j;
+	Row* row;
+	int changed = false;
+	
+	if (op->kind == RO_ADD) {
+		if (rr != NULL) return false;
+		index = io_c->table.count++;
+		row = &io_c->table.rows[index];
+		*row = op->values;
+		op->values.url.long_url = false;
+		row->id = io_c->table.next_UID++;
+		rowByID[row->id] = index + 1;
+		JournalRow(io_c, index, true);
+		IndexRowHost(io_c, index);
+		AddReplicaRow(r, op->row, row->id);
+		return true;
+	}
+	if (rr == NULL || rr->local_id == 0) {
+		return false;
+	}
+	index = rowByID[rr->local_id] - 1;
+	row = &io_c->table.rows[index];
+	
+	switch (op->kind) {
+		case RO_TITLE:
+			if (StampCompare(op->id, rr->title_at) > 0) {
+				JournalRow(io_c, index, false);
+				strcpy(row->title, op->values.title);
+				rr->title_at = op->id;
+				changed = true;
+			}
+			break;
+		case RO_COMMENT:
+			if (StampCompare(op->id, rr->comment_at) > 0) {
+				JournalRow(io_c, index, false);
+				strcpy(row->comment, op->values.comment);
+				rr->comment_at = op->id;
+				changed = true;
+			}
+			break;
+		case RO_TAG:
+			for (i = 0; i < rr->tag_c; ++i) {
+				if (StampCompare(rr->tags[i].added, op->id) == 0) break;
+			}
+			if (i == rr->tag_c) {
+				AddReplicaTag(rr, op->tag, op->id);
+				changed = true;
+			}
+			break;
+		case RO_UNTAG:
+			for (i = 0, j = 0; i < rr->tag_c; ++i) {
+				unsigned int k;
+				
+				for (k = 0; k < op->remove_c; ++k) {
+					if (StampCompare(rr->tags[i].added, op->removes[k]) == 0) break;
+				}
+				if (k < op->remove_c) continue;
+				rr->tags[j++] = rr->tags[i];
+			}
+			changed = j != rr->tag_c;
+			rr->tag_c = j;
+			break;
+		case RO_REMOVE:
+			JournalRow(io_c, index, false);
+			row->id = 0;
+			MapLocalReplicaRow(r, rr, 0);
+			return true;
+		default:
+			break;
+	}
+	if (op->kind == RO_TAG || op->kind == RO_UNTAG) {
+		if (changed == true) {
+			JournalRow(io_c, index, false);
+			ReplicaApplyTags(io_c, index, rr);
+		}
+	}
+	if (op->has_date == true && StampCompare(op->id, rr->date_at) > 0) {
+		JournalRow(io_c, index, false);
+		row->datetime = op->values.datetime;
+		rr->date_at = op->id;
+		changed = true;
+	}
+	
+	return changed;
+}
+
+/* Reads the operation at io_pos, leaving io_pos at the next one. */
+static int
+ParseReplicaOp(StructIndex* idx, size_t* io_pos, ReplicaOp* o_op)
+{
+	const char* s;
+	size_t l;
+	int hasID = false, hasRow = false, hasKind = false;
+	
+	memset(o_op, 0, sizeof(ReplicaOp));
+	o_op->start = *io_pos;
+	if (!StructExpect(idx, io_pos, '{')) return false;
+	while (*io_pos < idx->size && idx->text[*io_pos] == '"') {
+		char key[16] = { 0 };
+		
+		if (!StructString(idx, io_pos, &s, &l) ||
+		    !StructExpect(idx, io_pos, ':')) return false;
+		memcpy(key, s, Min(l, sizeof(key) - 1));
+		if (strcmp(key, "removes") == 0) {
+			if (!StructExpect(idx, io_pos, '[')) return false;
+			while (*io_pos < idx->size && idx->text[*io_pos] == '"') {
+				if (!StructString(idx, io_pos, &s, &l)) return false;
+				o_op->removes = realloc(o_op->removes,
+				                        sizeof(Stamp) * (o_op->remove_c + 1));
+				if (!ParseStamp(s, l, &o_op->removes[o_op->remove_c++])) {
+					return false;
+				}
+				if (!StructExpect(idx, io_pos, ',')) break;
+			}
+			if (!StructExpect(idx, io_pos, ']')) return false;
+		} else {
+			Row* v = &o_op->values;
+			
+			if (!StructString(idx, io_pos, &s, &l)) return false;
+			if (strcmp(key, "op") == 0) {
+				static const char* kinds[] = {
+					"add", "title", "comment", "tag", "untag", "remove"
+				};
+				unsigned int k;
+				
+				for (k = 0; k < sizeof(kinds) / sizeof(kinds[0]); ++k) {
+					if (strlen(kinds[k]) == l && memcmp(kinds[k], s, l) == 0) break;
+				}
+				if (k == sizeof(kinds) / sizeof(kinds[0])) return false;
+				o_op->kind = k;
+				hasKind = true;
+			} else if (strcmp(key, "id") == 0) {
+				hasID = ParseStamp(s, l, &o_op->id);
+			} else if (strcmp(key, "row") == 0) {
+				hasRow = ParseStamp(s, l, &o_op->row);
+			} else if (strcmp(key, "url") == 0) {
+				if (l > S_ADDR_S - 1) {
+					v->url.address.l = malloc(l + 1);
+					JSONUnescape(s, l, v->url.address.l, l + 1);
+					v->url.long_url = true;
+				} else {
+					JSONUnescape(s, l, v->url.address.s, S_ADDR_S);
+				}
+			} else if (strcmp(key, "title") == 0) {
+				JSONUnescape(s, l, v->title, TITLE_S);
+			} else if (strcmp(key, "comment") == 0) {
+				JSONUnescape(s, l, v->comment, COMMENT_S);
+			} else if (strcmp(key, "value") == 0) {
+				JSONUnescape(s, l, v->title, TITLE_S);
+				JSONUnescape(s, l, v->comment, COMMENT_S);
+			} else if (strcmp(key, "tag") == 0) {
+				JSONUnescape(s, l, o_op->tag, TAG_NAME_S);
+			} else if (strcmp(key, "date") == 0) {
+				JSONUnescape(s, l, v->datetime.last_updated, 20);
+				sscanf(v->datetime.last_updated, "%d-%d-%d %d:%d:%d",
+				       &v->datetime.d_y, &v->datetime.d_m, &v->datetime.d_d,
+				       &v->datetime.t_h, &v->datetime.t_m, &v->datetime.t_s);
+				o_op->has_date = true;
+			}
+		}
+		if (!StructExpect(idx, io_pos, ',')) break;
+	}
+	o_op->end = *io_pos;
+	if (!StructExpect(idx, io_pos, '}')) return false;
+	
+	return hasKind && hasID && hasRow;
+}
+
+/* Applies the operations in contents (lines as in oplog.json, from) which are
+ * new here. Returns how many were new, and sets o_applied to how many of them
+ * changed the entries. */
+static unsigned int
+ImportReplicaOps(Core* io_c, const char* contents, size_t size,
+                 const char* from, unsigned int* o_applied)
+{
+	Replica* r = &io_c->replica;
+	size_t pos;
+	StructIndex idx;
+	ReplicaOp* ops = NULL;
+	unsigned int opC = 0, capacity = 0, addC = 0, applied = 0, i;
+	unsigned int* rowByID;
+	
+	*o_applied = 0;
+	BuildStructIndex(contents, size, &idx);
+	pos = NextStructural(&idx, 0);
+	while (pos < idx.size) {
+		ReplicaOp op;
+		
+		if (!ParseReplicaOp(&idx, &pos, &op)) {
+			fprintf(stderr, "'%s' is not an operation log (at byte %lu).\n",
+			        from, (unsigned long) op.start);
+			exit(-1);
+		}
+		if (op.id.clock <= SeenClock(r->seen, r->seen_c, op.id.device)) {
+			if (op.values.url.long_url == true) free(op.values.url.address.l);
+			free(op.removes);
+			continue;
+		}
+		if (opC == capacity) {
+			capacity = Max(64, capacity * 2);
+			ops = realloc(ops, sizeof(ReplicaOp) * capacity);
+		}
+		ops[opC++] = op;
+		addC += op.kind == RO_ADD;
+	}
+	if (opC == 0) {
+		free(idx.bits);
+		return 0;
+	}
+	
+	/* Applied in stamp order, so that every operation comes after those it
+	 * saw (which have smaller clocks). */
+	qsort(ops, opC, sizeof(ReplicaOp), CompareReplicaOps);
+	io_c->table.rows = realloc(io_c->table.rows, sizeof(Row) *
+	                           (io_c->table.count + addC + 1));
+	memset(&io_c->table.rows[io_c->table.count], 0, sizeof(Row) * (addC + 1));
+	rowByID = malloc(sizeof(unsigned int) * (io_c->table.next_UID + addC + 1));
+	memset(rowByID, 0, sizeof(unsigned int) * (io_c->table.next_UID + addC + 1));
+	for (i = 0; i < io_c->table.count; ++i) {
+		if (io_c->table.rows[i].id != 0) rowByID[io_c->table.rows[i].id] = i + 1;
+	}
+	
+	r->importing = true;
+	for (i = 0; i < opC; ++i) {
+		applied += ApplyReplicaOp(io_c, &ops[i], rowByID);
+		ReplicaSee(r, ops[i].id);
+		BufferAppend(&r->log, &contents[ops[i].start],
+		             ops[i].end + 1 - ops[i].start);
+		BufferAppendS(&r->log, "\n");
+		if (ops[i].values.url.long_url == true) free(ops[i].values.url.address.l);
+		free(ops[i].removes);
+	}
+	
+	if (applied > 0) {
+		io_c->dirty = true;
+	} else {
+		WriteReplica(r);
+	}
+	
+	free(rowByID);
+	free(ops);
+	free(idx.bits);
+	*o_applied = applied;
+	return opC;
+}
+
+/* Loads replica.json for a command which needs replicated mode, first
+ * catching it up with the store if it has fallen behind. */
+static void
+OpenReplica(Core* io_c)
+{
+	Replica* r = &io_c->replica;
+	
+	if (r->enabled == false) {
+		fprintf(stderr, "Replicated mode is off. Run 'sbm replica init' " \
+		        "first.\n");
+		exit(-1);
+	}
+	if (r->loaded == false) LoadReplica(r);
+	if (r->generation != io_c->meta.generation) {
+		ReplicaAdopt(io_c);
+		r->generation = io_c->meta.generation;
+		WriteReplica(r);
+	}
+}
+
+/* 'sbm replica init | status | export <file> | import <file>' */
+static void
+ReplicaCommand(Core* io_c, char** args)
+{
+	Replica* r = &io_c->replica;
+	
+	if (strcmp(args[0], "init") == 0) {
+		FILE* fp;
+		unsigned int adopted;
+		
+		if (r->enabled == true) {
+			printf("Replicated mode is already on.\n");
+			exit(0);
+		}
+		if ((fp = fopen("/dev/urandom", "rb")) == NULL ||
+		    fread(&r->device, sizeof(r->device), 1, fp) < 1) {
+			r->device = (unsigned int) time(NULL) ^ ((unsigned int) getpid() << 16);
+		}
+		if (fp != NULL) fclose(fp);
+		r->device |= (r->device == 0);
+		r->enabled = r->loaded = true;
+		r->generation = io_c->meta.generation;
+		adopted = ReplicaAdopt(io_c);
+		WriteReplica(r);
+		printf("Replicated mode is on; this device is %08x. %d existing " \
+		       "entries were added to the operation log.\n", r->device, adopted);
+		return;
+	}
+	OpenReplica(io_c);
+	
+	if (strcmp(args[0], "status") == 0) {
+		unsigned int i, live = 0;
+		
+		for (i = 0; i < r->row_c; ++i) live += r->rows[i].local_id != 0;
+		printf("Device %08x, clock %u. %d entries (%d removed).\n", r->device,
+		       r->clock, live, r->row_c - live);
+		for (i = 0; i < r->seen_c; ++i) {
+			printf("\tSeen from %08x up to %u%s\n", r->seen[i].device,
+			       r->seen[i].clock,
+			       (r->seen[i].device == r->device) ? " (this device)" : "");
+		}
+	} else if (strcmp(args[0], "export") == 0) {
+		char filename[512] = { 0 };
+		char* contents;
+		size_t size = 0;
+		FILE* fp;
+		
+		GetConfigPath(filename);
+		strcat(filename, oplog_filename);
+		if ((contents = ReadWholeFile(filename, &size)) == NULL) {
+			contents = calloc(1, 1);
+		}
+		if ((fp = fopen(args[1], "wb")) == NULL ||
+		    (size > 0 && fwrite(contents, size, 1, fp) < 1)) {
+			fprintf(stderr, "Could not write to '%s'.\n", args[1]);
+			exit(-1);
+		}
+		fclose(fp);
+		printf("Wrote %lu bytes of operations to '%s'.\n",
+		       (unsigned long) size, args[1]);
+		free(contents);
+	} else {
+		char* contents;
+		size_t size;
+		unsigned int opC, applied;
+		
+		if ((contents = ReadWholeFile(args[1], &size)) == NULL) {
+			fprintf(stderr, "Could not open '%s'.\n", args[1]);
+			exit(-1);
+		}
+		if ((opC = ImportReplicaOps(io_c, contents, size, args[1],
+		                            &applied)) == 0) {
+			printf("Nothing new in '%s'.\n", args[1]);
+		} else {
+			printf("Imported %d new operation(s) from '%s', %d of which " \
+			       "changed entries.\n", opC, args[1], applied);
+		}
+		free(contents);
+	}
+}
+
+/* replica.json should describe the store as it is. */
+static unsigned int
+FsckReplica(Core* io_c, int repair)
+{
+	Replica* r = &io_c->replica;
+	unsigned int missing = 0, i;
+	
+	if (r->enabled == false || (r->loaded == false && !LoadReplica(r))) {
+		return 0;
+	}
+	for (i = 0; i < io_c->table.count; ++i) {
+		if (io_c->table.rows[i].id != 0 &&
+		    FindLocalReplicaRow(r, io_c->table.rows[i].id) == NULL) missing++;
+	}
+	if (repair == true) {
+		ReplicaAdopt(io_c);
+		r->generation = io_c->meta.generation;
+	}
+	return missing + (r->generation != io_c->meta.generation);
+}
+
+/* zlib is optional: when it cannot be loaded, sync bodies go uncompressed. */
+static ZLib*
+LoadZLib(void)
+{
+	static ZLib lib;
+	static int tried = false;
+	unsigned int i;
+	
+	if (tried == true) {
+		return (lib.handle != NULL) ? &lib : NULL;
+	}
+	tried = true;
+	for (i = 0; zlib_libs[i] != NULL && lib.handle == NULL; ++i) {
+		lib.handle = dlopen(zlib_libs[i], RTLD_NOW | RTLD_LOCAL);
+	}
+	if (lib.handle == NULL) {
+		return NULL;
+	}
+	*(void**) &lib.compress2     = dlsym(lib.handle, "compress2");
+	*(void**) &lib.compressBound = dlsym(lib.handle, "compressBound");
+	*(void**) &lib.uncompress    = dlsym(lib.handle, "uncompress");
+	if (!lib.compress2 || !lib.compressBound || !lib.uncompress) {
+		dlclose(lib.handle);
+		lib.handle = NULL;
+		return NULL;
+	}
+	return &lib;
+}
+
+/* Compresses n bytes of s into o_b as an HTTP "deflate" body (which is the
+ * zlib format). Returns false, leaving o_b alone, when zlib is not there or
+ * it would not help. */
+static int
+DeflateBody(const char* s, size_t n, Buffer* o_b)
+{
+	ZLib* z = LoadZLib();
+	unsigned long length;
+	
+	if (z == NULL || n < 256) {
+		return false;
+	}
+	length = z->compressBound(n);
+	BufferReserve(o_b, length);
+	if (z->compress2((unsigned char*) o_b->data, &length,
+	                 (const unsigned char*) s, n, 6) != 0 || length >= n) {
+		return false;
+	}
+	o_b->length = length;
+	return true;
+}
+
+/* Undoes Content-Encoding: deflate on a body of *io_n bytes. */
+static int
+InflateBody(HTTPMessage* m, char** io_body, size_t* io_n)
+{
+	ZLib* z;
+	unsigned long length;
+	char* raw;
+	
+	if (m->encoding[0] == '\0') {
+		return true;
+	}
+	if (stricmp(m->encoding, "deflate") != 0 || (z = LoadZLib()) == NULL) {
+		return false;
+	}
+	length = m->raw_length;
+	raw = malloc(length + 1);
+	if (z->uncompress((unsigned char*) raw, &length,
+	                  (const unsigned char*) *io_body, *io_n) != 0 ||
+	    length != m->raw_length) {
+		free(raw);
+		return false;
+	}
+	raw[length] = '\0';
+	free(*io_body);
+	*io_body = raw;
+	*io_n = length;
+	return true;
+}
+
+/* The value of a Content-Length or X-Sbm-Length header. Sets *io_bad if it is
+ * not a number or is above HTTP_BODY_S, which nothing could be sent. */
+static size_t
+ParseHTTPLength(const char* value, int* io_bad)
+{
+	unsigned long long n;
+	char* end;
+	
+	errno = 0;
+	n = strtoull(value, &end, 10);
+	if (errno != 0 || end == value || value[0] == '-' || n > HTTP_BODY_S) {
+		*io_bad = true;
+		return 0;
+	}
+	return n;
+}
+
+/* Parses the head of an HTTP message at the start of data. Returns its length
+ * (up to and including the blank line), or 0 if it has not all arrived. */
+static size_t
+ParseHTTPHead(const char* data, size_t n, HTTPMessage* o_m)
+{
+	const char* line, *end, *next;
+	size_t headLength = 0, i;
+	
+	for (i = 3; i < n; ++i) {
+		if (data[i] == '\n' && data[i - 1] == '\r' && data[i - 2] == '\n' &&
+		    data[i - 3] == '\r') {
+			headLength = i + 1;
+			break;
+		}
+	}
+	if (headLength == 0) {
+		return 0;
+	}
+	
+	memset(o_m, 0, sizeof(HTTPMessage));
+	o_m->head_length = headLength;
+	for (line = data; line < data + headLength - 2; line = next) {
+		char name[32] = { 0 }, value[64] = { 0 };
+		const char* colon;
+		
+		end = line;
+		while (*end != '\r') end++;
+		next = end + 2;
+		if (line == data) {
+			memcpy(o_m->start, line, Min((size_t) (end - line),
+			                             sizeof(o_m->start) - 1));
+			continue;
+		}
+		for (colon = line; colon < end && *colon != ':'; ++colon);
+		if (colon == end) continue;
+		memcpy(name, line, Min((size_t) (colon - line), sizeof(name) - 1));
+		for (colon++; colon < end && *colon == ' '; ++colon);
+		memcpy(value, colon, Min((size_t) (end - colon), sizeof(value) - 1));
+		
+		if (stricmp(name, "Content-Length") == 0) {
+			o_m->content_length = ParseHTTPLength(value, &o_m->too_large);
+		} else if (stricmp(name, "Content-Encoding") == 0) {
+			memcpy(o_m->encoding, value, Min(strlen(value),
+			                                 sizeof(o_m->encoding) - 1));
+			o_m->encoding[sizeof(o_m->encoding) - 1] = '\0';
+		} else if (stricmp(name, "Accept-Encoding") == 0) {
+			o_m->accepts_deflate = stristr(value, "deflate") != NULL;
+		} else if (stricmp(name, "Connection") == 0) {
+			o_m->close = stricmp(value, "close") == 0;
+		} else if (stricmp(name, "X-Sbm-Length") == 0) {
+			o_m->raw_length = ParseHTTPLength(value, &o_m->too_large);
+		} else if (stricmp(name, "X-Sbm-Log-Size") == 0) {
+			o_m->log_size = strtoul(value, NULL, 10);
+		}
+	}
+	
+	return headLength;
+}
+
+/* Reads the next message of the connection, with its body (decoded and
+ * NUL-terminated) in o_body. Returns false at the end of the connection, or
+ * if the message is too large to take. */
+static int
+ReadHTTPMessage(HTTPConn* io_c, HTTPMessage* o_m, char** o_body,
+                size_t* o_n)
+{
+	for (;;) {
+		size_t have = io_c->in.length - io_c->used, head;
+		ssize_t got;
+		
+		head = ParseHTTPHead(&io_c->in.data[io_c->used], have, o_m);
+		if (head > 0 && o_m->too_large == true) {
+			return false;
+		}
+		if (head > 0 && have >= head + o_m->content_length) {
+			*o_n = o_m->content_length;
+			*o_body = malloc(*o_n + 1);
+			memcpy(*o_body, &io_c->in.data[io_c->used + head], *o_n);
+			(*o_body)[*o_n] = '\0';
+			io_c->used += head + *o_n;
+			if (io_c->used == io_c->in.length) {
+				io_c->used = io_c->in.length = 0;
+			}
+			if (!InflateBody(o_m, o_body, o_n)) {
+				free(*o_body);
+				return false;
+			}
+			return true;
+		}
+		
+		BufferReserve(&io_c->in, io_c->in.length + 65536);
+		got = recv(io_c->fd, &io_c->in.data[io_c->in.length],
+		           io_c->in.capacity - io_c->in.length, 0);
+		if (got <= 0) {
+			return false;
+		}
+		io_c->in.length += got;
+	}
+}
+
+static int
+WriteAll(int fd, const char* data, size_t n)
+{
+	while (n > 0) {
+		ssize_t wrote = send(fd, data, n, MSG_NOSIGNAL);
+		
+		if (wrote <= 0) return false;
+		data += wrote;
+		n -= wrote;
+	}
+	return true;
+}
+
+/* Adds a request or response with the given start line and body to out. The
+ * body is compressed when compress is set and that makes it smaller. */
+static void
+BufferAppendHTTP(Buffer* io_out, const char* start, const char* headers,
+                 const char* body, size_t n, int compress)
+{
+	Buffer packed;
+	char text[160];
+	
+	memset(&packed, 0, sizeof(Buffer));
+	BufferAppendS(io_out, start);
+	BufferAppendS(io_out, "\r\n");
+	BufferAppendS(io_out, headers);
+	if (compress == true && DeflateBody(body, n, &packed)) {
+		snprintf(text, sizeof(text), "Content-Encoding: deflate\r\n" \
+		         "X-Sbm-Length: %lu\r\n", (unsigned long) n);
+		BufferAppendS(io_out, text);
+		body = packed.data;
+		n = packed.length;
+	}
+	snprintf(text, sizeof(text), "Content-Length: %lu\r\n\r\n",
+	         (unsigned long) n);
+	BufferAppendS(io_out, text);
+	if (n > 0) BufferAppend(io_out, body, n);
+	free(packed.data);
+}
+
+static long
+OpLogSize(void)
+{
+	char filename[512] = { 0 };
+	struct stat st;
+	
+	GetConfigPath(filename);
+	strcat(filename, oplog_filename);
+	return (stat(filename, &st) == 0) ? (long) st.st_size : 0;
+}
+
+/* Collects the lines of oplog.json from byte from onwards, leaving out those
+ * already covered by the vector seen (when given). Returns how many there
+ * were. */
+static unsigned int
+OpsSince(size_t from, Stamp* seen, unsigned int seenC, Buffer* o_b)
+{
+	char filename[512] = { 0 };
+	FILE* fp;
+	char* line = NULL;
+	size_t size = 0;
+	ssize_t l;
+	unsigned int opC = 0;
+	
+	GetConfigPath(filename);
+	strcat(filename, oplog_filename);
+	if ((fp = fopen(filename, "rb")) == NULL) {
+		return 0;
+	}
+	if (from > (size_t) OpLogSize()) from = 0;
+	fseek(fp, from, SEEK_SET);
+	while ((l = getline(&line, &size, fp)) > 0) {
+		const char* id = strstr(line, "\"id\": \"");
+		const char* end;
+		Stamp s;
+		
+		if (id == NULL || (end = strchr(id + 7, '"')) == NULL ||
+		    !ParseStamp(id + 7, end - id - 7, &s)) continue;
+		if (seen != NULL && s.clock <= SeenClock(seen, seenC, s.device)) {
+			continue;
+		}
+		BufferAppend(o_b, line, l);
+		opC++;
+	}
+	free(line);
+	fclose(fp);
+	
+	return opC;
+}
+
+/* sync.json has a line for each server synced with,
+ * 	"<url>": ["<sent>", "<received>"]
+ * the sizes of this device's oplog.json and of the server's when they last
+ * synced. Only what lies beyond them is exchanged the next time. */
+static void
+SyncState(const char* url, size_t* io_sent, size_t* io_received, int write)
+{
+	char filename[512] = { 0 };
+	char* contents;
+	size_t size = 0, pos;
+	StructIndex idx;
+	Buffer out;
+	FILE* fp;
+	
+	GetConfigPath(filename);
+	strcat(filename, sync_filename);
+	if ((contents = ReadWholeFile(filename, &size)) == NULL) {
+		contents = calloc(1, 1);
+		size = 0;
+	}
+	memset(&out, 0, sizeof(Buffer));
+	BuildStructIndex(contents, size, &idx);
+	pos = NextStructural(&idx, 0);
+	while (pos < idx.size && idx.text[pos] == '"') {
+		const char* s;
+		size_t l, lineAt = pos, sent, received;
+		char key[512];
+		
+		if (!StructString(&idx, &pos, &s, &l)) break;
+		JSONUnescape(s, l, key, sizeof(key));
+		if (!StructExpect(&idx, &pos, ':') || !StructExpect(&idx, &pos, '[') ||
+		    !StructString(&idx, &pos, &s, &l)) break;
+		sent = strtoul(s, NULL, 10);
+		if (!StructExpect(&idx, &pos, ',') ||
+		    !StructString(&idx, &pos, &s, &l)) break;
+		received = strtoul(s, NULL, 10);
+		if (!StructExpect(&idx, &pos, ']')) break;
+		if (strcmp(key, url) == 0) {
+			if (write == false) {
+				*io_sent = sent;
+				*io_received = received;
+			}
+		} else {
+			BufferAppend(&out, &contents[lineAt],
+			             ((pos < size) ? pos : size) - lineAt);
+			while (out.length > 0 && isspace((unsigned char)
+			                                 out.data[out.length - 1])) {
+				out.length--;
+			}
+			BufferAppendS(&out, "\n");
+		}
+	}
+	
+	if (write == true) {
+		char text[64];
+		
+		BufferAppendJSONString(&out, url);
+		snprintf(text, sizeof(text), ": [\"%lu\", \"%lu\"]\n",
+		         (unsigned long) *io_sent, (unsigned long) *io_received);
+		BufferAppendS(&out, text);
+		if ((fp = fopen(filename, "wb")) != NULL) {
+			fwrite(out.data, out.length, 1, fp);
+			fclose(fp);
+		}
+	}
+	free(out.data);
+	free(idx.bits);
+	free(contents);
+}
+
+static int
+ConnectTCP(const char* host, const char* port)
+{
+	struct addrinfo hints, *found, *a;
+	int fd = -1;
+	
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &found) != 0) {
+		return -1;
+	}
+	for (a = found; a != NULL; a = a->ai_next) {
+		if ((fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol)) < 0) {
+			continue;
+		}
+		if (connect(fd, a->ai_addr, a->ai_addrlen) == 0) break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(found);
+	
+	return fd;
+}
+
+/* 'sbm sync <url>'. Both requests go out at once on one connection: a POST of
+ * this device's operations since the last sync, and a GET of the server's
+ * operations since then which this device has not seen. */
+static void
+Sync(Core* io_c, const char* url)
+{
+	Replica* r = &io_c->replica;
+	char host[256] = { 0 }, port[16] = "80", path[256] = { 0 };
+	size_t sent = 0, received = 0, n, postLength;
+	unsigned int sentC, receivedC, applied = 0, i;
+	Buffer ops, requests, query;
+	HTTPConn conn;
+	HTTPMessage m;
+	char* body;
+	char headers[512];
+	
+	{
+		const char* p, *hostEnd, *pathAt;
+		
+		if (strncmp(url, "http://", 7) != 0) {
+			fprintf(stderr, "Only http:// URLs can be synced with.\n");
+			exit(-1);
+		}
+		p = url + 7;
+		pathAt = strchr(p, '/');
+		if (pathAt == NULL) pathAt = p + strlen(p);
+		for (hostEnd = p; hostEnd < pathAt && *hostEnd != ':'; ++hostEnd);
+		memcpy(host, p, Min((size_t) (hostEnd - p), sizeof(host) - 1));
+		if (hostEnd < pathAt) {
+			memset(port, 0, sizeof(port));
+			memcpy(port, hostEnd + 1,
+			       Min((size_t) (pathAt - hostEnd - 1), sizeof(port) - 1));
+		}
+		strncpy(path, pathAt, sizeof(path) - 1);
+		while (strlen(path) > 0 && path[strlen(path) - 1] == '/') {
+			path[strlen(path) - 1] = '\0';
+		}
+	}
+	
+	OpenReplica(io_c);
+	SyncState(url, &sent, &received, false);
+	
+	memset(&ops, 0, sizeof(Buffer));
+	memset(&requests, 0, sizeof(Buffer));
+	memset(&query, 0, sizeof(Buffer));
+	sentC = OpsSince(sent, NULL, 0, &ops);
+	snprintf(headers, sizeof(headers), "Host: %s\r\n", host);
+	{
+		char start[320];
+		
+		snprintf(start, sizeof(start), "POST %s/ops HTTP/1.1", path);
+		BufferAppendHTTP(&requests, start, headers, ops.data, ops.length, true);
+		postLength = requests.length;
+	}
+	BufferAppendS(&query, "GET ");
+	BufferAppendS(&query, path);
+	BufferAppendS(&query, "/ops?from=");
+	BufferAppendUInt(&query, received);
+	BufferAppendS(&query, "&seen=");
+	for (i = 0; i < r->seen_c; ++i) {
+		char text[32];
+		
+		snprintf(text, sizeof(text), "%s%u.%08x", (i == 0) ? "" : ",",
+		         r->seen[i].clock, r->seen[i].device);
+		BufferAppendS(&query, text);
+	}
+	BufferAppendS(&query, " HTTP/1.1");
+	snprintf(headers, sizeof(headers), "Host: %s\r\nAccept-Encoding: " \
+	         "deflate\r\nConnection: close\r\n", host);
+	BufferAppendHTTP(&requests, query.data, headers, NULL, 0, false);
+	
+	memset(&conn, 0, sizeof(HTTPConn));
+	if ((conn.fd = ConnectTCP(host, port)) < 0) {
+		fprintf(stderr, "Could not connect to '%s'.\n", url);
+		exit(-1);
+	}
+	if (!WriteAll(conn.fd, requests.data, requests.length) ||
+	    !ReadHTTPMessage(&conn, &m, &body, &n)) {
+		fprintf(stderr, "The connection to '%s' was lost.\n", url);
+		exit(-1);
+	}
+	if (strncmp(m.start, "HTTP/1.1 200", 12) != 0) {
+		fprintf(stderr, "'%s' refused the operations: %s\n", url, m.start);
+		exit(-1);
+	}
+	free(body);
+	if (!ReadHTTPMessage(&conn, &m, &body, &n) ||
+	    strncmp(m.start, "HTTP/1.1 200", 12) != 0) {
+		fprintf(stderr, "Could not get the operations of '%s'.\n", url);
+		exit(-1);
+	}
+	close(conn.fd);
+	
+	receivedC = (n > 0) ? ImportReplicaOps(io_c, body, n, url, &applied) : 0;
+	printf("Sent %d operation(s) (%lu bytes), received %d new (%lu bytes), " \
+	       "%d of which changed entries.\n", sentC,
+	       (unsigned long) postLength, receivedC,
+	       (unsigned long) (m.head_length + m.content_length), applied);
+	
+	/* What was just imported is appended to oplog.json after this, and is
+	 * the server's own, so it need not be sent back. */
+	sent = OpLogSize() + r->log.length;
+	received = m.log_size;
+	SyncState(url, &sent, &received, true);
+	
+	free(body);
+	free(conn.in.data);
+	free(ops.data);
+	free(requests.data);
+	free(query.data);
+}
+
+static void
+ServeSyncConnection(int fd)
+{
+	Core core;
+	HTTPConn conn;
+	HTTPMessage m;
+	char* body;
+	size_t n;
+	int loaded = false;
+	
+	memset(&conn, 0, sizeof(HTTPConn));
+	conn.fd = fd;
+	while (ReadHTTPMessage(&conn, &m, &body, &n)) {
+		Buffer out, ops;
+		char headers[128];
+		
+		memset(&out, 0, sizeof(Buffer));
+		memset(&ops, 0, sizeof(Buffer));
+		if (strncmp(m.start, "POST ", 5) == 0 && strstr(m.start, "/ops ") != NULL) {
+			unsigned int opC = 0, applied = 0;
+			
+			/* The store is only needed once there is something to apply. */
+			if (n > 0 && loaded == false) {
+				core = ReadJSON();
+				core.replica.enabled = ReplicaEnabled();
+				OpenReplica(&core);
+				strcpy(core.journal.command, "serve-sync");
+				loaded = true;
+			}
+			if (n > 0) {
+				opC = ImportReplicaOps(&core, body, n, "request", &applied);
+			}
+			if (loaded == true && core.dirty == true) {
+				WriteJSON(&core);
+				ResetJournal(&core.journal);
+				core.dirty = false;
+			}
+			printf("Received %d new operation(s), %d of which changed " \
+			       "entries.\n", opC, applied);
+			snprintf(headers, sizeof(headers), "X-Sbm-Applied: %u\r\n", applied);
+			BufferAppendHTTP(&out, "HTTP/1.1 200 OK", headers, NULL, 0, false);
+		} else if (strncmp(m.start, "GET ", 4) == 0 &&
+		           strstr(m.start, "/ops?") != NULL) {
+			const char* q = strstr(m.start, "/ops?") + 5;
+			const char* seenAt = strstr(q, "seen=");
+			Stamp* seen = NULL;
+			unsigned int seenC = 0, opC;
+			size_t from = 0;
+			
+			if (strncmp(q, "from=", 5) == 0) from = strtoul(q + 5, NULL, 10);
+			for (q = (seenAt != NULL) ? seenAt + 5 : NULL;
+			     q != NULL && isdigit((unsigned char) *q); ) {
+				size_t l = strcspn(q, ", ");
+				
+				seen = realloc(seen, sizeof(Stamp) * (seenC + 1));
+				if (ParseStamp(q, l, &seen[seenC])) seenC++;
+				q += l + (q[l] == ',');
+			}
+			opC = OpsSince(from, seen, seenC, &ops);
+			printf("Sent %d operation(s).\n", opC);
+			snprintf(headers, sizeof(headers), "X-Sbm-Log-Size: %ld\r\n",
+			         OpLogSize());
+			BufferAppendHTTP(&out, "HTTP/1.1 200 OK", headers, ops.data,
+			                 ops.length, m.accepts_deflate);
+			free(seen);
+		} else {
+			BufferAppendHTTP(&out, "HTTP/1.1 404 Not Found", "", NULL, 0, false);
+		}
+		fflush(stdout);
+		free(body);
+		free(ops.data);
+		if (!WriteAll(fd, out.data, out.length) || m.close == true) {
+			free(out.data);
+			break;
+		}
+		free(out.data);
+	}
+	close(fd);
+	exit(0);
+}
+
+/* 'sbm serve-sync [--port <n>]': a minimal server for 'sbm sync' over this
+ * store, on the loopback interface. Each connection is handled by a child
+ * which loads the store afresh, so edits made meanwhile are picked up, and
+ * connections are served one at a time. */
+static void
+ServeSync(Core* io_c, char** args, unsigned int argc)
+{
+	struct sockaddr_in addr;
+	int fd, conn, one = 1;
+	unsigned int port = SYNC_PORT;
+	
+	if (argc == 2) port = strtoul(args[1], NULL, 10);
+	OpenReplica(io_c);
+	
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+	    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+	    bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+	    listen(fd, 8) < 0) {
+		fprintf(stderr, "Could not listen on port %u.\n", port);
+		exit(-1);
+	}
+	printf("Serving 'sbm sync' on http://127.0.0.1:%u/\n", port);
+	fflush(stdout);
+	
+	while ((conn = accept(fd, NULL, NULL)) >= 0) {
+		pid_t child = fork();
+		
+		if (child == 0) {
+			close(fd);
+			ServeSyncConnection(conn);
+		}
+		close(conn);
+		if (child > 0) waitpid(child, NULL, 0);
+	}
+	close(fd);
+}
+
+static volatile sig_atomic_t serve_stop = false;
+
+static void
+StopServing(int sig)
+{
+	(void) sig;
+	serve_stop = true;
+}
+
+/* Copies the URL-decoded value of query parameter name in target (the path
+ * of a request) into o_buffer, which holds m bytes. */
+static int
+GetQueryParam(const char* target, const char* name, char* o_buffer, size_t m)
+{
+	const char* p = strchr(target, '?');
+	size_t l = strlen(name), i;
+	
+	while (p != NULL) {
+		p++;
+		if (strncmp(p, name, l) == 0 && p[l] == '=') {
+			for (p += l + 1, i = 0; *p != '\0' && *p != '&' && i + 1 < m; ++p) {
+				if (*p == '%' && isxdigit((unsigned char) p[1]) &&
+				    isxdigit((unsigned char) p[2])) {
+					char hex[3] = { p[1], p[2], '\0' };
+					
+					o_buffer[i++] = (char) strtoul(hex, NULL, 16);
+					p += 2;
+				} else {
+					o_buffer[i++] = (*p == '+') ? ' ' : *p;
+				}
+			}
+			o_buffer[i] = '\0';
+			return true;
+		}
+		p = strchr(p, '&');
+	}
+	return false;
+}
+
+/* Reads a request body: a flat JSON object of strings, numbers and arrays of
+ * strings. Unknown fields are ignored. */
+static int
+ParseServeFields(const char* body, size_t n, ServeFields* o_f)
+{
+	StructIndex idx;
+	size_t pos;
+	const char* s;
+	size_t l;
+	int ok = false;
+	
+	memset(o_f, 0, sizeof(ServeFields));
+	BuildStructIndex(body, n, &idx);
+	pos = NextStructural(&idx, 0);
+	if (!StructExpect(&idx, &pos, '{')) goto done;
+	while (pos < idx.size && idx.text[pos] == '"') {
+		char key[16] = { 0 };
+		size_t valueAt;
+		
+		if (!StructString(&idx, &pos, &s, &l)) goto done;
+		memcpy(key, s, Min(l, sizeof(key) - 1));
+		valueAt = pos + 1;
+		if (!StructExpect(&idx, &pos, ':')) goto done;
+		if (pos < idx.size && idx.text[pos] == '[') {
+			if (!StructExpect(&idx, &pos, '[')) goto done;
+			while (pos < idx.size && idx.text[pos] == '"') {
+				if (!StructString(&idx, &pos, &s, &l)) goto done;
+				if (strcmp(key, "tags") == 0 && o_f->tag_c < ROW_TAG_C) {
+					JSONUnescape(s, l, o_f->tags[o_f->tag_c++], TAG_NAME_S);
+				}
+				if (!StructExpect(&idx, &pos, ',')) break;
+			}
+			if (!StructExpect(&idx, &pos, ']')) goto done;
+		} else if (pos < idx.size && idx.text[pos] == '"') {
+			if (!StructString(&idx, &pos, &s, &l)) goto done;
+			if (strcmp(key, "url") == 0) {
+				free(o_f->url);
+				o_f->url = malloc(l + 1);
+				JSONUnescape(s, l, o_f->url, l + 1);
+			} else if (strcmp(key, "title") == 0) {
+				JSONUnescape(s, l, o_f->title, TITLE_S);
+				o_f->has_title = true;
+			} else if (strcmp(key, "comment") == 0) {
+				JSONUnescape(s, l, o_f->comment, COMMENT_S);
+			} else if (strcmp(key, "tag") == 0) {
+				JSONUnescape(s, l, o_f->tag, TAG_NAME_S);
+			} else if (strcmp(key, "id") == 0) {
+				o_f->id = StructUInt(s, l);
+			} else if (strcmp(key, "op") == 0) {
+				JSONUnescape(s, l, o_f->op, sizeof(o_f->op));
+			} else if (strcmp(key, "q") == 0) {
+				JSONUnescape(s, l, o_f->q, sizeof(o_f->q));
+			} else if (strcmp(key, "host") == 0) {
+				JSONUnescape(s, l, o_f->host, sizeof(o_f->host));
+			}
+		} else {
+			/* A number, which the index skips over */
+			while (valueAt < pos && isspace((unsigned char) idx.text[valueAt])) {
+				valueAt++;
+			}
+			if (strcmp(key, "id") == 0) {
+				o_f->id = StructUInt(&idx.text[valueAt], pos - valueAt);
+			}
+		}
+		if (!StructExpect(&idx, &pos, ',')) break;
+	}
+	ok = StructExpect(&idx, &pos, '}');
+	
+done:
+	free(idx.bits);
+	return ok;
+}
+
+static void
+BufferAppendRowObject(Buffer* io_b, Core* c, Row* r)
+{
+	unsigned int i, first;
+	
+	BufferAppendS(io_b, "{\"id\": ");
+	BufferAppendUInt(io_b, r->id);
+	BufferAppendS(io_b, ", \"url\": ");
+	BufferAppendJSONString(io_b, GetRowURL(r));
+	BufferAppendS(io_b, ", \"title\": ");
+	BufferAppendJSONString(io_b, r->title);
+	BufferAppendS(io_b, ", \"comment\": ");
+	BufferAppendJSONString(io_b, r->comment);
+	BufferAppendS(io_b, ", \"date\": ");
+	BufferAppendJSONString(io_b, r->datetime.last_updated);
+	BufferAppendS(io_b, ", \"tags\": [");
+	for (i = 0, first = true; i < ROW_TAG_C; ++i) {
+		int index = (r->tag_ids[i] != 0) ? FindTagIndex(c, r->tag_ids[i]) : -1;
+		
+		if (index < 0 || c->tags.tags[index].id == 0) continue;
+		BufferAppendS(io_b, (first == true) ? "" : ", ");
+		BufferAppendJSONString(io_b, c->tags.tags[index].name);
+		first = false;
+	}
+	BufferAppendS(io_b, "]}");
+}
+
+/* Adds a native messaging message: its length, in native byte order, and
+ * then the JSON itself. */
+static void
+BufferAppendNativeMessage(Buffer* io_b, const char* body, size_t n)
+{
+	uint32_t length = n;
+	
+	BufferAppend(io_b, (const char*) &length, sizeof(length));
+	BufferAppend(io_b, body, n);
+}
+
+static void
+ServeRespond(ServeConn* io_conn, const char* status, const char* body)
+{
+	char head[192];
+	size_t n = strlen(body);
+	
+	if (io_conn->native == true) {
+		BufferAppendNativeMessage(&io_conn->out, body, n);
+		return;
+	}
+	snprintf(head, sizeof(head), "HTTP/1.1 %s\r\nContent-Type: " \
+	         "application/json\r\nContent-Length: %lu\r\n%s\r\n", status,
+	         (unsigned long) n, (io_conn->close == true) ? "Connection: close\r\n"
+	                                                      : "");
+	BufferAppendS(&io_conn->out, head);
+	BufferAppend(&io_conn->out, body, n);
+}
+
+static void
+ServeError(ServeConn* io_conn, const char* status, const char* message)
+{
+	Buffer body;
+	
+	memset(&body, 0, sizeof(Buffer));
+	BufferAppendS(&body, "{\"error\": ");
+	BufferAppendJSONString(&body, message);
+	BufferAppendS(&body, "}");
+	ServeRespond(io_conn, status, body.data);
+	free(body.data);
+}
+
+/* Adds row index to the canonical URL table of s. Rows are added in order,
+ * so a rehash takes the live ones before it. */
+static void
+ServeIndexURL(Serve* io_s, unsigned int index)
+{
+	Core* c = io_s->core;
+	unsigned int mask, i;
+	
+	if ((c->table.count + 1) * 2 > io_s->bucket_c) {
+		io_s->bucket_c = Max(1024, io_s->bucket_c * 2);
+		while (io_s->bucket_c < (c->table.count + 1) * 2) io_s->bucket_c *= 2;
+		free(io_s->buckets);
+		io_s->buckets = malloc(sizeof(unsigned int) * io_s->bucket_c);
+		memset(io_s->buckets, 0, sizeof(unsigned int) * io_s->bucket_c);
+		mask = io_s->bucket_c - 1;
+		for (i = 0; i < index; ++i) {
+			unsigned int b;
+			
+			if (c->table.rows[i].id == 0) continue;
+			for (b = io_s->url_hashes[i] & mask; io_s->buckets[b] != 0;
+			     b = (b + 1) & mask);
+			io_s->buckets[b] = i + 1;
+		}
+	}
+	mask = io_s->bucket_c - 1;
+	for (i = io_s->url_hashes[index] & mask; io_s->buckets[i] != 0;
+	     i = (i + 1) & mask);
+	io_s->buckets[i] = index + 1;
+}
+
+/* Builds what s keeps alongside the store: the canonical URL table and the
+ * row ID map. */
+static void
+ServeBuildIndex(Serve* io_s)
+{
+	Core* c = io_s->core;
+	URLHashJob job;
+	unsigned int i;
+	
+	free(io_s->url_hashes);
+	free(io_s->buckets);
+	free(io_s->by_id);
+	io_s->buckets = NULL;
+	io_s->bucket_c = 0;
+	io_s->row_capacity = c->table.count + 1;
+	io_s->url_hashes = malloc(sizeof(unsigned int) * io_s->row_capacity);
+	job.rows = c->table.rows;
+	job.hashes = io_s->url_hashes;
+	RunParallel(c->table.count, 4096, HashURLs, &job);
+	io_s->by_id_c = c->table.next_UID + 1;
+	io_s->by_id = malloc(sizeof(unsigned int) * io_s->by_id_c);
+	memset(io_s->by_id, 0, sizeof(unsigned int) * io_s->by_id_c);
+	for (i = 0; i < c->table.count; ++i) {
+		Row* r = &c->table.rows[i];
+		
+		if (r->id == 0) continue;
+		if (r->id < io_s->by_id_c) io_s->by_id[r->id] = i + 1;
+		ServeIndexURL(io_s, i);
+	}
+}
+
+/* Adds rows from index from on (which were appended) to the URL table and
+ * the ID map. */
+static void
+ServeIndexRows(Serve* io_s, unsigned int from)
+{
+	Core* c = io_s->core;
+	unsigned int i;
+	
+	if (c->table.count + 1 > io_s->row_capacity) {
+		io_s->row_capacity = c->table.count + 1;
+		io_s->url_hashes = realloc(io_s->url_hashes,
+		                           sizeof(unsigned int) * io_s->row_capacity);
+	}
+	for (i = from; i < c->table.count; ++i) {
+		Row* r = &c->table.rows[i];
+		
+		if (r->id == 0) continue;
+		if (r->id >= io_s->by_id_c) {
+			unsigned int n = Max(r->id + 1, io_s->by_id_c * 2);
+			
+			io_s->by_id = realloc(io_s->by_id, sizeof(unsigned int) * n);
+			memset(&io_s->by_id[io_s->by_id_c], 0,
+			       sizeof(unsigned int) * (n - io_s->by_id_c));
+			io_s->by_id_c = n;
+		}
+		io_s->by_id[r->id] = i + 1;
+		io_s->url_hashes[i] = HashCanonicalURL(GetRowURL(r));
+		ServeIndexURL(io_s, i);
+	}
+}
+
+static int
+ServeRowIndex(Serve* s, unsigned int id)
+{
+	if (id == 0 || id >= s->by_id_c || s->by_id[id] == 0 ||
+	    s->core->table.rows[s->by_id[id] - 1].id != id) {
+		return -1;
+	}
+	return s->by_id[id] - 1;
+}
+
+static unsigned int
+ServeTagID(Core* c, const char* name)
+{
+	unsigned int i;
+	
+	for (i = 0; i < c->tags.count; ++i) {
+		if (c->tags.tags[i].id != 0 && strcmp(c->tags.tags[i].name, name) == 0) {
+			return c->tags.tags[i].id;
+		}
+	}
+	return 0;
+}
+
+/* Something changed: it is saved with whatever else changes within
+ * SERVE_FLUSH_MS, or once SERVE_FLUSH_C changes have built up. */
+static void
+ServeChanged(Serve* io_s)
+{
+	if (io_s->pending++ == 0) {
+		clock_gettime(CLOCK_MONOTONIC, &io_s->first_pending);
+	}
+	io_s->core->dirty = true;
+}
+
+static void
+ServeSave(Serve* io_s)
+{
+	if (io_s->pending == 0) return;
+	if (WriteJSON(io_s->core) < 1) {
+		fprintf(stderr, "Could not save to JSON\n");
+	}
+	ResetJournal(&io_s->core->journal);
+	WatchSaved(&io_s->watch);
+	io_s->core->dirty = false;
+	io_s->pending = 0;
+}
+
+static void
+ServeAdd(Serve* io_s, ServeConn* io_conn, ServeFields* f)
+{
+	Core* c = io_s->core;
+	unsigned int ids[ROW_TAG_C], index, i;
+	Row* row;
+	char body[64];
+	
+	if (f->url == NULL || f->url[0] == '\0') {
+		ServeError(io_conn, "400 Bad Request", "url is required");
+		return;
+	}
+	for (i = 0; i < f->tag_c; ++i) {
+		if ((ids[i] = ServeTagID(c, f->tags[i])) == 0) {
+			ServeError(io_conn, "400 Bad Request", "unknown tag");
+			return;
+		}
+	}
+	
+	if (c->table.count + 1 >= io_s->row_capacity) {
+		io_s->row_capacity = Max(c->table.count + 2, io_s->row_capacity * 2);
+		c->table.rows = realloc(c->table.rows, sizeof(Row) * io_s->row_capacity);
+		io_s->url_hashes = realloc(io_s->url_hashes,
+		                           sizeof(unsigned int) * io_s->row_capacity);
+	}
+	index = c->table.count;
+	row = &c->table.rows[index];
+	memset(row, 0, sizeof(Row));
+	row->id = c->table.next_UID++;
+	JournalRow(c, index, true);
+	if (strlen(f->url) >= S_ADDR_S) {
+		row->url.address.l = f->url;
+		row->url.long_url = true;
+		f->url = NULL;
+	} else {
+		strcpy(row->url.address.s, f->url);
+	}
+	/* Titles are not downloaded here, as that would hold up every other
+	 * request; the extension knows the page's title anyway. */
+	strcpyt(row->title, f->has_title ? f->title : GetRowURL(row), TITLE_S, -1);
+	strcpy(row->comment, f->comment);
+	GetCurrentDateTime(&row->datetime);
+	for (i = 0; i < f->tag_c; ++i) {
+		if (RowHasTagID(*row, ids[i])) continue;
+		row->tag_ids[i] = ids[i];
+		TagRowsAdd(c, ids[i], index);
+	}
+	IndexRowHost(c, index);
+	c->table.count++;
+	AutotagRow(c, index);
+	ServeIndexRows(io_s, index);
+	ServeChanged(io_s);
+	
+	snprintf(body, sizeof(body), "{\"id\": %u}", row->id);
+	ServeRespond(io_conn, "200 OK", body);
+}
+
+/* Gives (add is set) or takes a tag from a row. */
+static void
+ServeTag(Serve* io_s, ServeConn* io_conn, ServeFields* f, int add)
+{
+	Core* c = io_s->core;
+	unsigned int id, i;
+	int index;
+	Row* row;
+	
+	if ((index = ServeRowIndex(io_s, f->id)) < 0) {
+		ServeError(io_conn, "404 Not Found", "no such entry");
+		return;
+	}
+	if ((id = ServeTagID(c, f->tag)) == 0) {
+		ServeError(io_conn, "400 Bad Request", "unknown tag");
+		return;
+	}
+	row = &c->table.rows[index];
+	if (add == RowHasTagID(*row, id)) {
+		ServeRespond(io_conn, "200 OK", "{\"changed\": false}");
+		return;
+	}
+	for (i = 0; i < ROW_TAG_C && add == true && row->tag_ids[i] != 0; ++i);
+	if (i == ROW_TAG_C) {
+		ServeError(io_conn, "409 Conflict", "the entry has no room for more tags");
+		return;
+	}
+	
+	JournalRow(c, index, false);
+	if (add == true) {
+		row->tag_ids[i] = id;
+		TagRowsAdd(c, id, index);
+	} else {
+		for (i = 0; i < ROW_TAG_C; ++i) {
+			if (row->tag_ids[i] == id) row->tag_ids[i] = 0;
+		}
+	}
+	GetCurrentDateTime(&row->datetime);
+	ServeChanged(io_s);
+	ServeRespond(io_conn, "200 OK", "{\"changed\": true}");
+}
+
+/* Adds the next chunk of a search's results to out, ending the response once
+ * they run out. Over native messaging each chunk is a message of its own,
+ * {"entries": [...], "more": true}, as those are limited to 1MB. */
+static void
+ServeSearchChunk(Serve* s, ServeConn* io_conn)
+{
+	Core* c = s->core;
+	ServeSearch* q = &io_conn->search;
+	Buffer rows;
+	char size[32];
+	unsigned int before = q->found, start = q->next == 0;
+	TagClosure* closure = NULL;
+	int done;
+	
+	memset(&rows, 0, sizeof(Buffer));
+	BufferAppendS(&rows, "");
+	/* A search cut short by the store being loaded afresh just ends */
+	while (rows.length < SERVE_CHUNK_S && q->epoch == s->epoch) {
+		unsigned int index;
+		Row* r;
+		
+		if (q->host >= 0) {
+			Host* h = &c->hosts.hosts[q->host];
+			
+			if (q->next >= h->count) break;
+			index = h->rows[q->next++];
+		} else if (q->tag_id != 0) {
+			if ((closure = GetTagClosure(c, q->tag_id)) == NULL ||
+			    (index = NextClosureRow(closure, q->next, c->table.count)) ==
+			    c->table.count) break;
+			q->next = index + 1;
+		} else {
+			if (q->next >= c->table.count) break;
+			index = q->next++;
+		}
+		
+		r = &c->table.rows[index];
+		if (r->id == 0 || (q->tag_id != 0 && !RowUnderTag(closure, r)) ||
+		    (q->term[0] != '\0' && stristr(r->title, q->term) == NULL)) {
+			continue;
+		}
+		BufferAppendS(&rows, (q->found++ == before) ? "\n" : ",\n");
+		BufferAppendRowObject(&rows, c, r);
+	}
+	done = rows.length < SERVE_CHUNK_S;
+	q->active = !done;
+	
+	if (io_conn->native == true) {
+		Buffer message;
+		
+		memset(&message, 0, sizeof(Buffer));
+		BufferAppendS(&message, "{\"entries\": [");
+		BufferAppend(&message, rows.data, rows.length);
+		BufferAppendS(&message, (done == true) ? "\n], \"more\": false}"
+		                                       : "\n], \"more\": true}");
+		BufferAppendNativeMessage(&io_conn->out, message.data, message.length);
+		free(message.data);
+		free(rows.data);
+		return;
+	}
+	
+	snprintf(size, sizeof(size), "%lx\r\n",
+	         (unsigned long) (rows.length + start + (before > 0 && q->found > before) +
+	                          ((done == true) ? 3 : 0)));
+	BufferAppendS(&io_conn->out, size);
+	BufferAppendS(&io_conn->out, (start == true) ? "[" : "");
+	BufferAppendS(&io_conn->out, (before > 0 && q->found > before) ? "," : "");
+	BufferAppend(&io_conn->out, rows.data, rows.length);
+	BufferAppendS(&io_conn->out, (done == true) ? "\n]\n\r\n0\r\n\r\n" : "\r\n");
+	free(rows.data);
+}
+
+static void
+ServeLookup(Serve* s, ServeConn* io_conn, const char* url)
+{
+	Core* c = s->core;
+	Buffer out;
+	unsigned int h, mask, i, first = true;
+	
+	memset(&out, 0, sizeof(Buffer));
+	BufferAppendS(&out, "{\"entries\": [");
+	h = HashCanonicalURL(url);
+	mask = s->bucket_c - 1;
+	for (i = h & mask; s->bucket_c > 0 && s->buckets[i] != 0; i = (i + 1) & mask) {
+		unsigned int index = s->buckets[i] - 1;
+		Row* r = &c->table.rows[index];
+		
+		if (r->id == 0 || s->url_hashes[index] != h ||
+		    !SameCanonicalURL(GetRowURL(r), url)) continue;
+		BufferAppendS(&out, (first == true) ? "" : ", ");
+		BufferAppendRowObject(&out, c, r);
+		first = false;
+	}
+	BufferAppendS(&out, "]}");
+	ServeRespond(io_conn, "200 OK", out.data);
+	free(out.data);
+}
+
+/* Starts streaming the rows whose title contains term (any, when it is empty
+ * or "all"), restricted to those with tag and from host when they are given.
+ */
+static void
+ServeStartSearch(Serve* s, ServeConn* io_conn, const char* term,
+                 const char* tag, const char* host)
+{
+	Core* c = s->core;
+	ServeSearch* q = &io_conn->search;
+	
+	memset(q, 0, sizeof(ServeSearch));
+	q->host = -1;
+	q->epoch = s->epoch;
+	strcpyt(q->term, (char*) term, TITLE_S, -1);
+	if (stricmp(q->term, "all") == 0) q->term[0] = '\0';
+	if (tag != NULL && tag[0] != '\0' && (q->tag_id = ServeTagID(c, tag)) == 0) {
+		ServeError(io_conn, "400 Bad Request", "unknown tag");
+		return;
+	}
+	if (host != NULL && host[0] != '\0') {
+		Host* h = FindHost(&c->hosts, host);
+		
+		if (h == NULL) {
+			ServeRespond(io_conn, "200 OK", (io_conn->native == true)
+			             ? "{\"entries\": [], \"more\": false}" : "[]");
+			return;
+		}
+		q->host = h - c->hosts.hosts;
+	}
+	if (io_conn->native == false) {
+		BufferAppendS(&io_conn->out, "HTTP/1.1 200 OK\r\nContent-Type: " \
+		              "application/json\r\nTransfer-Encoding: chunked\r\n");
+		BufferAppendS(&io_conn->out, (io_conn->close == true)
+		                             ? "Connection: close\r\n\r\n" : "\r\n");
+	}
+	q->active = true;
+	ServeSearchChunk(s, io_conn);
+}
+
+static void
+ServeRemove(Serve* io_s, ServeConn* io_conn, ServeFields* f)
+{
+	int index = ServeRowIndex(io_s, f->id);
+	
+	if (index < 0) {
+		ServeError(io_conn, "404 Not Found", "no such entry");
+		return;
+	}
+	JournalRow(io_s->core, index, false);
+	io_s->core->table.rows[index].id = 0;
+	ServeChanged(io_s);
+	ServeRespond(io_conn, "200 OK", "{\"changed\": true}");
+}
+
+/* Carries out the change named by op ("add", "tag", "untag" or "remove"),
+ * returning false if there is no such change. */
+static int
+ServeChange(Serve* io_s, ServeConn* io_conn, const char* op, ServeFields* f)
+{
+	if (strcmp(op, "add") == 0) {
+		ServeAdd(io_s, io_conn, f);
+	} else if (strcmp(op, "tag") == 0 || strcmp(op, "untag") == 0) {
+		ServeTag(io_s, io_conn, f, op[0] == 't');
+	} else if (strcmp(op, "remove") == 0) {
+		ServeRemove(io_s, io_conn, f);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static void
+ServeRequest(Serve* io_s, ServeConn* io_conn, HTTPMessage* m, const char* body,
+             size_t n)
+{
+	char method[8] = { 0 }, target[sizeof(m->start)] = { 0 };
+	const char* path;
+	ServeFields f;
+	
+	io_conn->close = m->close;
+	if (sscanf(m->start, "%7s %2047s", method, target) != 2) {
+		io_conn->close = true;
+		ServeError(io_conn, "400 Bad Request", "malformed request");
+		return;
+	}
+	path = target;
+	
+	if (strcmp(method, "GET") == 0 && strncmp(path, "/lookup?", 8) == 0) {
+		char* url = malloc(strlen(path) + 1);
+		
+		if (GetQueryParam(path, "url", url, strlen(path) + 1)) {
+			ServeLookup(io_s, io_conn, url);
+		} else {
+			ServeError(io_conn, "400 Bad Request", "url is required");
+		}
+		free(url);
+	} else if (strcmp(method, "GET") == 0 &&
+	           (strcmp(path, "/search") == 0 ||
+	            strncmp(path, "/search?", 8) == 0)) {
+		char term[TITLE_S] = { 0 }, tag[TAG_NAME_S] = { 0 }, host[S_ADDR_S] = { 0 };
+		
+		GetQueryParam(path, "q", term, sizeof(term));
+		GetQueryParam(path, "tag", tag, sizeof(tag));
+		GetQueryParam(path, "host", host, sizeof(host));
+		ServeStartSearch(io_s, io_conn, term, tag, host);
+	} else if (strcmp(method, "POST") == 0 && path[0] == '/' &&
+	           strchr(path, '?') == NULL) {
+		if (!ParseServeFields(body, n, &f)) {
+			ServeError(io_conn, "400 Bad Request", "the body is not valid JSON");
+		} else if (!ServeChange(io_s, io_conn, &path[1], &f)) {
+			ServeError(io_conn, "404 Not Found", "no such endpoint");
+		}
+		free(f.url);
+	} else {
+		ServeError(io_conn, "404 Not Found", "no such endpoint");
+	}
+}
+
+/* Handles every complete request received on the connection, in order, and
+ * sends as much of the responses as the socket takes. Returns false once the
+ * connection should be closed. */
+static int
+ServeConnection(Serve* io_s, ServeConn* io_conn)
+{
+	for (;;) {
+		while (io_conn->search.active == false && io_conn->close == false) {
+			size_t have = io_conn->in.length - io_conn->used, head;
+			HTTPMessage m;
+			
+			head = ParseHTTPHead(&io_conn->in.data[io_conn->used], have, &m);
+			/* Checked before the length is added to anything */
+			if (head > 0 && (m.too_large == true ||
+			                 m.content_length > SERVE_REQUEST_S)) {
+				io_conn->close = true;
+				io_conn->used = io_conn->in.length;
+				ServeError(io_conn, "413 Payload Too Large",
+				           "the request is too large");
+				break;
+			}
+			if (head == 0 || have < head + m.content_length) {
+				if (have > SERVE_REQUEST_S) {
+					io_conn->close = true;
+					ServeError(io_conn, "413 Payload Too Large",
+					           "the request is too large");
+				}
+				break;
+			}
+			ServeRequest(io_s, io_conn, &m, &io_conn->in.data[io_conn->used + head],
+			             m.content_length);
+			io_conn->used += head + m.content_length;
+		}
+		if (io_conn->used == io_conn->in.length) {
+			io_conn->used = io_conn->in.length = 0;
+		}
+		
+		while (io_conn->sent < io_conn->out.length) {
+			ssize_t wrote = send(io_conn->fd, &io_conn->out.data[io_conn->sent],
+			                     io_conn->out.length - io_conn->sent, MSG_NOSIGNAL);
+			
+			if (wrote < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				return true;
+			}
+			if (wrote <= 0) return false;
+			io_conn->sent += wrote;
+		}
+		io_conn->sent = io_conn->out.length = 0;
+		
+		if (io_conn->search.active == true) {
+			ServeSearchChunk(io_s, io_conn);
+			continue;
+		}
+		if (io_conn->close == true) return false;
+		if (io_conn->in.length == 0) return true;
+		
+		/* More requests were pipelined behind a search; carry on with them
+		 * unless all that is left is an incomplete one. */
+		{
+			HTTPMessage m;
+			size_t head = ParseHTTPHead(io_conn->in.data, io_conn->in.length, &m);
+			
+			if (head == 0 || io_conn->in.length < head + m.content_length) {
+				return true;
+			}
+		}
+	}
+}
+
+static void
+CloseServeConn(ServeConn* conn)
+{
+	close(conn->fd);
+	free(conn->in.data);
+	free(conn->out.data);
+	free(conn);
+}
+
+/* Picks up saves by other processes once they have settled. Changes this
+ * process has not saved yet are kept on top. */
+static void
+ServeReload(Serve* io_s)
+{
+	Core* c = io_s->core;
+	unsigned int count = c->table.count;
+	int reloaded;
+	
+	if (!WatchDue(&io_s->watch)) {
+		return;
+	}
+	reloaded = ReloadStore(c, NULL);
+	WatchSaved(&io_s->watch);
+	if (reloaded == 2) {
+		ServeBuildIndex(io_s);
+		io_s->epoch++;
+	} else if (reloaded == 1) {
+		/* The table may have been reallocated to just fit */
+		io_s->row_capacity = c->table.count + 1;
+		io_s->url_hashes = realloc(io_s->url_hashes,
+		                           sizeof(unsigned int) * io_s->row_capacity);
+		ServeIndexRows(io_s, count);
+	}
+	if (c->dirty == false) {
+		io_s->pending = 0;
+	}
+}
+
+/* SIGINT and SIGTERM stop serving, once what is pending is saved. */
+static void
+StartServing(Serve* o_s, Core* io_c)
+{
+	struct sigaction stop;
+	
+	memset(o_s, 0, sizeof(Serve));
+	o_s->core = io_c;
+	ServeBuildIndex(o_s);
+	StartWatching(&o_s->watch);
+	
+	memset(&stop, 0, sizeof(stop));
+	stop.sa_handler = StopServing;
+	sigaction(SIGINT, &stop, NULL);
+	sigaction(SIGTERM, &stop, NULL);
+}
+
+static void
+StopServingStore(Serve* io_s)
+{
+	ServeSave(io_s);
+	if (io_s->watch.fd >= 0) close(io_s->watch.fd);
+	free(io_s->url_hashes);
+	free(io_s->buckets);
+	free(io_s->by_id);
+}
+
+/* Saves what is pending if it is due. Returns how long to wait (in ms) before
+ * calling again, or -1 when nothing is pending. */
+static int
+ServeSaveDue(Serve* io_s)
+{
+	struct timespec now;
+	long elapsed;
+	
+	if (io_s->pending == 0) {
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - io_s->first_pending.tv_sec) * 1000 +
+	          (now.tv_nsec - io_s->first_pending.tv_nsec) / 1000000;
+	if (elapsed >= SERVE_FLUSH_MS || io_s->pending >= SERVE_FLUSH_C) {
+		ServeSave(io_s);
+		return -1;
+	}
+	return SERVE_FLUSH_MS - elapsed;
+}
+
+/* 'sbm serve [--port <n>]': an HTTP/1.1 API over the store held in memory,
+ * on 127.0.0.1, for browser extensions and scripts. One thread serves every
+ * connection through epoll. Changes are saved in batches. */
+static void
+ServeAPI(Core* io_c, char** args, unsigned int argc)
+{
+	struct sockaddr_in addr;
+	struct epoll_event event, events[64];
+	Serve s;
+	int fd, ep, one = 1;
+	unsigned int port = SERVE_PORT, i;
+	
+	if (argc == 2) port = strtoul(args[1], NULL, 10);
+	StartServing(&s, io_c);
+	
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+	    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+	    bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+	    listen(fd, 64) < 0 || (ep = epoll_create1(0)) < 0) {
+		fprintf(stderr, "Could not listen on port %u.\n", port);
+		exit(-1);
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	epoll_ctl(ep, EPOLL_CTL_ADD, fd, &event);
+	if (s.watch.fd >= 0) {
+		event.data.ptr = &s.watch;
+		epoll_ctl(ep, EPOLL_CTL_ADD, s.watch.fd, &event);
+	}
+	
+	printf("Serving the API on http://127.0.0.1:%u/\n", port);
+	fflush(stdout);
+	
+	while (serve_stop == false) {
+		int n;
+		
+		n = epoll_wait(ep, events, 64,
+		               MinTimeout(ServeSaveDue(&s), WatchTimeout(&s.watch)));
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		for (i = 0; i < n; ++i) {
+			ServeConn* conn = events[i].data.ptr;
+			
+			if (events[i].data.ptr == &s.watch) {
+				WatchEvents(&s.watch);
+				continue;
+			}
+			if (conn == NULL) {
+				int client;
+				
+				while ((client = accept(fd, NULL, NULL)) >= 0) {
+					fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+					conn = malloc(sizeof(ServeConn));
+					memset(conn, 0, sizeof(ServeConn));
+					conn->fd = client;
+					event.events = EPOLLIN;
+					event.data.ptr = conn;
+					epoll_ctl(ep, EPOLL_CTL_ADD, client, &event);
+				}
+				continue;
+			}
+			
+			if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+				int open = true;
 				
-				if (stricmp(ia->word_buffers[WI_MOD], "all") == 0) {
-					for (i = 0; i < io_c->tags.count; ++i) {
-						if (io_c->tags.tags[i].id == 0) continue;
-						printf("%d] %s\n",
-						       io_c->tags.tags[i].id, io_c->tags.tags[i].name);
-					}
-				} else {
-					int found = false;
-					for (i = 0; i < io_c->tags.count; ++i) {
-						if (io_c->tags.tags[i].id == 0) continue;
-						if (stristr(io_c->tags.tags[i].name, ia->word_buffers[WI_MOD]) !=
-						    NULL) {
-							printf("%d] %s\n",
-							       io_c->tags.tags[i].id, io_c->tags.tags[i].name);
-							found = true;
-						}
+				for (;;) {
+					ssize_t got;
+					
+					BufferReserve(&conn->in, 16384);
+					got = recv(conn->fd, &conn->in.data[conn->in.length],
+					           conn->in.capacity - conn->in.length - 1, 0);
+					if (got > 0) {
+						conn->in.length += got;
+						continue;
 					}
-					if (found == false) {
-						printf("No tags found.\n");
+					if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+						open = false;
 					}
+					break;
+				}
+				if (!ServeConnection(&s, conn) || open == false) {
+					CloseServeConn(conn);
+					continue;
 				}
+			} else if (!ServeConnection(&s, conn)) {
+				CloseServeConn(conn);
+				continue;
 			}
-			break;
+			event.events = EPOLLIN | ((conn->sent < conn->out.length)
+			                          ? EPOLLOUT : 0);
+			event.data.ptr = conn;
+			epoll_ctl(ep, EPOLL_CTL_MOD, conn->fd, &event);
+		}
+		ServeReload(&s);
 	}
+	
+	StopServingStore(&s);
+	close(ep);
+	close(fd);
+	exit(0);
 }
 
+/* Reads a native messaging message from the start of data (n bytes): its
+ * length in native byte order and then the JSON. Returns the bytes it takes
+ * up, or 0 if it has not all arrived. */
+static size_t
+ParseNativeMessage(const char* data, size_t n, const char** o_body,
+                   size_t* o_l)
+{
+	uint32_t length;
+	
+	if (n < sizeof(length)) {
+		return 0;
+	}
+	memcpy(&length, data, sizeof(length));
+	*o_body = data + sizeof(length);
+	*o_l = length;
+	
+	return (n - sizeof(length) >= length) ? sizeof(length) + length : 0;
+}
 
-
-static char*
-stristr(const char* a, const char* b)
+static void
+NativeRequest(Serve* io_s, ServeConn* io_conn, const char* body, size_t n)
 {
-	const char* p1 = a;
-	const char* p2 = b;
-	const char* r = *p2 == 0 ? a : 0;
+	ServeFields f;
 	
-	while (*p1 != 0 && * p2 != 0) {
-		if (toupper((unsigned char) *p1) == toupper((unsigned char) *p2)) {
-			if (r == 0) {
-				r = p1;
-			}
-			p2++;
+	if (!ParseServeFields(body, n, &f)) {
+		ServeError(io_conn, "400 Bad Request", "the message is not valid JSON");
+	} else if (strcmp(f.op, "lookup") == 0) {
+		if (f.url != NULL) {
+			ServeLookup(io_s, io_conn, f.url);
 		} else {
-			p2 = b;
-			if (r != 0) {
-				p1 = r + 1;
-			}
-			
-			if (toupper((unsigned char)*p1) == toupper((unsigned char)*p2)) {
-				r = p1;
-				p2++;
-			} else {
-				r = 0;
-			}
+			ServeError(io_conn, "400 Bad Request", "url is required");
 		}
-		
-		p1++;
+	} else if (strcmp(f.op, "search") == 0) {
+		ServeStartSearch(io_s, io_conn, f.q, f.tag, f.host);
+	} else if (!ServeChange(io_s, io_conn, f.op, &f)) {
+		ServeError(io_conn, "404 Not Found", "no such op");
 	}
-	
-	return *p2 == 0 ? (char*)r : 0;
+	free(f.url);
 }
 
+/* Writes all of out to the browser. */
 static int
-stricmp(const char* a, const char* b)
+NativeFlush(ServeConn* io_conn)
 {
-	if (a == NULL || b == NULL) {
-		return(false);
+	while (io_conn->sent < io_conn->out.length) {
+		ssize_t wrote = write(io_conn->fd, &io_conn->out.data[io_conn->sent],
+		                      io_conn->out.length - io_conn->sent);
+		
+		if (wrote < 0 && errno == EINTR) continue;
+		if (wrote <= 0) return false;
+		io_conn->sent += wrote;
 	}
-	while(toupper(*a) && (toupper(*a) == toupper(*b))) {
-		a++;
-		b++;
+	io_conn->sent = io_conn->out.length = 0;
+	return true;
+}
+
+/* 'sbm native-host': the API of 'sbm serve' over the browser's native
+ * messaging protocol on stdin and stdout, for an extension which connects
+ * with runtime.connectNative() and so keeps the store loaded for as long as
+ * the port is open. Messages are {"op": ..., fields as for 'sbm serve'},
+ * where op is lookup, search, add, tag, untag or remove, and are answered in
+ * the order they arrive. Changes are saved in batches, and once the browser
+ * closes the port. */
+static void
+NativeHost(Core* io_c)
+{
+	struct sigaction ignore;
+	struct pollfd in[2];
+	ServeConn conn;
+	Serve s;
+	int open = true;
+	
+	StartServing(&s, io_c);
+	memset(&ignore, 0, sizeof(ignore));
+	ignore.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &ignore, NULL);
+	memset(&conn, 0, sizeof(ServeConn));
+	conn.fd = STDOUT_FILENO;
+	conn.native = true;
+	in[0].fd = STDIN_FILENO;
+	in[0].events = POLLIN;
+	in[1].fd = s.watch.fd;
+	in[1].events = POLLIN;
+	
+	while (open == true && serve_stop == false) {
+		const char* body;
+		size_t used = 0, length, n;
+		ssize_t got;
+		int ready;
+		
+		ready = poll(in, 2, MinTimeout(ServeSaveDue(&s), WatchTimeout(&s.watch)));
+		if (ready < 0 && errno != EINTR) break;
+		if (ready > 0 && (in[1].revents & POLLIN)) {
+			WatchEvents(&s.watch);
+		}
+		ServeReload(&s);
+		if (ready <= 0 || in[0].revents == 0) {
+			continue;
+		}
+		BufferReserve(&conn.in, 16384);
+		got = read(STDIN_FILENO, &conn.in.data[conn.in.length],
+		           conn.in.capacity - conn.in.length - 1);
+		if (got < 0 && errno == EINTR) continue;
+		if (got <= 0) break;
+		conn.in.length += got;
+		
+		while ((n = ParseNativeMessage(&conn.in.data[used], conn.in.length - used,
+		                               &body, &length)) > 0) {
+			NativeRequest(&s, &conn, body, length);
+			while (open == true && conn.search.active == true) {
+				open = NativeFlush(&conn);
+				ServeSearchChunk(&s, &conn);
+			}
+			used += n;
+		}
+		open = open && NativeFlush(&conn);
+		if (conn.in.length - used >= sizeof(uint32_t) &&
+		    ParseNativeMessage(&conn.in.data[used], conn.in.length - used,
+		                       &body, &length) == 0 && length > SERVE_REQUEST_S) {
+			fprintf(stderr, "A message of %lu bytes is too large.\n",
+			        (unsigned long) length);
+			break;
+		}
+		memmove(conn.in.data, &conn.in.data[used], conn.in.length - used);
+		conn.in.length -= used;
 	}
 	
-	return *(const char*) a - *(const char*) b;
+	StopServingStore(&s);
+	free(conn.in.data);
+	free(conn.out.data);
+	exit(0);
 }
 
-static char*
-strcpyt(char* d, char* s, unsigned int m, int l)
+/* Records row rowIndex as it is before the command changes it. isNew marks a
+ * row which the command adds (its ID must be set), so that undoing removes it
+ * again. Each row is recorded once per command. */
+static void
+JournalRow(Core* io_c, unsigned int rowIndex, int isNew)
 {
-	int i;
+	Journal* j = &io_c->journal;
+	Row* r = &io_c->table.rows[rowIndex];
 	
-	/* Sometimes I only want to copy a substring, other times the whole
-	 * string. In the latter case, it is sometimes annoying to have to 
-	 * call strlen and input a large variable name. Instead I can pass in
-	 * -1 and this will save me the time. */
-	if (l == -1) {
-		l = strlen(s);
+	if (rowIndex >= j->recorded_c) {
+		unsigned int c = Max(rowIndex + 1, j->recorded_c * 2);
+		
+		j->recorded = realloc(j->recorded, c);
+		memset(&j->recorded[j->recorded_c], 0, c - j->recorded_c);
+		j->recorded_c = c;
 	}
-	if (l >= m) {
-		l = m - 1;
+	if (j->recorded[rowIndex] != 0) {
+		return;
 	}
-	
-	strncpy(d, s, l);
-	if ((l + 1 >= m) && (l > 4)) {
-		l = m - 4;
-		for (i = l; i < l + 3; ++i) {
-			d[i] = '.';
+	j->recorded[rowIndex] = 1;
+	if (j->row_c == j->row_capacity) {
+		j->row_capacity = Max(16, j->row_capacity * 2);
+		j->rows = realloc(j->rows, sizeof(unsigned int) * 2 * j->row_capacity);
+		j->digests = realloc(j->digests, sizeof(uint64_t) * j->row_capacity);
+		if (io_c->replica.enabled == true) {
+			j->before = realloc(j->before, sizeof(Row) * j->row_capacity);
 		}
-		d[m - 1] = '\0';
+	}
+	j->rows[j->row_c * 2]     = rowIndex;
+	j->rows[j->row_c * 2 + 1] = r->id;
+	j->digests[j->row_c]      = (isNew == true) ? 0 : RowDigest(r);
+	if (j->before != NULL) {
+		j->before[j->row_c] = *r;
+		if (isNew == true) j->before[j->row_c].id = 0;
+	}
+	
+	BufferAppendS(&j->before_rows, (j->row_c++ == 0) ? "" : ", ");
+	if (isNew == true) {
+		BufferAppendS(&j->before_rows, "\"");
+		BufferAppendUInt(&j->before_rows, r->id);
+		BufferAppendS(&j->before_rows, "\": []");
 	} else {
-		d[l] = '\0';
+		BufferAppendRow(&j->before_rows, r);
+	}
+}
+
+static void
+JournalTag(Core* io_c, unsigned int tagIndex, int isNew)
+{
+	Journal* j = &io_c->journal;
+	Tag* t = &io_c->tags.tags[tagIndex];
+	
+	if (j->tag_c == j->tag_capacity) {
+		j->tag_capacity = Max(4, j->tag_capacity * 2);
+		j->tags = realloc(j->tags, sizeof(unsigned int) * 2 * j->tag_capacity);
 	}
+	j->tags[j->tag_c * 2]     = tagIndex;
+	j->tags[j->tag_c * 2 + 1] = t->id;
 	
-	return NULL;
+	BufferAppendS(&j->before_tags, (j->tag_c++ == 0) ? "\"" : ", \"");
+	BufferAppendUInt(&j->before_tags, t->id);
+	BufferAppendS(&j->before_tags, "\": ");
+	if (isNew == true) {
+		BufferAppendS(&j->before_tags, "[]");
+	} else {
+		BufferAppendJSONString(&j->before_tags, t->name);
+	}
 }
 
-static int
-RowHasTagID(Row r, unsigned int id)
+/* Records where alias name points (if anywhere) before the command changes
+ * it. Its image is "<name>": "<tag ID>", or [] when there is no such alias. */
+static void
+JournalAlias(Core* io_c, const char* name)
 {
-	unsigned int i;
-	for (i = 0; i < ROW_TAG_C; ++i) {
-		if (r.tag_ids[i] == id) {
-			return true;
-		}
+	Journal* j = &io_c->journal;
+	unsigned int i, id = GetTagAlias(io_c->tags, name);
+	
+	for (i = 0; i < j->alias_c; ++i) {
+		if (strcmp(j->aliases[i], name) == 0) return;
 	}
+	j->aliases = realloc(j->aliases, TAG_NAME_S * (j->alias_c + 1));
+	strcpy(j->aliases[j->alias_c], name);
 	
-	return false;
+	BufferAppendS(&j->before_aliases, (j->alias_c++ == 0) ? "" : ", ");
+	BufferAppendJSONString(&j->before_aliases, name);
+	if (id == 0) {
+		BufferAppendS(&j->before_aliases, ": []");
+	} else {
+		BufferAppendS(&j->before_aliases, ": \"");
+		BufferAppendUInt(&j->before_aliases, id);
+		BufferAppendS(&j->before_aliases, "\"");
+	}
 }
 
+/* Forgets what has been recorded, once it is saved, so that a process which
+ * saves more than once (e.g. 'sbm serve-sync') starts each time afresh. */
 static void
-PrintWithTagIDs(unsigned int* tagIDs, unsigned int tc,
-               Row* r, unsigned int rc,
-               Tags tg)
+ResetJournal(Journal* io_j)
 {
-	unsigned int i, j;
-	for (i = 0; i < rc; ++i) {
-		for (j = 0; j < tc; ++j) {
-			if (RowHasTagID(r[i], tagIDs[j]) == true) {
-				PrintRow(r[i], tg);
-			}
-		}
+	io_j->before_rows.length = 0;
+	io_j->before_tags.length = 0;
+	io_j->before_aliases.length = 0;
+	io_j->row_c = 0;
+	io_j->tag_c = 0;
+	io_j->alias_c = 0;
+	if (io_j->recorded != NULL) {
+		memset(io_j->recorded, 0, io_j->recorded_c);
 	}
+	io_j->step = 0;
 }
 
+/* Reads the journal: a header line, {"undo": "N", "generation": "G"}, followed
+ * by one entry per line. The first N entries can be undone and the rest
+ * redone. G is the generation of the store the journal belongs to. Returns the
+ * file's contents (split into o_lines in place), or NULL if there is none. */
 static char*
-GetTagName(Tags t, unsigned int id)
+ReadJournal(char*** o_lines, unsigned int* o_c, unsigned int* o_undo,
+            unsigned int* o_generation)
 {
-	unsigned int i;
-	for (i = 0; i < t.count; ++i) {
-		if (t.tags[i].id == id) {
-			return t.tags[i].name;
+	FILE* fp;
+	char filename[512] = { 0 };
+	char* contents, *p, *nl;
+	long size;
+	unsigned int capacity = 0;
+	
+	*o_lines = NULL;
+	*o_c = *o_undo = *o_generation = 0;
+	
+	GetConfigPath(filename);
+	strcat(filename, journal_filename);
+	if ((fp = fopen(filename, "rb")) == NULL) {
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	contents = malloc(size + 1);
+	contents[fread(contents, 1, size, fp)] = '\0';
+	fclose(fp);
+	
+	if (sscanf(contents, "{\"undo\": \"%u\", \"generation\": \"%u\"}",
+	           o_undo, o_generation) != 2 ||
+	    (p = strchr(contents, '\n')) == NULL) {
+		free(contents);
+		return NULL;
+	}
+	for (p++; *p != '\0'; p = nl + 1) {
+		if ((nl = strchr(p, '\n')) == NULL) break;
+		*nl = '\0';
+		if (*o_c == capacity) {
+			capacity = Max(16, capacity * 2);
+			*o_lines = realloc(*o_lines, sizeof(char*) * capacity);
 		}
+		(*o_lines)[(*o_c)++] = p;
 	}
+	*o_undo = Min(*o_undo, *o_c);
 	
-	return NULL;
+	return contents;
 }
 
-static unsigned int
-GetTagID(Tags t, char* s)
+/* Called once the store is saved. A command which recorded its changes adds
+ * an entry (dropping anything which could have been redone), undo and redo
+ * move through the entries, and any other change to the store (e.g. 'fsck
+ * --repair') clears the journal, as its entries may no longer apply. */
+static void
+CommitJournal(Core* c)
 {
-	unsigned int i;
-	for (i = 0; i < t.count; ++i) {
-		if (strcmp(t.tags[i].name, s) == 0) {
-			return t.tags[i].id;
+	Journal* j = &c->journal;
+	char filename[512] = { 0 };
+	char** lines, *contents;
+	unsigned int lineC, undo, generation, i, first;
+	Buffer out;
+	FILE* fp;
+	
+	GetConfigPath(filename);
+	strcat(filename, journal_filename);
+	if (j->step == 0 && j->row_c == 0 && j->tag_c == 0 && j->alias_c == 0) {
+		remove(filename);
+		return;
+	}
+	
+	contents = ReadJournal(&lines, &lineC, &undo, &generation);
+	memset(&out, 0, sizeof(Buffer));
+	
+	if (j->step == 0) {
+		Buffer entry;
+		
+		memset(&entry, 0, sizeof(Buffer));
+		BufferAppendS(&entry, "{\"generation\": \"");
+		BufferAppendUInt(&entry, c->meta.generation);
+		BufferAppendS(&entry, "\", \"command\": ");
+		BufferAppendJSONString(&entry, j->command);
+		BufferAppendS(&entry, ", \"before\":{\"tags\":{");
+		if (j->before_tags.length > 0) {
+			BufferAppend(&entry, j->before_tags.data, j->before_tags.length);
+		}
+		BufferAppendS(&entry, "}, \"rows\":{");
+		if (j->before_rows.length > 0) {
+			BufferAppend(&entry, j->before_rows.data, j->before_rows.length);
+		}
+		BufferAppendS(&entry, "}, \"aliases\":{");
+		if (j->before_aliases.length > 0) {
+			BufferAppend(&entry, j->before_aliases.data, j->before_aliases.length);
+		}
+		BufferAppendS(&entry, "}}, \"after\":{\"tags\":{");
+		for (i = 0; i < j->tag_c; ++i) {
+			Tag* t = &c->tags.tags[j->tags[i * 2]];
+			
+			BufferAppendS(&entry, (i == 0) ? "\"" : ", \"");
+			BufferAppendUInt(&entry, j->tags[i * 2 + 1]);
+			BufferAppendS(&entry, "\": ");
+			if (t->id == 0) {
+				BufferAppendS(&entry, "[]");
+			} else {
+				BufferAppendJSONString(&entry, t->name);
+			}
+		}
+		BufferAppendS(&entry, "}, \"rows\":{");
+		for (i = 0; i < j->row_c; ++i) {
+			Row* r = &c->table.rows[j->rows[i * 2]];
+			
+			BufferAppendS(&entry, (i == 0) ? "" : ", ");
+			if (r->id == 0) {
+				BufferAppendS(&entry, "\"");
+				BufferAppendUInt(&entry, j->rows[i * 2 + 1]);
+				BufferAppendS(&entry, "\": []");
+			} else {
+				BufferAppendRow(&entry, r);
+			}
+		}
+		BufferAppendS(&entry, "}, \"aliases\":{");
+		for (i = 0; i < j->alias_c; ++i) {
+			unsigned int id = GetTagAlias(c->tags, j->aliases[i]);
+			
+			BufferAppendS(&entry, (i == 0) ? "" : ", ");
+			BufferAppendJSONString(&entry, j->aliases[i]);
+			if (id == 0) {
+				BufferAppendS(&entry, ": []");
+			} else {
+				BufferAppendS(&entry, ": \"");
+				BufferAppendUInt(&entry, id);
+				BufferAppendS(&entry, "\"");
+			}
+		}
+		BufferAppendS(&entry, "}}}");
+		
+		/* Keep the undoable entries, newest last, and at most JOURNAL_C */
+		lineC = undo;
+		lines = realloc(lines, sizeof(char*) * (lineC + 1));
+		lines[lineC++] = entry.data;
+		first = (lineC > JOURNAL_C) ? lineC - JOURNAL_C : 0;
+		undo = lineC - first;
+		
+		BufferAppendS(&out, "{\"undo\": \"");
+		BufferAppendUInt(&out, undo);
+		for (i = first; i < lineC; ++i) {
+			if (i == first) {
+				BufferAppendS(&out, "\", \"generation\": \"");
+				BufferAppendUInt(&out, c->meta.generation);
+				BufferAppendS(&out, "\"}\n");
+			}
+			BufferAppendS(&out, lines[i]);
+			BufferAppendS(&out, "\n");
+		}
+		free(entry.data);
+	} else {
+		undo += j->step;
+		BufferAppendS(&out, "{\"undo\": \"");
+		BufferAppendUInt(&out, undo);
+		BufferAppendS(&out, "\", \"generation\": \"");
+		BufferAppendUInt(&out, c->meta.generation);
+		BufferAppendS(&out, "\"}\n");
+		for (i = 0; i < lineC; ++i) {
+			BufferAppendS(&out, lines[i]);
+			BufferAppendS(&out, "\n");
 		}
 	}
 	
-	return 0;
+	if ((fp = fopen(filename, "wb")) != NULL) {
+		fwrite(out.data, out.length, 1, fp);
+		fclose(fp);
+	}
+	free(out.data);
+	free(lines);
+	free(contents);
 }
 
-static void
-PrintRow(Row r, Tags tg)
+/* Applies one side ("before" or "after") of a journal entry: every tag and row
+ * in it is put back the way the image shows, where an image of [] means it
+ * does not exist. Only the rows and tags named are touched, and they are
+ * recorded as for any other command (though no entry is added for them). */
+static int
+ApplyJournalImages(Core* io_c, StructIndex* idx, size_t pos)
 {
-	unsigned int i, hasTags;
-	if (r.url.long_url == true) { 
-		printf("%d. %s\n\t > %s\n",
-		       r.id, r.title, r.url.address.l);
-	} else {
-		printf("%d. %s\n\t > %s\n",
-		       r.id, r.title, r.url.address.s);
+	const char* s;
+	size_t l, tagsAt = 0, rowsAt = 0, aliasesAt = 0;
+	unsigned int* rowByID, rowByIDC, imageC, id, i, j;
+	
+	if (!StructExpect(idx, &pos, '{')) return false;
+	while (pos < idx->size && idx->text[pos] == '"') {
+		if (!StructString(idx, &pos, &s, &l) ||
+		    !StructExpect(idx, &pos, ':')) return false;
+		if (l == 4 && memcmp(s, "tags", 4) == 0) tagsAt = pos;
+		if (l == 4 && memcmp(s, "rows", 4) == 0) rowsAt = pos;
+		if (l == 7 && memcmp(s, "aliases", 7) == 0) aliasesAt = pos;
+		if (!StructSkipValue(idx, &pos)) return false;
+		if (!StructExpect(idx, &pos, ',')) break;
 	}
+	if (tagsAt == 0 || rowsAt == 0) return false;
 	
-	if (strlen(r.comment) > 0) {
-		printf("\t + '%s'\n", r.comment);
+	/* Tags first, so that restored rows can be indexed under them. */
+	pos = tagsAt;
+	if (!StructExpect(idx, &pos, '{')) return false;
+	while (pos < idx->size && idx->text[pos] == '"') {
+		int index;
+		
+		if (!StructString(idx, &pos, &s, &l) ||
+		    !StructExpect(idx, &pos, ':')) return false;
+		id = StructUInt(s, l);
+		index = FindTagIndex(io_c, id);
+		if (idx->text[pos] == '[') {
+			if (index >= 0) {
+				JournalTag(io_c, index, false);
+				io_c->tags.tags[index].id = 0;
+				if (id < io_c->tag_rows.by_id_c) io_c->tag_rows.by_id[id] = 0;
+			}
+			if (!StructSkipValue(idx, &pos)) return false;
+		} else {
+			if (!StructString(idx, &pos, &s, &l)) return false;
+			if (index < 0) {
+				io_c->tags.tags = realloc(io_c->tags.tags, sizeof(Tag) *
+				                                           (io_c->tags.count + 2));
+				index = io_c->tags.count++;
+				memset(&io_c->tags.tags[index], 0, sizeof(Tag) * 2);
+				io_c->tags.tags[index].id = id;
+				io_c->tags.next_UID = Max(io_c->tags.next_UID, id + 1);
+				JournalTag(io_c, index, true);
+			} else {
+				JournalTag(io_c, index, false);
+			}
+			JSONUnescape(s, l, io_c->tags.tags[index].name, TAG_NAME_S);
+		}
+		if (!StructExpect(idx, &pos, ',')) break;
 	}
 	
-	for (i = 0, hasTags = false; i < tg.count; ++i) {
-		if (r.tag_ids[i] == 0) continue;
-		hasTags = true;
-		break;
+	/* Entries written before aliases were journalled have none. */
+	pos = aliasesAt;
+	if (aliasesAt != 0 && !StructExpect(idx, &pos, '{')) return false;
+	while (aliasesAt != 0 && pos < idx->size && idx->text[pos] == '"') {
+		char name[TAG_NAME_S];
+		
+		if (!StructString(idx, &pos, &s, &l) ||
+		    !StructExpect(idx, &pos, ':')) return false;
+		JSONUnescape(s, l, name, TAG_NAME_S);
+		JournalAlias(io_c, name);
+		if (idx->text[pos] == '[') {
+			SetTagAlias(&io_c->tags, name, 0);
+			if (!StructSkipValue(idx, &pos)) return false;
+		} else {
+			if (!StructString(idx, &pos, &s, &l)) return false;
+			SetTagAlias(&io_c->tags, name, StructUInt(s, l));
+		}
+		if (!StructExpect(idx, &pos, ',')) break;
 	}
-	if (hasTags) {
-		printf("\t |");
+	
+	/* Rows are found through a map of ID to index, built once. */
+	rowByIDC = io_c->table.next_UID + 1;
+	rowByID = malloc(sizeof(unsigned int) * rowByIDC);
+	memset(rowByID, 0, sizeof(unsigned int) * rowByIDC);
+	for (i = 0; i < io_c->table.count; ++i) {
+		if (io_c->table.rows[i].id != 0 && io_c->table.rows[i].id < rowByIDC) {
+			rowByID[io_c->table.rows[i].id] = i + 1;
+		}
 	}
-	for (i = 0; i < ROW_TAG_C; ++i) {
-		if (r.tag_ids[i] == 0) continue;
-		printf(" %s |", GetTagName(tg, r.tag_ids[i]));
+	pos = rowsAt;
+	if (!StructExpect(idx, &pos, '{')) return false;
+	for (imageC = 0; pos < idx->size && idx->text[pos] == '"'; imageC++) {
+		if (!StructString(idx, &pos, &s, &l) || !StructExpect(idx, &pos, ':') ||
+		    !StructSkipValue(idx, &pos)) return false;
+		if (!StructExpect(idx, &pos, ',')) break;
 	}
-	if (hasTags) {
-		printf("\n");
+	io_c->table.rows = realloc(io_c->table.rows, sizeof(Row) *
+	                                             (io_c->table.count + imageC + 1));
+	memset(&io_c->table.rows[io_c->table.count], 0, sizeof(Row) * (imageC + 1));
+	
+	pos = rowsAt;
+	StructExpect(idx, &pos, '{');
+	while (pos < idx->size && idx->text[pos] == '"') {
+		size_t keyAt = pos;
+		unsigned int index;
+		Row row;
+		
+		if (!StructString(idx, &pos, &s, &l) ||
+		    !StructExpect(idx, &pos, ':')) return false;
+		id = StructUInt(s, l);
+		index = (id < rowByIDC) ? rowByID[id] : 0;
+		if (idx->text[NextStructural(idx, pos + 1)] == ']') {
+			if (index != 0) {
+				JournalRow(io_c, index - 1, false);
+				io_c->table.rows[index - 1].id = 0;
+			}
+		} else {
+			if (!DecodeStructRow(idx, keyAt, &row)) return false;
+			if (index != 0) {
+				Row* old = &io_c->table.rows[index - 1];
+				
+				JournalRow(io_c, index - 1, false);
+				for (j = 0; j < ROW_TAG_C; ++j) {
+					if (row.tag_ids[j] != 0 && !RowHasTagID(*old, row.tag_ids[j])) {
+						TagRowsAdd(io_c, row.tag_ids[j], index - 1);
+					}
+				}
+				if (old->url.long_url == true) {
+					free(old->url.address.l);
+				}
+				*old = row;
+			} else {
+				index = io_c->table.count++;
+				io_c->table.rows[index] = row;
+				JournalRow(io_c, index, true);
+				for (j = 0; j < ROW_TAG_C; ++j) {
+					if (row.tag_ids[j] != 0) TagRowsAdd(io_c, row.tag_ids[j], index);
+				}
+				IndexRowHost(io_c, index);
+				io_c->table.next_UID = Max(io_c->table.next_UID, id + 1);
+			}
+		}
+		if (!StructSkipValue(idx, &pos)) return false;
+		if (!StructExpect(idx, &pos, ',')) break;
 	}
+	free(rowByID);
+	
+	return true;
 }
 
+/* Finds side ("before" or "after") of the journal entry indexed by idx, and
+ * its command when o_command is given. Returns 0 if there is no such side. */
 static size_t
-CURLBuildPage(char* b, size_t s, size_t c, void* d)
+FindJournalSide(StructIndex* idx, const char* side, const char** o_command,
+                size_t* o_commandL)
 {
-	CURLData* cd;
-	int i;
+	const char* s;
+	size_t pos = NextStructural(idx, 0), l, sideAt = 0;
 	
-	if (d == NULL){
-		return s * c;
+	if (!StructExpect(idx, &pos, '{')) {
+		return 0;
 	}
-	
-	cd = (CURLData*) d;
-	if (cd->contents != NULL) {
-		if ((strstr(cd->contents, "</title>")  != NULL) ||
-		    (strstr(cd->contents, "</header>") != NULL)) {
-			return s * c;
+	while (pos < idx->size && idx->text[pos] == '"') {
+		if (!StructString(idx, &pos, &s, &l) ||
+		    !StructExpect(idx, &pos, ':')) break;
+		if (l == 7 && memcmp(s, "command", 7) == 0 && o_command != NULL) {
+			*o_command = &idx->text[pos + 1];
+			*o_commandL = NextStructural(idx, pos + 1) - pos - 1;
+		} else if (l == strlen(side) && memcmp(s, side, l) == 0) {
+			sideAt = pos;
 		}
+		if (!StructSkipValue(idx, &pos) ||
+		    !StructExpect(idx, &pos, ',')) break;
 	}
 	
-	for (i = 0; i < c; ++i) {
-		cd->contents[cd->index] = b[i];
-		cd->index++;
-	}
-	
-	return s * c;
+	return sideAt;
 }
 
+/* Undoes (step -1) or redoes (step 1) the next entry of the journal. Entries
+ * are only applied to the store they were written against. */
 static void
-GetPageTitle(char* contents, char* o_buffer)
+StepJournal(Core* io_c, int step)
 {
-	char* startPos, *endPos;
-	int len;
+	char** lines, *contents, *line;
+	unsigned int lineC, undo, generation;
+	StructIndex idx;
+	const char* command = NULL;
+	size_t commandL = 0, sideAt;
 	
-	if (contents == NULL || strlen(contents) < 1) {
-		printf("No webpage contents read\n");
+	contents = ReadJournal(&lines, &lineC, &undo, &generation);
+	if (contents == NULL || (step < 0 && undo == 0) ||
+	    (step > 0 && undo == lineC)) {
+		printf("Nothing to %s.\n", (step < 0) ? "undo" : "redo");
+		exit(0);
+	}
+	if (generation != io_c->meta.generation) {
+		fprintf(stderr, "The store has been changed since the journal was " \
+		        "written, so it can no longer be %s.\n",
+		        (step < 0) ? "undone" : "redone");
+		exit(-1);
 	}
 	
-	startPos = strstr(contents, "<title>");
-	endPos   = strstr(contents, "</title>");
-	if (startPos == NULL) { 
-		printf("No <title> tag\n");
-	} 
-	if (endPos == NULL) {
-		printf("No </title> tag\n");
+	line = lines[(step < 0) ? undo - 1 : undo];
+	BuildStructIndex(line, strlen(line), &idx);
+	sideAt = FindJournalSide(&idx, (step < 0) ? "before" : "after", &command,
+	                         &commandL);
+	if (sideAt == 0 || !ApplyJournalImages(io_c, &idx, sideAt)) {
+		fprintf(stderr, "The journal is damaged.\n");
+		exit(-1);
 	}
-	startPos += strlen("<title>");
-	assert(startPos < endPos);
 	
-	len = endPos - startPos;
-	strcpyt(o_buffer, startPos, TITLE_S, len);
+	printf("%s '%.*s'\n", (step < 0) ? "Undid" : "Redid", (int) commandL,
+	       (command != NULL) ? command : "");
+	io_c->journal.step = step;
+	io_c->dirty = true;
+	
+	free(idx.bits);
+	free(lines);
+	free(contents);
+}
+
+/* Reads the meta line at the head of the store, without loading the rest.
+ * Returns false for stores which have none. */
+static int
+ReadStoreMeta(Meta* o_meta)
+{
+	char filename[512] = { 0 }, head[128] = { 0 };
+	int fd;
+	
+	GetConfigPath(filename);
+	strcat(filename, cache_filename);
+	if ((fd = open(filename, O_RDONLY)) < 0) {
+		return false;
+	}
+	if (read(fd, head, sizeof(head) - 1) < 0) {
+		head[0] = '\0';
+	}
+	close(fd);
+	
+	return sscanf(head, "{\n\t\"meta\":{\"generation\": \"%u\", \"rows_next\": " \
+	              "\"%u\", \"tags_next\": \"%u\"", &o_meta->generation,
+	              &o_meta->rows_next, &o_meta->tags_next) == 3;
 }
 
-static CURLData*
-GetWebpage(char* url)
+static void
+FreeCore(Core* io_c)
 {
-	CURLData* result;
-	CURL*     curl;
-	CURLcode  code;
-	
-	result = malloc(sizeof(CURLData));
-	memset(result, 0, sizeof(CURLData));
+	unsigned int i;
 	
+	for (i = 0; i < io_c->table.count; ++i) {
+		if (io_c->table.rows[i].url.long_url == true) {
+			free(io_c->table.rows[i].url.address.l);
+		}
+	}
+	free(io_c->table.rows);
+	free(io_c->tags.tags);
+	free(io_c->tags.aliases);
+	FreeHostIndex(&io_c->hosts);
+	FreeTagRows(&io_c->tag_rows);
+	free(io_c->journal.before_rows.data);
+	free(io_c->journal.before_tags.data);
+	free(io_c->journal.rows);
+	free(io_c->journal.tags);
+	free(io_c->journal.digests);
+	free(io_c->journal.before);
+	free(io_c->journal.recorded);
+	free(io_c->journal.before_aliases.data);
+	free(io_c->journal.aliases);
+	free(io_c->merkle.nodes);
+	free(io_c->quarantine.data);
+	FreeAutotag(io_c->autotag);
 	{
-		/* NOTE: This is the biggest design problem. It first reads the page to
-		 * determine how much needs to be alloced, but this just doubles the
-		 * amount of time spent downloading. This is always going to be *much*
-		 * longer than just reallocating every CURLBuildPage() call... */
-		long size;
-		curl = curl_easy_init();
-		if (curl) {
-			CURLcode res;
-			curl_easy_setopt(curl, CURLOPT_URL, url);
-			curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, true);
-			curl_easy_setopt(curl, CURLOPT_WRITEDATA, NULL);
-			curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, CURLBuildPage);
-			curl_easy_setopt(curl, CURLOPT_USERAGENT, "libcurl-agent/1.0");
-			res = curl_easy_perform(curl);
-			if (res == CURLE_OK) {
-				res = curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T , &size);
-			}
-			curl_easy_cleanup(curl);
+		Replica* r = &io_c->replica;
+		
+		for (i = 0; i < r->row_c; ++i) {
+			free(r->rows[i].tags);
 		}
-		result->contents_length = size + 1;
-		result->contents = malloc(result->contents_length);
-		memset(result->contents, 0, result->contents_length);
+		free(r->rows);
+		free(r->by_id);
+		free(r->by_local);
+		free(r->seen);
+		free(r->log.data);
 	}
+}
+
+/* Watches the store's directory, so that long-running commands notice when
+ * another process saves. Events are left to settle for WATCH_SETTLE_MS, as a
+ * save writes the store and then the journal. */
+static void
+StartWatching(Watch* o_w)
+{
+	char filename[512] = { 0 };
 	
-	curl = curl_easy_init();
-	if (!curl) {
-		printf("Could not init CURL.");
+	memset(o_w, 0, sizeof(Watch));
+	GetConfigPath(filename);
+	if ((o_w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) >= 0 &&
+	    inotify_add_watch(o_w->fd, filename, IN_CLOSE_WRITE | IN_MOVED_TO |
+	                                         IN_DELETE) < 0) {
+		close(o_w->fd);
+		o_w->fd = -1;
 	}
-	curl_easy_setopt(curl, CURLOPT_URL, url);
-	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, true);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, result);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, CURLBuildPage);
-	curl_easy_setopt(curl, CURLOPT_USERAGENT, "libcurl-agent/1.0");
-	
-	code = curl_easy_perform(curl);
-	if (code != CURLE_OK) {
-		fprintf(stderr,
-		        "Could not download page: %s\n",
-		        curl_easy_strerror(code));
-		free(result->contents);
-		exit(0);
+	if (o_w->fd < 0) {
+		fprintf(stderr, "Could not watch '%s'; changes made by other " \
+		        "processes will not be seen.\n", filename);
 	}
-	
-	curl_easy_cleanup(curl);
-	return result;
+	WatchSaved(o_w);
 }
 
+/* Records the store as it is now as known, e.g. after saving it. */
 static void
-ValidateTagName(char* io_buffer[], const unsigned int index)
+WatchSaved(Watch* io_w)
 {
-	char buffer[TAG_NAME_S];
-	int i;
+	char filename[512] = { 0 };
+	struct stat st;
 	
-	assert(io_buffer[index]);
-	memset(buffer, 0, sizeof(char) * TAG_NAME_S);
-	if (isdigit(io_buffer[index][0])/* == true*/) {
-		printf("Invalid tag name. Tag names cannot start with a number.\n");
-		exit(0);
-	}
-	else if ((stricmp(io_buffer[index], "add") == 0) ||
-	         (stricmp(io_buffer[index], "update") == 0) ||
-	         (stricmp(io_buffer[index], "rename") == 0) ||
-	         (stricmp(io_buffer[index], "remove") == 0)) {
-		printf("Invalid tag name. Tag names cannot be set to reserved terms\n");
-		exit(0);
-	}
+	GetConfigPath(filename);
+	strcat(filename, cache_filename);
+	memset(&st, 0, sizeof(st));
+	stat(filename, &st);
+	io_w->mtime = st.st_mtim;
+	io_w->size = st.st_size;
+}
+
+/* Reads what inotify has queued. */
+static void
+WatchEvents(Watch* io_w)
+{
+	char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t n;
 	
-	if (strstr(io_buffer[index], " ") != NULL) {
-		for (i = 0; i < strlen(io_buffer[index]); ++i) {
-			char c = io_buffer[index][i];
-			if (c == ' ') {
-				buffer[i] = '-';
-			} else {
-				buffer[i] = c;
+	while ((n = read(io_w->fd, events, sizeof(events))) > 0) {
+		char* p;
+		
+		for (p = events; p < events + n;
+		     p += sizeof(struct inotify_event) + ((struct inotify_event*) p)->len) {
+			struct inotify_event* e = (struct inotify_event*) p;
+			
+			if (e->len > 0 && (strcmp(e->name, cache_filename) == 0 ||
+			                   strcmp(e->name, journal_filename) == 0) &&
+			    io_w->settling == false) {
+				clock_gettime(CLOCK_MONOTONIC, &io_w->due);
+				io_w->due.tv_nsec += WATCH_SETTLE_MS * 1000000L;
+				io_w->due.tv_sec += io_w->due.tv_nsec / 1000000000L;
+				io_w->due.tv_nsec %= 1000000000L;
+				io_w->settling = true;
 			}
 		}
 	}
+}
+
+/* How long to wait (in ms) before calling WatchDue(), or -1 */
+static int
+WatchTimeout(Watch* w)
+{
+	struct timespec now;
+	long left;
 	
-	if (strlen(buffer) > 0) {
-		strcpy(io_buffer[index], buffer);
+	if (w->settling == false) {
+		return -1;
 	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	left = (w->due.tv_sec - now.tv_sec) * 1000 +
+	       (w->due.tv_nsec - now.tv_nsec) / 1000000;
+	
+	return (left > 0) ? left : 0;
 }
 
-static unsigned int
-GetInputTagIndex(Core* c, char* buffers[], const unsigned int inputIndex)
+/* Whether the store should be reloaded now: events have settled, and it is
+ * not as it was last loaded or saved. */
+static int
+WatchDue(Watch* io_w)
 {
-	int result;
-	int i;
+	char filename[512] = { 0 };
+	struct stat st;
 	
-	result = 0;
-	if (buffers[inputIndex] != NULL) {
-		if (isdigit(buffers[inputIndex][0])) {
-			const int value = atoi(buffers[inputIndex]);
-			for (i = 0, result = 0; i < c->tags.count; ++i) {
-				if (c->tags.tags[i].id == value) {
-					result = i;
-					break;
-				}
-			}
-		} else {
-			for (i = 0, result = 0; i < c->tags.count; ++i) {
-				if (stricmp(c->tags.tags[i].name, buffers[inputIndex]) == 0) {
-					result = i;
-					break;
-				}
-			}
-		}
-	} else {
-		printf("Invalid args\n");
-		exit(0);
+	if (io_w->settling == false || WatchTimeout(io_w) > 0) {
+		return false;
+	}
+	io_w->settling = false;
+	GetConfigPath(filename);
+	strcat(filename, cache_filename);
+	if (stat(filename, &st) < 0) {
+		return false;
 	}
 	
-	return result;
+	return st.st_size != io_w->size ||
+	       st.st_mtim.tv_sec != io_w->mtime.tv_sec ||
+	       st.st_mtim.tv_nsec != io_w->mtime.tv_nsec;
 }
 
-static void
-GetCurrentDateTime(DateTime* o_dt)
+static int
+MinTimeout(int a, int b)
 {
-	struct tm* t;
-	time_t now;
-	
-	now = time(0);
-	t = localtime(&now);
-	strftime(o_dt->last_updated, 19, "%F %T", t);
+	if (a < 0) return b;
+	if (b < 0) return a;
+	return Min(a, b);
+}
+
+/* Applies the "after" side of every journal entry written since the store
+ * was at io_c's generation, up to generation. The entries must follow on
+ * from one another: an undo or redo in between writes none, and the journal
+ * only keeps JOURNAL_C, so then the store has to be loaded afresh. */
+static int
+ApplyJournalSince(Core* io_c, unsigned int generation)
+{
+	char** lines, *contents;
+	unsigned int lineC, undo, journalGeneration, first, i;
+	int ok;
 	
-	if (sscanf
-	(
-		o_dt->last_updated,
-		"%d-%d-%d %d:%d:%d",
-		&o_dt->d_y, &o_dt->d_m, &o_dt->d_d,
-		&o_dt->t_h, &o_dt->t_m, &o_dt->t_s
-	) < 1) {
-		printf("Could not parse date and time\n");
+	contents = ReadJournal(&lines, &lineC, &undo, &journalGeneration);
+	if (contents == NULL || journalGeneration != generation ||
+	    generation <= io_c->meta.generation ||
+	    generation - io_c->meta.generation > undo) {
+		free(lines);
+		free(contents);
+		return false;
+	}
+	first = undo - (generation - io_c->meta.generation);
+	for (i = first, ok = true; i < undo && ok == true; ++i) {
+		unsigned int entryGeneration = 0;
+		
+		ok = sscanf(lines[i], "{\"generation\": \"%u\"", &entryGeneration) == 1 &&
+		     entryGeneration == io_c->meta.generation + 1 + (i - first);
+	}
+	for (i = first; i < undo && ok == true; ++i) {
+		StructIndex idx;
+		size_t sideAt;
+		
+		BuildStructIndex(lines[i], strlen(lines[i]), &idx);
+		sideAt = FindJournalSide(&idx, "after", NULL, NULL);
+		ok = sideAt != 0 && ApplyJournalImages(io_c, &idx, sideAt);
+		free(idx.bits);
 	}
+	free(lines);
+	free(contents);
+	
+	return ok;
 }
 
 static void
-UpdateRowTags(Core* io_c, unsigned int rowIndex, InputArgs* ia)
+BufferAppendEvent(Buffer* io_b, unsigned int generation, const char* event,
+                  unsigned int id)
 {
-	char* tagInput;
-	int tagID, tagIndexInRow;
+	BufferAppendS(io_b, "{\"generation\": \"");
+	BufferAppendUInt(io_b, generation);
+	BufferAppendS(io_b, "\", \"event\": \"");
+	BufferAppendS(io_b, event);
+	BufferAppendS(io_b, "\", \"id\": ");
+	BufferAppendUInt(io_b, id);
+}
+
+static void
+BufferAppendRowEvent(Buffer* io_b, Core* c, const char* event, unsigned int id,
+                     Row* r)
+{
+	BufferAppendEvent(io_b, c->meta.generation, event, id);
+	if (r != NULL) {
+		BufferAppendS(io_b, ", \"entry\": ");
+		BufferAppendRowObject(io_b, c, r);
+	}
+	BufferAppendS(io_b, "}\n");
+}
+
+/* Brings io_c up to date with the store on disk, after another process has
+ * saved it. When the journal covers the change only the rows it names are
+ * applied; otherwise the store is loaded afresh. Rows io_c had changed but
+ * not saved are changed again on top. Those it added keep their IDs unless a
+ * reloaded row has taken one, in which case they get a new ID and a
+ * {"event": "renumber", "id": new, "was": old} line. A line of NDJSON for
+ * each change, to rows and then to tags, is added to o_events when it is
+ * given. Returns 0 when nothing was reloaded, 1 when rows were only changed
+ * or appended, and 2 when the store was loaded afresh (so row indices
+ * changed). */
+static int
+ReloadStore(Core* io_c, Buffer* o_events)
+{
+	Journal* j = &io_c->journal;
+	Meta meta;
+	Row* kept;
+	unsigned int* keptIDs, keptC = 0, tagC, i, k;
+	unsigned char* keptNew;
+	Tag* tags;
+	int result;
 	
-	tagInput = ia->word_buffers[WI_TAG];
-	{
-		if (isdigit(tagInput[0])) {
-			tagID = atoi(tagInput);
-			if (tagID < 1) {
-				printf("Invalid tag ID (%s)\n", tagInput);
+	/* What this process has not saved yet */
+	kept = malloc(sizeof(Row) * (j->row_c + 1));
+	keptIDs = malloc(sizeof(unsigned int) * (j->row_c + 1));
+	keptNew = malloc(j->row_c + 1);
+	for (i = 0; i < j->row_c; ++i) {
+		Row* r = &io_c->table.rows[j->rows[i * 2]];
+		
+		if (j->digests[i] == 0 && r->id == 0) continue;
+		kept[keptC] = *r;
+		if (r->url.long_url == true) {
+			kept[keptC].url.address.l = malloc(strlen(r->url.address.l) + 1);
+			strcpy(kept[keptC].url.address.l, r->url.address.l);
+		}
+		keptIDs[keptC] = j->rows[i * 2 + 1];
+		keptNew[keptC++] = j->digests[i] == 0;
+	}
+	tagC = io_c->tags.count;
+	tags = malloc(sizeof(Tag) * (tagC + 1));
+	memcpy(tags, io_c->tags.tags, sizeof(Tag) * tagC);
+	
+	/* They are undone first, so that the journal's entries apply to the rows
+	 * as they were saved. */
+	if (j->row_c > 0 || j->tag_c > 0 || j->alias_c > 0) {
+		StructIndex idx;
+		Buffer before;
+		size_t pos;
+		
+		memset(&before, 0, sizeof(Buffer));
+		BufferAppendS(&before, "{\"tags\":{");
+		if (j->before_tags.length > 0) {
+			BufferAppend(&before, j->before_tags.data, j->before_tags.length);
+		}
+		BufferAppendS(&before, "}, \"rows\":{");
+		if (j->before_rows.length > 0) {
+			BufferAppend(&before, j->before_rows.data, j->before_rows.length);
+		}
+		BufferAppendS(&before, "}, \"aliases\":{");
+		if (j->before_aliases.length > 0) {
+			BufferAppend(&before, j->before_aliases.data, j->before_aliases.length);
+		}
+		BufferAppendS(&before, "}}");
+		BuildStructIndex(before.data, before.length, &idx);
+		pos = NextStructural(&idx, 0);
+		ApplyJournalImages(io_c, &idx, pos);
+		free(idx.bits);
+		free(before.data);
+	}
+	ResetJournal(j);
+	/* The rules and closures are built from the tags, which may have
+	 * changed. */
+	FreeAutotag(io_c->autotag);
+	io_c->autotag = NULL;
+	FreeTagClosures(&io_c->tag_rows);
+	result = 1;
+	if (!ReadStoreMeta(&meta) || !ApplyJournalSince(io_c, meta.generation)) {
+		char command[sizeof(j->command)];
+		uint64_t* digests;
+		unsigned int digestC = io_c->table.next_UID + 1;
+		int replicated = io_c->replica.enabled;
+		Core fresh;
+		
+		digests = malloc(sizeof(uint64_t) * digestC);
+		memset(digests, 0, sizeof(uint64_t) * digestC);
+		for (i = 0; i < io_c->table.count; ++i) {
+			Row* r = &io_c->table.rows[i];
+			
+			if (r->id != 0 && r->id < digestC) digests[r->id] = RowDigest(r);
+		}
+		
+		strcpy(command, j->command);
+		fresh = ReadJSON();
+		FreeCore(io_c);
+		*io_c = fresh;
+		strcpy(io_c->journal.command, command);
+		io_c->replica.enabled = replicated;
+		result = 2;
+		
+		for (i = 0; i < io_c->table.count && o_events != NULL; ++i) {
+			Row* r = &io_c->table.rows[i];
+			
+			if (r->id == 0) continue;
+			if (r->id >= digestC || digests[r->id] == 0) {
+				BufferAppendRowEvent(o_events, io_c, "add", r->id, r);
+			} else if (digests[r->id] != RowDigest(r)) {
+				BufferAppendRowEvent(o_events, io_c, "update", r->id, r);
+			}
+			if (r->id < digestC) digests[r->id] = 0;
+		}
+		for (i = 1; i < digestC && o_events != NULL; ++i) {
+			if (digests[i] != 0) {
+				BufferAppendRowEvent(o_events, io_c, "remove", i, NULL);
+			}
+		}
+		free(digests);
+	} else {
+		io_c->meta = meta;
+		for (i = 0; i < j->row_c && o_events != NULL; ++i) {
+			Row* r = &io_c->table.rows[j->rows[i * 2]];
+			
+			if (j->digests[i] == 0 && r->id != 0) {
+				BufferAppendRowEvent(o_events, io_c, "add", r->id, r);
+			} else if (j->digests[i] != 0 && r->id == 0) {
+				BufferAppendRowEvent(o_events, io_c, "remove", j->rows[i * 2 + 1],
+				                     NULL);
+			} else if (j->digests[i] != 0 && j->digests[i] != RowDigest(r)) {
+				BufferAppendRowEvent(o_events, io_c, "update", r->id, r);
 			}
+		}
+		ResetJournal(j);
+	}
+	io_c->table.next_UID = Max(io_c->table.next_UID, io_c->meta.rows_next);
+	io_c->tags.next_UID = Max(io_c->tags.next_UID, io_c->meta.tags_next);
+	
+	for (i = 0; i < io_c->tags.count && o_events != NULL; ++i) {
+		Tag* t = &io_c->tags.tags[i];
+		
+		if (t->id == 0) continue;
+		for (k = 0; k < tagC && tags[k].id != t->id; ++k);
+		if (k == tagC) {
+			BufferAppendEvent(o_events, io_c->meta.generation, "tag-add", t->id);
+		} else if (strcmp(tags[k].name, t->name) != 0) {
+			BufferAppendEvent(o_events, io_c->meta.generation, "tag-rename", t->id);
 		} else {
-			int index;
-			ValidateTagName(ia->word_buffers, WI_TAG);
-			index = GetInputTagIndex(io_c, ia->word_buffers, WI_TAG);
-			tagID = io_c->tags.tags[index].id;
+			continue;
 		}
+		BufferAppendS(o_events, ", \"name\": ");
+		BufferAppendJSONString(o_events, t->name);
+		BufferAppendS(o_events, "}\n");
 	}
-	{
-		unsigned int i, full;
+	for (k = 0; k < tagC && o_events != NULL; ++k) {
+		if (tags[k].id != 0 && FindTagIndex(io_c, tags[k].id) < 0) {
+			BufferAppendEvent(o_events, io_c->meta.generation, "tag-remove",
+			                  tags[k].id);
+			BufferAppendS(o_events, "}\n");
+		}
+	}
+	free(tags);
+	
+	/* Then this process's own changes go back on top */
+	for (k = 0; k < keptC; ++k) {
+		Row* row = &kept[k];
+		int index = -1;
 		
-		for (i = 0, full = true, tagIndexInRow = -1; i < ROW_TAG_C; ++i) {
-			if (io_c->table.rows[rowIndex].tag_ids[i] == 0 &&
-			    tagIndexInRow == -1) {
-				full = false;
-				tagIndexInRow = i;
-			} else if (io_c->table.rows[rowIndex].tag_ids[i] == tagID) {
-				char confirmation;
-				
-				full = false;
-				tagIndexInRow = i;
-				printf("Are you sure you want to remove tag %s from row " \
-				       "%d? [Y/n] \n", GetTagName(io_c->tags, tagID),  tagID);
-				
-				scanf("%c", &confirmation);
-				if ((confirmation == 'y') || (confirmation == 'Y')) {
-					tagID = 0;
-				} else {
-					exit(0);
+		for (i = 0; i < ROW_TAG_C; ++i) {
+			if (row->tag_ids[i] != 0 && FindTagIndex(io_c, row->tag_ids[i]) < 0) {
+				row->tag_ids[i] = 0;
+			}
+		}
+		if (keptNew[k] == true) {
+			unsigned int id = keptIDs[k];
+			
+			/* A new ID only if a reloaded row already has this one */
+			for (i = 0; i < io_c->table.count &&
+			            io_c->table.rows[i].id != id; ++i);
+			if (i < io_c->table.count) {
+				id = io_c->table.next_UID++;
+				if (o_events != NULL) {
+					BufferAppendEvent(o_events, io_c->meta.generation,
+					                  "renumber", id);
+					BufferAppendS(o_events, ", \"was\": ");
+					BufferAppendUInt(o_events, keptIDs[k]);
+					BufferAppendS(o_events, "}\n");
 				}
-				break;
+			} else {
+				io_c->table.next_UID = Max(io_c->table.next_UID, id + 1);
+			}
+			io_c->table.rows = realloc(io_c->table.rows, sizeof(Row) *
+			                                             (io_c->table.count + 2));
+			index = io_c->table.count;
+			io_c->table.rows[index] = *row;
+			io_c->table.rows[index].id = id;
+			memset(&io_c->table.rows[index + 1], 0, sizeof(Row));
+			JournalRow(io_c, index, true);
+			IndexRowHost(io_c, index);
+			io_c->table.count++;
+		} else {
+			for (i = 0; i < io_c->table.count; ++i) {
+				if (io_c->table.rows[i].id == keptIDs[k]) break;
 			}
+			if (row->url.long_url == true) free(row->url.address.l);
+			if (i == io_c->table.count) continue;
+			index = i;
+			JournalRow(io_c, index, false);
+			row->url = io_c->table.rows[index].url;
+			io_c->table.rows[index] = *row;
 		}
-		
-		if (full == true) {
-			printf("Cannot add anymore tags to this url entry.\n");
-			exit(0);
+		for (i = 0; i < ROW_TAG_C; ++i) {
+			if (row->tag_ids[i] != 0) {
+				TagRowsAdd(io_c, row->tag_ids[i], index);
+			}
 		}
 	}
+	io_c->dirty = keptC > 0;
+	free(kept);
+	free(keptIDs);
+	free(keptNew);
 	
-	io_c->table.rows[rowIndex].tag_ids[tagIndexInRow] = tagID;
+	return result;
 }
 
+/* 'sbm watch': prints a line of NDJSON for every change other processes make
+ * to the store, until interrupted:
+ * {"generation": "G", "event": "add", "id": N, "entry": {...}}, where event is
+ * add, update or remove (without "entry"), or tag-add, tag-rename or
+ * tag-remove (with "name" rather than "entry"). */
 static void
-GetConfigPath(char* o_buffer)
+WatchStore(Core* io_c)
 {
-	if (strstr(cache_dir, "~/") != NULL) {
-		const char* homedir;
-		unsigned int index = 0, i;
-		
-		if ((homedir = getenv("HOME")) == NULL) {
-			homedir = getpwuid(getuid())->pw_dir;
+	struct sigaction stop;
+	struct pollfd in;
+	Watch w;
+	Buffer events;
+	
+	StartWatching(&w);
+	if (w.fd < 0) {
+		exit(-1);
+	}
+	memset(&stop, 0, sizeof(stop));
+	stop.sa_handler = StopServing;
+	sigaction(SIGINT, &stop, NULL);
+	sigaction(SIGTERM, &stop, NULL);
+	memset(&events, 0, sizeof(Buffer));
+	in.fd = w.fd;
+	in.events = POLLIN;
+	
+	while (serve_stop == false) {
+		if (poll(&in, 1, WatchTimeout(&w)) < 0 && errno != EINTR) {
+			break;
 		}
-		
-		for (i = 0; i < strlen(cache_dir); ++i, ++index) {
-			if (cache_dir[i] == '~') {
-				unsigned int j;
-				for (j = 0; j < strlen(homedir); ++j, ++index) {
-					o_buffer[index] = homedir[j];
-				}
-				index--;
-			} else {
-				o_buffer[index] = cache_dir[i];
-			}
+		WatchEvents(&w);
+		if (!WatchDue(&w)) {
+			continue;
+		}
+		events.length = 0;
+		ReloadStore(io_c, &events);
+		WatchSaved(&w);
+		if (events.length > 0) {
+			fwrite(events.data, events.length, 1, stdout);
+			fflush(stdout);
 		}
-	} else {
-		strcpy(o_buffer, cache_dir);
 	}
+	
+	close(w.fd);
+	free(events.data);
+	io_c->dirty = false;
 }
 
 int
@@ -1554,22 +11605,35 @@ main(int argc, char* args[])
 	} else {
 		printf("No args provided.\n");
 	}
+	if (inputArgs.input_mode == IM_HAS) {
+		int found = HasURL(inputArgs.word_buffers[WI_MOD]);
+		
+		if (found >= 0) {
+			return (found == true) ? 0 : 1;
+		}
+	}
+	if (inputArgs.input_mode == IM_LIST && ListFromResults(&inputArgs)) {
+		return 0;
+	}
 	core = ReadJSON();
+	core.replica.enabled = ReplicaEnabled();
+	{
+		int i;
+		
+		for (i = 0; i < argc; ++i) {
+			size_t used = strlen(core.journal.command);
+			
+			snprintf(&core.journal.command[used],
+			         sizeof(core.journal.command) - used,
+			         (i == 0) ? "%s" : " %s", args[i]);
+		}
+	}
 	ProcessCommand(&core, &inputArgs);
-	if (WriteJSON(&core) < 1) {
+	if (core.dirty == true && WriteJSON(&core) < 1) {
 		printf("Could not save to JSON");
 	}
 	
-	{
-		unsigned int i;
-		for (i = 0; i < core.table.count; ++i) {
-			if (core.table.rows[i].url.long_url == true) {
-				free(core.table.rows[i].url.address.l);
-			}
-		}
-		free(core.table.rows);
-		free(core.tags.tags);
-	}
+	FreeCore(&core);
 	
 	return 0;
 }